@@ -0,0 +1,1667 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmarks for the per-message routines (wrap, unwrap, IOV
+ * variants, MIC and PRF). Established contexts are created directly
+ * from a fixed key, which requires the mechanism to be configured with
+ * --enable-bench; no IdP is involved. Results are written as JSON.
+ *
+ * With -H, whole context establishments with the named acceptor are
+ * also timed, both full logins through the IdP in SAML_EC_IDP and
+ * logins with a reauthentication ticket, which skip the IdP. Both ends
+ * run in this process, so the SP must be configured as for gss-server.
+ * A reauthentication request presented twice must be rejected.
+ * Full logins are also run on several threads sharing one credential,
+ * which should overlap their waits for the IdP.
+ *
+ * Handle churn is timed by importing and releasing names and
+ * contexts; comparing builds configured with and without
+ * --disable-pool shows the effect of the per-thread handle caches.
+ *
+ * Acceptor contexts are also exported and imported again.
+ *
+ * Attribute lookup, name duplication and composite name export and
+ * import are timed on initiator names carrying synthetic attribute
+ * sets of increasing size, imported with acceptor contexts. Names are
+ * also compared against lists of composite initiator names.
+ *
+ * Default initiator credentials are resolved from a temporary static
+ * identity file.
+ *
+ * The acceptor's replay store, built in from util_replay.c, is timed
+ * recording fresh assertion IDs, on one thread and on several, in
+ * memory and in a file, and finding IDs it has already seen.
+ *
+ *      gss-bench [-e enctype]... [-s size]... [-t seconds]
+ *                [-b batch] [-op name] [-o file]
+ *                [-H service@host -u user -p password]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <gssapi/gssapi_generic.h>
+#include <gssapi/gssapi_ext.h>
+#include "gssapi_eap.h"
+#include "util_replay.h"
+#include "gss-misc.h"
+
+/* Must match EAP_EXPORT_CONTEXT_BENCH and CTX_FLAG_INITIATOR */
+#define BENCH_CONTEXT_TOKEN     0x42454E43
+#define BENCH_CTX_INITIATOR     0x00000001
+
+#define BENCH_MAX_IOV           5
+#define BENCH_MAX_ARGS          16
+#define BENCH_SIGN_ONLY_LENGTH  16
+#define BENCH_PRF_LENGTH        64
+
+/* Offset of the first length-prefixed field of a version 2 token */
+#define BENCH_V2_FIXED_LENGTH   52
+
+/* Threads sharing one credential in handshake_full_shared */
+#define BENCH_HANDSHAKE_THREADS 4
+
+/*
+ * Replay store runs keep time of their own, one second per
+ * BENCH_REPLAY_RATE IDs, so that the store stays part full of IDs
+ * that live for BENCH_REPLAY_LIFETIME seconds.
+ */
+#define BENCH_REPLAY_ENTRIES    262144
+#define BENCH_REPLAY_RATE       1024
+#define BENCH_REPLAY_LIFETIME   8
+#define BENCH_REPLAY_EPOCH      1000000000
+#define BENCH_REPLAY_SEEN_KEYS  4096
+
+static const char benchSeed[] = "mech_saml_ec benchmark session key";
+
+struct bench_layout {
+    const char *name;
+    int rotated;
+    int count;
+    OM_uint32 types[BENCH_MAX_IOV];
+};
+
+static const struct bench_layout benchLayouts[] = {
+    { "header|data|padding|trailer", 0, 4,
+      { GSS_IOV_BUFFER_TYPE_HEADER, GSS_IOV_BUFFER_TYPE_DATA,
+        GSS_IOV_BUFFER_TYPE_PADDING, GSS_IOV_BUFFER_TYPE_TRAILER } },
+    { "header|sign_only|data|padding|trailer", 0, 5,
+      { GSS_IOV_BUFFER_TYPE_HEADER, GSS_IOV_BUFFER_TYPE_SIGN_ONLY,
+        GSS_IOV_BUFFER_TYPE_DATA, GSS_IOV_BUFFER_TYPE_PADDING,
+        GSS_IOV_BUFFER_TYPE_TRAILER } },
+    { "header|data|padding", 1, 3,
+      { GSS_IOV_BUFFER_TYPE_HEADER, GSS_IOV_BUFFER_TYPE_DATA,
+        GSS_IOV_BUFFER_TYPE_PADDING } },
+};
+
+#define BENCH_LAYOUT_COUNT  (sizeof(benchLayouts) / sizeof(benchLayouts[0]))
+
+/* A message laid out over a single allocation, resettable between runs */
+struct iov_msg {
+    gss_iov_buffer_desc iov[BENCH_MAX_IOV];
+    size_t lengths[BENCH_MAX_IOV];
+    size_t wrappedLengths[BENCH_MAX_IOV];
+    int count;
+    unsigned char *storage;
+    unsigned char *wrapped;
+    size_t storageLength;
+};
+
+struct bench_case {
+    gss_ctx_id_t initiator;
+    gss_ctx_id_t acceptor;
+    int enctype;
+    int conf;
+    size_t size;
+    unsigned char *msg;
+    const struct bench_layout *layout;
+    struct iov_msg *msgs;
+    int msgCount;
+    gss_iov_batch_desc *batch;
+    gss_buffer_desc token;
+    unsigned char *work;
+    size_t workLength;
+    size_t headerLength;
+    size_t trailerLength;
+    gss_cred_id_t cred;
+    gss_name_t target;
+    gss_name_t *names;
+    size_t nameCount;
+    struct gss_eap_replay_store *replay;
+    const char *label;
+};
+
+typedef OM_uint32 (*bench_fn)(OM_uint32 *minor, struct bench_case *bc, long n);
+
+static FILE *out;
+static int firstResult = 1;
+static double benchSeconds = 0.2;
+static const char *opFilter;
+
+static void
+store_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >>  8) & 0xFF;
+    p[3] = (v      ) & 0xFF;
+}
+
+static uint32_t
+load_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+xmalloc(size_t length)
+{
+    void *p = malloc(length ? length : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "gss-bench: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void
+check(const char *what, OM_uint32 major, OM_uint32 minor)
+{
+    if (major != GSS_S_COMPLETE) {
+        display_status((char *)what, major, minor);
+        exit(1);
+    }
+}
+
+static gss_ctx_id_t
+import_context(int enctype, int initiator)
+{
+    unsigned char token[20 + sizeof(benchSeed) - 1];
+    gss_buffer_desc buf;
+    gss_ctx_id_t ctx = GSS_C_NO_CONTEXT;
+    OM_uint32 major, minor;
+
+    store_be32(&token[0], BENCH_CONTEXT_TOKEN);
+    store_be32(&token[4], initiator ? BENCH_CTX_INITIATOR : 0);
+    store_be32(&token[8], GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG |
+                          GSS_C_INTEG_FLAG);
+    store_be32(&token[12], enctype);
+    store_be32(&token[16], sizeof(benchSeed) - 1);
+    memcpy(&token[20], benchSeed, sizeof(benchSeed) - 1);
+
+    buf.length = sizeof(token);
+    buf.value = token;
+
+    major = gss_import_sec_context(&minor, &buf, &ctx);
+    if (GSS_ERROR(major)) {
+        display_status("importing benchmark context "
+                       "(is the mechanism built with --enable-bench?)",
+                       major, minor);
+        exit(1);
+    }
+
+    return ctx;
+}
+
+/*
+ * IOV message helpers
+ */
+
+static void
+iov_msg_init(struct bench_case *bc, struct iov_msg *m)
+{
+    OM_uint32 major, minor;
+    unsigned char *p;
+    int i;
+
+    m->count = bc->layout->count;
+    for (i = 0; i < m->count; i++) {
+        m->iov[i].type = bc->layout->types[i];
+        m->iov[i].buffer.value = NULL;
+        if (m->iov[i].type == GSS_IOV_BUFFER_TYPE_DATA)
+            m->iov[i].buffer.length = bc->size;
+        else if (m->iov[i].type == GSS_IOV_BUFFER_TYPE_SIGN_ONLY)
+            m->iov[i].buffer.length = BENCH_SIGN_ONLY_LENGTH;
+        else
+            m->iov[i].buffer.length = 0;
+    }
+
+    major = gss_wrap_iov_length(&minor, bc->initiator, bc->conf,
+                                GSS_C_QOP_DEFAULT, NULL, m->iov, m->count);
+    check("gss_wrap_iov_length", major, minor);
+
+    m->storageLength = 0;
+    for (i = 0; i < m->count; i++)
+        m->storageLength += m->iov[i].buffer.length;
+
+    m->storage = xmalloc(m->storageLength);
+    m->wrapped = xmalloc(m->storageLength);
+
+    for (i = 0, p = m->storage; i < m->count; i++) {
+        m->iov[i].buffer.value = p;
+        m->lengths[i] = m->iov[i].buffer.length;
+        p += m->lengths[i];
+    }
+}
+
+static void
+iov_msg_reset(struct bench_case *bc, struct iov_msg *m)
+{
+    int i;
+
+    for (i = 0; i < m->count; i++) {
+        m->iov[i].buffer.length = m->lengths[i];
+        if (m->iov[i].type == GSS_IOV_BUFFER_TYPE_DATA)
+            memcpy(m->iov[i].buffer.value, bc->msg, bc->size);
+        else if (m->iov[i].type == GSS_IOV_BUFFER_TYPE_SIGN_ONLY)
+            memset(m->iov[i].buffer.value, 'A', BENCH_SIGN_ONLY_LENGTH);
+    }
+}
+
+/* Wrap once and keep the result so that it can be unwrapped repeatedly */
+static void
+iov_msg_wrap(struct bench_case *bc, struct iov_msg *m)
+{
+    OM_uint32 major, minor;
+    int i;
+
+    iov_msg_reset(bc, m);
+
+    major = gss_wrap_iov(&minor, bc->initiator, bc->conf,
+                         GSS_C_QOP_DEFAULT, NULL, m->iov, m->count);
+    check("gss_wrap_iov", major, minor);
+
+    memcpy(m->wrapped, m->storage, m->storageLength);
+    for (i = 0; i < m->count; i++)
+        m->wrappedLengths[i] = m->iov[i].buffer.length;
+}
+
+static void
+iov_msg_restore(struct iov_msg *m)
+{
+    int i;
+
+    memcpy(m->storage, m->wrapped, m->storageLength);
+    for (i = 0; i < m->count; i++)
+        m->iov[i].buffer.length = m->wrappedLengths[i];
+}
+
+static void
+iov_msg_free(struct iov_msg *m)
+{
+    free(m->storage);
+    free(m->wrapped);
+}
+
+/*
+ * Benchmarks
+ */
+
+static OM_uint32
+bench_wrap(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc in, token;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+    int conf_state;
+
+    in.length = bc->size;
+    in.value = bc->msg;
+
+    while (n-- > 0) {
+        major = gss_wrap(minor, bc->initiator, bc->conf, GSS_C_QOP_DEFAULT,
+                         &in, &conf_state, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &token);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_unwrap(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc msg;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+    int conf_state;
+
+    while (n-- > 0) {
+        major = gss_unwrap(minor, bc->acceptor, &bc->token, &msg,
+                           &conf_state, NULL);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &msg);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_wrap_iov(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    struct iov_msg *m = &bc->msgs[0];
+    OM_uint32 major = GSS_S_COMPLETE;
+
+    while (n-- > 0) {
+        iov_msg_reset(bc, m);
+        major = gss_wrap_iov(minor, bc->initiator, bc->conf,
+                             GSS_C_QOP_DEFAULT, NULL, m->iov, m->count);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_unwrap_iov(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    struct iov_msg *m = &bc->msgs[0];
+    OM_uint32 major = GSS_S_COMPLETE;
+    int conf_state;
+
+    while (n-- > 0) {
+        iov_msg_restore(m);
+        major = gss_unwrap_iov(minor, bc->acceptor, &conf_state, NULL,
+                               m->iov, m->count);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_unwrap_iov_stream(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_iov_buffer_desc iov[2];
+    OM_uint32 major = GSS_S_COMPLETE;
+    int conf_state;
+
+    while (n-- > 0) {
+        memcpy(bc->work, bc->token.value, bc->token.length);
+
+        iov[0].type = GSS_IOV_BUFFER_TYPE_STREAM;
+        iov[0].buffer.length = bc->token.length;
+        iov[0].buffer.value = bc->work;
+
+        iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+        iov[1].buffer.length = 0;
+        iov[1].buffer.value = NULL;
+
+        major = gss_unwrap_iov(minor, bc->acceptor, &conf_state, NULL,
+                               iov, 2);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_wrap_iov_batch(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+
+    while (n-- > 0) {
+        for (i = 0; i < bc->msgCount; i++)
+            iov_msg_reset(bc, &bc->msgs[i]);
+        major = gss_wrap_iov_batch(minor, bc->initiator, bc->conf,
+                                   GSS_C_QOP_DEFAULT, bc->batch, bc->msgCount);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_unwrap_iov_batch(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+
+    while (n-- > 0) {
+        for (i = 0; i < bc->msgCount; i++)
+            iov_msg_restore(&bc->msgs[i]);
+        major = gss_unwrap_iov_batch(minor, bc->acceptor,
+                                     bc->batch, bc->msgCount);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_wrap_in_place(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc buf, token;
+    OM_uint32 major = GSS_S_COMPLETE;
+    int conf_state;
+
+    buf.length = bc->workLength;
+    buf.value = bc->work;
+
+    while (n-- > 0) {
+        memcpy(bc->work + bc->headerLength, bc->msg, bc->size);
+        major = gss_wrap_in_place(minor, bc->initiator, bc->conf,
+                                  GSS_C_QOP_DEFAULT, &buf, bc->headerLength,
+                                  bc->size, &conf_state, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_get_mic(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc in, token;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    in.length = bc->size;
+    in.value = bc->msg;
+
+    while (n-- > 0) {
+        major = gss_get_mic(minor, bc->initiator, GSS_C_QOP_DEFAULT,
+                            &in, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &token);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_verify_mic(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc in;
+    OM_uint32 major = GSS_S_COMPLETE;
+
+    in.length = bc->size;
+    in.value = bc->msg;
+
+    while (n-- > 0) {
+        major = gss_verify_mic(minor, bc->acceptor, &in, &bc->token, NULL);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_pseudo_random(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc in, prf;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    in.length = bc->size;
+    in.value = bc->msg;
+
+    while (n-- > 0) {
+        major = gss_pseudo_random(minor, bc->initiator, GSS_C_PRF_KEY_FULL,
+                                  &in, BENCH_PRF_LENGTH, &prf);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &prf);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_export_import(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc token;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_export_sec_context(minor, &bc->acceptor, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+        major = gss_import_sec_context(minor, &token, &bc->acceptor);
+        gss_release_buffer(&tmpMinor, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_import_name(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_name_t name;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_import_name(minor, &bc->token, GSS_C_NT_USER_NAME, &name);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_name(&tmpMinor, &name);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_duplicate_name(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_name_t name;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_duplicate_name(minor, bc->target, &name);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_name(&tmpMinor, &name);
+    }
+
+    return major;
+}
+
+/* Look the target up in a list of names, as an acceptor checking an ACL */
+static OM_uint32
+bench_compare_name(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+    size_t i;
+    int equal = 0;
+
+    while (n-- > 0) {
+        for (i = 0; i < bc->nameCount; i++) {
+            major = gss_compare_name(minor, bc->target, bc->names[i], &equal);
+            if (major != GSS_S_COMPLETE)
+                return major;
+            if (equal)
+                break;
+        }
+        if (!equal) {
+            fprintf(stderr, "gss-bench: name not found in list\n");
+            exit(1);
+        }
+    }
+
+    return major;
+}
+
+/* Resolve the default initiator identity, as for a default credential */
+static OM_uint32
+bench_default_cred(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_cred_id_t cred;
+    gss_name_t name;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_acquire_cred(minor, GSS_C_NO_NAME, GSS_C_INDEFINITE,
+                                 GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                                 &cred, NULL, NULL);
+        if (major != GSS_S_COMPLETE)
+            break;
+        major = gss_inquire_cred(minor, cred, &name, NULL, NULL, NULL);
+        gss_release_cred(&tmpMinor, &cred);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_name(&tmpMinor, &name);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_import_context(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_ctx_id_t ctx;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_import_sec_context(minor, &bc->token, &ctx);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_delete_sec_context(&tmpMinor, &ctx, GSS_C_NO_BUFFER);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_get_name_attribute(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc value, displayValue;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+    int authenticated, complete, more;
+
+    while (n-- > 0) {
+        more = -1;
+        major = gss_get_name_attribute(minor, bc->target, &bc->token,
+                                       &authenticated, &complete,
+                                       &value, &displayValue, &more);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &value);
+        gss_release_buffer(&tmpMinor, &displayValue);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_export_name_composite(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_buffer_desc token;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_export_name_composite(minor, bc->target, &token);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_buffer(&tmpMinor, &token);
+    }
+
+    return major;
+}
+
+static OM_uint32
+bench_import_name_composite(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    gss_name_t name;
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+
+    while (n-- > 0) {
+        major = gss_import_name(minor, &bc->token, GSS_C_NT_COMPOSITE_EXPORT,
+                                &name);
+        if (major != GSS_S_COMPLETE)
+            break;
+        gss_release_name(&tmpMinor, &name);
+    }
+
+    return major;
+}
+
+/*
+ * Context establishment, with both ends in this process
+ */
+
+static OM_uint32
+handshake(OM_uint32 *minor, gss_cred_id_t cred, gss_name_t target)
+{
+    gss_ctx_id_t initiator = GSS_C_NO_CONTEXT;
+    gss_ctx_id_t acceptor = GSS_C_NO_CONTEXT;
+    gss_buffer_desc initToken = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc acceptToken = GSS_C_EMPTY_BUFFER;
+    OM_uint32 major, initMajor, acceptMajor = GSS_S_CONTINUE_NEEDED;
+    OM_uint32 tmpMinor;
+
+    do {
+        major = gss_init_sec_context(minor, cred, &initiator, target,
+                                     GSS_C_NO_OID, GSS_C_MUTUAL_FLAG, 0,
+                                     GSS_C_NO_CHANNEL_BINDINGS, &acceptToken,
+                                     NULL, &initToken, NULL, NULL);
+        gss_release_buffer(&tmpMinor, &acceptToken);
+        if (GSS_ERROR(major))
+            goto cleanup;
+
+        initMajor = major;
+
+        if (initToken.length != 0) {
+            major = gss_accept_sec_context(minor, &acceptor,
+                                           GSS_C_NO_CREDENTIAL, &initToken,
+                                           GSS_C_NO_CHANNEL_BINDINGS,
+                                           NULL, NULL, &acceptToken,
+                                           NULL, NULL, NULL);
+            gss_release_buffer(&tmpMinor, &initToken);
+            if (GSS_ERROR(major))
+                goto cleanup;
+
+            acceptMajor = major;
+        }
+    } while (initMajor == GSS_S_CONTINUE_NEEDED);
+
+    major = acceptMajor;
+
+cleanup:
+    gss_release_buffer(&tmpMinor, &initToken);
+    gss_release_buffer(&tmpMinor, &acceptToken);
+    gss_delete_sec_context(&tmpMinor, &initiator, GSS_C_NO_BUFFER);
+    gss_delete_sec_context(&tmpMinor, &acceptor, GSS_C_NO_BUFFER);
+
+    return major;
+}
+
+static OM_uint32
+bench_handshake(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+
+    while (n-- > 0) {
+        major = handshake(minor, bc->cred, bc->target);
+        if (major != GSS_S_COMPLETE)
+            break;
+    }
+
+    return major;
+}
+
+struct handshake_thread {
+    pthread_t thread;
+    struct bench_case *bc;
+    long n;
+    OM_uint32 major;
+    OM_uint32 minor;
+};
+
+static void *
+handshake_thread_main(void *arg)
+{
+    struct handshake_thread *t = arg;
+
+    t->major = bench_handshake(&t->minor, t->bc, t->n);
+
+    return NULL;
+}
+
+/*
+ * Run n handshakes on each of several threads at once, all with the
+ * same credential. The initiator does not hold the credential's lock
+ * while it waits for the IdP, so these should overlap.
+ */
+static OM_uint32
+bench_handshake_threads(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    struct handshake_thread threads[BENCH_HANDSHAKE_THREADS];
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+
+    *minor = 0;
+
+    for (i = 0; i < BENCH_HANDSHAKE_THREADS; i++) {
+        threads[i].bc = bc;
+        threads[i].n = n;
+        if (pthread_create(&threads[i].thread, NULL,
+                           handshake_thread_main, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < BENCH_HANDSHAKE_THREADS; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].major != GSS_S_COMPLETE) {
+            major = threads[i].major;
+            *minor = threads[i].minor;
+        }
+    }
+
+    return major;
+}
+
+/*
+ * Runner
+ */
+
+static void
+run(const char *op, bench_fn fn, struct bench_case *bc, int perCall)
+{
+    OM_uint32 major, minor;
+    double start, elapsed;
+    long n = 1;
+    const char *layout = "token";
+    int rotated = 0;
+
+    if (opFilter != NULL && strcmp(opFilter, op) != 0)
+        return;
+
+    if (bc->label != NULL) {
+        layout = bc->label;
+    } else if (bc->layout != NULL) {
+        layout = bc->layout->name;
+        rotated = bc->layout->rotated;
+    } else if (strcmp(op, "unwrap_iov") == 0) {
+        layout = "stream|data";
+    }
+
+    /* Double the iteration count until a run lasts long enough */
+    for (;;) {
+        start = now();
+        major = fn(&minor, bc, n);
+        elapsed = now() - start;
+        check(op, major, minor);
+        if (elapsed >= benchSeconds)
+            break;
+        n *= (elapsed < benchSeconds / 8) ? 8 : 2;
+    }
+
+    fprintf(out, "%s\n    {\"op\": \"%s\", \"layout\": \"%s\", "
+            "\"rotated\": %s, \"enctype\": %d, \"conf\": %d, "
+            "\"size\": %lu, \"batch\": %d, \"iterations\": %ld, "
+            "\"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+            "\"mbytes_per_sec\": %.2f}",
+            firstResult ? "" : ",",
+            op, layout, rotated ? "true" : "false", bc->enctype, bc->conf,
+            (unsigned long)bc->size, perCall, n * perCall, elapsed,
+            n * perCall / elapsed,
+            (double)n * perCall * bc->size / elapsed / 1e6);
+    firstResult = 0;
+}
+
+static void
+bench_enctype_size(gss_ctx_id_t initiator, gss_ctx_id_t acceptor,
+                   int enctype, size_t size, int batchCount)
+{
+    struct bench_case bc;
+    gss_buffer_desc in;
+    OM_uint32 major, minor;
+    unsigned int l;
+    int i, conf_state;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.initiator = initiator;
+    bc.acceptor = acceptor;
+    bc.enctype = enctype;
+    bc.size = size;
+    bc.msg = xmalloc(size);
+    for (i = 0; i < (int)size; i++)
+        bc.msg[i] = (unsigned char)i;
+
+    in.length = size;
+    in.value = bc.msg;
+
+    for (bc.conf = 0; bc.conf <= 1; bc.conf++) {
+        /* gss_wrap / gss_unwrap and STREAM unwrap of the same token */
+        major = gss_wrap(&minor, initiator, bc.conf, GSS_C_QOP_DEFAULT,
+                         &in, &conf_state, &bc.token);
+        check("gss_wrap", major, minor);
+        bc.work = xmalloc(bc.token.length);
+
+        run("wrap", bench_wrap, &bc, 1);
+        run("unwrap", bench_unwrap, &bc, 1);
+        run("unwrap_iov", bench_unwrap_iov_stream, &bc, 1);
+
+        gss_release_buffer(&minor, &bc.token);
+        free(bc.work);
+        bc.work = NULL;
+
+        /* IOV layouts, rotated and not */
+        for (l = 0; l < BENCH_LAYOUT_COUNT; l++) {
+            struct iov_msg m;
+
+            bc.layout = &benchLayouts[l];
+            bc.msgs = &m;
+            bc.msgCount = 1;
+
+            iov_msg_init(&bc, &m);
+            iov_msg_wrap(&bc, &m);
+
+            run("wrap_iov", bench_wrap_iov, &bc, 1);
+            run("unwrap_iov", bench_unwrap_iov, &bc, 1);
+
+            iov_msg_free(&m);
+        }
+
+        /* Batched IOV */
+        bc.layout = &benchLayouts[0];
+        bc.msgCount = batchCount;
+        bc.msgs = xmalloc(batchCount * sizeof(*bc.msgs));
+        bc.batch = xmalloc(batchCount * sizeof(*bc.batch));
+        for (i = 0; i < batchCount; i++) {
+            iov_msg_init(&bc, &bc.msgs[i]);
+            iov_msg_wrap(&bc, &bc.msgs[i]);
+            memset(&bc.batch[i], 0, sizeof(bc.batch[i]));
+            bc.batch[i].iov = bc.msgs[i].iov;
+            bc.batch[i].iov_count = bc.msgs[i].count;
+        }
+
+        run("wrap_iov_batch", bench_wrap_iov_batch, &bc, batchCount);
+        run("unwrap_iov_batch", bench_unwrap_iov_batch, &bc, batchCount);
+
+        for (i = 0; i < batchCount; i++)
+            iov_msg_free(&bc.msgs[i]);
+        free(bc.msgs);
+        free(bc.batch);
+        bc.msgs = NULL;
+        bc.batch = NULL;
+        bc.layout = NULL;
+
+        /* In-place wrap into caller-reserved space */
+        major = gss_wrap_in_place_length(&minor, initiator, bc.conf,
+                                         GSS_C_QOP_DEFAULT, size,
+                                         &bc.headerLength, &bc.trailerLength);
+        check("gss_wrap_in_place_length", major, minor);
+        bc.workLength = bc.headerLength + size + bc.trailerLength;
+        bc.work = xmalloc(bc.workLength);
+
+        run("wrap_in_place", bench_wrap_in_place, &bc, 1);
+
+        free(bc.work);
+        bc.work = NULL;
+    }
+
+    /* MIC and PRF do not depend on confidentiality */
+    bc.conf = 0;
+
+    major = gss_get_mic(&minor, initiator, GSS_C_QOP_DEFAULT, &in, &bc.token);
+    check("gss_get_mic", major, minor);
+
+    run("get_mic", bench_get_mic, &bc, 1);
+    run("verify_mic", bench_verify_mic, &bc, 1);
+
+    gss_release_buffer(&minor, &bc.token);
+
+    run("pseudo_random", bench_pseudo_random, &bc, 1);
+
+    free(bc.msg);
+}
+
+static gss_buffer_desc
+export_context(int enctype)
+{
+    gss_ctx_id_t ctx = import_context(enctype, 0);
+    gss_buffer_desc token;
+    OM_uint32 major, minor;
+
+    major = gss_export_sec_context(&minor, &ctx, &token);
+    check("gss_export_sec_context", major, minor);
+
+    return token;
+}
+
+static void
+bench_names(void)
+{
+    static const char user[] = "user@example.org";
+    struct bench_case bc;
+    OM_uint32 major, minor;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.label = "name";
+    bc.token.value = (void *)user;
+    bc.token.length = sizeof(user) - 1;
+    bc.size = bc.token.length;
+
+    run("import_name", bench_import_name, &bc, 1);
+
+    major = gss_import_name(&minor, &bc.token, GSS_C_NT_USER_NAME,
+                            &bc.target);
+    check("gss_import_name", major, minor);
+
+    run("duplicate_name", bench_duplicate_name, &bc, 1);
+
+    gss_release_name(&minor, &bc.target);
+}
+
+/*
+ * Compare a composite SAML initiator name, as built by the acceptor,
+ * against lists of such names ending with the same name imported
+ * separately.
+ */
+static void
+bench_compare_names(void)
+{
+    static const size_t counts[] = { 16, 256, 4096 };
+    static const char format[] =
+        "user%05lu@example.org!"
+        "urn:oasis:names:tc:SAML:2.0:nameid-format:persistent!"
+        "https://idp.example.org/idp/shibboleth!"
+        "https://sp.example.org/shibboleth!";
+    struct bench_case bc;
+    gss_buffer_desc buf;
+    OM_uint32 major, minor;
+    char user[256];
+    unsigned int c;
+    size_t i;
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        memset(&bc, 0, sizeof(bc));
+        bc.label = "acl";
+        bc.size = counts[c];
+        bc.nameCount = counts[c];
+        bc.names = xmalloc(counts[c] * sizeof(*bc.names));
+
+        buf.value = user;
+        for (i = 0; i < counts[c]; i++) {
+            buf.length = snprintf(user, sizeof(user), format,
+                                  (unsigned long)i);
+            major = gss_import_name(&minor, &buf, GSS_C_NT_USER_NAME,
+                                    &bc.names[i]);
+            check("gss_import_name", major, minor);
+        }
+
+        major = gss_import_name(&minor, &buf, GSS_C_NT_USER_NAME,
+                                &bc.target);
+        check("gss_import_name", major, minor);
+
+        /* Report the cost of one comparison */
+        run("compare_name", bench_compare_name, &bc, (int)counts[c]);
+
+        for (i = 0; i < counts[c]; i++)
+            gss_release_name(&minor, &bc.names[i]);
+        free(bc.names);
+        gss_release_name(&minor, &bc.target);
+    }
+}
+
+/* Replace path, as an editor saving the file would */
+static void
+write_identity_file(const char *path, const char *identity)
+{
+    char tmpPath[256];
+    FILE *fp;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.new", path);
+
+    fp = fopen(tmpPath, "w");
+    if (fp == NULL || fprintf(fp, "%s\nbench password\n", identity) < 0 ||
+        fclose(fp) != 0 || rename(tmpPath, path) != 0) {
+        perror(tmpPath);
+        exit(1);
+    }
+}
+
+static void
+bench_identity_file(void)
+{
+    struct bench_case bc;
+    char path[] = "/tmp/gss-bench-id.XXXXXX";
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+
+    setenv("GSSEAP_IDENTITY", path, 1);
+
+    write_identity_file(path, "bench@example.org");
+
+    memset(&bc, 0, sizeof(bc));
+    bc.label = "identity_file";
+    run("default_cred", bench_default_cred, &bc, 1);
+
+    unlink(path);
+    unsetenv("GSSEAP_IDENTITY");
+}
+
+/*
+ * Replay store
+ */
+
+/* Shared by all threads, as the clock would be */
+static unsigned long replaySerial;
+
+static OM_uint32
+bench_replay_record(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    unsigned long serial;
+    char key[40];
+    time_t t;
+    int length;
+
+    *minor = 0;
+
+    while (n-- > 0) {
+        serial = __sync_fetch_and_add(&replaySerial, 1);
+        t = BENCH_REPLAY_EPOCH + serial / BENCH_REPLAY_RATE;
+        length = snprintf(key, sizeof(key), "_%032lx", serial);
+
+        if (gssEapReplayCheck(bc->replay, GSSEAP_REPLAY_ASSERTION, key, length,
+                              t + BENCH_REPLAY_LIFETIME, t) != GSSEAP_REPLAY_FRESH) {
+            fprintf(stderr, "gss-bench: replay store refused fresh ID %s\n", key);
+            return GSS_S_FAILURE;
+        }
+    }
+
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+bench_replay_seen(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    char key[40];
+    time_t t = BENCH_REPLAY_EPOCH + replaySerial / BENCH_REPLAY_RATE;
+    int length;
+
+    *minor = 0;
+
+    while (n-- > 0) {
+        length = snprintf(key, sizeof(key), "_seen%027lx",
+                          (unsigned long)n % BENCH_REPLAY_SEEN_KEYS);
+
+        if (gssEapReplayCheck(bc->replay, GSSEAP_REPLAY_ASSERTION, key, length,
+                              t + BENCH_REPLAY_LIFETIME, t) != GSSEAP_REPLAY_SEEN) {
+            fprintf(stderr, "gss-bench: replay store missed ID %s\n", key);
+            return GSS_S_FAILURE;
+        }
+    }
+
+    return GSS_S_COMPLETE;
+}
+
+struct replay_thread {
+    pthread_t thread;
+    struct bench_case *bc;
+    long n;
+    OM_uint32 major;
+    OM_uint32 minor;
+};
+
+static void *
+replay_thread_main(void *arg)
+{
+    struct replay_thread *t = arg;
+
+    t->major = bench_replay_record(&t->minor, t->bc, t->n);
+
+    return NULL;
+}
+
+/* Several threads recording at once, which mostly take different shards */
+static OM_uint32
+bench_replay_record_threads(OM_uint32 *minor, struct bench_case *bc, long n)
+{
+    struct replay_thread threads[BENCH_HANDSHAKE_THREADS];
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+
+    *minor = 0;
+
+    for (i = 0; i < BENCH_HANDSHAKE_THREADS; i++) {
+        threads[i].bc = bc;
+        threads[i].n = n;
+        if (pthread_create(&threads[i].thread, NULL,
+                           replay_thread_main, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < BENCH_HANDSHAKE_THREADS; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].major != GSS_S_COMPLETE) {
+            major = threads[i].major;
+            *minor = threads[i].minor;
+        }
+    }
+
+    return major;
+}
+
+static void
+bench_replay(void)
+{
+    struct bench_case bc;
+    char path[] = "/tmp/gss-bench-replay.XXXXXX";
+    char key[40];
+    unsigned long i;
+    int fd, length;
+
+    memset(&bc, 0, sizeof(bc));
+
+    bc.label = "memory";
+    bc.replay = gssEapReplayOpen(NULL, BENCH_REPLAY_ENTRIES);
+    if (bc.replay == NULL) {
+        fprintf(stderr, "gss-bench: unable to create replay store\n");
+        exit(1);
+    }
+
+    for (i = 0; i < BENCH_REPLAY_SEEN_KEYS; i++) {
+        length = snprintf(key, sizeof(key), "_seen%027lx", i);
+        gssEapReplayCheck(bc.replay, GSSEAP_REPLAY_ASSERTION, key, length,
+                          BENCH_REPLAY_EPOCH * 2L, BENCH_REPLAY_EPOCH);
+    }
+
+    run("replay_record", bench_replay_record, &bc, 1);
+    run("replay_record_threads", bench_replay_record_threads, &bc,
+        BENCH_HANDSHAKE_THREADS);
+    run("replay_seen", bench_replay_seen, &bc, 1);
+    gssEapReplayClose(bc.replay);
+
+    /* The same, with the store kept in a file */
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+
+    bc.label = "file";
+    bc.replay = gssEapReplayOpen(path, BENCH_REPLAY_ENTRIES);
+    if (bc.replay == NULL) {
+        perror(path);
+        exit(1);
+    }
+    run("replay_record", bench_replay_record, &bc, 1);
+    run("replay_record_threads", bench_replay_record_threads, &bc,
+        BENCH_HANDSHAKE_THREADS);
+    gssEapReplayClose(bc.replay);
+
+    unlink(path);
+}
+
+/*
+ * Build a version 2 acceptor context token whose initiator name carries
+ * count attributes, by splicing them into the empty attributes field of
+ * a token exported from a bench context. This must follow the field
+ * order written by exportContextV2().
+ */
+static gss_buffer_desc
+attribute_context_token(int enctype, size_t count)
+{
+    gss_buffer_desc token, spliced;
+    unsigned char *p, *q;
+    size_t i, offset, attrsLength = 0, tail;
+    char attr[64], value[64];
+    int field;
+
+    token = export_context(enctype);
+
+    /* Skip mechanismUsed, rfc3961Key, initiatorName and acceptorName */
+    offset = BENCH_V2_FIXED_LENGTH;
+    for (field = 0; field < 4; field++)
+        offset += 4 + load_be32((unsigned char *)token.value + offset);
+
+    for (i = 0; i < count; i++) {
+        attrsLength += 8 + snprintf(attr, sizeof(attr), "urn:bench:attr:%lu",
+                                    (unsigned long)i);
+        attrsLength += snprintf(value, sizeof(value), "value-%lu",
+                                (unsigned long)i);
+    }
+
+    /* The existing attributes field is empty, just its length */
+    tail = token.length - offset - 4;
+
+    spliced.length = token.length + attrsLength;
+    spliced.value = p = xmalloc(spliced.length);
+
+    memcpy(p, token.value, offset);
+    store_be32(&p[4], spliced.length);
+    q = p + offset;
+    store_be32(q, attrsLength);
+    q += 4;
+
+    for (i = 0; i < count; i++) {
+        size_t attrLength, valueLength;
+
+        attrLength = snprintf(attr, sizeof(attr), "urn:bench:attr:%lu",
+                              (unsigned long)i);
+        valueLength = snprintf(value, sizeof(value), "value-%lu",
+                               (unsigned long)i);
+
+        store_be32(q, attrLength);
+        memcpy(q + 4, attr, attrLength);
+        q += 4 + attrLength;
+        store_be32(q, valueLength);
+        memcpy(q + 4, value, valueLength);
+        q += 4 + valueLength;
+    }
+
+    memcpy(q, (unsigned char *)token.value + offset + 4, tail);
+
+    memset(token.value, 0, token.length);
+    free(token.value);
+
+    return spliced;
+}
+
+static void
+bench_attributes(int enctype)
+{
+    static const size_t counts[] = { 16, 256, 4096 };
+    struct bench_case bc;
+    gss_buffer_desc token;
+    gss_ctx_id_t ctx;
+    OM_uint32 major, minor;
+    char attr[64];
+    unsigned int c;
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        memset(&bc, 0, sizeof(bc));
+        bc.enctype = enctype;
+        bc.label = "attributes";
+        bc.size = counts[c];
+
+        token = attribute_context_token(enctype, counts[c]);
+        major = gss_import_sec_context(&minor, &token, &ctx);
+        check("gss_import_sec_context with attributes", major, minor);
+        free(token.value);
+
+        major = gss_inquire_context(&minor, ctx, &bc.target, NULL, NULL,
+                                    NULL, NULL, NULL, NULL);
+        check("gss_inquire_context", major, minor);
+
+        /* The last attribute is the worst case for a linear scan */
+        bc.token.value = attr;
+        bc.token.length = snprintf(attr, sizeof(attr), "urn:bench:attr:%lu",
+                                   (unsigned long)counts[c] - 1);
+
+        run("get_name_attribute", bench_get_name_attribute, &bc, 1);
+        run("duplicate_name", bench_duplicate_name, &bc, 1);
+        run("export_name_composite", bench_export_name_composite, &bc, 1);
+
+        major = gss_export_name_composite(&minor, bc.target, &bc.token);
+        check("gss_export_name_composite", major, minor);
+
+        run("import_name_composite", bench_import_name_composite, &bc, 1);
+
+        gss_release_buffer(&minor, &bc.token);
+        gss_release_name(&minor, &bc.target);
+        gss_delete_sec_context(&minor, &ctx, GSS_C_NO_BUFFER);
+    }
+}
+
+static void
+bench_export(int enctype)
+{
+    struct bench_case bc;
+    gss_buffer_desc token;
+    OM_uint32 minor;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.enctype = enctype;
+    bc.label = "v2";
+
+    /* Report the token size as the message size */
+    token = export_context(enctype);
+    bc.size = token.length;
+    gss_release_buffer(&minor, &token);
+
+    bc.acceptor = import_context(enctype, 0);
+    run("export_import", bench_export_import, &bc, 1);
+    gss_delete_sec_context(&minor, &bc.acceptor, GSS_C_NO_BUFFER);
+
+    /* Import and delete alone, which is mostly handle churn */
+    bc.token = export_context(enctype);
+    run("import_delete_context", bench_import_context, &bc, 1);
+    gss_release_buffer(&minor, &bc.token);
+}
+
+static gss_cred_id_t
+acquire_cred(const char *user, const char *password, int reauth)
+{
+    gss_buffer_desc buf;
+    gss_name_t name = GSS_C_NO_NAME;
+    gss_cred_id_t cred = GSS_C_NO_CREDENTIAL;
+    unsigned char flag[5];
+    OM_uint32 major, minor;
+
+    buf.value = (void *)user;
+    buf.length = strlen(user);
+
+    major = gss_import_name(&minor, &buf, GSS_C_NT_USER_NAME, &name);
+    check("gss_import_name", major, minor);
+
+    buf.value = (void *)password;
+    buf.length = strlen(password);
+
+    major = gss_acquire_cred_with_password(&minor, name, &buf, 0,
+                                           GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                                           &cred, NULL, NULL);
+    check("gss_acquire_cred_with_password", major, minor);
+
+    gss_release_name(&minor, &name);
+
+    if (reauth) {
+        store_be32(flag, GSS_EAP_ENABLE_REAUTH_FLAG);
+        flag[4] = 0;
+
+        buf.value = flag;
+        buf.length = sizeof(flag);
+
+        major = gssspi_set_cred_option(&minor, &cred,
+                                       GSS_EAP_CRED_SET_CRED_FLAG, &buf);
+        check("gssspi_set_cred_option", major, minor);
+    }
+
+    return cred;
+}
+
+/*
+ * Present one reauthentication request to two acceptors; the second
+ * must reject it as a replay rather than establish a context.
+ */
+static void
+check_reauth_replay(struct bench_case *bc)
+{
+    gss_ctx_id_t initiator = GSS_C_NO_CONTEXT;
+    gss_ctx_id_t acceptor = GSS_C_NO_CONTEXT;
+    gss_buffer_desc initToken = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc acceptToken = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc replayToken = GSS_C_EMPTY_BUFFER;
+    OM_uint32 major, minor;
+
+    major = gss_init_sec_context(&minor, bc->cred, &initiator, bc->target,
+                                 GSS_C_NO_OID, GSS_C_MUTUAL_FLAG, 0,
+                                 GSS_C_NO_CHANNEL_BINDINGS, GSS_C_NO_BUFFER,
+                                 NULL, &initToken, NULL, NULL);
+    if (GSS_ERROR(major))
+        check("gss_init_sec_context", major, minor);
+
+    major = gss_accept_sec_context(&minor, &acceptor, GSS_C_NO_CREDENTIAL,
+                                   &initToken, GSS_C_NO_CHANNEL_BINDINGS,
+                                   NULL, NULL, &acceptToken,
+                                   NULL, NULL, NULL);
+    if (major != GSS_S_COMPLETE) {
+        fprintf(stderr, "gss-bench: reauthentication ticket not used\n");
+        exit(1);
+    }
+    gss_delete_sec_context(&minor, &acceptor, GSS_C_NO_BUFFER);
+
+    /* Finish the initiator, so that it keeps the ticket */
+    major = gss_init_sec_context(&minor, bc->cred, &initiator, bc->target,
+                                 GSS_C_NO_OID, GSS_C_MUTUAL_FLAG, 0,
+                                 GSS_C_NO_CHANNEL_BINDINGS, &acceptToken,
+                                 NULL, &replayToken, NULL, NULL);
+    check("gss_init_sec_context", major, minor);
+    gss_release_buffer(&minor, &replayToken);
+    gss_release_buffer(&minor, &acceptToken);
+    gss_delete_sec_context(&minor, &initiator, GSS_C_NO_BUFFER);
+
+    major = gss_accept_sec_context(&minor, &acceptor, GSS_C_NO_CREDENTIAL,
+                                   &initToken, GSS_C_NO_CHANNEL_BINDINGS,
+                                   NULL, NULL, &acceptToken,
+                                   NULL, NULL, NULL);
+    if (!GSS_ERROR(major)) {
+        fprintf(stderr, "gss-bench: replayed reauthentication request "
+                "was not rejected\n");
+        exit(1);
+    }
+
+    gss_release_buffer(&minor, &acceptToken);
+    gss_delete_sec_context(&minor, &acceptor, GSS_C_NO_BUFFER);
+    gss_release_buffer(&minor, &initToken);
+}
+
+static void
+bench_handshakes(const char *service, const char *user, const char *password)
+{
+    struct bench_case bc;
+    gss_buffer_desc buf;
+    OM_uint32 major, minor;
+
+    memset(&bc, 0, sizeof(bc));
+
+    buf.value = (void *)service;
+    buf.length = strlen(service);
+
+    major = gss_import_name(&minor, &buf, GSS_C_NT_HOSTBASED_SERVICE,
+                            &bc.target);
+    check("gss_import_name", major, minor);
+
+    bc.cred = acquire_cred(user, password, 0);
+    run("handshake_full", bench_handshake, &bc, 1);
+    run("handshake_full_shared", bench_handshake_threads, &bc,
+        BENCH_HANDSHAKE_THREADS);
+    gss_release_cred(&minor, &bc.cred);
+
+    /* The first login fetches the ticket used by the rest */
+    bc.cred = acquire_cred(user, password, 1);
+    major = handshake(&minor, bc.cred, bc.target);
+    check("priming reauthentication ticket", major, minor);
+    check_reauth_replay(&bc);
+    run("handshake_reauth", bench_handshake, &bc, 1);
+    gss_release_cred(&minor, &bc.cred);
+
+    gss_release_name(&minor, &bc.target);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: gss-bench [-e enctype]... [-s size]... "
+            "[-t seconds] [-b batch] [-op name] [-o file]\n"
+            "                 [-H service@host -u user -p password]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const size_t defaultSizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+    static const int defaultEnctypes[] = { 17, 18 };
+    size_t sizes[BENCH_MAX_ARGS];
+    int enctypes[BENCH_MAX_ARGS];
+    int nsizes = 0, nenctypes = 0, batchCount = 16;
+    int e, s;
+    const char *service = NULL, *user = NULL, *password = NULL;
+    OM_uint32 minor;
+
+    display_file = stderr;
+    out = stdout;
+
+    for (argc--, argv++; argc > 0; argc--, argv++) {
+        if (argc < 2)
+            usage();
+        if (strcmp(*argv, "-e") == 0 && nenctypes < BENCH_MAX_ARGS) {
+            enctypes[nenctypes++] = atoi(*++argv);
+        } else if (strcmp(*argv, "-s") == 0 && nsizes < BENCH_MAX_ARGS) {
+            sizes[nsizes++] = strtoul(*++argv, NULL, 0);
+        } else if (strcmp(*argv, "-t") == 0) {
+            benchSeconds = atof(*++argv);
+        } else if (strcmp(*argv, "-b") == 0) {
+            batchCount = atoi(*++argv);
+        } else if (strcmp(*argv, "-op") == 0) {
+            opFilter = *++argv;
+        } else if (strcmp(*argv, "-H") == 0) {
+            service = *++argv;
+        } else if (strcmp(*argv, "-u") == 0) {
+            user = *++argv;
+        } else if (strcmp(*argv, "-p") == 0) {
+            password = *++argv;
+        } else if (strcmp(*argv, "-o") == 0) {
+            out = fopen(*++argv, "w");
+            if (out == NULL) {
+                perror(*argv);
+                exit(1);
+            }
+        } else {
+            usage();
+        }
+        argc--;
+    }
+
+    if (batchCount <= 0 || benchSeconds <= 0)
+        usage();
+    if (service != NULL && (user == NULL || password == NULL))
+        usage();
+
+    if (nsizes == 0) {
+        for (s = 0; s < (int)(sizeof(defaultSizes) / sizeof(defaultSizes[0])); s++)
+            sizes[nsizes++] = defaultSizes[s];
+    }
+    if (nenctypes == 0) {
+        for (e = 0; e < (int)(sizeof(defaultEnctypes) / sizeof(defaultEnctypes[0])); e++)
+            enctypes[nenctypes++] = defaultEnctypes[e];
+    }
+
+    fprintf(out, "{\n  \"suite\": \"mech_saml_ec\",\n"
+            "  \"min_seconds\": %.3f,\n  \"results\": [", benchSeconds);
+
+    if (service != NULL)
+        bench_handshakes(service, user, password);
+
+    bench_names();
+    bench_compare_names();
+    bench_identity_file();
+    bench_replay();
+
+    /* Handshakes do not need contexts made with --enable-bench */
+    if (opFilter != NULL && strncmp(opFilter, "handshake", 9) == 0)
+        nenctypes = 0;
+
+    for (e = 0; e < nenctypes; e++) {
+        gss_ctx_id_t initiator = import_context(enctypes[e], 1);
+        gss_ctx_id_t acceptor = import_context(enctypes[e], 0);
+
+        for (s = 0; s < nsizes; s++)
+            bench_enctype_size(initiator, acceptor, enctypes[e], sizes[s],
+                               batchCount);
+
+        bench_export(enctypes[e]);
+        bench_attributes(enctypes[e]);
+
+        gss_delete_sec_context(&minor, &initiator, GSS_C_NO_BUFFER);
+        gss_delete_sec_context(&minor, &acceptor, GSS_C_NO_BUFFER);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
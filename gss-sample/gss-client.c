@@ -57,10 +57,14 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 #endif
 
 #include <gssapi/gssapi_generic.h>
@@ -86,9 +90,125 @@ usage()
     fprintf(stderr, "\n");
     fprintf(stderr, "       [-f] [-q] [-ccount count] [-mcount count]\n");
     fprintf(stderr, "       [-v1] [-na] [-nw] [-nx] [-nm] host service msg\n");
+#ifndef _WIN32
+    fprintf(stderr, "       load mode: [-concurrency num] [-rate per_sec] "
+            "[-duration secs] [-json]\n");
+#endif
     exit(1);
 }
 
+#ifndef _WIN32
+/*
+ * Latency histogram for load mode.  Values are microseconds, bucketed
+ * log-linearly as in HdrHistogram: exact below LAT_SUB, and above that
+ * LAT_SUB linear buckets per power of two, so any recorded value is
+ * reported within 1/LAT_SUB (about 1.6%) of its true value.
+ */
+#define LAT_SUB_BITS    6
+#define LAT_SUB         (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS    40      /* about 12 days */
+#define LAT_BUCKETS     ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct latency_hist {
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t total;
+    uint64_t min, max;
+    double  sum;
+};
+
+struct load_stats {
+    struct latency_hist context;    /* connect through context established */
+    struct latency_hist message;    /* wrap, send, receive and verify */
+    double  scheduled;              /* when this call should have started */
+    uint64_t calls_ok, calls_failed;
+};
+
+static double
+load_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+lat_index(uint64_t v)
+{
+    int     e, shift;
+
+    if (v < LAT_SUB)
+        return (int) v;
+    e = 63 - __builtin_clzll(v);
+    if (e >= LAT_MAX_BITS)
+        return LAT_BUCKETS - 1;
+    shift = e - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB + (int) ((v >> shift) - LAT_SUB);
+}
+
+/* The highest value that lands in bucket i */
+static uint64_t
+lat_value(int i)
+{
+    int     shift;
+
+    if (i < LAT_SUB)
+        return i;
+    shift = i / LAT_SUB - 1;
+    return ((uint64_t) (LAT_SUB + i % LAT_SUB + 1) << shift) - 1;
+}
+
+static void
+lat_record(struct latency_hist *h, double seconds)
+{
+    uint64_t us = seconds > 0 ? (uint64_t) (seconds * 1e6 + 0.5) : 0;
+
+    h->counts[lat_index(us)]++;
+    if (h->total == 0 || us < h->min)
+        h->min = us;
+    if (us > h->max)
+        h->max = us;
+    h->total++;
+    h->sum += us;
+}
+
+static void
+lat_merge(struct latency_hist *to, const struct latency_hist *from)
+{
+    int     i;
+
+    if (from->total == 0)
+        return;
+    for (i = 0; i < LAT_BUCKETS; i++)
+        to->counts[i] += from->counts[i];
+    if (to->total == 0 || from->min < to->min)
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+    to->total += from->total;
+    to->sum += from->sum;
+}
+
+static uint64_t
+lat_percentile(const struct latency_hist *h, double pct)
+{
+    uint64_t rank, seen = 0;
+    int     i;
+
+    if (h->total == 0)
+        return 0;
+    rank = (uint64_t) (pct / 100.0 * h->total);
+    if (rank < pct / 100.0 * h->total || rank == 0)
+        rank++;
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return lat_value(i) < h->max ? lat_value(i) : h->max;
+    }
+    return h->max;
+}
+#endif /* !_WIN32 */
+
 /*
  * Function: connect_to_server
  *
@@ -113,8 +233,18 @@ connect_to_server(char *host, u_short port)
     struct sockaddr_in saddr;
     struct hostent *hp;
     int     s;
+#ifndef _WIN32
+    static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+    int     on = 1;
 
+    /* gethostbyname is not reentrant, and load mode calls it from many
+     * threads at once */
+    pthread_mutex_lock(&resolve_lock);
+#endif
     if ((hp = gethostbyname(host)) == NULL) {
+#ifndef _WIN32
+        pthread_mutex_unlock(&resolve_lock);
+#endif
         fprintf(stderr, "Unknown host: %s\n", host);
         return -1;
     }
@@ -122,11 +252,19 @@ connect_to_server(char *host, u_short port)
     saddr.sin_family = hp->h_addrtype;
     memcpy(&saddr.sin_addr, hp->h_addr, sizeof(saddr.sin_addr));
     saddr.sin_port = htons(port);
+#ifndef _WIN32
+    pthread_mutex_unlock(&resolve_lock);
+#endif
 
     if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("creating socket");
         return -1;
     }
+#ifndef _WIN32
+    /* send_token writes the flags, length and token separately, which
+     * otherwise costs a delayed ACK on every round trip */
+    (void) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+#endif
     if (connect(s, (struct sockaddr *) &saddr, sizeof(saddr)) < 0) {
         perror("connecting to server");
         (void) close(s);
@@ -417,6 +555,7 @@ read_file(file_name, in_buf)
  *      msg             (r) the message to have "signed"
  *      use_file        (r) whether to treat msg as an input file name
  *      mcount          (r) the number of times to send the message
+ *      stats           (w) load mode latencies to record, or NULL
  *
  * Returns: 0 on success, -1 on failure
  *
@@ -431,7 +570,7 @@ read_file(file_name, in_buf)
 static int
 call_server(host, port, oid, service_name, gss_flags, auth_flag,
             wrap_flag, encrypt_flag, mic_flag, v1_format, msg, use_file,
-            mcount, username, password)
+            mcount, username, password, stats)
     char   *host;
     u_short port;
     gss_OID oid;
@@ -444,6 +583,7 @@ call_server(host, port, oid, service_name, gss_flags, auth_flag,
     int     mcount;
     char    *username;
     char    *password;
+    struct load_stats *stats;
 {
     gss_ctx_id_t context = GSS_C_NO_CONTEXT;
     gss_buffer_desc in_buf, out_buf;
@@ -462,6 +602,12 @@ call_server(host, port, oid, service_name, gss_flags, auth_flag,
     gss_buffer_desc oid_name;
     size_t  i;
     int     token_flags;
+#ifndef _WIN32
+    double  start = 0;
+
+    if (stats != NULL)
+        start = stats->scheduled ? stats->scheduled : load_now();
+#endif
 
     /* Open connection */
     if ((s = connect_to_server(host, port)) < 0)
@@ -475,6 +621,11 @@ call_server(host, port, oid, service_name, gss_flags, auth_flag,
         return -1;
     }
 
+#ifndef _WIN32
+    if (stats != NULL)
+        lat_record(&stats->context, load_now() - start);
+#endif
+
     if (auth_flag && verbose) {
         /* display the flags */
         display_ctx_flags(ret_flags);
@@ -563,6 +714,10 @@ call_server(host, port, oid, service_name, gss_flags, auth_flag,
     }
 
     for (i = 0; i < mcount; i++) {
+#ifndef _WIN32
+        if (stats != NULL)
+            start = load_now();
+#endif
         if (wrap_flag) {
             maj_stat =
                 gss_wrap(&min_stat, context, encrypt_flag, GSS_C_QOP_DEFAULT,
@@ -623,6 +778,10 @@ call_server(host, port, oid, service_name, gss_flags, auth_flag,
         }
 
         free(out_buf.value);
+#ifndef _WIN32
+        if (stats != NULL)
+            lat_record(&stats->message, load_now() - start);
+#endif
     }
 
     if (use_file)
@@ -762,7 +921,8 @@ worker_bee(void *unused)
 {
     if (call_server(server_host, port, oid, service_name,
                     gss_flags, auth_flag, wrap_flag, encrypt_flag, mic_flag,
-                    v1_format, msg, use_file, mcount, username, password) < 0)
+                    v1_format, msg, use_file, mcount, username, password,
+                    NULL) < 0)
         exit(1);
 
 #ifdef _WIN32
@@ -771,6 +931,166 @@ worker_bee(void *unused)
 #endif
 }
 
+#ifndef _WIN32
+/*
+ * Load mode.  Each of load_concurrency threads repeatedly claims the
+ * next call from a shared counter.  With -rate, call k is due at
+ * load_start + k / load_rate; a worker sleeps until then and measures
+ * the context latency from that time, so that a saturated acceptor
+ * shows up as queueing delay instead of silently lowering the offered
+ * rate.  Without -rate each worker starts its next call as soon as the
+ * last one finishes.
+ */
+static int load_concurrency = 0;
+static double load_rate = 0, load_duration = 0;
+static int load_json = 0;
+static double load_start, load_end;
+static uint64_t load_next;
+
+static void *
+load_worker(void *param)
+{
+    struct load_stats *stats = (struct load_stats *) param;
+    struct timespec ts;
+    uint64_t k;
+    double  due, now;
+
+    for (;;) {
+        k = __sync_fetch_and_add(&load_next, 1);
+        if (load_duration == 0 && k >= (uint64_t) ccount)
+            break;
+
+        now = load_now();
+        if (load_rate > 0) {
+            due = load_start + k / load_rate;
+            if (load_duration > 0 && (due >= load_end || now >= load_end))
+                break;
+            if (due > now) {
+                ts.tv_sec = (time_t) (due - now);
+                ts.tv_nsec = (long) ((due - now - ts.tv_sec) * 1e9);
+                nanosleep(&ts, NULL);
+            }
+            stats->scheduled = due;
+        } else {
+            if (load_duration > 0 && now >= load_end)
+                break;
+            stats->scheduled = 0;
+        }
+
+        if (call_server(server_host, port, oid, service_name,
+                        gss_flags, auth_flag, wrap_flag, encrypt_flag,
+                        mic_flag, v1_format, msg, use_file, mcount,
+                        username, password, stats) < 0)
+            stats->calls_failed++;
+        else
+            stats->calls_ok++;
+    }
+
+    return NULL;
+}
+
+static void
+load_print_hist(const char *name, const struct latency_hist *h)
+{
+    static const double pcts[] = { 50, 90, 99, 99.9 };
+    static const char *labels[] = { "p50", "p90", "p99", "p99_9" };
+    double  mean = h->total ? h->sum / h->total : 0;
+    int     i;
+
+    if (load_json) {
+        printf("  \"%s_latency_us\": {\"count\": %llu, \"min\": %llu, "
+               "\"mean\": %.1f", name, (unsigned long long) h->total,
+               (unsigned long long) h->min, mean);
+        for (i = 0; i < 4; i++)
+            printf(", \"%s\": %llu", labels[i],
+                   (unsigned long long) lat_percentile(h, pcts[i]));
+        printf(", \"max\": %llu}", (unsigned long long) h->max);
+        return;
+    }
+
+    printf("%s latency (ms): min %.3f mean %.3f", name, h->min / 1e3,
+           mean / 1e3);
+    for (i = 0; i < 4; i++)
+        printf(" p%g %.3f", pcts[i], lat_percentile(h, pcts[i]) / 1e3);
+    printf(" max %.3f\n", h->max / 1e3);
+}
+
+static int
+load_run(void)
+{
+    struct load_stats **stats, total;
+    pthread_t *threads;
+    double  elapsed, error_rate;
+    uint64_t calls;
+    int     i, n;
+
+    stats = calloc(load_concurrency, sizeof(*stats));
+    threads = calloc(load_concurrency, sizeof(*threads));
+    if (stats == NULL || threads == NULL) {
+        fprintf(stderr, "Couldn't allocate load generator state\n");
+        return -1;
+    }
+
+    load_start = load_now();
+    load_end = load_start + load_duration;
+
+    for (n = 0; n < load_concurrency; n++) {
+        stats[n] = calloc(1, sizeof(struct load_stats));
+        if (stats[n] == NULL ||
+            pthread_create(&threads[n], NULL, load_worker, stats[n]) != 0) {
+            fprintf(stderr, "Couldn't start load generator thread\n");
+            free(stats[n]);
+            break;
+        }
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+        lat_merge(&total.context, &stats[i]->context);
+        lat_merge(&total.message, &stats[i]->message);
+        total.calls_ok += stats[i]->calls_ok;
+        total.calls_failed += stats[i]->calls_failed;
+        free(stats[i]);
+    }
+    elapsed = load_now() - load_start;
+    free(stats);
+    free(threads);
+
+    calls = total.calls_ok + total.calls_failed;
+    error_rate = calls ? (double) total.calls_failed / calls : 0;
+
+    if (load_json) {
+        printf("{\n  \"concurrency\": %d,\n  \"rate\": %.1f,\n"
+               "  \"seconds\": %.3f,\n", n, load_rate, elapsed);
+        printf("  \"contexts\": {\"ok\": %llu, \"failed\": %llu, "
+               "\"error_rate\": %.4f, \"per_sec\": %.1f},\n",
+               (unsigned long long) total.calls_ok,
+               (unsigned long long) total.calls_failed, error_rate,
+               total.calls_ok / elapsed);
+        printf("  \"messages\": {\"ok\": %llu, \"per_sec\": %.1f},\n",
+               (unsigned long long) total.message.total,
+               total.message.total / elapsed);
+        load_print_hist("context", &total.context);
+        printf(",\n");
+        load_print_hist("message", &total.message);
+        printf("\n}\n");
+    } else {
+        printf("contexts: %llu ok, %llu failed (%.2f%% errors) in %.2f s, "
+               "%.1f/s\n", (unsigned long long) total.calls_ok,
+               (unsigned long long) total.calls_failed, error_rate * 100,
+               elapsed, total.calls_ok / elapsed);
+        printf("messages: %llu ok, %.1f/s\n",
+               (unsigned long long) total.message.total,
+               total.message.total / elapsed);
+        load_print_hist("context", &total.context);
+        load_print_hist("message", &total.message);
+    }
+
+    return total.calls_failed ? -1 : 0;
+}
+#endif /* !_WIN32 */
+
 int
 main(argc, argv)
     int     argc;
@@ -862,6 +1182,40 @@ main(argc, argv)
             mic_flag = 0;
         } else if (strcmp(*argv, "-v1") == 0) {
             v1_format = 1;
+#ifndef _WIN32
+        } else if (strcmp(*argv, "-concurrency") == 0) {
+            argc--;
+            argv++;
+            if (!argc)
+                usage();
+            load_concurrency = atoi(*argv);
+            if (load_concurrency <= 0)
+                usage();
+        } else if (strcmp(*argv, "-rate") == 0) {
+            argc--;
+            argv++;
+            if (!argc)
+                usage();
+            load_rate = atof(*argv);
+            if (load_rate <= 0)
+                usage();
+            if (load_concurrency == 0)
+                load_concurrency = 1;
+        } else if (strcmp(*argv, "-duration") == 0) {
+            argc--;
+            argv++;
+            if (!argc)
+                usage();
+            load_duration = atof(*argv);
+            if (load_duration <= 0)
+                usage();
+            if (load_concurrency == 0)
+                load_concurrency = 1;
+        } else if (strcmp(*argv, "-json") == 0) {
+            load_json = 1;
+            if (load_concurrency == 0)
+                load_concurrency = 1;
+#endif
         } else
             break;
         argc--;
@@ -884,6 +1238,18 @@ main(argc, argv)
     if (mechanism)
         parse_oid(mechanism, &oid);
 
+#ifndef _WIN32
+    if (load_concurrency > 0) {
+        /* Keep stdout for the report */
+        verbose = 0;
+        display_file = stderr;
+        i = load_run();
+        if (oid != GSS_C_NULL_OID)
+            (void) gss_release_oid(&min_stat, &oid);
+        return i < 0 ? 1 : 0;
+    }
+#endif
+
     if (max_threads == 1) {
         for (i = 0; i < ccount; i++) {
             worker_bee(0);
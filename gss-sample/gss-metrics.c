@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Print the counters from a mechanism's exported metrics segment, as
+ * created when the process using the mechanism was started with
+ * MECH_SAML_EC_METRICS_SHM set. The segment is only read; nothing in
+ * the mechanism is called.
+ *
+ * Each counter is printed as a name and its value summed over the
+ * segment's slots. Counters that are zero are left out unless -a is
+ * given. With -i, the counters are printed again every interval
+ * seconds.
+ *
+ *      gss-metrics [-a] [-i seconds] /name
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util_metrics.h"
+
+static const char *simpleNames[GSSEAP_METRIC_MAX] = {
+    [GSSEAP_METRIC_INIT_COMPLETE]       = "init_complete",
+    [GSSEAP_METRIC_INIT_CONTINUE]       = "init_continue",
+    [GSSEAP_METRIC_INIT_FAILURE]        = "init_failure",
+    [GSSEAP_METRIC_ACCEPT_COMPLETE]     = "accept_complete",
+    [GSSEAP_METRIC_ACCEPT_CONTINUE]     = "accept_continue",
+    [GSSEAP_METRIC_ACCEPT_FAILURE]      = "accept_failure",
+    [GSSEAP_METRIC_WRAP]                = "wrap",
+    [GSSEAP_METRIC_UNWRAP]              = "unwrap",
+    [GSSEAP_METRIC_GET_MIC]             = "get_mic",
+    [GSSEAP_METRIC_VERIFY_MIC]          = "verify_mic",
+    [GSSEAP_METRIC_SEQ_DUPLICATE]       = "seq_duplicate",
+    [GSSEAP_METRIC_SEQ_OLD]             = "seq_old",
+    [GSSEAP_METRIC_SEQ_UNSEQ]           = "seq_unseq",
+    [GSSEAP_METRIC_SEQ_GAP]             = "seq_gap",
+    [GSSEAP_METRIC_SP_RESOLVE]          = "sp_resolve",
+    [GSSEAP_METRIC_SP_RESOLVE_MICROS]   = "sp_resolve_us",
+    [GSSEAP_METRIC_POOL_HIT]            = "pool_hit",
+    [GSSEAP_METRIC_POOL_MISS]           = "pool_miss",
+    [GSSEAP_METRIC_INTERN_HIT]          = "intern_hit",
+    [GSSEAP_METRIC_INTERN_MISS]         = "intern_miss",
+    [GSSEAP_METRIC_LOCALNAME_HIT]       = "localname_hit",
+    [GSSEAP_METRIC_LOCALNAME_MISS]      = "localname_miss",
+    [GSSEAP_METRIC_CONFIG_HIT]          = "config_hit",
+    [GSSEAP_METRIC_CONFIG_MISS]         = "config_miss",
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: gss-metrics [-a] [-i seconds] /name\n");
+    exit(1);
+}
+
+static void
+metricName(const struct gss_eap_metrics_segment *segment,
+           int metric, char *name, size_t size)
+{
+    int i;
+
+    if (simpleNames[metric] != NULL) {
+        snprintf(name, size, "%s", simpleNames[metric]);
+    } else if (metric >= GSSEAP_METRIC_FAILURE_MINOR &&
+               metric < GSSEAP_METRIC_WRAP) {
+        i = metric - GSSEAP_METRIC_FAILURE_MINOR;
+        if (i == GSSEAP_METRICS_MINOR_CODES - 1)
+            snprintf(name, size, "failure_minor{code=\"other\"}");
+        else
+            snprintf(name, size, "failure_minor{code=\"%lu\"}",
+                     (unsigned long)segment->minorBase + i);
+    } else if (metric >= GSSEAP_METRIC_WRAP_BYTES &&
+               metric < GSSEAP_METRIC_SEQ_DUPLICATE) {
+        const char *type = "wrap";
+
+        i = metric - GSSEAP_METRIC_WRAP_BYTES;
+        if (i >= GSSEAP_METRICS_ENCTYPES) {
+            type = "unwrap";
+            i -= GSSEAP_METRICS_ENCTYPES;
+        }
+        if (i == GSSEAP_METRICS_ENCTYPES - 1)
+            snprintf(name, size, "%s_bytes{enctype=\"other\"}", type);
+        else
+            snprintf(name, size, "%s_bytes{enctype=\"%d\"}", type, i);
+    } else if (metric >= GSSEAP_METRIC_IDP_HTTP &&
+               metric < GSSEAP_METRIC_SP_RESOLVE) {
+        i = metric - GSSEAP_METRIC_IDP_HTTP;
+        if (i == 0)
+            snprintf(name, size, "idp_http{status=\"error\"}");
+        else
+            snprintf(name, size, "idp_http{status=\"%dxx\"}", i);
+    } else {
+        snprintf(name, size, "metric_%d", metric);
+    }
+}
+
+static void
+printMetrics(const volatile struct gss_eap_metrics_segment *segment,
+             int all)
+{
+    uint64_t counters[GSSEAP_METRIC_MAX];
+    char name[64];
+    int i, j;
+
+    memset(counters, 0, sizeof(counters));
+
+    for (i = 0; i < GSSEAP_METRICS_SLOTS; i++) {
+        for (j = 0; j < GSSEAP_METRIC_MAX; j++)
+            counters[j] += segment->slots[i].counters[j];
+    }
+
+    for (j = 0; j < GSSEAP_METRIC_MAX; j++) {
+        if (counters[j] == 0 && !all)
+            continue;
+        metricName((const struct gss_eap_metrics_segment *)segment,
+                   j, name, sizeof(name));
+        printf("%s %llu\n", name, (unsigned long long)counters[j]);
+    }
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    const struct gss_eap_metrics_segment *segment;
+    struct stat st;
+    int all = 0, interval = 0;
+    int fd;
+
+    argc--; argv++;
+    while (argc) {
+        if (strcmp(*argv, "-a") == 0) {
+            all = 1;
+        } else if (strcmp(*argv, "-i") == 0) {
+            argc--; argv++;
+            if (!argc)
+                usage();
+            interval = atoi(*argv);
+        } else
+            break;
+        argc--; argv++;
+    }
+    if (argc != 1)
+        usage();
+
+    fd = shm_open(*argv, O_RDONLY, 0);
+    if (fd < 0) {
+        perror(*argv);
+        exit(1);
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*segment)) {
+        fprintf(stderr, "%s: not a metrics segment\n", *argv);
+        exit(1);
+    }
+
+    segment = mmap(NULL, sizeof(*segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    if (segment->magic != GSSEAP_METRICS_MAGIC ||
+        segment->version != GSSEAP_METRICS_VERSION ||
+        segment->slotCount != GSSEAP_METRICS_SLOTS ||
+        segment->counterCount != GSSEAP_METRIC_MAX ||
+        segment->slotSize != sizeof(struct gss_eap_metrics_slot)) {
+        fprintf(stderr, "%s: segment layout does not match this tool\n",
+                *argv);
+        exit(1);
+    }
+
+    printf("# pid %llu\n", (unsigned long long)segment->pid);
+    for (;;) {
+        printMetrics(segment, all);
+        if (interval <= 0)
+            break;
+        sleep(interval);
+        printf("\n");
+    }
+
+    munmap((void *)segment, sizeof(*segment));
+
+    return 0;
+}
@@ -44,6 +44,11 @@
  * or implied warranty.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE 1           /* accept4, pipe2 */
+#define USE_EPOLL 1
+#endif
+
 #include <stdio.h>
 #ifdef _WIN32
 #include <windows.h>
@@ -52,6 +57,14 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -77,7 +90,7 @@ static void
 usage()
 {
     fprintf(stderr, "Usage: gss-server [-port port] [-verbose] [-once]");
-#ifdef _WIN32
+#if defined(_WIN32) || defined(USE_EPOLL)
     fprintf(stderr, " [-threads num]");
 #endif
     fprintf(stderr, "\n");
@@ -146,6 +159,144 @@ fflush(stderr);
     return 0;
 }
 
+#ifndef MECH_EAP
+static struct gss_channel_bindings_struct server_cb = {
+    GSS_C_AF_NULLADDR, {0, NULL},
+    GSS_C_AF_NULLADDR, {0, NULL},
+    {sizeof("HLJHLJHLJHLJHJKLHLJHLJH") - 1, "HLJHLJHLJHLJHJKLHLJHLJH"}
+};
+#endif
+
+/*
+ * Function: server_accept_token
+ *
+ * Purpose: feeds one context token from the client to
+ * gss_accept_sec_context
+ *
+ * Arguments:
+ *
+ *      server_creds    (r) server credentials, from gss_acquire_cred
+ *      context         (r/w) the context being established
+ *      recv_tok        (r) the token received; its value is freed
+ *      send_tok        (w) the token to return to the client, if any
+ *      client          (w) the client's name, once established
+ *      doid            (w) the mechanism used, once established
+ *      ret_flags       (w) the context flags, once established
+ *
+ * Returns: 1 if more tokens are needed, 0 once the context is
+ * established, -1 on failure
+ *
+ * Effects:
+ *
+ * send_tok must be sent to the client, and released, whatever the
+ * result.  On failure an error message is displayed and the context
+ * is deleted.
+ */
+static int
+server_accept_token(gss_cred_id_t server_creds, gss_ctx_id_t *context,
+                    gss_buffer_t recv_tok, gss_buffer_t send_tok,
+                    gss_name_t *client, gss_OID *doid, OM_uint32 *ret_flags)
+{
+    OM_uint32 maj_stat, min_stat, acc_sec_min_stat;
+
+    if (verbose && logfile) {
+        fprintf(logfile, "Received token (size=%d): \n",
+                (int) recv_tok->length);
+        print_token(recv_tok);
+    }
+
+    maj_stat = gss_accept_sec_context(&acc_sec_min_stat, context,
+                                      server_creds, recv_tok,
+#ifdef MECH_EAP
+                                      GSS_C_NO_CHANNEL_BINDINGS,
+#else
+                                      &server_cb,
+#endif
+                                      client, doid, send_tok,
+                                      ret_flags,
+                                      NULL,  /* time_rec */
+                                      NULL); /* del_cred_handle */
+
+    if (recv_tok->value) {
+        free(recv_tok->value);
+        recv_tok->value = NULL;
+    }
+
+    if (send_tok->length != 0 && verbose && logfile) {
+        fprintf(logfile, "Sending accept_sec_context token (size=%d):\n",
+                (int) send_tok->length);
+        print_token(send_tok);
+    }
+
+    if (maj_stat != GSS_S_COMPLETE && maj_stat != GSS_S_CONTINUE_NEEDED) {
+        display_status("accepting context", maj_stat, acc_sec_min_stat);
+        if (*context != GSS_C_NO_CONTEXT)
+            gss_delete_sec_context(&min_stat, context, GSS_C_NO_BUFFER);
+        return -1;
+    }
+
+    if (verbose && logfile) {
+        if (maj_stat == GSS_S_CONTINUE_NEEDED)
+            fprintf(logfile, "continue needed...\n");
+        else
+            fprintf(logfile, "\n");
+        fflush(logfile);
+    }
+
+    return (maj_stat == GSS_S_CONTINUE_NEEDED);
+}
+
+/*
+ * Function: server_context_established
+ *
+ * Purpose: reports on a newly established context and returns the
+ * client's display name
+ *
+ * Arguments:
+ *
+ *      client          (r) the client's name; released on return
+ *      doid            (r) the mechanism used
+ *      ret_flags       (r) the context flags
+ *      client_name     (w) the client's ASCII name
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int
+server_context_established(gss_name_t client, gss_OID doid,
+                           OM_uint32 ret_flags, gss_buffer_t client_name)
+{
+    OM_uint32 maj_stat, min_stat;
+    gss_buffer_desc oid_name;
+
+    /* display the flags */
+    display_ctx_flags(ret_flags);
+
+    if (verbose && logfile) {
+        maj_stat = gss_oid_to_str(&min_stat, doid, &oid_name);
+        if (maj_stat != GSS_S_COMPLETE) {
+            display_status("converting oid->string", maj_stat, min_stat);
+            return -1;
+        }
+        fprintf(logfile, "Accepted connection using mechanism OID %.*s.\n",
+                (int) oid_name.length, (char *) oid_name.value);
+        (void) gss_release_buffer(&min_stat, &oid_name);
+    }
+
+    maj_stat = gss_display_name(&min_stat, client, client_name, &doid);
+    if (maj_stat != GSS_S_COMPLETE) {
+        display_status("displaying name", maj_stat, min_stat);
+        return -1;
+    }
+    enumerateAttributes(&min_stat, client, TRUE);
+    maj_stat = gss_release_name(&min_stat, &client);
+    if (maj_stat != GSS_S_COMPLETE) {
+        display_status("releasing name", maj_stat, min_stat);
+        return -1;
+    }
+
+    return 0;
+}
+
 /*
  * Function: server_establish_context
  *
@@ -177,14 +328,9 @@ server_establish_context(int s, gss_cred_id_t server_creds,
     gss_buffer_desc send_tok, recv_tok;
     gss_name_t client;
     gss_OID doid;
-    OM_uint32 maj_stat, min_stat, acc_sec_min_stat;
-    gss_buffer_desc oid_name;
+    OM_uint32 min_stat;
     int     token_flags;
-#ifndef MECH_EAP
-    struct gss_channel_bindings_struct cb = {GSS_C_AF_NULLADDR, {0, NULL},
-                                             GSS_C_AF_NULLADDR, {0, NULL},
-        {strlen("HLJHLJHLJHLJHJKLHLJHLJH"), "HLJHLJHLJHLJHJKLHLJHLJH"}};
-#endif
+    int     ret;
 
     if (recv_token(s, &token_flags, &recv_tok) < 0)
         return -1;
@@ -208,36 +354,10 @@ server_establish_context(int s, gss_cred_id_t server_creds,
             if (recv_token(s, &token_flags, &recv_tok) < 0)
                 return -1;
 
-            if (verbose && logfile) {
-                fprintf(logfile, "Received token (size=%d): \n",
-                        (int) recv_tok.length);
-                print_token(&recv_tok);
-            }
-
-            maj_stat = gss_accept_sec_context(&acc_sec_min_stat, context,
-                                              server_creds, &recv_tok,
-#ifdef MECH_EAP
-                                              GSS_C_NO_CHANNEL_BINDINGS,
-#else
-                                              &cb,
-#endif
-                                              &client, &doid, &send_tok,
-                                              ret_flags,
-                                              NULL,  /* time_rec */
-                                              NULL); /* del_cred_handle */
-
-            if (recv_tok.value) {
-                free(recv_tok.value);
-                recv_tok.value = NULL;
-            }
+            ret = server_accept_token(server_creds, context, &recv_tok,
+                                      &send_tok, &client, &doid, ret_flags);
 
             if (send_tok.length != 0) {
-                if (verbose && logfile) {
-                    fprintf(logfile,
-                            "Sending accept_sec_context token (size=%d):\n",
-                            (int) send_tok.length);
-                    print_token(&send_tok);
-                }
                 if (send_token(s, TOKEN_CONTEXT, &send_tok) < 0) {
                     if (logfile)
                         fprintf(logfile, "failure sending token\n");
@@ -246,50 +366,13 @@ server_establish_context(int s, gss_cred_id_t server_creds,
 
                 (void) gss_release_buffer(&min_stat, &send_tok);
             }
-            if (maj_stat != GSS_S_COMPLETE
-                && maj_stat != GSS_S_CONTINUE_NEEDED) {
-                display_status("accepting context", maj_stat,
-                               acc_sec_min_stat);
-                if (*context != GSS_C_NO_CONTEXT)
-                    gss_delete_sec_context(&min_stat, context,
-                                           GSS_C_NO_BUFFER);
-                return -1;
-            }
-
-            if (verbose && logfile) {
-                if (maj_stat == GSS_S_CONTINUE_NEEDED)
-                    fprintf(logfile, "continue needed...\n");
-                else
-                    fprintf(logfile, "\n");
-                fflush(logfile);
-            }
-        } while (maj_stat == GSS_S_CONTINUE_NEEDED);
-
-        /* display the flags */
-        display_ctx_flags(*ret_flags);
-
-        if (verbose && logfile) {
-            maj_stat = gss_oid_to_str(&min_stat, doid, &oid_name);
-            if (maj_stat != GSS_S_COMPLETE) {
-                display_status("converting oid->string", maj_stat, min_stat);
+            if (ret < 0)
                 return -1;
-            }
-            fprintf(logfile, "Accepted connection using mechanism OID %.*s.\n",
-                    (int) oid_name.length, (char *) oid_name.value);
-            (void) gss_release_buffer(&min_stat, &oid_name);
-        }
+        } while (ret > 0);
 
-        maj_stat = gss_display_name(&min_stat, client, client_name, &doid);
-        if (maj_stat != GSS_S_COMPLETE) {
-            display_status("displaying name", maj_stat, min_stat);
-            return -1;
-        }
-        enumerateAttributes(&min_stat, client, TRUE);
-        maj_stat = gss_release_name(&min_stat, &client);
-        if (maj_stat != GSS_S_COMPLETE) {
-            display_status("releasing name", maj_stat, min_stat);
+        if (server_context_established(client, doid, *ret_flags,
+                                       client_name) < 0)
             return -1;
-        }
     } else {
         client_name->length = *ret_flags = 0;
 
@@ -402,164 +485,175 @@ test_import_export_context(gss_ctx_id_t *context)
 }
 
 /*
- * Function: sign_server
+ * Function: server_process_message
  *
- * Purpose: Performs the "sign" service.
+ * Purpose: handles one message token of the "sign" service
  *
  * Arguments:
  *
- *      s               (r) a TCP socket on which a connection has been
- *                      accept()ed
- *      service_name    (r) the ASCII name of the GSS-API service to
- *                      establish a context as
- *      export          (r) whether to test context exporting
+ *      context         (r) the established context, or GSS_C_NO_CONTEXT
+ *      token_flags     (r) the flags the message token arrived with
+ *      xmit_buf        (r) the message token; its value is freed
+ *      reply_flags     (w) the flags to send the reply with
+ *      reply           (w) the reply token, to be released by the caller
  *
- * Returns: -1 on error
+ * Returns: 1 if the client ended the exchange, 0 if reply should be
+ * sent, -1 on error
  *
  * Effects:
  *
- * sign_server establishes a context, and performs a single sign request.
- *
- * A sign request is a single GSS-API sealed token.  The token is
- * unsealed and a signature block, produced with gss_sign, is returned
- * to the sender.  The context is the destroyed and the connection
- * closed.
- *
- * If any error occurs, -1 is returned.
+ * A wrapped token is unwrapped, the message is logged, and if the
+ * client asked for one a signature block produced with gss_get_mic is
+ * returned in reply; otherwise reply is empty and sent as a NOOP.
  */
 static int
-sign_server(int s, gss_cred_id_t server_creds, int export)
+server_process_message(gss_ctx_id_t context, int token_flags,
+                       gss_buffer_t xmit_buf, int *reply_flags,
+                       gss_buffer_t reply)
 {
-    gss_buffer_desc client_name, xmit_buf, msg_buf;
-    gss_ctx_id_t context;
+    gss_buffer_desc msg_buf;
     OM_uint32 maj_stat, min_stat;
-    int     i, conf_state;
-    OM_uint32 ret_flags;
+    int     conf_state;
     char   *cp;
-    int     token_flags;
-
-    /* Establish a context with the client */
-    if (server_establish_context(s, server_creds, &context,
-                                 &client_name, &ret_flags) < 0)
-        return (-1);
 
-    if (context == GSS_C_NO_CONTEXT) {
-        printf("Accepted unauthenticated connection.\n");
-    } else {
-        printf("Accepted connection: \"%.*s\"\n",
-               (int) client_name.length, (char *) client_name.value);
-        (void) gss_release_buffer(&min_stat, &client_name);
+    reply->length = 0;
+    reply->value = NULL;
 
-        if (export) {
-            for (i = 0; i < 3; i++)
-                if (test_import_export_context(&context))
-                    return -1;
+    if (token_flags & TOKEN_NOOP) {
+        if (logfile)
+            fprintf(logfile, "NOOP token\n");
+        if (xmit_buf->value) {
+            free(xmit_buf->value);
+            xmit_buf->value = 0;
         }
+        return 1;
     }
 
-    do {
-        /* Receive the message token */
-        if (recv_token(s, &token_flags, &xmit_buf) < 0)
-            return (-1);
-
-        if (token_flags & TOKEN_NOOP) {
-            if (logfile)
-                fprintf(logfile, "NOOP token\n");
-            if (xmit_buf.value) {
-                free(xmit_buf.value);
-                xmit_buf.value = 0;
-            }
-            break;
-        }
+    if (verbose && logfile) {
+        fprintf(logfile, "Message token (flags=%d):\n", token_flags);
+        print_token(xmit_buf);
+    }
 
-        if (verbose && logfile) {
-            fprintf(logfile, "Message token (flags=%d):\n", token_flags);
-            print_token(&xmit_buf);
+    if ((context == GSS_C_NO_CONTEXT) &&
+        (token_flags & (TOKEN_WRAPPED | TOKEN_ENCRYPTED | TOKEN_SEND_MIC)))
+    {
+        if (logfile)
+            fprintf(logfile,
+                    "Unauthenticated client requested authenticated services!\n");
+        if (xmit_buf->value) {
+            free(xmit_buf->value);
+            xmit_buf->value = 0;
         }
+        return (-1);
+    }
 
-        if ((context == GSS_C_NO_CONTEXT) &&
-            (token_flags & (TOKEN_WRAPPED | TOKEN_ENCRYPTED | TOKEN_SEND_MIC)))
-        {
-            if (logfile)
-                fprintf(logfile,
-                        "Unauthenticated client requested authenticated services!\n");
-            if (xmit_buf.value) {
-                free(xmit_buf.value);
-                xmit_buf.value = 0;
+    if (token_flags & TOKEN_WRAPPED) {
+        maj_stat = gss_unwrap(&min_stat, context, xmit_buf, &msg_buf,
+                              &conf_state, (gss_qop_t *) NULL);
+        if (maj_stat != GSS_S_COMPLETE) {
+            display_status("unsealing message", maj_stat, min_stat);
+            if (xmit_buf->value) {
+                free(xmit_buf->value);
+                xmit_buf->value = 0;
             }
             return (-1);
+        } else if (!conf_state && (token_flags & TOKEN_ENCRYPTED)) {
+            fprintf(stderr, "Warning!  Message not encrypted.\n");
         }
 
-        if (token_flags & TOKEN_WRAPPED) {
-            maj_stat = gss_unwrap(&min_stat, context, &xmit_buf, &msg_buf,
-                                  &conf_state, (gss_qop_t *) NULL);
-            if (maj_stat != GSS_S_COMPLETE) {
-                display_status("unsealing message", maj_stat, min_stat);
-                if (xmit_buf.value) {
-                    free(xmit_buf.value);
-                    xmit_buf.value = 0;
-                }
-                return (-1);
-            } else if (!conf_state && (token_flags & TOKEN_ENCRYPTED)) {
-                fprintf(stderr, "Warning!  Message not encrypted.\n");
-            }
+        if (xmit_buf->value) {
+            free(xmit_buf->value);
+            xmit_buf->value = 0;
+        }
+    } else {
+        msg_buf = *xmit_buf;
+        xmit_buf->value = 0;
+    }
 
-            if (xmit_buf.value) {
-                free(xmit_buf.value);
-                xmit_buf.value = 0;
-            }
+    if (logfile) {
+        fprintf(logfile, "Received message: ");
+        cp = msg_buf.value;
+        if ((isprint((int) cp[0]) || isspace((int) cp[0])) &&
+            (isprint((int) cp[1]) || isspace((int) cp[1]))) {
+            fprintf(logfile, "\"%.*s\"\n", (int) msg_buf.length,
+                    (char *) msg_buf.value);
         } else {
-            msg_buf = xmit_buf;
+            fprintf(logfile, "\n");
+            print_token(&msg_buf);
         }
+    }
 
-        if (logfile) {
-            fprintf(logfile, "Received message: ");
-            cp = msg_buf.value;
-            if ((isprint((int) cp[0]) || isspace((int) cp[0])) &&
-                (isprint((int) cp[1]) || isspace((int) cp[1]))) {
-                fprintf(logfile, "\"%.*s\"\n", (int) msg_buf.length,
-                        (char *) msg_buf.value);
-            } else {
-                fprintf(logfile, "\n");
-                print_token(&msg_buf);
-            }
+    if (token_flags & TOKEN_SEND_MIC) {
+        /* Produce a signature block for the message */
+        maj_stat = gss_get_mic(&min_stat, context, GSS_C_QOP_DEFAULT,
+                               &msg_buf, reply);
+        if (msg_buf.value) {
+            free(msg_buf.value);
+            msg_buf.value = 0;
+        }
+        if (maj_stat != GSS_S_COMPLETE) {
+            display_status("signing message", maj_stat, min_stat);
+            return (-1);
         }
 
-        if (token_flags & TOKEN_SEND_MIC) {
-            /* Produce a signature block for the message */
-            maj_stat = gss_get_mic(&min_stat, context, GSS_C_QOP_DEFAULT,
-                                   &msg_buf, &xmit_buf);
-            if (maj_stat != GSS_S_COMPLETE) {
-                display_status("signing message", maj_stat, min_stat);
-                return (-1);
-            }
+        *reply_flags = TOKEN_MIC;
+    } else {
+        if (msg_buf.value) {
+            free(msg_buf.value);
+            msg_buf.value = 0;
+        }
+        *reply_flags = TOKEN_NOOP;
+    }
 
-            if (msg_buf.value) {
-                free(msg_buf.value);
-                msg_buf.value = 0;
-            }
+    return 0;
+}
 
-            /* Send the signature block to the client */
-            if (send_token(s, TOKEN_MIC, &xmit_buf) < 0)
-                return (-1);
+/*
+ * Function: server_connection_established
+ *
+ * Purpose: announces a new connection and runs the export test
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int
+server_connection_established(gss_ctx_id_t *context,
+                              gss_buffer_t client_name, int export)
+{
+    OM_uint32 min_stat;
+    int     i;
 
-            if (xmit_buf.value) {
-                free(xmit_buf.value);
-                xmit_buf.value = 0;
-            }
-        } else {
-            if (msg_buf.value) {
-                free(msg_buf.value);
-                msg_buf.value = 0;
-            }
-            if (send_token(s, TOKEN_NOOP, empty_token) < 0)
-                return (-1);
+    if (*context == GSS_C_NO_CONTEXT) {
+        printf("Accepted unauthenticated connection.\n");
+    } else {
+        printf("Accepted connection: \"%.*s\"\n",
+               (int) client_name->length, (char *) client_name->value);
+        (void) gss_release_buffer(&min_stat, client_name);
+
+        if (export) {
+            for (i = 0; i < 3; i++)
+                if (test_import_export_context(context))
+                    return -1;
         }
-    } while (1 /* loop will break if NOOP received */ );
+    }
+
+    return 0;
+}
+
+/*
+ * Function: server_delete_context
+ *
+ * Purpose: deletes the context at the end of a connection
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int
+server_delete_context(gss_ctx_id_t *context)
+{
+    OM_uint32 maj_stat, min_stat;
 
-    if (context != GSS_C_NO_CONTEXT) {
+    if (*context != GSS_C_NO_CONTEXT) {
         /* Delete context */
-        maj_stat = gss_delete_sec_context(&min_stat, &context, NULL);
+        maj_stat = gss_delete_sec_context(&min_stat, context, NULL);
         if (maj_stat != GSS_S_COMPLETE) {
             display_status("deleting context", maj_stat, min_stat);
             return (-1);
@@ -572,6 +666,73 @@ sign_server(int s, gss_cred_id_t server_creds, int export)
     return (0);
 }
 
+/*
+ * Function: sign_server
+ *
+ * Purpose: Performs the "sign" service.
+ *
+ * Arguments:
+ *
+ *      s               (r) a TCP socket on which a connection has been
+ *                      accept()ed
+ *      service_name    (r) the ASCII name of the GSS-API service to
+ *                      establish a context as
+ *      export          (r) whether to test context exporting
+ *
+ * Returns: -1 on error
+ *
+ * Effects:
+ *
+ * sign_server establishes a context, and performs a single sign request.
+ *
+ * A sign request is a single GSS-API sealed token.  The token is
+ * unsealed and a signature block, produced with gss_sign, is returned
+ * to the sender.  The context is the destroyed and the connection
+ * closed.
+ *
+ * If any error occurs, -1 is returned.
+ */
+static int
+sign_server(int s, gss_cred_id_t server_creds, int export)
+{
+    gss_buffer_desc client_name, xmit_buf, reply;
+    gss_ctx_id_t context;
+    OM_uint32 min_stat;
+    OM_uint32 ret_flags;
+    int     token_flags, reply_flags;
+    int     ret;
+
+    /* Establish a context with the client */
+    if (server_establish_context(s, server_creds, &context,
+                                 &client_name, &ret_flags) < 0)
+        return (-1);
+
+    if (server_connection_established(&context, &client_name, export) < 0)
+        return (-1);
+
+    do {
+        /* Receive the message token */
+        if (recv_token(s, &token_flags, &xmit_buf) < 0)
+            return (-1);
+
+        ret = server_process_message(context, token_flags, &xmit_buf,
+                                     &reply_flags, &reply);
+        if (ret < 0)
+            return (-1);
+        else if (ret > 0)
+            break;
+
+        /* Send the signature block, or a NOOP, to the client */
+        ret = send_token(s, reply_flags,
+                         reply.length != 0 ? &reply : empty_token);
+        (void) gss_release_buffer(&min_stat, &reply);
+        if (ret < 0)
+            return (-1);
+    } while (1 /* loop will break if NOOP received */ );
+
+    return server_delete_context(&context);
+}
+
 static int max_threads = 1;
 
 #ifdef _WIN32
@@ -661,6 +822,541 @@ worker_bee(void *param)
 #endif
 }
 
+#ifdef USE_EPOLL
+/*
+ * Event driven server for -threads N on Linux.  All connections share
+ * one epoll set, registered EPOLLONESHOT so that a ready connection is
+ * picked up by exactly one of the N workers, which runs its state
+ * machine as far as it can without blocking on the socket and then
+ * rearms it.  Writing to the wake pipe (from SIGINT/SIGTERM, or after
+ * the only connection with -once) stops every worker.
+ */
+enum conn_state {
+    CONN_EXPECT_NOOP,           /* waiting for the client's first NOOP */
+    CONN_ACCEPTING,             /* gss_accept_sec_context loop */
+    CONN_MESSAGES,              /* sign exchange */
+    CONN_CLOSING                /* flush output, then close */
+};
+
+struct server_conn {
+    int     s;
+    enum conn_state state;
+    gss_ctx_id_t context;
+    int     token_flags;
+    unsigned char hdr[5];
+    size_t  hdr_len;            /* bytes of hdr read */
+    gss_buffer_desc in;         /* token body being read */
+    size_t  in_len;             /* bytes of in read */
+    unsigned char *out;         /* queued replies */
+    size_t  out_len, out_off;
+    struct server_conn *prev, *next;
+};
+
+struct epoll_server {
+    int     epfd;
+    int     listen_s;
+    int     wake[2];
+    gss_cred_id_t server_creds;
+    int     export;
+    int     once;
+    pthread_mutex_t lock;       /* protects conns */
+    struct server_conn *conns;
+};
+
+static int epoll_wake_fd = -1;
+
+static void
+epoll_stop(int sig)
+{
+    char c = 0;
+
+    (void) sig;
+    if (write(epoll_wake_fd, &c, 1) < 0)
+        return;
+}
+
+/*
+ * Read the next token off the connection without blocking.  Returns 1
+ * when conn->in and conn->token_flags hold a complete token, 0 if more
+ * data is needed, and -1 on EOF or error.  Only the bytes of the current
+ * token are read, so a following token stays in the socket buffer.
+ */
+static int
+conn_read_token(struct server_conn *conn)
+{
+    size_t need;
+    ssize_t n;
+
+    for (;;) {
+        need = (conn->hdr_len > 0 && conn->hdr[0] == 0) ? 4 : 5;
+        if (conn->hdr_len < need) {
+            n = recv(conn->s, conn->hdr + conn->hdr_len,
+                     need - conn->hdr_len, 0);
+        } else if (conn->in.value == NULL) {
+            unsigned char *len = conn->hdr + (need - 4);
+
+            conn->token_flags = conn->hdr[0];
+            conn->in.length = ((size_t) len[0] << 24) | (len[1] << 16) |
+                              (len[2] << 8) | len[3];
+            conn->in.value = malloc(conn->in.length ? conn->in.length : 1);
+            if (conn->in.value == NULL) {
+                if (display_file)
+                    fprintf(display_file,
+                            "Out of memory allocating token data\n");
+                return -1;
+            }
+            conn->in_len = 0;
+            continue;
+        } else if (conn->in_len < conn->in.length) {
+            n = recv(conn->s, (char *) conn->in.value + conn->in_len,
+                     conn->in.length - conn->in_len, 0);
+        } else {
+            conn->hdr_len = 0;
+            return 1;
+        }
+
+        if (n == 0)
+            return -1;
+        else if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            perror("reading token");
+            return -1;
+        }
+
+        if (conn->hdr_len < need)
+            conn->hdr_len += n;
+        else
+            conn->in_len += n;
+    }
+}
+
+/* Append a token, framed as send_token would, to the output queue */
+static int
+conn_queue_token(struct server_conn *conn, int flags, gss_buffer_t tok)
+{
+    unsigned char *p;
+
+    if (tok->length > 0xffffffffUL)
+        abort();
+
+    p = realloc(conn->out, conn->out_len + 5 + tok->length);
+    if (p == NULL)
+        return -1;
+    conn->out = p;
+    p += conn->out_len;
+
+    *p++ = (unsigned char) flags;
+    *p++ = (tok->length >> 24) & 0xff;
+    *p++ = (tok->length >> 16) & 0xff;
+    *p++ = (tok->length >> 8) & 0xff;
+    *p++ = tok->length & 0xff;
+    if (tok->length != 0)
+        memcpy(p, tok->value, tok->length);
+    conn->out_len += 5 + tok->length;
+
+    return 0;
+}
+
+/*
+ * Write as much queued output as the socket takes.  Returns 1 if output
+ * is still pending, 0 once the queue is empty, -1 on error.
+ */
+static int
+conn_flush(struct server_conn *conn)
+{
+    ssize_t n;
+
+    while (conn->out_off < conn->out_len) {
+        n = send(conn->s, conn->out + conn->out_off,
+                 conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            perror("sending token");
+            return -1;
+        }
+        conn->out_off += n;
+    }
+
+    conn->out_off = conn->out_len = 0;
+
+    return 0;
+}
+
+static void
+conn_free(struct server_conn *conn)
+{
+    OM_uint32 min_stat;
+
+    if (conn->context != GSS_C_NO_CONTEXT)
+        gss_delete_sec_context(&min_stat, &conn->context, GSS_C_NO_BUFFER);
+    close(conn->s);
+    free(conn->in.value);
+    free(conn->out);
+    free(conn);
+}
+
+static void
+conn_close(struct epoll_server *server, struct server_conn *conn)
+{
+    char    c = 0;
+
+    pthread_mutex_lock(&server->lock);
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        server->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&server->lock);
+
+    (void) epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->s, NULL);
+    conn_free(conn);
+
+    if (server->once && write(server->wake[1], &c, 1) < 0)
+        perror("waking workers");
+}
+
+/*
+ * Advance the connection's state machine by one token, which has been
+ * read into conn->in.  Returns -1 if the connection should be dropped
+ * without flushing its output.
+ */
+static int
+conn_process_token(struct epoll_server *server, struct server_conn *conn)
+{
+    gss_buffer_desc send_tok, client_name;
+    gss_name_t client;
+    gss_OID doid;
+    OM_uint32 min_stat, ret_flags;
+    int     reply_flags;
+    int     ret = 0;
+
+    switch (conn->state) {
+    case CONN_EXPECT_NOOP:
+        free(conn->in.value);
+        conn->in.value = NULL;
+        if (!(conn->token_flags & TOKEN_NOOP)) {
+            if (logfile)
+                fprintf(logfile, "Expected NOOP token, got %d token instead\n",
+                        conn->token_flags);
+            return -1;
+        }
+        if (conn->token_flags & TOKEN_CONTEXT_NEXT) {
+            conn->state = CONN_ACCEPTING;
+            break;
+        }
+        if (logfile)
+            fprintf(logfile, "Accepted unauthenticated connection.\n");
+        client_name.length = 0;
+        if (server_connection_established(&conn->context, &client_name,
+                                          server->export) < 0)
+            return -1;
+        conn->state = CONN_MESSAGES;
+        break;
+    case CONN_ACCEPTING:
+        ret = server_accept_token(server->server_creds, &conn->context,
+                                  &conn->in, &send_tok, &client, &doid,
+                                  &ret_flags);
+        if (send_tok.length != 0) {
+            if (conn_queue_token(conn, TOKEN_CONTEXT, &send_tok) < 0)
+                ret = -1;
+            (void) gss_release_buffer(&min_stat, &send_tok);
+        }
+        if (ret < 0) {
+            conn->state = CONN_CLOSING;
+        } else if (ret == 0) {
+            if (server_context_established(client, doid, ret_flags,
+                                           &client_name) < 0 ||
+                server_connection_established(&conn->context, &client_name,
+                                              server->export) < 0)
+                return -1;
+            conn->state = CONN_MESSAGES;
+        }
+        break;
+    case CONN_MESSAGES:
+        ret = server_process_message(conn->context, conn->token_flags,
+                                     &conn->in, &reply_flags, &send_tok);
+        if (ret < 0)
+            return -1;
+        else if (ret > 0) {
+            (void) server_delete_context(&conn->context);
+            conn->state = CONN_CLOSING;
+            break;
+        }
+        ret = conn_queue_token(conn, reply_flags, &send_tok);
+        (void) gss_release_buffer(&min_stat, &send_tok);
+        if (ret < 0)
+            return -1;
+        break;
+    case CONN_CLOSING:
+        /* the client should not send anything more */
+        return -1;
+    }
+
+    conn->in.value = NULL;
+    conn->in.length = 0;
+
+    return 0;
+}
+
+/*
+ * Run one connection for as long as it can make progress without
+ * blocking, then rearm it.  Returns 1 if the connection was closed.
+ */
+static int
+conn_service(struct epoll_server *server, struct server_conn *conn,
+             uint32_t events)
+{
+    struct epoll_event ev;
+    int     pending;
+
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN))
+        goto close;
+
+    pending = conn_flush(conn);
+    while (pending == 0 && conn->state != CONN_CLOSING) {
+        int     ret = conn_read_token(conn);
+
+        if (ret < 0)
+            goto close;
+        else if (ret == 0)
+            break;
+
+        if (conn_process_token(server, conn) < 0)
+            goto close;
+
+        pending = conn_flush(conn);
+    }
+
+    if (pending < 0 || (pending == 0 && conn->state == CONN_CLOSING))
+        goto close;
+
+    /* conn may be picked up by another worker as soon as it is rearmed */
+    ev.events = (pending ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->s, &ev) < 0) {
+        perror("rearming connection");
+        goto close;
+    }
+
+    return 0;
+
+close:
+    conn_close(server, conn);
+    return 1;
+}
+
+static void
+epoll_accept(struct epoll_server *server)
+{
+    struct epoll_event ev;
+    struct server_conn *conn;
+    int     s;
+
+    for (;;) {
+        s = accept4(server->listen_s, NULL, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (s < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accepting connection");
+            break;
+        }
+
+        conn = calloc(1, sizeof(*conn));
+        if (conn == NULL) {
+            fprintf(stderr, "out of memory accepting connection\n");
+            close(s);
+            continue;
+        }
+        conn->s = s;
+        conn->state = CONN_EXPECT_NOOP;
+        conn->context = GSS_C_NO_CONTEXT;
+
+        pthread_mutex_lock(&server->lock);
+        conn->next = server->conns;
+        if (conn->next != NULL)
+            conn->next->prev = conn;
+        server->conns = conn;
+        pthread_mutex_unlock(&server->lock);
+
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, s, &ev) < 0) {
+            perror("registering connection");
+            conn_close(server, conn);
+            continue;
+        }
+
+        if (server->once)
+            return;             /* leave the listener disarmed */
+    }
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = &server->listen_s;
+    if (epoll_ctl(server->epfd, EPOLL_CTL_MOD, server->listen_s, &ev) < 0)
+        perror("rearming listener");
+}
+
+static void *
+epoll_worker(void *param)
+{
+    struct epoll_server *server = (struct epoll_server *) param;
+    struct epoll_event ev;
+    unsigned long served = 0;
+    int     n;
+
+    for (;;) {
+        n = epoll_wait(server->epfd, &ev, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("waiting for events");
+            break;
+        } else if (n == 0)
+            continue;
+
+        if (ev.data.ptr == server->wake)
+            break;              /* never drained, so every worker sees it */
+        else if (ev.data.ptr == &server->listen_s)
+            epoll_accept(server);
+        else
+            served += conn_service(server, ev.data.ptr, ev.events);
+    }
+
+    return (void *) served;
+}
+
+static int
+epoll_add(struct epoll_server *server, int fd, uint32_t events, void *ptr)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ptr;
+
+    return epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Function: epoll_server
+ *
+ * Purpose: serves connections on a listening socket with a pool of
+ * worker threads until interrupted
+ *
+ * Arguments:
+ *
+ *      stmp            (r) the listening socket
+ *      server_creds    (r) server credentials, from gss_acquire_cred
+ *      export          (r) whether to test context exporting
+ *      once            (r) whether to stop after a single connection
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ * Effects:
+ *
+ * On SIGINT or SIGTERM the workers are stopped and joined, and any
+ * connections still open have their contexts deleted and are closed.
+ */
+static int
+epoll_server(int stmp, gss_cred_id_t server_creds, int export, int once)
+{
+    struct epoll_server server;
+    struct server_conn *conn;
+    struct sigaction sa;
+    pthread_t *threads;
+    void   *served;
+    int     i, nthreads = 0;
+    int     ret = -1;
+
+    memset(&server, 0, sizeof(server));
+    server.listen_s = stmp;
+    server.server_creds = server_creds;
+    server.export = export;
+    server.once = once;
+    server.epfd = -1;
+    server.wake[0] = server.wake[1] = -1;
+    pthread_mutex_init(&server.lock, NULL);
+
+    threads = calloc(max_threads, sizeof(pthread_t));
+    if (threads == NULL) {
+        fprintf(stderr, "fatal error: out of memory");
+        goto cleanup;
+    }
+
+    if (pipe2(server.wake, O_CLOEXEC) < 0) {
+        perror("creating wake pipe");
+        goto cleanup;
+    }
+
+    server.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.epfd < 0) {
+        perror("creating epoll set");
+        goto cleanup;
+    }
+
+    if (fcntl(stmp, F_SETFL, fcntl(stmp, F_GETFL) | O_NONBLOCK) < 0 ||
+        epoll_add(&server, stmp, EPOLLIN | EPOLLONESHOT,
+                  &server.listen_s) < 0 ||
+        epoll_add(&server, server.wake[0], EPOLLIN, server.wake) < 0) {
+        perror("registering listener");
+        goto cleanup;
+    }
+
+    epoll_wake_fd = server.wake[1];
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = epoll_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (nthreads = 0; nthreads < max_threads; nthreads++) {
+        if (pthread_create(&threads[nthreads], NULL,
+                           epoll_worker, &server) != 0) {
+            perror("creating worker thread");
+            epoll_stop(0);
+            break;
+        }
+    }
+
+    ret = 0;
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], &served);
+        if (logfile)
+            fprintf(logfile, "worker %d: %lu connections\n",
+                    i, (unsigned long) served);
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    epoll_wake_fd = -1;
+
+cleanup:
+    while ((conn = server.conns) != NULL) {
+        server.conns = conn->next;
+        conn_free(conn);
+    }
+    if (server.epfd >= 0)
+        close(server.epfd);
+    if (server.wake[0] >= 0) {
+        close(server.wake[0]);
+        close(server.wake[1]);
+    }
+    pthread_mutex_destroy(&server.lock);
+    free(threads);
+
+    return ret;
+}
+#endif /* USE_EPOLL */
+
 int
 main(int argc, char **argv)
 {
@@ -684,7 +1380,7 @@ main(int argc, char **argv)
                 usage();
             port = atoi(*argv);
         }
-#ifdef _WIN32
+#if defined(_WIN32) || defined(USE_EPOLL)
         else if (strcmp(*argv, "-threads") == 0) {
             argc--;
             argv++;
@@ -740,7 +1436,7 @@ main(int argc, char **argv)
     if ((*argv)[0] == '-')
         usage();
 
-#ifdef _WIN32
+#if defined(_WIN32) || defined(USE_EPOLL)
     if (max_threads < 1) {
         fprintf(stderr, "warning: there must be at least one thread\n");
         max_threads = 1;
@@ -749,7 +1445,8 @@ main(int argc, char **argv)
     if (max_threads > 1 && do_inetd)
         fprintf(stderr,
                 "warning: one thread may be used in conjunction with inetd\n");
-
+#endif
+#ifdef _WIN32
     InitHandles();
 #endif
 
@@ -768,6 +1465,16 @@ main(int argc, char **argv)
         int     stmp;
 
         if ((stmp = create_socket(port)) >= 0) {
+#ifdef USE_EPOLL
+            if (max_threads > 1) {
+                if (listen(stmp, SOMAXCONN) < 0)
+                    perror("listening on socket");
+                fprintf(stderr, "starting %d workers...\n", max_threads);
+                epoll_server(stmp, server_creds, export, once);
+                close(stmp);
+                goto done;
+            }
+#endif
             if (listen(stmp, max_threads == 1 ? 0 : max_threads) < 0)
                 perror("listening on socket");
             fprintf(stderr, "starting...\n");
@@ -820,6 +1527,9 @@ main(int argc, char **argv)
         }
     }
 
+#ifdef USE_EPOLL
+done:
+#endif
     (void) gss_release_cred(&min_stat, &server_creds);
 
 #ifdef _WIN32
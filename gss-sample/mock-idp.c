@@ -0,0 +1,931 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * A stand-in for an ECP identity provider, for running handshakes
+ * without a network or a real IdP. It answers every SOAP POST with a
+ * successful SAML response for whoever authenticated with HTTP Basic
+ * auth, carrying a samlec:GeneratedKey in both the ECP header and the
+ * assertion's Advice, as SAML EC expects.
+ *
+ * The assertion is signed (enveloped, exclusive c14n, rsa-sha256) with
+ * the key in keydir/idp-signing.key, and with -encrypt it is encrypted
+ * to the certificate in the SP metadata (aes128-cbc, rsa-oaep-mgf1p).
+ * TLS uses keydir/idp-tls.crt and keydir/idp-tls.key.
+ *
+ * None of this is meant to be secure: the password check is a string
+ * compare, the request signature is not checked and every request from
+ * the SP in -sp-metadata is answered.
+ *
+ *      mock-idp [-port port] [-user name -pass password] [-entity id]
+ *               [-sp-metadata file] [-encrypt] [-lifetime secs] [-v] keydir
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/c14n.h>
+
+#define SAML2_NS        "urn:oasis:names:tc:SAML:2.0:assertion"
+#define SAML2P_NS       "urn:oasis:names:tc:SAML:2.0:protocol"
+#define SOAP11_NS       "http://schemas.xmlsoap.org/soap/envelope/"
+#define ECP_NS          "urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp"
+#define SAMLEC_NS       "urn:ietf:params:xml:ns:samlec"
+#define DS_NS           "http://www.w3.org/2000/09/xmldsig#"
+#define XENC_NS         "http://www.w3.org/2001/04/xmlenc#"
+#define MD_NS           "urn:oasis:names:tc:SAML:2.0:metadata"
+
+#define SOAP_ACTOR      "http://schemas.xmlsoap.org/soap/actor/next"
+
+#define MAX_HEADER      16384
+#define MAX_BODY        (1024 * 1024)
+
+static struct {
+    SSL_CTX     *ssl;
+    EVP_PKEY    *signKey;
+    char        *signCert;      /* base64 DER, for ds:KeyInfo */
+    const char  *entity;
+    char        *spEntity;      /* from -sp-metadata */
+    EVP_PKEY    *spKey;         /* SP encryption key, for -encrypt */
+    const char  *user;
+    const char  *pass;
+    int         encrypt;
+    long        lifetime;
+    int         verbose;
+} idp;
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: mock-idp [-port port] [-user name -pass password] "
+            "[-entity id]\n"
+            "                [-sp-metadata file] [-encrypt] [-lifetime secs] "
+            "[-v] keydir\n");
+    exit(1);
+}
+
+/*
+ * A growable string, for assembling XML and HTTP messages.
+ */
+struct strbuf {
+    char    *s;
+    size_t  len;
+    size_t  cap;
+};
+
+static int
+sb_printf(struct strbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int     n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(sb->s ? sb->s + sb->len : NULL,
+                      sb->s ? sb->cap - sb->len : 0, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return -1;
+        if (sb->s != NULL && sb->len + n < sb->cap)
+            break;
+
+        size_t  cap = sb->cap ? sb->cap : 1024;
+        char   *s;
+
+        while (cap <= sb->len + n)
+            cap *= 2;
+        if ((s = realloc(sb->s, cap)) == NULL)
+            return -1;
+        sb->s = s;
+        sb->cap = cap;
+    }
+    sb->len += n;
+    return 0;
+}
+
+static char *
+b64_encode(const unsigned char *data, size_t len)
+{
+    char   *out = malloc(4 * ((len + 2) / 3) + 1);
+
+    if (out != NULL)
+        EVP_EncodeBlock((unsigned char *) out, data, (int) len);
+    return out;
+}
+
+static char *
+xml_escape(const char *in)
+{
+    struct strbuf sb = { NULL, 0, 0 };
+
+    if (sb_printf(&sb, "%s", "") < 0)
+        return NULL;
+    for (; *in; in++) {
+        switch (*in) {
+        case '&':  sb_printf(&sb, "&amp;");  break;
+        case '<':  sb_printf(&sb, "&lt;");   break;
+        case '>':  sb_printf(&sb, "&gt;");   break;
+        case '"':  sb_printf(&sb, "&quot;"); break;
+        default:   sb_printf(&sb, "%c", *in); break;
+        }
+    }
+    return sb.s;
+}
+
+static void
+iso_time(time_t t, char *buf, size_t len)
+{
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+/* SAML IDs must be NCNames, so start with an underscore */
+static void
+new_id(char *buf)
+{
+    unsigned char r[16];
+    int     i;
+
+    RAND_bytes(r, sizeof(r));
+    buf[0] = '_';
+    for (i = 0; i < 16; i++)
+        sprintf(buf + 1 + 2 * i, "%02x", r[i]);
+}
+
+/*
+ * Exclusive canonical form of a standalone XML fragment. The assertion
+ * and SignedInfo each declare every namespace they use, so this is the
+ * same as their canonical form in place within the response.
+ */
+static int
+c14n_exclusive(const char *xml, xmlChar **out)
+{
+    xmlDocPtr doc;
+    int     len;
+
+    doc = xmlReadMemory(xml, strlen(xml), "c14n", NULL, XML_PARSE_NONET);
+    if (doc == NULL)
+        return -1;
+    len = xmlC14NDocDumpMemory(doc, NULL, XML_C14N_EXCLUSIVE_1_0, NULL, 0, out);
+    xmlFreeDoc(doc);
+    return len;
+}
+
+static char *
+sign_assertion(const char *id, const char *head, const char *tail)
+{
+    struct strbuf unsigned_ = { NULL, 0, 0 }, signedInfo = { NULL, 0, 0 };
+    struct strbuf out = { NULL, 0, 0 };
+    unsigned char digest[EVP_MAX_MD_SIZE], *sig = NULL;
+    unsigned int dlen;
+    size_t  slen = 0;
+    xmlChar *canon = NULL;
+    char   *digest64 = NULL, *sig64 = NULL;
+    EVP_MD_CTX *md = NULL;
+    int     len;
+
+    /* Enveloped signature: the digest covers the unsigned assertion */
+    if (sb_printf(&unsigned_, "%s%s", head, tail) < 0 ||
+        (len = c14n_exclusive(unsigned_.s, &canon)) < 0 ||
+        !EVP_Digest(canon, len, digest, &dlen, EVP_sha256(), NULL) ||
+        (digest64 = b64_encode(digest, dlen)) == NULL)
+        goto cleanup;
+    xmlFree(canon);
+    canon = NULL;
+
+    if (sb_printf(&signedInfo,
+            "<ds:SignedInfo xmlns:ds=\"" DS_NS "\">"
+            "<ds:CanonicalizationMethod Algorithm=\"http://www.w3.org/2001/10/xml-exc-c14n#\"/>"
+            "<ds:SignatureMethod Algorithm=\"http://www.w3.org/2001/04/xmldsig-more#rsa-sha256\"/>"
+            "<ds:Reference URI=\"#%s\"><ds:Transforms>"
+            "<ds:Transform Algorithm=\"http://www.w3.org/2000/09/xmldsig#enveloped-signature\"/>"
+            "<ds:Transform Algorithm=\"http://www.w3.org/2001/10/xml-exc-c14n#\"/>"
+            "</ds:Transforms>"
+            "<ds:DigestMethod Algorithm=\"http://www.w3.org/2001/04/xmlenc#sha256\"/>"
+            "<ds:DigestValue>%s</ds:DigestValue></ds:Reference></ds:SignedInfo>",
+            id, digest64) < 0 ||
+        (len = c14n_exclusive(signedInfo.s, &canon)) < 0)
+        goto cleanup;
+
+    if ((md = EVP_MD_CTX_new()) == NULL ||
+        EVP_DigestSignInit(md, NULL, EVP_sha256(), NULL, idp.signKey) != 1 ||
+        EVP_DigestSignUpdate(md, canon, len) != 1 ||
+        EVP_DigestSignFinal(md, NULL, &slen) != 1 ||
+        (sig = malloc(slen)) == NULL ||
+        EVP_DigestSignFinal(md, sig, &slen) != 1 ||
+        (sig64 = b64_encode(sig, slen)) == NULL)
+        goto cleanup;
+
+    if (sb_printf(&out, "%s<ds:Signature xmlns:ds=\"" DS_NS "\">%s"
+                  "<ds:SignatureValue>%s</ds:SignatureValue>"
+                  "<ds:KeyInfo><ds:X509Data><ds:X509Certificate>%s"
+                  "</ds:X509Certificate></ds:X509Data></ds:KeyInfo>"
+                  "</ds:Signature>%s",
+                  head, signedInfo.s, sig64, idp.signCert, tail) < 0) {
+        free(out.s);
+        out.s = NULL;
+    }
+
+cleanup:
+    EVP_MD_CTX_free(md);
+    xmlFree(canon);
+    free(unsigned_.s);
+    free(signedInfo.s);
+    free(digest64);
+    free(sig);
+    free(sig64);
+    return out.s;
+}
+
+/*
+ * Wrap a signed assertion in saml:EncryptedAssertion. The content key
+ * is prefixed with the IV and padded as XML Encryption expects, which
+ * PKCS#7 padding satisfies.
+ */
+static char *
+encrypt_assertion(const char *assertion)
+{
+    struct strbuf out = { NULL, 0, 0 };
+    unsigned char key[16], *data = NULL, *ekey = NULL;
+    size_t  alen = strlen(assertion), eklen = 0;
+    char   *data64 = NULL, *ekey64 = NULL;
+    EVP_CIPHER_CTX *cipher = NULL;
+    EVP_PKEY_CTX *pctx = NULL;
+    int     n, total;
+
+    if ((data = malloc(16 + alen + 16)) == NULL ||
+        RAND_bytes(key, sizeof(key)) != 1 ||
+        RAND_bytes(data, 16) != 1 ||
+        (cipher = EVP_CIPHER_CTX_new()) == NULL ||
+        EVP_EncryptInit_ex(cipher, EVP_aes_128_cbc(), NULL, key, data) != 1 ||
+        EVP_EncryptUpdate(cipher, data + 16, &n,
+                          (const unsigned char *) assertion, (int) alen) != 1)
+        goto cleanup;
+    total = 16 + n;
+    if (EVP_EncryptFinal_ex(cipher, data + total, &n) != 1 ||
+        (data64 = b64_encode(data, total + n)) == NULL)
+        goto cleanup;
+
+    if ((pctx = EVP_PKEY_CTX_new(idp.spKey, NULL)) == NULL ||
+        EVP_PKEY_encrypt_init(pctx) != 1 ||
+        EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_OAEP_PADDING) != 1 ||
+        EVP_PKEY_encrypt(pctx, NULL, &eklen, key, sizeof(key)) != 1 ||
+        (ekey = malloc(eklen)) == NULL ||
+        EVP_PKEY_encrypt(pctx, ekey, &eklen, key, sizeof(key)) != 1 ||
+        (ekey64 = b64_encode(ekey, eklen)) == NULL)
+        goto cleanup;
+
+    if (sb_printf(&out,
+            "<saml:EncryptedAssertion xmlns:saml=\"" SAML2_NS "\">"
+            "<xenc:EncryptedData xmlns:xenc=\"" XENC_NS "\" "
+            "Type=\"" XENC_NS "Element\">"
+            "<xenc:EncryptionMethod Algorithm=\"" XENC_NS "aes128-cbc\"/>"
+            "<ds:KeyInfo xmlns:ds=\"" DS_NS "\"><xenc:EncryptedKey>"
+            "<xenc:EncryptionMethod Algorithm=\"" XENC_NS "rsa-oaep-mgf1p\">"
+            "<ds:DigestMethod Algorithm=\"" DS_NS "sha1\"/>"
+            "</xenc:EncryptionMethod>"
+            "<xenc:CipherData><xenc:CipherValue>%s</xenc:CipherValue>"
+            "</xenc:CipherData></xenc:EncryptedKey></ds:KeyInfo>"
+            "<xenc:CipherData><xenc:CipherValue>%s</xenc:CipherValue>"
+            "</xenc:CipherData></xenc:EncryptedData>"
+            "</saml:EncryptedAssertion>", ekey64, data64) < 0) {
+        free(out.s);
+        out.s = NULL;
+    }
+
+cleanup:
+    OPENSSL_cleanse(key, sizeof(key));
+    EVP_CIPHER_CTX_free(cipher);
+    EVP_PKEY_CTX_free(pctx);
+    free(data);
+    free(data64);
+    free(ekey);
+    free(ekey64);
+    return out.s;
+}
+
+static xmlNodePtr
+find_element(xmlNodePtr node, const char *name, const char *ns)
+{
+    xmlNodePtr found;
+
+    for (; node != NULL; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+        if (node->ns != NULL && strcmp((char *) node->name, name) == 0 &&
+            strcmp((char *) node->ns->href, ns) == 0)
+            return node;
+        if ((found = find_element(node->children, name, ns)) != NULL)
+            return found;
+    }
+    return NULL;
+}
+
+/*
+ * Build the ECP response to an AuthnRequest: a SOAP envelope whose
+ * header carries ecp:Response and samlec:GeneratedKey and whose body is
+ * a samlp:Response holding one signed, and perhaps encrypted, assertion.
+ */
+static char *
+make_response(const char *requestId, const char *acs, const char *user)
+{
+    struct strbuf head = { NULL, 0, 0 }, tail = { NULL, 0, 0 };
+    struct strbuf out = { NULL, 0, 0 };
+    char    responseId[34], assertionId[34], nameId[34], sessionIndex[34];
+    char    now[32], soon[32], sessionEnd[32];
+    unsigned char key[16];
+    char   *key64 = NULL, *assertion = NULL, *encrypted = NULL;
+    char   *eId = NULL, *eAcs = NULL, *eUser = NULL, *eEntity = NULL;
+    char   *eSp = NULL;
+    time_t  t = time(NULL);
+
+    new_id(responseId);
+    new_id(assertionId);
+    new_id(nameId);
+    new_id(sessionIndex);
+    iso_time(t, now, sizeof(now));
+    iso_time(t + 300, soon, sizeof(soon));
+    iso_time(t + idp.lifetime, sessionEnd, sizeof(sessionEnd));
+
+    if (RAND_bytes(key, sizeof(key)) != 1 ||
+        (key64 = b64_encode(key, sizeof(key))) == NULL ||
+        (eId = xml_escape(requestId)) == NULL ||
+        (eAcs = xml_escape(acs)) == NULL ||
+        (eUser = xml_escape(user)) == NULL ||
+        (eEntity = xml_escape(idp.entity)) == NULL ||
+        (eSp = xml_escape(idp.spEntity ? idp.spEntity : "")) == NULL)
+        goto cleanup;
+
+    if (sb_printf(&head,
+            "<saml:Assertion xmlns:saml=\"" SAML2_NS "\" ID=\"%s\" "
+            "IssueInstant=\"%s\" Version=\"2.0\">"
+            "<saml:Issuer>%s</saml:Issuer>",
+            assertionId, now, eEntity) < 0 ||
+        sb_printf(&tail,
+            "<saml:Subject><saml:NameID "
+            "Format=\"urn:oasis:names:tc:SAML:2.0:nameid-format:transient\" "
+            "NameQualifier=\"%s\" SPNameQualifier=\"%s\">%s</saml:NameID>"
+            "<saml:SubjectConfirmation Method=\"urn:oasis:names:tc:SAML:2.0:cm:bearer\">"
+            "<saml:SubjectConfirmationData InResponseTo=\"%s\" "
+            "NotOnOrAfter=\"%s\" Recipient=\"%s\"/>"
+            "</saml:SubjectConfirmation></saml:Subject>"
+            "<saml:Conditions NotBefore=\"%s\" NotOnOrAfter=\"%s\">"
+            "<saml:AudienceRestriction><saml:Audience>%s</saml:Audience>"
+            "</saml:AudienceRestriction></saml:Conditions>"
+            "<saml:Advice><samlec:GeneratedKey xmlns:samlec=\"" SAMLEC_NS "\">"
+            "%s</samlec:GeneratedKey></saml:Advice>"
+            "<saml:AuthnStatement AuthnInstant=\"%s\" SessionIndex=\"%s\" "
+            "SessionNotOnOrAfter=\"%s\"><saml:AuthnContext>"
+            "<saml:AuthnContextClassRef>"
+            "urn:oasis:names:tc:SAML:2.0:ac:classes:PasswordProtectedTransport"
+            "</saml:AuthnContextClassRef></saml:AuthnContext>"
+            "</saml:AuthnStatement>"
+            "<saml:AttributeStatement><saml:Attribute FriendlyName=\"uid\" "
+            "Name=\"urn:oid:0.9.2342.19200300.100.1.1\" "
+            "NameFormat=\"urn:oasis:names:tc:SAML:2.0:attrname-format:uri\">"
+            "<saml:AttributeValue>%s</saml:AttributeValue></saml:Attribute>"
+            "</saml:AttributeStatement></saml:Assertion>",
+            eEntity, eSp, nameId, eId, soon, eAcs, now, soon, eSp, key64,
+            now, sessionIndex, sessionEnd, eUser) < 0)
+        goto cleanup;
+
+    if ((assertion = sign_assertion(assertionId, head.s, tail.s)) == NULL ||
+        (idp.encrypt && (encrypted = encrypt_assertion(assertion)) == NULL))
+        goto cleanup;
+
+    if (sb_printf(&out,
+            "<S:Envelope xmlns:S=\"" SOAP11_NS "\"><S:Header>"
+            "<ecp:Response xmlns:ecp=\"" ECP_NS "\" S:mustUnderstand=\"1\" "
+            "S:actor=\"" SOAP_ACTOR "\" AssertionConsumerServiceURL=\"%s\"/>"
+            "<samlec:GeneratedKey xmlns:samlec=\"" SAMLEC_NS "\" "
+            "S:mustUnderstand=\"1\" S:actor=\"" SOAP_ACTOR "\">%s"
+            "</samlec:GeneratedKey></S:Header><S:Body>"
+            "<samlp:Response xmlns:samlp=\"" SAML2P_NS "\" "
+            "xmlns:saml=\"" SAML2_NS "\" ID=\"%s\" InResponseTo=\"%s\" "
+            "Version=\"2.0\" IssueInstant=\"%s\" Destination=\"%s\">"
+            "<saml:Issuer>%s</saml:Issuer><samlp:Status>"
+            "<samlp:StatusCode Value=\"urn:oasis:names:tc:SAML:2.0:status:Success\"/>"
+            "</samlp:Status>%s</samlp:Response></S:Body></S:Envelope>",
+            eAcs, key64, responseId, eId, now, eAcs, eEntity,
+            encrypted ? encrypted : assertion) < 0) {
+        free(out.s);
+        out.s = NULL;
+    }
+
+cleanup:
+    OPENSSL_cleanse(key, sizeof(key));
+    free(head.s);
+    free(tail.s);
+    free(key64);
+    free(assertion);
+    free(encrypted);
+    free(eId);
+    free(eAcs);
+    free(eUser);
+    free(eEntity);
+    free(eSp);
+    return out.s;
+}
+
+static char *
+soap_fault(const char *code, const char *message)
+{
+    struct strbuf out = { NULL, 0, 0 };
+
+    sb_printf(&out, "<S:Envelope xmlns:S=\"" SOAP11_NS "\"><S:Body><S:Fault>"
+              "<faultcode>S:%s</faultcode><faultstring>%s</faultstring>"
+              "</S:Fault></S:Body></S:Envelope>", code, message);
+    return out.s;
+}
+
+/*
+ * Check HTTP Basic credentials against -user/-pass, returning the user
+ * name to put in the assertion, or NULL if they don't match.
+ */
+static char *
+check_auth(const char *authorization)
+{
+    unsigned char decoded[512];
+    char   *colon;
+    size_t  len;
+    int     n;
+
+    if (authorization == NULL ||
+        strncasecmp(authorization, "Basic ", 6) != 0)
+        return idp.user ? NULL : strdup("anonymous");
+
+    authorization += 6;
+    len = strcspn(authorization, "\r\n");
+    if (len == 0 || len > 4 * (sizeof(decoded) - 1) / 3)
+        return NULL;
+    n = EVP_DecodeBlock(decoded, (const unsigned char *) authorization,
+                        (int) len);
+    if (n < 0)
+        return NULL;
+    while (n > 0 && len > 0 && authorization[--len] == '=')
+        n--;
+    decoded[n] = '\0';
+
+    if ((colon = strchr((char *) decoded, ':')) == NULL)
+        return NULL;
+    *colon++ = '\0';
+    if (idp.user != NULL &&
+        (strcmp((char *) decoded, idp.user) != 0 ||
+         strcmp(colon, idp.pass) != 0))
+        return NULL;
+    return strdup((char *) decoded);
+}
+
+/*
+ * Answer one SOAP request, returning the HTTP status and setting *body
+ * to the SOAP envelope to send back.
+ */
+static int
+process_request(const char *request, size_t len, const char *authorization,
+                char **body)
+{
+    xmlDocPtr doc = NULL;
+    xmlNodePtr authnRequest, issuer;
+    xmlChar *id = NULL, *acs = NULL, *spEntity = NULL;
+    char   *user = NULL;
+    int     status = 500;
+
+    *body = NULL;
+
+    if ((user = check_auth(authorization)) == NULL) {
+        *body = soap_fault("Client", "authentication failed");
+        status = 401;
+        goto cleanup;
+    }
+
+    doc = xmlReadMemory(request, (int) len, "request", NULL, XML_PARSE_NONET);
+    if (doc == NULL ||
+        (authnRequest = find_element(xmlDocGetRootElement(doc),
+                                     "AuthnRequest", SAML2P_NS)) == NULL ||
+        (id = xmlGetProp(authnRequest, BAD_CAST "ID")) == NULL ||
+        (acs = xmlGetProp(authnRequest,
+                          BAD_CAST "AssertionConsumerServiceURL")) == NULL) {
+        *body = soap_fault("Client", "no usable samlp:AuthnRequest");
+        goto cleanup;
+    }
+
+    issuer = find_element(authnRequest->children, "Issuer", SAML2_NS);
+    if (issuer != NULL)
+        spEntity = xmlNodeGetContent(issuer);
+    if (idp.spEntity != NULL &&
+        (spEntity == NULL || strcmp((char *) spEntity, idp.spEntity) != 0)) {
+        *body = soap_fault("Client", "unknown service provider");
+        goto cleanup;
+    }
+
+    if ((*body = make_response((char *) id, (char *) acs, user)) != NULL)
+        status = 200;
+
+    if (idp.verbose)
+        fprintf(stderr, "mock-idp: %s for %s from %s: %d\n", (char *) id,
+                user, spEntity ? (char *) spEntity : "(no issuer)", status);
+
+cleanup:
+    xmlFree(id);
+    xmlFree(acs);
+    xmlFree(spEntity);
+    xmlFreeDoc(doc);
+    free(user);
+    return status;
+}
+
+static const char *
+find_header(char *headers, const char *name)
+{
+    size_t  len = strlen(name);
+    char   *line;
+
+    for (line = strstr(headers, "\r\n"); line != NULL;
+         line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':') {
+            line += len + 1;
+            while (*line == ' ' || *line == '\t')
+                line++;
+            return line;
+        }
+    }
+    return NULL;
+}
+
+static int
+send_all(SSL *ssl, const char *data, size_t len)
+{
+    int     n;
+
+    while (len > 0) {
+        if ((n = SSL_write(ssl, data, (int) len)) <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Serve HTTP/1.1 requests on one connection until the client closes
+ * it. curl asks for 100-continue on larger POSTs and would otherwise
+ * wait a second before sending the body.
+ */
+static void *
+serve_connection(void *arg)
+{
+    SSL    *ssl = arg;
+    char   *buf, *end, *body;
+    size_t  len = 0, cap = MAX_HEADER + MAX_BODY;
+    int     n, keepAlive = 1;
+
+    if ((buf = malloc(cap + 1)) == NULL || SSL_accept(ssl) != 1)
+        goto done;
+
+    while (keepAlive) {
+        const char *value;
+        size_t  headerLen, contentLength;
+        char    reply[256];
+        int     status;
+
+        buf[len] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL) {
+            if (len >= MAX_HEADER ||
+                (n = SSL_read(ssl, buf + len, (int) (cap - len))) <= 0)
+                goto done;
+            len += n;
+            buf[len] = '\0';
+        }
+        *end = '\0';
+        headerLen = end + 4 - buf;
+
+        value = find_header(buf, "Content-Length");
+        contentLength = value ? strtoul(value, NULL, 10) : 0;
+        if (contentLength > MAX_BODY)
+            goto done;
+        if (strncmp(buf, "POST ", 5) != 0)
+            goto done;
+        keepAlive = strstr(buf, " HTTP/1.1\r\n") != NULL;
+        if ((value = find_header(buf, "Connection")) != NULL &&
+            strncasecmp(value, "close", 5) == 0)
+            keepAlive = 0;
+
+        if ((value = find_header(buf, "Expect")) != NULL &&
+            strncasecmp(value, "100-continue", 12) == 0 &&
+            len < headerLen + contentLength &&
+            send_all(ssl, "HTTP/1.1 100 Continue\r\n\r\n", 25) < 0)
+            goto done;
+
+        while (len < headerLen + contentLength) {
+            if ((n = SSL_read(ssl, buf + len, (int) (cap - len))) <= 0)
+                goto done;
+            len += n;
+        }
+
+        status = process_request(buf + headerLen, contentLength,
+                                 find_header(buf, "Authorization"), &body);
+        if (body == NULL)
+            goto done;
+
+        n = snprintf(reply, sizeof(reply),
+                     "HTTP/1.1 %d %s\r\nContent-Type: text/xml\r\n"
+                     "Content-Length: %zu\r\n%s%s\r\n", status,
+                     status == 200 ? "OK" :
+                     status == 401 ? "Unauthorized" : "Internal Server Error",
+                     strlen(body),
+                     status == 401 ? "WWW-Authenticate: Basic realm=\"mock-idp\"\r\n" : "",
+                     keepAlive ? "" : "Connection: close\r\n");
+        if (send_all(ssl, reply, n) < 0 ||
+            send_all(ssl, body, strlen(body)) < 0) {
+            free(body);
+            goto done;
+        }
+        free(body);
+
+        /* Keep anything the client pipelined behind this request */
+        len -= headerLen + contentLength;
+        memmove(buf, buf + headerLen + contentLength, len);
+    }
+
+done:
+    SSL_shutdown(ssl);
+    close(SSL_get_fd(ssl));
+    SSL_free(ssl);
+    free(buf);
+    return NULL;
+}
+
+static EVP_PKEY *
+load_key(const char *dir, const char *name)
+{
+    char    path[1024];
+    EVP_PKEY *key = NULL;
+    FILE   *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fp = fopen(path, "r")) != NULL) {
+        key = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        fclose(fp);
+    }
+    if (key == NULL)
+        fprintf(stderr, "mock-idp: couldn't read private key %s\n", path);
+    return key;
+}
+
+static char *
+load_cert(const char *dir, const char *name)
+{
+    char    path[1024];
+    unsigned char *der = NULL;
+    char   *b64 = NULL;
+    X509   *cert = NULL;
+    FILE   *fp;
+    int     len;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fp = fopen(path, "r")) != NULL) {
+        cert = PEM_read_X509(fp, NULL, NULL, NULL);
+        fclose(fp);
+    }
+    if (cert != NULL && (len = i2d_X509(cert, &der)) > 0)
+        b64 = b64_encode(der, len);
+    if (b64 == NULL)
+        fprintf(stderr, "mock-idp: couldn't read certificate %s\n", path);
+    OPENSSL_free(der);
+    X509_free(cert);
+    return b64;
+}
+
+/*
+ * Take the SP's entityID, and its encryption key if -encrypt was given,
+ * from its metadata.
+ */
+static int
+load_sp_metadata(const char *path)
+{
+    xmlDocPtr doc;
+    xmlNodePtr root, kd;
+    xmlChar *text = NULL, *use;
+    unsigned char *der = NULL;
+    const unsigned char *p;
+    X509   *cert = NULL;
+    size_t  i, j;
+    int     len;
+
+    if ((doc = xmlReadFile(path, NULL, XML_PARSE_NONET)) == NULL ||
+        (root = find_element(xmlDocGetRootElement(doc), "EntityDescriptor",
+                             MD_NS)) == NULL ||
+        (text = xmlGetProp(root, BAD_CAST "entityID")) == NULL) {
+        fprintf(stderr, "mock-idp: no md:EntityDescriptor in %s\n", path);
+        xmlFreeDoc(doc);
+        return -1;
+    }
+    idp.spEntity = strdup((char *) text);
+    xmlFree(text);
+    text = NULL;
+
+    for (kd = find_element(root, "KeyDescriptor", MD_NS);
+         kd != NULL && idp.encrypt;
+         kd = find_element(kd->next, "KeyDescriptor", MD_NS)) {
+        xmlNodePtr x509;
+
+        use = xmlGetProp(kd, BAD_CAST "use");
+        if (use != NULL && strcmp((char *) use, "encryption") != 0) {
+            xmlFree(use);
+            continue;
+        }
+        xmlFree(use);
+        if ((x509 = find_element(kd->children, "X509Certificate", DS_NS)) == NULL)
+            continue;
+
+        /* EVP_DecodeBlock doesn't skip the whitespace in metadata */
+        text = xmlNodeGetContent(x509);
+        for (i = j = 0; text[i]; i++)
+            if (text[i] != ' ' && text[i] != '\t' &&
+                text[i] != '\r' && text[i] != '\n')
+                text[j++] = text[i];
+        text[j] = '\0';
+        if ((der = malloc(j)) != NULL &&
+            (len = EVP_DecodeBlock(der, text, (int) j)) > 0) {
+            p = der;
+            cert = d2i_X509(NULL, &p, len);
+        }
+        free(der);
+        xmlFree(text);
+        if (cert != NULL)
+            break;
+    }
+
+    if (cert != NULL) {
+        idp.spKey = X509_get_pubkey(cert);
+        X509_free(cert);
+    }
+    xmlFreeDoc(doc);
+
+    if (idp.encrypt && idp.spKey == NULL) {
+        fprintf(stderr, "mock-idp: no encryption certificate in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *keydir, *spMetadata = NULL;
+    char    path[1024];
+    struct sockaddr_in sin;
+    pthread_attr_t attr;
+    int     port = 8443, s, fd, on = 1;
+
+    idp.entity = "https://idp.example.test/idp/shibboleth";
+    idp.lifetime = 8 * 60 * 60;
+
+    for (argc--, argv++; argc > 1; argc--, argv++) {
+        if (strcmp(*argv, "-port") == 0) {
+            argc--; argv++;
+            port = atoi(*argv);
+        } else if (strcmp(*argv, "-user") == 0) {
+            argc--; argv++;
+            idp.user = *argv;
+        } else if (strcmp(*argv, "-pass") == 0) {
+            argc--; argv++;
+            idp.pass = *argv;
+        } else if (strcmp(*argv, "-entity") == 0) {
+            argc--; argv++;
+            idp.entity = *argv;
+        } else if (strcmp(*argv, "-sp-metadata") == 0) {
+            argc--; argv++;
+            spMetadata = *argv;
+        } else if (strcmp(*argv, "-lifetime") == 0) {
+            argc--; argv++;
+            idp.lifetime = atol(*argv);
+        } else if (strcmp(*argv, "-encrypt") == 0) {
+            idp.encrypt = 1;
+        } else if (strcmp(*argv, "-v") == 0) {
+            idp.verbose = 1;
+        } else
+            break;
+        if (argc <= 1)
+            usage();
+    }
+    if (argc != 1 || port <= 0 || (idp.user == NULL) != (idp.pass == NULL) ||
+        (idp.encrypt && spMetadata == NULL))
+        usage();
+    keydir = *argv;
+
+    xmlInitParser();
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((idp.signKey = load_key(keydir, "idp-signing.key")) == NULL ||
+        (idp.signCert = load_cert(keydir, "idp-signing.crt")) == NULL ||
+        (spMetadata != NULL && load_sp_metadata(spMetadata) < 0))
+        exit(1);
+
+    if ((idp.ssl = SSL_CTX_new(TLS_server_method())) == NULL)
+        exit(1);
+    snprintf(path, sizeof(path), "%s/idp-tls.crt", keydir);
+    if (SSL_CTX_use_certificate_chain_file(idp.ssl, path) != 1) {
+        fprintf(stderr, "mock-idp: couldn't use certificate %s\n", path);
+        exit(1);
+    }
+    snprintf(path, sizeof(path), "%s/idp-tls.key", keydir);
+    if (SSL_CTX_use_PrivateKey_file(idp.ssl, path, SSL_FILETYPE_PEM) != 1) {
+        fprintf(stderr, "mock-idp: couldn't use private key %s\n", path);
+        exit(1);
+    }
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("creating socket");
+        exit(1);
+    }
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+        listen(s, 128) < 0) {
+        perror("binding socket");
+        exit(1);
+    }
+
+    /* The driver waits for this line before starting clients */
+    printf("mock-idp: listening on https://localhost:%d/\n", port);
+    fflush(stdout);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (;;) {
+        pthread_t thread;
+        SSL    *ssl;
+
+        if ((fd = accept(s, NULL, NULL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accepting connection");
+            exit(1);
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if ((ssl = SSL_new(idp.ssl)) == NULL || SSL_set_fd(ssl, fd) != 1 ||
+            pthread_create(&thread, &attr, serve_connection, ssl) != 0) {
+            SSL_free(ssl);
+            close(fd);
+        }
+    }
+}
@@ -36,11 +36,20 @@
 #include <xmltooling/util/XMLConstants.h>
 #include <xmltooling/util/DateTime.h>
 #include <xmltooling/validation/ValidatorSuite.h>
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <pthread.h>
+
+#include "util_attr_index.h"
+#include "util_random.h"
+#include "util_replay.h"
+#include "util_trace.h"
 
 using namespace opensaml::saml2;
 using namespace opensaml::saml2p;
@@ -56,7 +65,74 @@ using namespace xmltooling::logging;
 using namespace xmltooling;
 using namespace std;
 
-static ResolutionContext* ctx = nullptr;
+// Attributes resolved from one assertion, and shared by every name
+// that carries them, so that they outlive the next login. Nothing is
+// serialised until an attribute is asked for: the index from alias to
+// entry is built on the first lookup, and each entry's values are
+// joined by ";" the first time that entry is read.
+struct gss_eap_saml_attribute {
+    string alias;
+    vector<const shibsp::Attribute*> attributes;
+    string values;
+    bool joined;
+};
+
+struct gss_eap_saml_resolution {
+    pthread_mutex_t mutex;
+    int refs;
+    ResolutionContext* ctx;
+    bool indexed;
+    vector<gss_eap_saml_attribute> entries;
+    struct gss_eap_attr_index index;
+};
+
+extern "C" gss_eap_saml_resolution* referenceSAMLResolution(gss_eap_saml_resolution* res)
+{
+    if (res != nullptr) {
+        pthread_mutex_lock(&res->mutex);
+        res->refs++;
+        pthread_mutex_unlock(&res->mutex);
+    }
+
+    return res;
+}
+
+extern "C" void releaseSAMLResolution(gss_eap_saml_resolution* res)
+{
+    int refs;
+
+    if (res == nullptr)
+        return;
+
+    pthread_mutex_lock(&res->mutex);
+    refs = --res->refs;
+    pthread_mutex_unlock(&res->mutex);
+
+    if (refs != 0)
+        return;
+
+    gssEapAttrIndexRelease(&res->index);
+    delete res->ctx;
+    pthread_mutex_destroy(&res->mutex);
+    delete res;
+}
+
+// Takes ownership of ctx; the result holds one reference
+static gss_eap_saml_resolution* newSAMLResolution(ResolutionContext* ctx)
+{
+    gss_eap_saml_resolution* res = nullptr;
+
+    if (ctx != nullptr) {
+        res = new gss_eap_saml_resolution;
+        pthread_mutex_init(&res->mutex, NULL);
+        res->refs = 1;
+        res->ctx = ctx;
+        res->indexed = false;
+        memset(&res->index, 0, sizeof(res->index));
+    }
+
+    return res;
+}
 
 // Taken from http://stackoverflow.com/questions/504810/
 static string getfqdn()
@@ -84,20 +160,16 @@ static string getfqdn()
     return retstr;
 }
 
-// Taken from AbstractHandler.cpp
-void generateRandomHex(std::string& buf, unsigned int len) {
-    static char DIGITS[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-    int r;
-    unsigned char b1,b2;
+// len hex digits from the per-thread random pool
+static void generateRandomHex(std::string& buf, unsigned int len) {
+    char digits[65];
+
     buf.erase();
-    for (unsigned int i=0; i<len; i+=4) {
-        r = rand();
-        b1 = (0x00FF & r);
-        b2 = (0xFF00 & r)  >> 8;
-        buf += (DIGITS[(0xF0 & b1) >> 4 ]);
-        buf += (DIGITS[0x0F & b1]);
-        buf += (DIGITS[(0xF0 & b2) >> 4 ]);
-        buf += (DIGITS[0x0F & b2]);
+    while (buf.length() < len) {
+        unsigned int n = min(len - (unsigned int)buf.length(), 64U);
+        if (gssEapRandomHex(digits, n) != 0)
+            throw XMLToolingException("Unable to generate random identifier.");
+        buf.append(digits, n);
     }
 }
 
@@ -107,6 +179,8 @@ SPConfig& getConf(void) {
     static int featuresSet = 0;
     if (!featuresSet) {
         featuresSet = 1;
+        XMLToolingConfig::getConfig().log_config(
+            GSSEAP_TRACING(GSSEAP_TRACE_DEBUG) ? "DEBUG" : "WARN");
         conf.setFeatures(
             SPConfig::Metadata |
             SPConfig::Trust |
@@ -121,6 +195,145 @@ SPConfig& getConf(void) {
     return conf;
 }
 
+// The acceptor's own replay store, used in place of the MessageFlow rule
+// and ReplayCache of the SP's security policy only if
+// MECH_SAML_EC_REPLAY_CACHE is set: to "memory" for a store private to
+// the process, for acceptors that run in a single process, or else to a
+// file that acceptor processes on the host share. The SP's ReplayCache
+// is shared through shibd, so is the default. If the configured store
+// cannot be opened, logins are refused rather than left unchecked.
+// MECH_SAML_EC_REPLAY_ENTRIES sizes it.
+static pthread_once_t replayOnce = PTHREAD_ONCE_INIT;
+static struct gss_eap_replay_store* replayStoreInstance = nullptr;
+static bool replayStoreFailed = false;
+
+static void replayInit(void)
+{
+    const char* path = getenv("MECH_SAML_EC_REPLAY_CACHE");
+    const char* entries = getenv("MECH_SAML_EC_REPLAY_ENTRIES");
+    size_t n = GSSEAP_REPLAY_DEFAULT_ENTRIES;
+
+    if (path == nullptr || *path == '\0' || strcmp(path, "sp") == 0)
+        return;
+    if (entries != nullptr && atol(entries) > 0)
+        n = atol(entries);
+
+    if (strcmp(path, "memory") == 0)
+        path = nullptr;
+
+    replayStoreInstance = gssEapReplayOpen(path, n);
+    if (replayStoreInstance == nullptr) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Unable to open replay cache %s",
+                     path ? path : "in memory");
+        replayStoreFailed = true;
+    }
+}
+
+// NULL if replay detection is left to the SP; sets failed if it cannot
+// be done at all
+static struct gss_eap_replay_store* replayStore(bool& failed)
+{
+    pthread_once(&replayOnce, replayInit);
+    failed = replayStoreFailed;
+    return replayStoreInstance;
+}
+
+// Reauthentication requests have no SP rule to fall back on, so are
+// checked in the configured store, or if there is none in one private
+// to the process. NULL if the configured store could not be opened.
+static pthread_once_t reauthReplayOnce = PTHREAD_ONCE_INIT;
+static struct gss_eap_replay_store* reauthReplayInstance = nullptr;
+
+static void reauthReplayInit(void)
+{
+    bool failed;
+
+    reauthReplayInstance = replayStore(failed);
+    if (reauthReplayInstance == nullptr && !failed)
+        reauthReplayInstance = gssEapReplayOpen(nullptr, GSSEAP_REPLAY_DEFAULT_ENTRIES);
+}
+
+extern "C" struct gss_eap_replay_store* reauthReplayStore(void)
+{
+    pthread_once(&reauthReplayOnce, reauthReplayInit);
+    return reauthReplayInstance;
+}
+
+// AuthnRequests awaiting their Response, by the RelayState sent with
+// them. A Response is accepted only with the RelayState of a request
+// made here in the last PENDING_REQUEST_LIFETIME seconds, once, and is
+// checked against what that request asked for. Every entry lives for
+// the same time, so entries expire in the order they were added.
+#define PENDING_REQUEST_LIFETIME    (5 * 60)
+#define PENDING_REQUEST_MAX         65536
+
+#define PENDING_FLAG_MUTUAL         0x1
+#define PENDING_FLAG_DELEG          0x2
+
+struct PendingRequest {
+    PendingRequest() : flags(0), created(0) {}
+
+    string requestID;
+    string acsURL;
+    string channelBindings;     // base64, empty if none
+    int flags;
+    time_t created;
+};
+
+class PendingRequests {
+public:
+    PendingRequests() {
+        pthread_mutex_init(&m_mutex, nullptr);
+    }
+
+    void add(const string& relayState, const PendingRequest& request) {
+        pthread_mutex_lock(&m_mutex);
+        expire(request.created);
+        while (m_order.size() >= PENDING_REQUEST_MAX) {
+            m_requests.erase(m_order.front().second);
+            m_order.pop_front();
+        }
+        m_requests[relayState] = request;
+        m_order.push_back(make_pair(request.created, relayState));
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    // Remove the request sent with relayState into request, if it is
+    // still pending
+    bool take(const string& relayState, time_t now, PendingRequest& request) {
+        bool found = false;
+
+        pthread_mutex_lock(&m_mutex);
+        expire(now);
+        unordered_map<string, PendingRequest>::iterator i = m_requests.find(relayState);
+        if (i != m_requests.end()) {
+            request = i->second;
+            m_requests.erase(i);
+            found = true;
+        }
+        pthread_mutex_unlock(&m_mutex);
+
+        return found;
+    }
+
+private:
+    // Entries already taken are left in m_order, and erasing them again
+    // does nothing
+    void expire(time_t now) {
+        while (!m_order.empty() &&
+               m_order.front().first + PENDING_REQUEST_LIFETIME <= now) {
+            m_requests.erase(m_order.front().second);
+            m_order.pop_front();
+        }
+    }
+
+    pthread_mutex_t m_mutex;
+    unordered_map<string, PendingRequest> m_requests;
+    deque< pair<time_t, string> > m_order;
+};
+
+static PendingRequests pendingRequests;
+
 // Taken from resolvertest.cpp
 // This is necessary since resolveAttributes is protected and thus cannot be called 
 // from a local instance of a Handler/AssertionConsumerService object.
@@ -198,7 +411,7 @@ extern "C" char* getSAMLRequest2(char *name, int name_len, int signatureRequeste
                 // Taken from AbstractHandler.cpp Handler::preserveRelayState()
                 string relayStateStr = "";
                 string rsKey;
-                generateRandomHex(rsKey,5);
+                generateRandomHex(rsKey,32);
                 relayStateStr = "cookie:" + rsKey;
                 const char* relayState = relayStateStr.c_str();
 
@@ -210,6 +423,11 @@ extern "C" char* getSAMLRequest2(char *name, int name_len, int signatureRequeste
 
                 // Build up AuthnRequest section of the SOAP message
                 auto_ptr<AuthnRequest> request(AuthnRequestBuilder::buildAuthnRequest());
+                string requestID;
+                generateRandomHex(requestID,32);
+                requestID.insert(0, "_");
+                auto_ptr_XMLCh requestIDXML(requestID.c_str());
+                request->setID(requestIDXML.get());
                 
                 // Taken from AbstractSPRequest::getHandlerURL()
                 string m_handlerURL;
@@ -455,6 +673,15 @@ extern "C" char* getSAMLRequest2(char *name, int name_len, int signatureRequeste
                     s << *rootElement;
 
                     retstr = s.str();
+
+                    PendingRequest pending;
+                    pending.requestID = requestID;
+                    pending.acsURL = m_handlerURL;
+                    pending.channelBindings = channel_bindings ? channel_bindings : "";
+                    pending.flags = (signatureRequested ? PENDING_FLAG_MUTUAL : 0) |
+                                    (deleg_requested ? PENDING_FLAG_DELEG : 0);
+                    pending.created = time(nullptr);
+                    pendingRequests.add(relayStateStr, pending);
                     
                     // long ret = genericResponse.sendResponse(s);
                 
@@ -474,8 +701,8 @@ extern "C" char* getSAMLRequest2(char *name, int name_len, int signatureRequeste
     }
 
     char* cstr = strdup(retstr.c_str());
-    if (getenv("MECH_SAML_EC_DEBUG"))
-        fprintf(stdout,"--- GETSAMLREQUEST2() RETURNING XML: ---\n%s\n",cstr);
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                 "--- GETSAMLREQUEST2() RETURNING XML: ---\n%s\n", cstr);
     return cstr; //  Must free() returned char*
 }
 
@@ -499,8 +726,8 @@ static vector<saml2::Assertion*> extractAssertions(const Response& resp,
         CredentialResolver* cr = app.getCredentialResolver();
         if ( ! cr )
             {
-            cerr << "Response contained encrypted assertion, "
-                 <<  "but no CredentialResolver available." << endl;
+            GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "Response contained encrypted "
+                         "assertion, but no CredentialResolver available.");
             return retval;
             }
 
@@ -525,12 +752,12 @@ static vector<saml2::Assertion*> extractAssertions(const Response& resp,
 
                 if ( decassertion )
                     {
-                    cerr << "Decrypted assertion." << endl;
-                    if (getenv("MECH_SAML_EC_DEBUG")) {
+                    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "Decrypted assertion.");
+                    if (GSSEAP_TRACING(GSSEAP_TRACE_DEBUG)) {
                         DOMElement* assertionElement = decassertion->marshall();
                         stringstream s;
                         s << *assertionElement;
-                        cerr << s.str().c_str() << endl;
+                        gssEapTrace(GSSEAP_TRACE_DEBUG, "%s", s.str().c_str());
                     }
                     retval.push_back(decassertion->cloneAssertion());
                     delete decassertion;
@@ -538,12 +765,13 @@ static vector<saml2::Assertion*> extractAssertions(const Response& resp,
                     }
                 else
                     {
-                    cerr << "Encrpyted assertion not decrypted." << endl;
+                    GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "Encrypted assertion not decrypted.");
                     }
                 }
             catch ( exception& ex )
                 {
-                cerr << "Failed to decrypt assertion: " << ex.what() << endl;
+                GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                             "Failed to decrypt assertion: %s", ex.what());
                 }
             }
        }
@@ -572,7 +800,8 @@ static vector<saml2::Assertion*> filterValidSignedAssertions(
         {
         invalid = assertions;
         assertions.clear();
-        cerr << "No XMLSigningRule's, all assertions deemed invalid" << endl;
+        GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                     "No XMLSigningRule's, all assertions deemed invalid");
         return invalid;
         }
 
@@ -589,20 +818,21 @@ static vector<saml2::Assertion*> filterValidSignedAssertions(
             catch ( exception& e )
                 {
                 is_valid = false;
-                cerr << "Assertion signature failed verification: "
-                     << e.what() << endl;
+                GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                             "Assertion signature failed verification: %s",
+                             e.what());
                 }
             if ( ! is_valid ) break;
             }
 
         if ( is_valid )
             {
-            cerr << "Signature on assertion verified" << endl;
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "Signature on assertion verified");
             valid.push_back(assertions[i]);
             }
         else
             {
-            cerr << "Filtered invalidly signed assertion" << endl;
+            GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "Filtered invalidly signed assertion");
             invalid.push_back(assertions[i]);
             }
         }
@@ -611,20 +841,163 @@ static vector<saml2::Assertion*> filterValidSignedAssertions(
     return invalid;
     }
 
-extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_name,
-                                  char ** session_expiry, char **generated_key,
-                                  char **delegated_assertions)
+// What the MessageFlow rule checks, against our store, in two parts.
+// First the Response must be recent and have an ID, which needs no state.
+static bool checkMessageAge(const saml2::RootObject& msg, time_t now)
+{
+    time_t skew = XMLToolingConfig::getConfig().clock_skew_secs;
+    time_t issued = msg.getIssueInstantEpoch();
+
+    if (issued > now + skew) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Response was issued in the future");
+        return false;
+    }
+    if (issued < now - skew - GSSEAP_REPLAY_MESSAGE_WINDOW) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Response is too old to accept");
+        return false;
+    }
+
+    auto_ptr_char id(msg.getID());
+    if (!id.get() || !*id.get()) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Response has no ID");
+        return false;
+    }
+
+    return true;
+}
+
+// Then its ID must not have been seen while it was recent. This is only
+// recorded once the Response has yielded a validly signed assertion, so
+// that unsigned Responses cannot fill the store.
+static bool recordMessageID(struct gss_eap_replay_store* replay,
+                            const saml2::RootObject& msg, time_t now)
+{
+    time_t skew = XMLToolingConfig::getConfig().clock_skew_secs;
+    time_t issued = msg.getIssueInstantEpoch();
+    auto_ptr_char id(msg.getID());
+
+    if (gssEapReplayCheck(replay, GSSEAP_REPLAY_MESSAGE, id.get(), strlen(id.get()),
+                          issued + skew + GSSEAP_REPLAY_MESSAGE_WINDOW + 1, now) != GSSEAP_REPLAY_FRESH) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Replayed Response %s", id.get());
+        return false;
+    }
+
+    return true;
+}
+
+// An assertion is remembered until it could no longer be accepted
+// anyway: the NotOnOrAfter of its bearer confirmation, else of its
+// Conditions, else as long as a Response is.
+static time_t assertionExpiry(const saml2::Assertion& assertion, time_t skew)
+{
+    time_t expiry = 0;
+
+    const saml2::Subject* subject = assertion.getSubject();
+    if (subject) {
+        const vector<saml2::SubjectConfirmation*>& confs = subject->getSubjectConfirmations();
+        for (size_t i = 0; i < confs.size(); ++i) {
+            if (!XMLString::equals(confs[i]->getMethod(), saml2::SubjectConfirmation::BEARER))
+                continue;
+            const saml2::SubjectConfirmationDataType* data =
+                dynamic_cast<const saml2::SubjectConfirmationDataType*>(confs[i]->getSubjectConfirmationData());
+            if (data && data->getNotOnOrAfter() && data->getNotOnOrAfterEpoch() > expiry)
+                expiry = data->getNotOnOrAfterEpoch();
+        }
+    }
+
+    const saml2::Conditions* cond = assertion.getConditions();
+    if (expiry == 0 && cond && cond->getNotOnOrAfter())
+        expiry = cond->getNotOnOrAfterEpoch();
+    if (expiry == 0)
+        expiry = assertion.getIssueInstantEpoch() + GSSEAP_REPLAY_MESSAGE_WINDOW;
+
+    return expiry + skew;
+}
+
+// Like filterValidSignedAssertions, but removing assertions with a bearer
+// confirmation in reply to some request other than requestID.
+static vector<saml2::Assertion*> filterUncorrelatedAssertions(
+    vector<saml2::Assertion*>& assertions, const string& requestID)
+{
+    vector<saml2::Assertion*> valid;
+    vector<saml2::Assertion*> invalid;
+
+    for (size_t i = 0; i < assertions.size(); ++i) {
+        bool correlated = true;
+        const saml2::Subject* subject = assertions[i]->getSubject();
+
+        if (subject) {
+            const vector<saml2::SubjectConfirmation*>& confs = subject->getSubjectConfirmations();
+            for (size_t j = 0; j < confs.size(); ++j) {
+                if (!XMLString::equals(confs[j]->getMethod(), saml2::SubjectConfirmation::BEARER))
+                    continue;
+                const saml2::SubjectConfirmationDataType* data =
+                    dynamic_cast<const saml2::SubjectConfirmationDataType*>(confs[j]->getSubjectConfirmationData());
+                auto_ptr_char inResponseTo(data ? data->getInResponseTo() : nullptr);
+                if (inResponseTo.get() && requestID != inResponseTo.get())
+                    correlated = false;
+            }
+        }
+
+        if (correlated) {
+            valid.push_back(assertions[i]);
+        } else {
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Filtered assertion in reply to another request");
+            invalid.push_back(assertions[i]);
+        }
+    }
+
+    assertions = valid;
+    return invalid;
+}
+
+// Like filterValidSignedAssertions, but removing assertions whose IDs
+// have been seen before, or which have none.
+static vector<saml2::Assertion*> filterReplayedAssertions(
+    struct gss_eap_replay_store* replay,
+    vector<saml2::Assertion*>& assertions, time_t now)
+{
+    vector<saml2::Assertion*> valid;
+    vector<saml2::Assertion*> invalid;
+    time_t skew = XMLToolingConfig::getConfig().clock_skew_secs;
+
+    for (size_t i = 0; i < assertions.size(); ++i) {
+        auto_ptr_char id(assertions[i]->getID());
+
+        if (!id.get() || !*id.get()) {
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Filtered assertion without ID");
+            invalid.push_back(assertions[i]);
+        } else if (gssEapReplayCheck(replay, GSSEAP_REPLAY_ASSERTION,
+                                     id.get(), strlen(id.get()),
+                                     assertionExpiry(*assertions[i], skew), now) != GSSEAP_REPLAY_FRESH) {
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Filtered replayed assertion %s", id.get());
+            invalid.push_back(assertions[i]);
+        } else {
+            valid.push_back(assertions[i]);
+        }
+    }
+
+    assertions = valid;
+    return invalid;
+}
+
+extern "C" int verifySAMLResponse(const char* saml, int len,
+                                  const char* channel_bindings, char** initiator_name,
+                                  time_t* session_expiry, char **generated_key,
+                                  char **delegated_assertions,
+                                  gss_eap_saml_resolution** resolution)
 {
     int retbool = 1; // FIXME: Defaulting to successful verification is dangerous.
     string initiatorName = "";
     stringstream deleg_assertion_str;
 
-    XMLToolingConfig::getConfig().log_config("DEBUG");
+    *resolution = nullptr;
+
     Category& log = Category::getInstance(SHIBSP_LOGCAT".verifySAMLResponse");
 
     string samlstr(saml, len);
-    if (getenv("MECH_SAML_EC_DEBUG"))
-        fprintf(stdout,"--- VERIFYSAMLRESPONSE() GOT XML: ---\n%s\n",samlstr.c_str());
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                 "--- VERIFYSAMLRESPONSE() GOT XML: ---\n%s\n", samlstr.c_str());
 
     // Initialization code taken from resolvertest.cpp::main()
     SPConfig& conf = getConf();
@@ -638,7 +1011,7 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                 const Handler* ACS=nullptr;
                 ACS = app->getAssertionConsumerServiceByProtocol(SAML20P_NS,SAML20_BINDING_PAOS);
                 if (!ACS) {
-                    cerr << "Unable to locate PAOS response endpoint." << endl;
+                    GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Unable to locate PAOS response endpoint.");
                     retbool = 0;
                 }
 
@@ -655,6 +1028,25 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                     vector<const SecurityPolicyRule*> rules =
                         app->getServiceProvider().getPolicyRules(app->getString("policyId").second);
                     rules.push_back(SAMLConfig::getConfig().SecurityPolicyRuleManager.newPlugin(BEARER_POLICY_RULE, nullptr));
+
+                    // Our store, if configured, stands in for MessageFlow,
+                    // whose ReplayCache may be a round trip to shibd on
+                    // every accept
+                    bool replayFailed;
+                    struct gss_eap_replay_store* replay = replayStore(replayFailed);
+                    time_t now = time(nullptr);
+                    if (replayFailed) {
+                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Replay cache unavailable, refusing Response");
+                        retbool = 0;
+                    }
+                    if (replay != nullptr) {
+                        for (vector<const SecurityPolicyRule*>::iterator r = rules.begin(); r != rules.end(); ) {
+                            if (!strcmp((*r)->getType(), MESSAGEFLOW_POLICY_RULE))
+                                r = rules.erase(r);
+                            else
+                                ++r;
+                        }
+                    }
                     policy.getRules().assign(rules.begin(),rules.end());
                     /*
                     vector<const SecurityPolicyRule*>::iterator it;
@@ -668,9 +1060,8 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                         istringstream samlstream(samlstr);
                        
                         // Taken from SAML2ECPDecoder::decode()
-                        cerr << "parsing samlstream..." << endl;
                         DOMDocument* doc = XMLToolingConfig::getConfig().getParser().parse(samlstream);
-                        cerr << "samlstream parsing succeeded!" << endl;
+                        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "samlstream parsing succeeded!");
                         XercesJanitor<DOMDocument> docjan(doc);
                         auto_ptr<XMLObject> token(XMLObjectBuilder::buildOneFromElement(doc->getDocumentElement(), true));
                         docjan.release();
@@ -682,7 +1073,39 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                             Body* body = env->getBody();
                             if (body && body->hasChildren()) {
                                 Response* response = dynamic_cast<Response*>(body->getUnknownXMLObjects().front());
+                                PendingRequest pending;
                                 if (response) {
+                                    // The RelayState header must be that of a request
+                                    // still pending here
+                                    string relayState;
+                                    static const XMLCh RelayState[] = UNICODE_LITERAL_10(R,e,l,a,y,S,t,a,t,e);
+                                    if (env->getHeader()) {
+                                        const vector<XMLObject*>& blocks = const_cast<const Header*>(env->getHeader())->getUnknownXMLObjects();
+                                        vector<XMLObject*>::const_iterator h =
+                                            find_if(blocks.begin(), blocks.end(), hasQName(xmltooling::QName(samlconstants::SAML20ECP_NS, RelayState)));
+                                        const ElementProxy* ep = dynamic_cast<const ElementProxy*>(h != blocks.end() ? *h : nullptr);
+                                        if (ep) {
+                                            auto_ptr_char rs(ep->getTextContent());
+                                            if (rs.get())
+                                                relayState = rs.get();
+                                        }
+                                    }
+                                    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "relayState = %s", relayState.c_str());
+                                    if (!pendingRequests.take(relayState, now, pending)) {
+                                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                                     "RelayState \"%s\" is not that of a pending request",
+                                                     relayState.c_str());
+                                        retbool = 0;
+                                    } else if (pending.channelBindings != (channel_bindings ? channel_bindings : "")) {
+                                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                                     "Channel bindings differ from those of the request");
+                                        retbool = 0;
+                                    } else {
+                                        auto_ptr_XMLCh requestID(pending.requestID.c_str());
+                                        policy.setCorrelationID(requestID.get());
+                                    }
+                                }
+                                if (response && retbool) {
                                     // Run through the policy at two layers.
                                     /*
                                     extractMessageDetails(*env, genericRequest, samlconstants::SAML20P_NS, policy);
@@ -702,6 +1125,15 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
 
                                             policy.setMessageID(samlRoot.getID());
                                             policy.setIssueInstant(samlRoot.getIssueInstantEpoch());
+                                            if (replay != nullptr && !checkMessageAge(samlRoot, now))
+                                                retbool = 0;
+
+                                            auto_ptr_char inResponseTo(response->getInResponseTo());
+                                            if (!inResponseTo.get() || pending.requestID != inResponseTo.get()) {
+                                                GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Response is not in reply to request %s",
+                                                             pending.requestID.c_str());
+                                                retbool = 0;
+                                            }
 
                                             const Issuer* issuer = samlRoot.getIssuer();
                                             if (issuer) {
@@ -716,27 +1148,26 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                 }
                                             }
                                             if (!issuer) {
-                                                cerr << "Issuer identity not extracted!" << endl;
+                                                GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Issuer identity not extracted!");
                                                 retbool = 0;
                                             }
 
                                             if (retbool) {
                                                 auto_ptr_char iname(issuer->getName());
-                                                cout << "issuer = " << iname.get() << endl;
+                                                GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "issuer = %s", iname.get());
 
                                                 if (policy.getIssuerMetadata()) {
-                                                    cerr << "metadata for issuer already set, leaving in place." << endl;
+                                                    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "metadata for issuer already set, leaving in place.");
                                                     // return;
                                                 }
 
                                                 if (policy.getMetadataProvider() && policy.getRole()) {
                                                     if (issuer->getFormat() && !XMLString::equals(issuer->getFormat(), 
                                                                                                   NameIDType::ENTITY)) {
-                                                        cerr << "non-system entity issuer, skipping metadata lookup!" << endl;
+                                                        GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "non-system entity issuer, skipping metadata lookup!");
                                                         // return;
                                                     }
 
-                                                    cerr << "searching metadata for message issuer... ";
                                                     MetadataProvider::Criteria& mc = policy.getMetadataProviderCriteria();
                                                     mc.entityID_unicode = issuer->getName();
                                                     mc.role = policy.getRole();
@@ -745,21 +1176,34 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                         policy.getMetadataProvider()->getEntityDescriptor(mc);
                                                     if (!entity.first) {
                                                         auto_ptr_char temp(issuer->getName());
-                                                        cerr << "no metadata found, can't establish identity of issuer (" <<
-                                                                temp.get() << ")" << endl;
+                                                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "no metadata found, can't establish identity of issuer (%s)",
+                                                                     temp.get());
                                                         retbool = 0;
                                                     }
                                                     else if (!entity.second) {
-                                                        cerr << "unable to find compatible role (" << 
-                                                                policy.getRole()->toString().c_str() << ") in metadata" << endl;
+                                                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "unable to find compatible role (%s) in metadata",
+                                                                     policy.getRole()->toString().c_str());
                                                         retbool = 0;
                                                     } else {
                                                         policy.setIssuerMetadata(entity.second);
-                                                        cerr << "Done!" << endl;
+                                                        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "found metadata for message issuer");
                                                     }
 
                                                     vector<saml2::Assertion*> invalid_assertions =
                                                         filterValidSignedAssertions(assertions, policy);
+                                                    vector<saml2::Assertion*> uncorrelated =
+                                                        filterUncorrelatedAssertions(assertions, pending.requestID);
+                                                    invalid_assertions.insert(invalid_assertions.end(),
+                                                                              uncorrelated.begin(), uncorrelated.end());
+                                                    if (replay != nullptr && retbool && !assertions.empty() &&
+                                                        !recordMessageID(replay, samlRoot, now))
+                                                        retbool = 0;
+                                                    if (replay != nullptr && retbool) {
+                                                        vector<saml2::Assertion*> replayed =
+                                                            filterReplayedAssertions(replay, assertions, now);
+                                                        invalid_assertions.insert(invalid_assertions.end(),
+                                                                                  replayed.begin(), replayed.end());
+                                                    }
                                                     for_each(invalid_assertions.begin(), invalid_assertions.end(), xmltooling::cleanup<saml2::Assertion>());
 
                                                     // Attempt to extract local-login-user attribute
@@ -776,12 +1220,14 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                                     for (size_t k = 0; k < cond->getAudienceRestrictions()[j]->getAudiences().size(); ++k) {
                                                                         if (XMLString::equals(issuer->getName(), cond->getAudienceRestrictions()[j]->getAudiences()[k]->getAudienceURI())) {
                                                                             deleg_assertion = 1;
-                                                                            fprintf(stderr, "ASSERTION DELEGATED!\n");
+                                                                            GSSEAP_TRACE(GSSEAP_TRACE_NOTE, "ASSERTION DELEGATED!");
                                                                         }
                                                                     }
                                                                 }
                                                             }
-                                                            if (deleg_assertion) {
+                                                            if (deleg_assertion && !(pending.flags & PENDING_FLAG_DELEG)) {
+                                                                GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "Ignoring delegated assertion, delegation was not requested");
+                                                            } else if (deleg_assertion) {
                                                                 DOMElement* assertionElement = a2->marshall();
                                                                 deleg_assertion_str << *assertionElement;
                                                             }
@@ -807,7 +1253,7 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                             }
                                                         }
                                                         if (assertions.empty()) {
-                                                            cerr << "no valid assertions available to inspect for attribute mapped to local-login-user" << endl;
+                                                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "no valid assertions available to inspect for attribute mapped to local-login-user");
                                                             retbool = 0;
                                                         }
                                                         const XMLCh* protocol = samlconstants::SAML20P_NS;
@@ -815,10 +1261,10 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                         tokens.assign(assertions.begin(),assertions.end());
 
                                                         LocalResolver lr(nullptr,nullptr);
-                                                        ctx = lr.resolveAttributes(
+                                                        releaseSAMLResolution(*resolution);
+                                                        *resolution = newSAMLResolution(lr.resolveAttributes(
                                                             *app,entity.second,protocol,nullptr,v2name,
-                                                                nullptr,nullptr,&tokens);
-                                                        // auto_ptr<ResolutionContext> wrapper(ctx); NOTE: ctx now static to enable later retrieval of attributes
+                                                                nullptr,nullptr,&tokens));
                                                         if (v2name != nullptr) {
                                                             char *tmp;
                                                             initiatorName += (tmp = xercesc::XMLString::transcode(v2name->getName()));
@@ -838,11 +1284,14 @@ extern "C" int verifySAMLResponse(const char* saml, int len, char** initiator_na
                                                             initiatorName += v2name->getSPProvidedID()?(tmp = xercesc::XMLString::transcode(v2name->getSPProvidedID())):"";
                                                             xercesc::XMLString::release(&tmp);
                                                         }
+                                                        // XMLTooling parsed this as UTC along with the assertion
                                                         if (session_not_on_or_after != nullptr && session_expiry != NULL) {
-                                                            char *tmp = XMLString::transcode(session_not_on_or_after->getFormattedString());
-                                                            *session_expiry = strdup(tmp);
-fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session_not_on_or_after->getYear());
-                                                            XMLString::release(&tmp);
+                                                            *session_expiry = session_not_on_or_after->getEpoch();
+                                                            if (GSSEAP_TRACING(GSSEAP_TRACE_DEBUG)) {
+                                                                auto_ptr_char tmp(session_not_on_or_after->getFormattedString());
+                                                                gssEapTrace(GSSEAP_TRACE_DEBUG, "SessionNotOnOrAfter = %s (%ld)",
+                                                                            tmp.get(), (long)*session_expiry);
+                                                            }
                                                         }
                                                     }
                                                 }
@@ -850,7 +1299,7 @@ fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session
 
                                             for_each(assertions.begin(), assertions.end(), xmltooling::cleanup<saml2::Assertion>());
                                         } catch (bad_cast&) {
-                                            cerr << "caught a bad_cast while extracting message details" << endl;
+                                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "caught a bad_cast while extracting message details");
                                         }
                                     } else { // Message is not SAML20P_NS - problem!
                                         retbool = 0;
@@ -859,18 +1308,18 @@ fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session
 
                                     if (retbool) {
                                         try {
-                                            cerr << "Evaluating SecurityPolicy rules on Response" << endl;
+                                            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "Evaluating SecurityPolicy rules on Response");
                                             for ( size_t i = 0; i < policy.getRules().size(); ++i )
                                                 {
                                                 string rule_type = policy.getRules()[i]->getType();
                                                 if ( policy.getRules()[i]->evaluate(*response, nullptr, policy) )
-                                                    cerr << "SecurityPolicyRule '" << rule_type << "' passed." << endl;
+                                                    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "SecurityPolicyRule '%s' passed.", rule_type.c_str());
                                                 else
-                                                    cerr << "SecurityPolicyRule '" << rule_type << "' ignored." << endl;
+                                                    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "SecurityPolicyRule '%s' ignored.", rule_type.c_str());
                                                 }
                                         } catch (exception& ex) {
                                             retbool = 0;
-                                            cerr << "Caught exception evaluating SecurityPolicy on Response:"<< ex.what() << endl;
+                                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Caught exception evaluating SecurityPolicy on Response: %s", ex.what());
                                         }
                                     }
 
@@ -878,36 +1327,23 @@ fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session
                                         // Check destination URL.
                                         auto_ptr_char dest(response->getDestination());
                                         if (response->getSignature() && (!dest.get() || !*(dest.get()))) {
-                                            cerr << "Signed SAML message missing Destination attribute!" << endl;
+                                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Signed SAML message missing Destination attribute!");
                                             // return 0;
                                             retbool = 0;
+                                        } else if (dest.get() && *(dest.get()) && pending.acsURL != dest.get()) {
+                                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Destination %s is not the requested %s",
+                                                         dest.get(), pending.acsURL.c_str());
+                                            retbool = 0;
                                         }
                                     }
 
-                                    // Check for RelayState header.
-                                    // Do we need to do something "useful" with the RelayState?
-                                    if ((retbool) && (env->getHeader())) {
-                                        string relayState;
-                                        static const XMLCh RelayState[] = UNICODE_LITERAL_10(R,e,l,a,y,S,t,a,t,e);
-                                        const vector<XMLObject*>& blocks = const_cast<const Header*>(env->getHeader())->getUnknownXMLObjects();
-                                        vector<XMLObject*>::const_iterator h =
-                                            find_if(blocks.begin(), blocks.end(), hasQName(xmltooling::QName(samlconstants::SAML20ECP_NS, RelayState)));
-                                        const ElementProxy* ep = dynamic_cast<const ElementProxy*>(h != blocks.end() ? *h : nullptr);
-                                        if (ep) {
-                                            auto_ptr_char rs(ep->getTextContent());
-                                            if (rs.get())
-                                                relayState = rs.get();
-                                        }
-                                        cout << "relayState = " << relayState << endl;
-                                    }
-
                                     token.release();
                                     body->detach(); // frees Envelope
                                     response->detach();   // frees Body
                                 }
                             }
                         } else {
-                            cerr << "-----" << endl << "Decoded message was not a SOAP 1.1 Envelope" << endl << "-----" << endl;
+                            GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Decoded message was not a SOAP 1.1 Envelope");
                         }
 
                         /*
@@ -920,7 +1356,7 @@ fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session
 
                     } catch (exception & ex) {
                         retbool = 0;
-                        cerr << "Caught exception: " << ex.what() << endl;
+                        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "Caught exception: %s", ex.what());
                     }
 
                 // XXX This is here to force a cleanup of any role the
@@ -943,41 +1379,178 @@ fprintf(stderr, ">>>>>>>>>>>>>>SESSION NOT ON OR AFTER (%s)(%d)\n", tmp, session
     if (!deleg_assertion_str.str().empty())
         *delegated_assertions = strdup(deleg_assertion_str.str().c_str());
 
+    if (!retbool) {
+        releaseSAMLResolution(*resolution);
+        *resolution = nullptr;
+    }
+
     return retbool;
 }
 
+// Index the aliases of the resolved attributes. Called with res->mutex
+// held. 1 on success; 0 if memory ran out.
+static int indexResolution(gss_eap_saml_resolution* res)
+{
+    const vector<shibsp::Attribute*>& resolved = res->ctx->getResolvedAttributes();
+    size_t count = 0;
+
+    if (res->indexed)
+        return 1;
+
+    for (vector<shibsp::Attribute*>::const_iterator a = resolved.begin();
+         a != resolved.end();
+         ++a)
+        count += (*a)->getAliases().size();
+
+    if (!gssEapAttrIndexInit(&res->index, count))
+        return 0;
+
+    try {
+        for (vector<shibsp::Attribute*>::const_iterator a = resolved.begin();
+             a != resolved.end();
+             ++a) {
+            for (vector<string>::const_iterator s = (*a)->getAliases().begin();
+                 s != (*a)->getAliases().end();
+                 ++s) {
+                size_t i;
+
+                if (!gssEapAttrIndexFind(&res->index, s->data(), s->length(), &i)) {
+                    i = res->entries.size();
+                    if (!gssEapAttrIndexAdd(&res->index, s->data(), s->length(), i))
+                        throw std::bad_alloc();
+                    res->entries.push_back(gss_eap_saml_attribute());
+                    res->entries.back().alias = *s;
+                    res->entries.back().joined = false;
+                }
+
+                res->entries[i].attributes.push_back(*a);
+            }
+        }
+    } catch (std::bad_alloc& e) {
+        res->entries.clear();
+        gssEapAttrIndexRelease(&res->index);
+        return 0;
+    }
+
+    res->indexed = true;
+    return 1;
+}
+
+// The values of every attribute with this alias, joined by ";". Called
+// with res->mutex held; may throw std::bad_alloc.
+static const string& joinedValues(gss_eap_saml_attribute& entry)
+{
+    if (entry.joined)
+        return entry.values;
+
+    for (vector<const shibsp::Attribute*>::const_iterator a = entry.attributes.begin();
+         a != entry.attributes.end();
+         ++a) {
+        const vector<string>& values = (*a)->getSerializedValues();
+
+        for (vector<string>::const_iterator v = values.begin(); v != values.end(); ++v) {
+            if (!entry.values.empty())
+                entry.values += ";";
+            entry.values += *v;
+        }
+    }
+
+    entry.joined = true;
+    return entry.values;
+}
+
 // 1 on success; 0 on not found
-extern "C" int getSAMLAttribute(const char* attrib, char** value)
+extern "C" int getResolvedSAMLAttribute(gss_eap_saml_resolution* res,
+                                        const char* attrib, char** value)
 {
-    string localValue = "";
+    size_t i;
 
     *value = NULL;
 
-    if (ctx == nullptr)
+    if (res == nullptr)
         return 0;
 
-    for (vector<shibsp::Attribute*>::const_iterator a = ctx->getResolvedAttributes().begin(); 
-         a != ctx->getResolvedAttributes().end(); 
-         ++a) {
-        for (vector<string>::const_iterator s = (*a)->getAliases().begin(); 
-             s != (*a)->getAliases().end(); 
-             ++s) {
-            if (s->compare(attrib) == 0) {
-                for (vector<string>::const_iterator v=(*a)->getSerializedValues().begin();
-                     v != (*a)->getSerializedValues().end(); 
-                     ++v) {
-                    if (v != (*a)->getSerializedValues().begin())
-                        localValue += ";";
-                    localValue += *v;
+    pthread_mutex_lock(&res->mutex);
+
+    try {
+        if (indexResolution(res) &&
+            gssEapAttrIndexFind(&res->index, attrib, strlen(attrib), &i)) {
+            const string& localValue = joinedValues(res->entries[i]);
+
+            if (!localValue.empty())
+                *value = strdup(localValue.c_str());
+        }
+    } catch (std::bad_alloc& e) {
+    }
+
+    pthread_mutex_unlock(&res->mutex);
+
+    return *value != NULL;
+}
+
+static char* storeCountedString(char* p, const string& s)
+{
+    size_t len = s.length();
+
+    p[0] = (char)((len >> 24) & 0xff);
+    p[1] = (char)((len >> 16) & 0xff);
+    p[2] = (char)((len >>  8) & 0xff);
+    p[3] = (char)((len      ) & 0xff);
+    memcpy(p + 4, s.data(), len);
+
+    return p + 4 + len;
+}
+
+// Serialise every resolved attribute, as getResolvedSAMLAttribute()
+// would return it, into a list of (name, value) pairs each prefixed by
+// a 4 byte big-endian length. 1 on success; 0 if there are no
+// attributes or memory ran out.
+extern "C" int exportResolvedSAMLAttributes(gss_eap_saml_resolution* res,
+                                            char** attrs, size_t* length)
+{
+    size_t total = 0;
+
+    *attrs = NULL;
+    *length = 0;
+
+    if (res == nullptr)
+        return 0;
+
+    pthread_mutex_lock(&res->mutex);
+
+    try {
+        if (indexResolution(res)) {
+            vector<gss_eap_saml_attribute>::iterator e;
+
+            // Size the list first, so that it is written in one pass
+            for (e = res->entries.begin(); e != res->entries.end(); ++e) {
+                const string& values = joinedValues(*e);
+
+                if (!values.empty())
+                    total += 8 + e->alias.length() + values.length();
+            }
+
+            if (total != 0)
+                *attrs = (char*)malloc(total);
+
+            if (*attrs != NULL) {
+                char* p = *attrs;
+
+                for (e = res->entries.begin(); e != res->entries.end(); ++e) {
+                    if (e->values.empty())
+                        continue;
+
+                    p = storeCountedString(p, e->alias);
+                    p = storeCountedString(p, e->values);
                 }
+
+                *length = total;
             }
         }
+    } catch (std::bad_alloc& e) {
     }
 
-    if (localValue.empty())
-        return 0;
+    pthread_mutex_unlock(&res->mutex);
 
-    // TODO: check for allocation failure here and elsewhere.
-    *value = strdup(localValue.c_str());
-    return 1;
+    return *attrs != NULL;
 }
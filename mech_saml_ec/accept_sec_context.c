@@ -40,11 +40,9 @@
 #include <libxml/xmlreader.h>
 
 char* getSAMLRequest2(char *, int, int, int, char*);
-int verifySAMLResponse(const char*,int,char**,char**,char**,char**);
-int getSAMLAttribute(const char* attrib, char** value);
-
-static xmlChar *gl_generated_key = NULL;
-static xmlChar *gl_encryption_type = NULL;
+int verifySAMLResponse(const char*,int,const char*,char**,time_t*,char**,char**,
+                       struct gss_eap_saml_resolution**);
+void releaseSAMLResolution(struct gss_eap_saml_resolution *res);
 
 /*
  * Mark an acceptor context as ready for cryptographic operations
@@ -63,7 +61,8 @@ acceptReadyEap(OM_uint32 *minor, gss_ctx_id_t ctx, gss_cred_id_t cred)
                                &ctx->encryptionType);
 #else
     /* Cache encryption type specified by IdP */
-    major = krbStringToEnctype(gl_encryption_type, &ctx->encryptionType);
+    major = krbStringToEnctype(ctx->acceptorCtx.encryptionType,
+                               &ctx->encryptionType);
 #endif
     if (GSS_ERROR(major))
         return major;
@@ -101,11 +100,14 @@ acceptReadyEap(OM_uint32 *minor, gss_ctx_id_t ctx, gss_cred_id_t cred)
                                    ctx->encryptionType,
                                    &ctx->rfc3961Key);
 #else
+    uint64_t start = gssEapBeginPhase(ctx, GSS_EAP_PHASE_KEY_DERIVATION);
+
     major = gssEapDeriveRfc3961Key(minor,
-                                   gl_generated_key,
-                                   strlen(gl_generated_key),
+                                   (unsigned char *)ctx->acceptorCtx.generatedKey,
+                                   strlen(ctx->acceptorCtx.generatedKey),
                                    ctx->encryptionType,
                                    &ctx->rfc3961Key);
+    gssEapAddPhaseTime(ctx, GSS_EAP_PHASE_KEY_DERIVATION, start);
 #endif
     if (GSS_ERROR(major))
         return major;
@@ -189,24 +191,14 @@ eapGssSmAcceptVendorInfo(OM_uint32 *minor,
                          gss_buffer_t outputToken GSSEAP_UNUSED,
                          OM_uint32 *smFlags GSSEAP_UNUSED)
 {
-    if (MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "GSS-EAP: vendor: %.*s\n",
-            (int)inputToken->length, (char *)inputToken->value);
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "GSS-EAP: vendor: %.*s\n",
+                 (int)inputToken->length, (char *)inputToken->value);
 
     *minor = 0;
     return GSS_S_CONTINUE_NEEDED;
 }
 #endif
 
-static void random_hex(char* s, size_t len) {
-    static const char hexdigit[] = "0123456789abcdef";
-    size_t i;
-    for ( i = 0; i < len - 1; ++i )
-        s[i] = hexdigit[random() % (sizeof(hexdigit) - 1)];
-    s[len - 1] = 0;
-}
-
-
 /*
  * Emit a identity EAP request to force the initiator (peer) to identify
  * itself.
@@ -259,9 +251,8 @@ eapGssSmAcceptIdentity(OM_uint32 *minor,
     saml_req = getSAMLRequest2(NULL, 0, ctx->gssFlags & GSS_C_MUTUAL_FLAG,
                                 ctx->gssFlags & GSS_C_DELEG_FLAG, NULL);
     major = makeStringBuffer(minor, saml_req?:"", outputToken);
-    if (MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "--- SENDING SAML_AUTHREQUEST: ---\n%s\n", 
-           (char *)outputToken->value);
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "--- SENDING SAML_AUTHREQUEST: ---\n%s\n",
+                 (char *)outputToken->value);
     free(saml_req);
     saml_req = NULL;
 #endif
@@ -838,28 +829,33 @@ static struct gss_eap_sm eapGssAcceptorSm[] = {
 };
 
 
-/* Per timegm(3):
- * For a portable version of timegm(), set the TZ  environment
- * variable  to  UTC,  call mktime(3) and restore the value of
- * TZ.  Something like:
+#ifndef MECH_EAP
+/*
+ * The initiator must have a local-login-user attribute, whether from a
+ * fresh assertion or from a reauthentication ticket.
  */
-time_t
-my_timegm(struct tm *tm)
+static OM_uint32
+checkLocalLoginUser(OM_uint32 *minor, gss_ctx_id_t ctx)
 {
-    time_t ret;
-    char *tz;
-
-    tz = getenv("TZ");
-    setenv("TZ", "", 1);
-    tzset();
-    ret = mktime(tm);
-    if (tz)
-        setenv("TZ", tz, 1);
-    else
-        unsetenv("TZ");
-    tzset();
-    return ret;
+    OM_uint32 tmpMinor;
+    gss_buffer_desc localLogin = GSS_C_EMPTY_BUFFER;
+
+    if (GSS_ERROR(gssEapLocalLoginUser(&tmpMinor, ctx->initiatorName,
+                                       &localLogin))) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: local-login-user not available\n");
+        *minor = GSSEAP_BAD_INITIATOR_NAME;
+        return GSS_S_BAD_NAME;
+    }
+
+    GSSEAP_TRACE(GSSEAP_TRACE_NOTE, "local-login-user is (%.*s)\n",
+                 (int)localLogin.length, (char *)localLogin.value);
+    gss_release_buffer(&tmpMinor, &localLogin);
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
 }
+#endif
 
 
 OM_uint32
@@ -880,6 +876,8 @@ gssEapAcceptSecContext(OM_uint32 *minor,
     char *saml_req = NULL;
     int initialContextToken = (ctx->mechanismUsed == GSS_C_NO_OID);
     char *cb_type = NULL;
+    char *cb_data = NULL;
+    uint64_t phaseStart;
 #endif
 
     if (cred == GSS_C_NO_CREDENTIAL) {
@@ -898,9 +896,10 @@ gssEapAcceptSecContext(OM_uint32 *minor,
 
         cred = ctx->cred;
     }
-    else if (cred->name && MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "CRED NAME IS: %.*s\n", cred->name->username.length,
-                   cred->name->username.value);
+    else if (cred->name)
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "CRED NAME IS: %.*s\n",
+                     (int)cred->name->username.length,
+                     (char *)cred->name->username.value);
 
     /*
      * Previously we acquired the credential mutex here, but it should not be
@@ -941,13 +940,32 @@ gssEapAcceptSecContext(OM_uint32 *minor,
 
         GSSEAP_ASSERT(oidEqual(ctx->mechanismUsed, GSS_SAMLEC_MECHANISM));
 
-        /* Format of innerToken: [hok],[mutual-auth],[del] */
+        if (gssEapIsReauthToken(&innerToken)) {
+            major = gssEapReauthAccept(minor, ctx, &innerToken,
+                                       input_chan_bindings, output_token);
+            if (major == GSS_S_COMPLETE) {
+                major = checkLocalLoginUser(minor, ctx);
+                goto reauth;
+            } else if (major != GSS_S_DEFECTIVE_CREDENTIAL &&
+                       major != GSS_S_CREDENTIALS_EXPIRED) {
+                goto cleanup;
+            }
+
+            /* Fall back to a full login, and issue a fresh ticket */
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE, "NOTE: reauthentication ticket not "
+                         "accepted, sending SAML request\n");
+            ctx->flags |= CTX_FLAG_REAUTH_CREDS;
+            goto saml_request;
+        }
+
+        /* Format of innerToken: [hok],[mutual-auth],[del][,reauth] */
 
         /* TODO: hok (holder of key) has yet to be implemented */
 
         /* should see comma now */
         if (innerToken.length <= 0 || ((char *)innerToken.value)[0] != ',') {
-            fprintf(stderr, "ERROR: unexpected token content\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: unexpected token content\n");
             *minor = GSSEAP_WRONG_SIZE;
             major = GSS_S_DEFECTIVE_TOKEN;
             goto cleanup;
@@ -959,8 +977,8 @@ gssEapAcceptSecContext(OM_uint32 *minor,
         if (innerToken.length >= strlen(MECH_SAML_EC_MUTUAL_AUTH) &&
             strncmp(MECH_SAML_EC_MUTUAL_AUTH, innerToken.value,
                           strlen(MECH_SAML_EC_MUTUAL_AUTH)) == 0) {
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "NOTE: Mutual Authentication requested\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: Mutual Authentication requested\n");
             ctx->gssFlags |= GSS_C_MUTUAL_FLAG;
             innerToken.value += strlen(MECH_SAML_EC_MUTUAL_AUTH);
             innerToken.length -= strlen(MECH_SAML_EC_MUTUAL_AUTH);
@@ -968,7 +986,8 @@ gssEapAcceptSecContext(OM_uint32 *minor,
 
         /* should see comma now */
         if (innerToken.length <= 0 || ((char *)innerToken.value)[0] != ',') {
-            fprintf(stderr, "ERROR: unexpected token content\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: unexpected token content\n");
             *minor = GSSEAP_WRONG_SIZE;
             major = GSS_S_DEFECTIVE_TOKEN;
             goto cleanup;
@@ -980,22 +999,33 @@ gssEapAcceptSecContext(OM_uint32 *minor,
         if (innerToken.length >= strlen(MECH_SAML_EC_DELEG_REQ) &&
             strncmp(MECH_SAML_EC_DELEG_REQ, innerToken.value,
                           strlen(MECH_SAML_EC_DELEG_REQ)) == 0) {
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "NOTE: Credential Delegation requested\n");
-                fprintf(stderr, ">>>>>>>>>>>>>>>>>>>>>>>>NOTE: Credential Delegation requested\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: Credential Delegation requested\n");
             ctx->gssFlags |= GSS_C_DELEG_FLAG;
             innerToken.value += strlen(MECH_SAML_EC_DELEG_REQ);
             innerToken.length -= strlen(MECH_SAML_EC_DELEG_REQ);
         }
 
+        if (innerToken.length > strlen(MECH_SAML_EC_REAUTH_REQ) &&
+            ((char *)innerToken.value)[0] == ',' &&
+            strncmp(MECH_SAML_EC_REAUTH_REQ, (char *)innerToken.value + 1,
+                          strlen(MECH_SAML_EC_REAUTH_REQ)) == 0) {
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: Reauthentication ticket requested\n");
+            ctx->flags |= CTX_FLAG_REAUTH_CREDS;
+            innerToken.value += 1 + strlen(MECH_SAML_EC_REAUTH_REQ);
+            innerToken.length -= 1 + strlen(MECH_SAML_EC_REAUTH_REQ);
+        }
+
         if (innerToken.length) {
-            fprintf(stderr, "ERROR: unexpected token content\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: unexpected token content\n");
             *minor = GSSEAP_WRONG_SIZE;
             major = GSS_S_DEFECTIVE_TOKEN;
             goto cleanup;
         }
 
-        char *cb_data = NULL;
+saml_request:
         if (input_chan_bindings != GSS_C_NO_CHANNEL_BINDINGS &&
             input_chan_bindings->application_data.length != 0)
             base64Encode(input_chan_bindings->application_data.value,
@@ -1004,11 +1034,13 @@ gssEapAcceptSecContext(OM_uint32 *minor,
         if (cb_data != NULL) {
             major = readChannelBindingsType(&tmpMinor, &cb_type);
             if (major != GSS_S_COMPLETE) {
-                fprintf(stderr, "ERROR: Couldn't find Channel Bindings Type\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: Couldn't find Channel Bindings Type\n");
                 goto cleanup;
             }
         }
 
+        phaseStart = gssEapBeginPhase(ctx, GSS_EAP_PHASE_AUTHN_REQUEST);
         if (cred->name)
             saml_req = getSAMLRequest2(cred->name->username.value,
                                 cred->name->username.length,
@@ -1018,6 +1050,7 @@ gssEapAcceptSecContext(OM_uint32 *minor,
             saml_req = getSAMLRequest2(NULL, 0,
                                 ctx->gssFlags & GSS_C_MUTUAL_FLAG,
                                 ctx->gssFlags & GSS_C_DELEG_FLAG, cb_data);
+        gssEapAddPhaseTime(ctx, GSS_EAP_PHASE_AUTHN_REQUEST, phaseStart);
         if (cb_data != NULL) {
             GSSEAP_FREE(cb_data); cb_data = NULL;
         }
@@ -1028,27 +1061,35 @@ gssEapAcceptSecContext(OM_uint32 *minor,
             major = GSS_S_FAILURE;
 
         if (!GSS_ERROR(major)) {
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "--- SENDING SAML_AUTHREQUEST: ---\n%s\n", 
-                   (char *)output_token->value);
-                major = GSS_S_CONTINUE_NEEDED;
-                ctx->state = GSSEAP_STATE_AUTHENTICATE;
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                         "--- SENDING SAML_AUTHREQUEST: ---\n%s\n",
+                         (char *)output_token->value);
+            major = GSS_S_CONTINUE_NEEDED;
+            ctx->state = GSSEAP_STATE_AUTHENTICATE;
         }
     } else {
 
-        // TODO: have verifySAMLResponse return any value found in
-        // SessionNotOnOrAfter in AuthnStatement and set ctx->expiryTime
-        // to that value.
         char* initiator_name = NULL;
-        char* session_not_on_or_after = NULL;
+        time_t session_not_on_or_after = 0;
         char* delegated_assertions = NULL;
-        if (gl_generated_key != NULL) {
-            free(gl_generated_key); gl_generated_key = NULL;
-        }
+        char* advice = NULL;
+        struct gss_eap_saml_resolution *resolution = NULL;
+        /* Must match those the request was sent with */
+        if (input_chan_bindings != GSS_C_NO_CHANNEL_BINDINGS &&
+            input_chan_bindings->application_data.length != 0)
+            base64Encode(input_chan_bindings->application_data.value,
+                input_chan_bindings->application_data.length, &cb_data);
+
+        phaseStart = gssEapBeginPhase(ctx, GSS_EAP_PHASE_VERIFY_RESPONSE);
         int result = verifySAMLResponse((char*)input_token->value,
-                                        (int)input_token->length,
+                                        (int)input_token->length, cb_data,
                                         &initiator_name, &session_not_on_or_after,
-                                        &gl_generated_key, &delegated_assertions);
+                                        &advice, &delegated_assertions,
+                                        &resolution);
+        gssEapAddPhaseTime(ctx, GSS_EAP_PHASE_VERIFY_RESPONSE, phaseStart);
+        if (cb_data != NULL) {
+            GSSEAP_FREE(cb_data); cb_data = NULL;
+        }
 
         if (result) {
             xmlDocPtr doc_from_client = xmlReadMemory(input_token->value, input_token->length, "FROMCLIENT", NULL, 0);
@@ -1058,8 +1099,8 @@ gssEapAcceptSecContext(OM_uint32 *minor,
 
             if (initiator_name) {
                 gss_buffer_desc buf = {0, NULL};
-                if (MECH_SAML_EC_DEBUG)
-                    fprintf(stdout,"initiator name = '%s'\n",initiator_name);
+                GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                             "initiator name = '%s'\n", initiator_name);
                 major = makeStringBuffer(minor, initiator_name, &buf);
                 if (major == GSS_S_COMPLETE)
                     major = gssEapImportName(minor, &buf, GSS_C_NT_USER_NAME,
@@ -1067,41 +1108,28 @@ gssEapAcceptSecContext(OM_uint32 *minor,
                 major = GSS_S_COMPLETE;
                 ctx->state = GSSEAP_STATE_ESTABLISHED;
             } else {
-                fprintf(stderr, "ERROR: initiator name not available\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: initiator name not available\n");
                 major = GSS_S_BAD_NAME;
                 *minor = GSSEAP_BAD_INITIATOR_NAME;
                 goto verify_cleanup;
             }
 
-            if (session_not_on_or_after) {
-                struct tm session_tm;
-                memset(&session_tm, 0, sizeof(session_tm));
-                sscanf(session_not_on_or_after, "%d-%d-%dT%d:%d:%d.",
-                              &session_tm.tm_year, &session_tm.tm_mon,
-                              &session_tm.tm_mday, &session_tm.tm_hour,
-                              &session_tm.tm_min, &session_tm.tm_sec);
-                /* TODO VSY: check sscanf succeeded */
-                session_tm.tm_year -= 1900; /* tm_year is number of years since 1900 */
-                session_tm.tm_mon -= 1; /* month value should be 0 thru 11 */
-                session_tm.tm_isdst = -1; /* DST not known */
-                ctx->expiryTime = my_timegm(&session_tm);
-                printf("CONTEXT VALID FOR (%d) SECONDS!\n", ctx->expiryTime - time(NULL));
-                if (MECH_SAML_EC_DEBUG)
-                    fprintf(stdout, "session_not_on_or_after is (%s);"
-                              " (%d)(%d)(%d)T(%d)(%d)(%d)\n",
-                              session_not_on_or_after,
-                              session_tm.tm_year, session_tm.tm_mon,
-                              session_tm.tm_mday, session_tm.tm_hour,
-                              session_tm.tm_min, session_tm.tm_sec);
+            if (session_not_on_or_after != 0) {
+                ctx->expiryTime = session_not_on_or_after;
+                GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                             "CONTEXT VALID FOR (%ld) SECONDS!\n",
+                             (long)(ctx->expiryTime - time(NULL)));
             } else {
-                fprintf(stderr, "WARNING: SessionNotOnOrAfter not available;"
-                                " defaulting to indefinite context validity.\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                             "WARNING: SessionNotOnOrAfter not available;"
+                             " defaulting to indefinite context validity.\n");
             }
 
             if (delegated_assertions != NULL && delegated_cred_handle != NULL) {
                 
-                if (MECH_SAML_EC_DEBUG)
-                    printf("NOTE: Delegated Assertion(s): (%s)", delegated_assertions);
+                GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                             "NOTE: Delegated Assertion(s): (%s)", delegated_assertions);
 
                 major = gssEapAcquireCred(minor, ctx->initiatorName,
                                       GSS_C_INDEFINITE /* timeReq TODO: ENABLE THIS in gssEapAcquireCred*/,
@@ -1109,8 +1137,9 @@ gssEapAcceptSecContext(OM_uint32 *minor,
                                       GSS_C_INITIATE, delegated_cred_handle,
                                       NULL, NULL);
                 if (GSS_ERROR(major)) {
-                    fprintf(stderr, "ERROR: gssEapAcquireCred failed for delegated "
-                                    "credential\n");
+                    GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                 "ERROR: gssEapAcquireCred failed for delegated "
+                                 "credential\n");
                     goto verify_cleanup;
                 }
 
@@ -1118,15 +1147,17 @@ gssEapAcceptSecContext(OM_uint32 *minor,
                 major = makeStringBuffer(minor, delegated_assertions,
                                     &buf);
                 if (GSS_ERROR(major)) {
-                    fprintf(stderr, "ERROR: makeStringBuffer failed for delegated "
-                                    "credential\n");
+                    GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                 "ERROR: makeStringBuffer failed for delegated "
+                                 "credential\n");
                     goto verify_cleanup;
                 }
 
                 major = gssEapSetCredDelegAssertions(minor, delegated_cred_handle, &buf);
                 if (GSS_ERROR(major)) {
-                    fprintf(stderr, "ERROR: gssEapSetCredDelegAssertions failed for delegated "
-                                    "credential\n");
+                    GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                 "ERROR: gssEapSetCredDelegAssertions failed for delegated "
+                                 "credential\n");
                     goto verify_cleanup;
                 }
 
@@ -1137,55 +1168,73 @@ gssEapAcceptSecContext(OM_uint32 *minor,
             // is able to return the actual key instead of the whole Advice XML
             xmlDocPtr advice_from_idp = NULL;
             xmlNode *gen_key = NULL;
-            if (gl_generated_key == NULL ||
-                (advice_from_idp = xmlReadMemory(gl_generated_key,
-                            strlen(gl_generated_key), "ADVICE", NULL, 0)) == NULL ||
+            if (advice == NULL ||
+                (advice_from_idp = xmlReadMemory(advice,
+                            strlen(advice), "ADVICE", NULL, 0)) == NULL ||
                 (gen_key = getXmlElement(xmlDocGetRootElement(advice_from_idp),
                  "GeneratedKey", MECH_SAML_EC_SAMLEC_NS)) == NULL) {
                 if (getenv("MECH_SAML_EC_FORCE_SAMPLE_KEY")) {
-                    fprintf(stderr, "WARNING: No GeneratedKey in SAML Response from IdP; "
-                            "Since MECH_SAML_EC_FORCE_SAMPLE_KEY is set in the "
-                            "environment, forcing use of a sample key!\n");
+                    GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                                 "WARNING: No GeneratedKey in SAML Response from IdP; "
+                                 "Since MECH_SAML_EC_FORCE_SAMPLE_KEY is set in the "
+                                 "environment, forcing use of a sample key!\n");
 
-                    gl_generated_key = strdup("3w1wSBKUosRLsU69xGK7dg==");
+                    ctx->acceptorCtx.generatedKey =
+                        strdup("3w1wSBKUosRLsU69xGK7dg==");
                 } else {
-                    fprintf(stderr, "ERROR: No GeneratedKey in SAML assertion from IdP; "
-                        "To force use of a sample key set "
-                        "MECH_SAML_EC_FORCE_SAMPLE_KEY in the "
-                        "environment!\n");
+                    GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                                 "ERROR: No GeneratedKey in SAML assertion from IdP; "
+                                 "To force use of a sample key set "
+                                 "MECH_SAML_EC_FORCE_SAMPLE_KEY in the "
+                                 "environment!\n");
                     *minor = GSSEAP_KEY_UNAVAILABLE;
                     major = GSS_S_FAILURE;
                     goto verify_cleanup;
                 }
             } else
-                gl_generated_key = xmlNodeGetContent(gen_key);
+                ctx->acceptorCtx.generatedKey =
+                    (char *)xmlNodeGetContent(gen_key);
+            if (ctx->acceptorCtx.generatedKey == NULL) {
+                *minor = ENOMEM;
+                major = GSS_S_FAILURE;
+                goto verify_cleanup;
+            }
 
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "GeneratedKey (%s)\n", gl_generated_key);
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                         "GeneratedKey (%s)\n", ctx->acceptorCtx.generatedKey);
 
             if ((session_key = getXmlElement(xmlDocGetRootElement(doc_from_client), "SessionKey", MECH_SAML_EC_SAMLEC_NS)) != NULL &&
                 (enc_type = getXmlElement(session_key->children, "EncType", MECH_SAML_EC_SAMLEC_NS)) != NULL) {
-                gl_encryption_type = xmlNodeGetContent(enc_type);
+                ctx->acceptorCtx.encryptionType =
+                    (char *)xmlNodeGetContent(enc_type);
             } else {
-                fprintf(stderr, "ERROR: SessionKey/EncType not sent by initiator(client)\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: SessionKey/EncType not sent by initiator(client)\n");
                 major = GSS_S_FAILURE;
                 *minor = GSSEAP_KEY_UNAVAILABLE;
                 goto verify_cleanup;
             }
 
-            char *local_login = NULL;
-            if (getSAMLAttribute("local-login-user", &local_login) == 1)
-            {
-                fprintf(stdout, "local-login-user is (%s)\n", local_login);
-                free(local_login); local_login = NULL;
-            } else {
-                fprintf(stderr, "ERROR: local-login-user not available\n");
-                major = GSS_S_BAD_NAME;
-                *minor = GSSEAP_BAD_INITIATOR_NAME;
-                goto verify_cleanup;
+            /* Keep the attributes with the name, for reauthentication */
+            if (ctx->initiatorName != GSS_C_NO_NAME) {
+                major = gssEapImportSamlAttributes(minor, ctx->initiatorName,
+                                                   resolution);
+                if (GSS_ERROR(major))
+                    goto verify_cleanup;
             }
 
+            major = checkLocalLoginUser(minor, ctx);
+            if (GSS_ERROR(major))
+                goto verify_cleanup;
+
+            /* acceptReadyEap() resets the expiry time */
+            time_t sessionExpiryTime = ctx->expiryTime;
+
             major = acceptReadyEap(minor, ctx, cred);
+            if (major == GSS_S_COMPLETE &&
+                (ctx->flags & CTX_FLAG_REAUTH_CREDS))
+                major = gssEapMakeReauthCreds(minor, ctx, sessionExpiryTime,
+                                              output_token);
         } else {
             major = GSS_S_FAILURE;
             *minor = GSSEAP_PEER_AUTH_FAILURE;
@@ -1193,8 +1242,14 @@ gssEapAcceptSecContext(OM_uint32 *minor,
 
 verify_cleanup:
         free(initiator_name); initiator_name = NULL;
-        free(session_not_on_or_after); session_not_on_or_after = NULL;
+        if (advice != NULL) {
+            gssEapSecureZero(advice, strlen(advice));
+            free(advice); advice = NULL;
+        }
+        releaseSAMLResolution(resolution);
     }
+
+reauth:
 #endif
     if (GSS_ERROR(major))
         goto cleanup;
@@ -1219,10 +1274,9 @@ verify_cleanup:
             major = gssEapDuplicateName(&tmpMinor, ctx->initiatorName, src_name);
             if (GSS_ERROR(major))
                 goto cleanup;
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "SOURCE NAME IS (%.*s)\n",
-                                   ctx->initiatorName->username.length,
-                                   (char *)(ctx->initiatorName->username.value));
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "SOURCE NAME IS (%.*s)\n",
+                         (int)ctx->initiatorName->username.length,
+                         (char *)(ctx->initiatorName->username.value));
         }
         if (time_rec != NULL) {
             major = gssEapContextTime(&tmpMinor, ctx, time_rec);
@@ -1288,6 +1342,16 @@ gss_accept_sec_context(OM_uint32 *minor,
                                    time_rec,
                                    delegated_cred_handle);
 
+    GSSEAP_PROBE3(accept__done, ctx, major, *minor);
+
+    if (major == GSS_S_COMPLETE) {
+        gssEapMetricIncrement(GSSEAP_METRIC_ACCEPT_COMPLETE);
+        gssEapTracePhaseTimes(ctx);
+    } else if (GSS_ERROR(major))
+        gssEapMetricFailure(GSSEAP_METRIC_ACCEPT_FAILURE, *minor);
+    else
+        gssEapMetricIncrement(GSSEAP_METRIC_ACCEPT_CONTINUE);
+
     GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
 
     if (GSS_ERROR(major))
@@ -38,15 +38,31 @@
 
 OM_uint32 GSSAPI_CALLCONV
 gssspi_authorize_localname(OM_uint32 *minor,
-                           const gss_name_t name GSSEAP_UNUSED,
-                           gss_const_buffer_t local_user GSSEAP_UNUSED,
+                           const gss_name_t name,
+                           gss_const_buffer_t local_user,
                            gss_const_OID local_nametype GSSEAP_UNUSED)
 {
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+    OM_uint32 major, tmpMinor;
+    gss_buffer_desc localLogin;
+    int authorized;
+
+    /* The mapping is kept with the name, so this is cheap when repeated */
+    major = gssEapLocalLoginUser(minor, name, &localLogin);
+    if (major == GSS_S_COMPLETE) {
+        authorized = gssEapLocalLoginUserMatch(&localLogin, local_user->value,
+                                               local_user->length);
+        gss_release_buffer(&tmpMinor, &localLogin);
+        if (authorized)
+            return GSS_S_COMPLETE;
+    }
+#endif
+
     /*
      * The MIT mechglue will fallback to comparing names in the absence
      * of a mechanism implementation of gss_userok. To avoid this and
      * force the mechglue to use attribute-based authorization, always
-     * return access denied here.
+     * return access denied here unless the name maps to the local user.
      */
 
     *minor = 0;
@@ -44,6 +44,7 @@ gssEapInitiatorInit(OM_uint32 *minor)
     OM_uint32 major;
 
     initialize_eapg_error_table();
+    gssEapTraceInit();
 
     *minor = 0;
     return GSS_S_COMPLETE;
@@ -60,6 +61,7 @@ gssEapFinalize(void)
 #ifdef MECH_EAP
     eap_peer_unregister_methods();
 #endif
+    gssEapTraceFlush();
 }
 
 #ifdef GSSEAP_CONSTRUCTOR
@@ -101,10 +101,11 @@ cleanup:
 }
 #endif /* GSSEAP_ENABLE_ACCEPTOR */
 
-OM_uint32
-gssEapExportSecContext(OM_uint32 *minor,
-                       gss_ctx_id_t ctx,
-                       gss_buffer_t token)
+#ifdef MECH_EAP
+static OM_uint32
+exportContextV1(OM_uint32 *minor,
+                gss_ctx_id_t ctx,
+                gss_buffer_t token)
 {
     OM_uint32 major, tmpMinor;
     size_t length;
@@ -113,12 +114,6 @@ gssEapExportSecContext(OM_uint32 *minor,
     gss_buffer_desc partialCtx = GSS_C_EMPTY_BUFFER;
     unsigned char *p;
 
-    if ((CTX_IS_INITIATOR(ctx) && !CTX_IS_ESTABLISHED(ctx)) ||
-        ctx->mechanismUsed == GSS_C_NO_OID) {
-        *minor = GSSEAP_CONTEXT_INCOMPLETE;
-        return GSS_S_NO_CONTEXT;
-    }
-
     if (ctx->initiatorName != GSS_C_NO_NAME) {
         major = gssEapExportNameInternal(minor, ctx->initiatorName,
                                          &initiatorName,
@@ -202,6 +197,171 @@ cleanup:
 
     return major;
 }
+#else
+/*
+ * Version 2 context tokens carry the context key and the initiator's
+ * SAML attributes, so that a context established in one process can
+ * be used for per-message operations in another. Every field is at a
+ * fixed offset or length-prefixed, so that a token can be validated
+ * in full before anything is allocated:
+ *
+ *      version         EAP_EXPORT_CONTEXT_V2
+ *      length          of the whole token
+ *      state
+ *      flags
+ *      gssFlags
+ *      checksumType
+ *      encryptionType
+ *      expiryTime      64-bit
+ *      sendSeq         64-bit
+ *      recvSeq         64-bit
+ *      mechanismUsed   OID, length-prefixed
+ *      rfc3961Key      key contents, length-prefixed
+ *      initiatorName   exported name without mechanism OID, length-prefixed
+ *      acceptorName    exported name without mechanism OID, length-prefixed
+ *      attributes      see gssEapGetSamlAttribute(), length-prefixed
+ *      seqState        length-prefixed
+ *      partialCtx      unestablished acceptor contexts only
+ *
+ * all integers being 32-bit big endian unless noted. Absent optional
+ * fields have zero length.
+ */
+static size_t
+nameLengthV2(gss_name_t name)
+{
+    return (name != GSS_C_NO_NAME) ? 4 + name->username.length : 0;
+}
+
+static unsigned char *
+storeNameV2(gss_name_t name, unsigned char *p)
+{
+    store_uint32_be(nameLengthV2(name), p);
+    p += 4;
+
+    if (name != GSS_C_NO_NAME)
+        p = store_buffer(&name->username, p, FALSE);
+
+    return p;
+}
+
+static OM_uint32
+exportContextV2(OM_uint32 *minor,
+                gss_ctx_id_t ctx,
+                gss_buffer_t token)
+{
+    OM_uint32 major, tmpMinor;
+    size_t length, seqLength = 0;
+    gss_buffer_desc key = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc attributes = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc partialCtx = GSS_C_EMPTY_BUFFER;
+    unsigned char *p;
+
+    key.length = KRB_KEY_LENGTH(&ctx->rfc3961Key);
+    key.value = KRB_KEY_DATA(&ctx->rfc3961Key);
+
+#ifdef GSSEAP_ENABLE_ACCEPTOR
+    if (ctx->initiatorName != GSS_C_NO_NAME) {
+        major = gssEapMaterializeSamlAttributes(minor, ctx->initiatorName);
+        if (GSS_ERROR(major))
+            goto cleanup;
+
+        gssEapGetSamlAttributesList(ctx->initiatorName, &attributes);
+    }
+
+    if (!CTX_IS_INITIATOR(ctx) && !CTX_IS_ESTABLISHED(ctx) &&
+        (ctx->flags & CTX_FLAG_KRB_REAUTH) == 0) {
+        major = gssEapExportPartialContext(minor, ctx, &partialCtx);
+        if (GSS_ERROR(major))
+            goto cleanup;
+    }
+#endif
+
+    if (ctx->seqState != NULL)
+        seqLength = sequenceSize(ctx->seqState);
+
+    length  = 52;                                   /* fixed fields */
+    length += 4 + ctx->mechanismUsed->length;       /* mechanismUsed */
+    length += 4 + key.length;                       /* rfc3961Key */
+    length += 4 + nameLengthV2(ctx->initiatorName); /* initiatorName */
+    length += 4 + nameLengthV2(ctx->acceptorName);  /* acceptorName */
+    length += 4 + attributes.length;                /* attributes */
+    length += 4 + seqLength;                        /* seqState */
+
+    if (partialCtx.value != NULL)
+        length += 4 + partialCtx.length;            /* partialCtx */
+
+    token->value = GSSEAP_MALLOC(length);
+    if (token->value == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+    token->length = length;
+
+    p = (unsigned char *)token->value;
+
+    store_uint32_be(EAP_EXPORT_CONTEXT_V2, &p[0]);
+    store_uint32_be(length,                &p[4]);
+    store_uint32_be(GSSEAP_SM_STATE(ctx),  &p[8]);
+    store_uint32_be(ctx->flags,            &p[12]);
+    store_uint32_be(ctx->gssFlags,         &p[16]);
+    store_uint32_be(ctx->checksumType,     &p[20]);
+    store_uint32_be(ctx->encryptionType,   &p[24]);
+    store_uint64_be(ctx->expiryTime,       &p[28]);
+    store_uint64_be(ctx->sendSeq,          &p[36]);
+    store_uint64_be(ctx->recvSeq,          &p[44]);
+    p = store_oid(ctx->mechanismUsed,      &p[52]);
+
+    p = store_buffer(&key,                 p, FALSE);
+    p = storeNameV2(ctx->initiatorName,    p);
+    p = storeNameV2(ctx->acceptorName,     p);
+    p = store_buffer(&attributes,          p, FALSE);
+
+    store_uint32_be(seqLength, p);
+    p += 4;
+    if (seqLength != 0) {
+        major = sequenceExternalize(minor, ctx->seqState, &p, &seqLength);
+        if (GSS_ERROR(major))
+            goto cleanup;
+    }
+
+    if (partialCtx.value != NULL)
+        p = store_buffer(&partialCtx, p, FALSE);
+
+    GSSEAP_ASSERT(p == (unsigned char *)token->value + token->length);
+
+    major = GSS_S_COMPLETE;
+    *minor = 0;
+
+cleanup:
+    if (GSS_ERROR(major)) {
+        if (token->value != NULL)
+            memset(token->value, 0, token->length);
+        gss_release_buffer(&tmpMinor, token);
+    }
+    gss_release_buffer(&tmpMinor, &partialCtx);
+
+    return major;
+}
+#endif /* MECH_EAP */
+
+OM_uint32
+gssEapExportSecContext(OM_uint32 *minor,
+                       gss_ctx_id_t ctx,
+                       gss_buffer_t token)
+{
+    if ((CTX_IS_INITIATOR(ctx) && !CTX_IS_ESTABLISHED(ctx)) ||
+        ctx->mechanismUsed == GSS_C_NO_OID) {
+        *minor = GSSEAP_CONTEXT_INCOMPLETE;
+        return GSS_S_NO_CONTEXT;
+    }
+
+#ifdef MECH_EAP
+    return exportContextV1(minor, ctx, token);
+#else
+    return exportContextV2(minor, ctx, token);
+#endif
+}
 
 OM_uint32 GSSAPI_CALLCONV
 gss_export_sec_context(OM_uint32 *minor,
@@ -223,11 +383,7 @@ gss_export_sec_context(OM_uint32 *minor,
 
     GSSEAP_MUTEX_LOCK(&ctx->mutex);
 
-#ifdef MECH_EAP
     major = gssEapExportSecContext(minor, ctx, interprocess_token);
-#else
-    major = GSS_S_UNAVAILABLE;
-#endif
     if (GSS_ERROR(major)) {
         GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
         return major;
@@ -82,10 +82,7 @@ gss_get_mic(OM_uint32 *minor,
 
     *message_token = iov[1].buffer;
 
-    if (MECH_SAML_EC_DEBUG) {
-        fprintf(stdout, "MIC TOKEN GENERATED IS: \n");
-        printBuffer(stdout, message_token);
-    }
+    traceBuffer(GSSEAP_TRACE_DEBUG, "MIC TOKEN GENERATED IS: ", message_token);
 
 cleanup:
     GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
@@ -36,10 +36,6 @@
  * Wrapper for retrieving a naming attribute.
  */
 
-#ifndef MECH_EAP
-int getSAMLAttribute(const char* attrib, char** value);
-#endif
-
 OM_uint32 GSSAPI_CALLCONV
 gss_get_name_attribute(OM_uint32 *minor,
                        gss_name_t name,
@@ -71,11 +67,16 @@ gss_get_name_attribute(OM_uint32 *minor,
     char *attr_str = NULL;
     major = bufferToString(minor, attr, &attr_str);
     if (major == GSS_S_COMPLETE) {
-        if (getSAMLAttribute(attr_str, &value->value) == 1) {
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "gss_get_name_attribute():"
-                            " attribute (%s) has value (%s)\n",
-                            attr_str, value->value);
+        int found;
+
+        GSSEAP_MUTEX_LOCK(&name->mutex);
+        found = gssEapGetSamlAttribute(name, attr_str, (char **)&value->value);
+        GSSEAP_MUTEX_UNLOCK(&name->mutex);
+
+        if (found == 1) {
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "gss_get_name_attribute():"
+                         " attribute (%s) has value (%s)\n",
+                         attr_str, (char *)value->value);
             value->length = strlen(value->value);
             if (authenticated != NULL)
                 *authenticated = 1;
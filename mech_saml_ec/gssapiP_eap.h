@@ -101,7 +101,12 @@ extern "C" {
 #endif /* GSSEAP_ENABLE_ACCEPTOR */
 
 #include "gsseap_err.h"
+#include "util_trace.h"
 #include "util.h"
+#include "util_attr_index.h"
+#include "util_reauth.h"
+#include "util_metrics.h"
+#include "util_random.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -115,18 +120,33 @@ extern "C" {
 struct gss_eap_saml_attr_ctx;
 struct gss_eap_attr_ctx;
 
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+/* SAML EC attributes, shared between duplicated names */
+struct gss_eap_saml_attrs {
+    GSSEAP_REFCOUNT refs;
+    gss_buffer_desc list; /* see gssEapGetSamlAttribute() */
+    struct gss_eap_attr_index index; /* into list */
+};
+#endif
+
 #ifdef HAVE_HEIMDAL_VERSION
 struct gss_name_t_desc_struct
 #else
 struct gss_name_struct
 #endif
 {
-    GSSEAP_MUTEX mutex; /* mutex protects attrCtx */
+    GSSEAP_MUTEX mutex; /* mutex protects attrCtx, samlAttrs, localLogin */
     OM_uint32 flags;
     gss_OID mechanismUsed; /* this is immutable */
     gss_buffer_desc username;
+    struct gss_eap_interned_name *interned; /* as username, or NULL */
 #ifdef GSSEAP_ENABLE_ACCEPTOR
     struct gss_eap_attr_ctx *attrCtx;
+#ifndef MECH_EAP
+    struct gss_eap_saml_attrs *samlAttrs; /* shared, never modified */
+    struct gss_eap_saml_resolution *samlResolution; /* not yet serialised */
+    gss_buffer_desc localLogin; /* mapped on first use */
+#endif
 #endif
 };
 
@@ -151,6 +171,7 @@ struct gss_cred_id_struct
     gss_buffer_desc password;
 #ifndef MECH_EAP
     gss_buffer_desc deleg_assertions;
+    struct gss_eap_reauth_creds *reauthCreds; /* for initiator */
 #endif
     gss_OID_set mechanisms;
     time_t expiryTime;
@@ -164,6 +185,7 @@ struct gss_cred_id_struct
 
 #define CTX_FLAG_INITIATOR                  0x00000001
 #define CTX_FLAG_KRB_REAUTH                 0x00000002
+#define CTX_FLAG_REAUTH_CREDS               0x00000004
 
 #define CTX_IS_INITIATOR(ctx)               (((ctx)->flags & CTX_FLAG_INITIATOR) != 0)
 
@@ -184,6 +206,11 @@ struct gss_cred_id_struct
 struct gss_eap_initiator_ctx {
     unsigned int idleWhile;
     struct eap_sm *eap;
+#ifndef MECH_EAP
+    time_t reauthTime;
+    unsigned char reauthNonce[GSSEAP_REAUTH_NONCE_LENGTH];
+    char *generatedKey;             /* GeneratedKey from the IdP */
+#endif
 };
 
 #ifdef GSSEAP_ENABLE_ACCEPTOR
@@ -194,10 +221,26 @@ struct gss_eap_acceptor_ctx {
     gss_buffer_desc state;
 #ifdef MECH_EAP
     VALUE_PAIR *vps;
+#else
+    char *generatedKey;             /* GeneratedKey from the IdP */
+    char *encryptionType;           /* EncType sent by the initiator */
 #endif
 };
 #endif
 
+/*
+ * RFC 3961 lengths from which RFC 4121 token sizes are derived. These
+ * depend only on the encryption type, so are looked up once per key.
+ */
+struct gss_eap_wrap_lengths {
+    krb5_enctype enctype;
+    size_t krbHeaderLen;
+    size_t krbTrailerLen;
+    size_t krbPaddingLen;
+    size_t krbChecksumLen;
+    size_t krbBlockSize;
+};
+
 #ifdef HAVE_HEIMDAL_VERSION
 struct gss_ctx_id_t_desc_struct
 #else
@@ -212,6 +255,8 @@ struct gss_ctx_id_struct
     krb5_cksumtype checksumType;
     krb5_enctype encryptionType;
     krb5_keyblock rfc3961Key;
+    struct gss_eap_wrap_lengths wrapLengths;
+    struct gss_eap_aesni_key *aesNiKey;
     gss_name_t initiatorName;
     gss_name_t acceptorName;
     time_t expiryTime;
@@ -228,6 +273,7 @@ struct gss_ctx_id_struct
     } ctxU;
     const struct gss_eap_token_buffer_set *inputTokens;
     const struct gss_eap_token_buffer_set *outputTokens;
+    uint64_t phaseTimes[GSS_EAP_PHASE_MAX + 1]; /* microseconds, by phase */
 };
 
 #define TOK_FLAG_SENDER_IS_ACCEPTOR         0x01
@@ -239,6 +285,12 @@ struct gss_ctx_id_struct
 #define KEY_USAGE_INITIATOR_SEAL            24
 #define KEY_USAGE_INITIATOR_SIGN            25
 
+/* RFC 4120 application key usages, for fast reauthentication */
+#define KEY_USAGE_REAUTH_TICKET             1024
+#define KEY_USAGE_REAUTH_CREDS              1025
+#define KEY_USAGE_REAUTH_REQ                1026
+#define KEY_USAGE_REAUTH_RESP               1027
+
 /* accept_sec_context.c */
 OM_uint32
 gssEapAcceptSecContext(OM_uint32 *minor,
@@ -296,6 +348,15 @@ gssEapWrapIovLength(OM_uint32 *minor,
                     int *conf_state,
                     gss_iov_buffer_desc *iov,
                     int iov_count);
+
+OM_uint32
+gssEapWrapTokenLength(OM_uint32 *minor,
+                      gss_ctx_id_t ctx,
+                      int conf_req_flag,
+                      size_t dataLength,
+                      size_t *headerLength,
+                      size_t *trailerLength);
+
 OM_uint32
 gssEapWrap(OM_uint32 *minor,
            gss_ctx_id_t ctx,
@@ -305,6 +366,16 @@ gssEapWrap(OM_uint32 *minor,
            int *conf_state,
            gss_buffer_t output_message_buffer);
 
+OM_uint32
+gssEapWrapInPlace(OM_uint32 *minor,
+                  gss_ctx_id_t ctx,
+                  int conf_req_flag,
+                  gss_buffer_t buffer,
+                  size_t data_offset,
+                  size_t data_length,
+                  int *conf_state,
+                  gss_buffer_t output_message_buffer);
+
 unsigned char
 rfc4121Flags(gss_ctx_id_t ctx, int receiving);
 
@@ -77,12 +77,109 @@ extern gss_OID GSS_EAP_CRED_SET_CRED_FLAG;
  */
 extern gss_OID GSS_EAP_CRED_SET_CRED_PASSWORD;
 
+/*
+ * Time spent in each phase of establishing a context, as measured
+ * by a monotonic clock, for gss_inquire_sec_context_by_oid(). One
+ * buffer is returned for each phase that took place, holding the
+ * phase number below as a 32-bit integer followed by the elapsed
+ * microseconds as a 64-bit integer, both in network byte order.
+ * Context inquiries are numbered under 1.3.6.1.4.1.5322.22.3.4, apart
+ * from the credential options under .3.3.
+ */
+extern gss_OID GSS_EAP_INQ_CTX_PHASE_TIMES;
+
+/* Acceptor: making the AuthnRequest */
+#define GSS_EAP_PHASE_AUTHN_REQUEST         1
+/* Acceptor: parsing, verifying and decrypting the response, and
+ * resolving attributes */
+#define GSS_EAP_PHASE_VERIFY_RESPONSE       2
+/* Acceptor: deriving the context key */
+#define GSS_EAP_PHASE_KEY_DERIVATION        3
+/* Initiator: resolving the IdP's host name */
+#define GSS_EAP_PHASE_IDP_DNS               4
+/* Initiator: connecting to the IdP */
+#define GSS_EAP_PHASE_IDP_CONNECT           5
+/* Initiator: TLS handshake with the IdP */
+#define GSS_EAP_PHASE_IDP_TLS               6
+/* Initiator: sending the request to the IdP and receiving its response */
+#define GSS_EAP_PHASE_IDP_TRANSFER          7
+#define GSS_EAP_PHASE_MAX                   7
+
 /*
  * Credentials flag indicating the local attributes
  * processing should be skipped.
  */
 #define GSS_EAP_DISABLE_LOCAL_ATTRS_FLAG    0x00000001
 
+/*
+ * Credentials flag asking the acceptor for a reauthentication
+ * ticket, which is cached in the credentials handle and lets
+ * later contexts with the same acceptor skip the IdP.
+ */
+#define GSS_EAP_ENABLE_REAUTH_FLAG          0x00000002
+
+/*
+ * Return the header and trailer lengths that must be reserved
+ * either side of data_length bytes passed to gss_wrap_in_place().
+ */
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_in_place_length(OM_uint32 *minor,
+                         gss_ctx_id_t context_handle,
+                         int conf_req_flag,
+                         gss_qop_t qop_req,
+                         size_t data_length,
+                         size_t *header_length,
+                         size_t *trailer_length);
+
+/*
+ * Wrap data_length bytes at data_offset in buffer, encrypting in
+ * place and writing the token header and trailer into the space the
+ * caller has reserved around the data. On return output_message_buffer
+ * refers to the token within buffer and must not be released.
+ */
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_in_place(OM_uint32 *minor,
+                  gss_ctx_id_t context_handle,
+                  int conf_req_flag,
+                  gss_qop_t qop_req,
+                  gss_buffer_t buffer,
+                  size_t data_offset,
+                  size_t data_length,
+                  int *conf_state,
+                  gss_buffer_t output_message_buffer);
+
+/*
+ * One message of a batch passed to gss_wrap_iov_batch() or
+ * gss_unwrap_iov_batch(). The caller supplies the IOV array; the
+ * remaining fields are outputs.
+ */
+typedef struct gss_iov_batch_desc_struct {
+    gss_iov_buffer_desc *iov;
+    int iov_count;
+    int conf_state;
+    gss_qop_t qop_state;
+    OM_uint32 major_status;
+    OM_uint32 minor_status;
+} gss_iov_batch_desc, *gss_iov_batch_t;
+
+/*
+ * Wrap or unwrap batch_count messages under a single context lock,
+ * in array order. Returns the status of the first message that failed.
+ */
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_iov_batch(OM_uint32 *minor,
+                   gss_ctx_id_t context_handle,
+                   int conf_req_flag,
+                   gss_qop_t qop_req,
+                   gss_iov_batch_desc *batch,
+                   int batch_count);
+
+OM_uint32 GSSAPI_CALLCONV
+gss_unwrap_iov_batch(OM_uint32 *minor,
+                     gss_ctx_id_t context_handle,
+                     gss_iov_batch_desc *batch,
+                     int batch_count);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
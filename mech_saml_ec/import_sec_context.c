@@ -184,6 +184,331 @@ importName(OM_uint32 *minor,
     return GSS_S_COMPLETE;
 }
 
+#ifdef GSSEAP_ENABLE_BENCH
+/*
+ * Test-only import of an established context with a fixed key, so that
+ * the per-message routines can be benchmarked without an IdP exchange.
+ * Only compiled with --enable-bench. The token is:
+ *
+ *      version     EAP_EXPORT_CONTEXT_BENCH
+ *      flags       CTX_FLAG_INITIATOR or zero
+ *      gssFlags
+ *      enctype
+ *      seed        4-octet length followed by the seed
+ *
+ * all integers being 32-bit big endian. The context key is derived from
+ * the seed as it would be from the IdP-issued session key, and the
+ * names are fixed.
+ */
+static OM_uint32
+importBenchContext(OM_uint32 *minor,
+                   unsigned char *p,
+                   size_t remain,
+                   gss_ctx_id_t ctx)
+{
+    OM_uint32 major;
+    size_t seedLength;
+    gss_buffer_desc nameBuf;
+
+    if (remain < 20) {
+        *minor = GSSEAP_TOK_TRUNC;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
+    ctx->state          = GSSEAP_STATE_ESTABLISHED;
+    ctx->flags          = load_uint32_be(&p[4]) & CTX_FLAG_INITIATOR;
+    ctx->gssFlags       = load_uint32_be(&p[8]);
+    ctx->encryptionType = load_uint32_be(&p[12]);
+    seedLength          = load_uint32_be(&p[16]);
+    p      += 20;
+    remain -= 20;
+
+    if (remain != seedLength || seedLength == 0 ||
+        ctx->encryptionType == ENCTYPE_NULL) {
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
+    major = gssEapCanonicalizeOid(minor, GSS_C_NO_OID,
+                                  OID_FLAG_NULL_VALID |
+                                  OID_FLAG_MAP_NULL_TO_DEFAULT_MECH,
+                                  &ctx->mechanismUsed);
+    if (GSS_ERROR(major))
+        return major;
+
+    /* Names, so that the context can be exported and imported again */
+    nameBuf.value = "bench-initiator";
+    nameBuf.length = sizeof("bench-initiator") - 1;
+
+    major = gssEapImportName(minor, &nameBuf, GSS_C_NT_USER_NAME,
+                             GSS_C_NO_OID, &ctx->initiatorName);
+    if (GSS_ERROR(major))
+        return major;
+
+    nameBuf.value = "bench-acceptor";
+    nameBuf.length = sizeof("bench-acceptor") - 1;
+
+    major = gssEapImportName(minor, &nameBuf, GSS_C_NT_USER_NAME,
+                             GSS_C_NO_OID, &ctx->acceptorName);
+    if (GSS_ERROR(major))
+        return major;
+
+    major = gssEapDeriveRfc3961Key(minor, p, seedLength,
+                                   ctx->encryptionType,
+                                   &ctx->rfc3961Key);
+    if (GSS_ERROR(major))
+        return major;
+
+    major = rfc3961ChecksumTypeForKey(minor, &ctx->rfc3961Key,
+                                      &ctx->checksumType);
+    if (GSS_ERROR(major))
+        return major;
+
+    return sequenceInit(minor, &ctx->seqState, 0,
+                        ((ctx->gssFlags & GSS_C_REPLAY_FLAG) != 0),
+                        ((ctx->gssFlags & GSS_C_SEQUENCE_FLAG) != 0),
+                        TRUE);
+}
+#endif /* GSSEAP_ENABLE_BENCH */
+
+#ifndef MECH_EAP
+/*
+ * A version 2 context token, as laid out in export_sec_context.c. The
+ * buffers point into the token.
+ */
+struct gss_eap_context_v2 {
+    OM_uint32 state;
+    OM_uint32 flags;
+    OM_uint32 gssFlags;
+    OM_uint32 checksumType;
+    OM_uint32 encryptionType;
+    uint64_t expiryTime;
+    uint64_t sendSeq;
+    uint64_t recvSeq;
+    gss_OID_desc mechanismUsed;
+    gss_buffer_desc key;
+    gss_buffer_desc initiatorName;
+    gss_buffer_desc acceptorName;
+    gss_buffer_desc attributes;
+    gss_buffer_desc seqState;
+    gss_buffer_desc partialCtx;     /* including its length prefix */
+};
+
+static int
+getFieldV2(unsigned char **pBuf, size_t *pRemain, gss_buffer_t field)
+{
+    if (*pRemain < 4)
+        return 0;
+
+    field->length = load_uint32_be(*pBuf);
+    if (*pRemain - 4 < field->length)
+        return 0;
+
+    field->value = (field->length != 0) ? *pBuf + 4 : NULL;
+
+    *pBuf    += 4 + field->length;
+    *pRemain -= 4 + field->length;
+
+    return 1;
+}
+
+static int
+validNameV2(gss_buffer_t name)
+{
+    return name->length == 0 ||
+        (name->length >= 4 &&
+         load_uint32_be(name->value) == name->length - 4);
+}
+
+/*
+ * Check the framing of a version 2 token and the invariants between
+ * its fields without allocating anything, so that most malformed
+ * tokens are rejected before any work is done.
+ */
+static OM_uint32
+parseContextV2(OM_uint32 *minor,
+               gss_buffer_t token,
+               struct gss_eap_context_v2 *v2)
+{
+    unsigned char *p = (unsigned char *)token->value;
+    size_t remain = token->length;
+    gss_buffer_desc mech;
+    int initiator, established, partial;
+
+    if (remain < 52) {
+        *minor = GSSEAP_TOK_TRUNC;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+    if (load_uint32_be(&p[4]) != remain) {
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
+    v2->state           = load_uint32_be(&p[8]);
+    v2->flags           = load_uint32_be(&p[12]);
+    v2->gssFlags        = load_uint32_be(&p[16]);
+    v2->checksumType    = load_uint32_be(&p[20]);
+    v2->encryptionType  = load_uint32_be(&p[24]);
+    v2->expiryTime      = load_uint64_be(&p[28]);
+    v2->sendSeq         = load_uint64_be(&p[36]);
+    v2->recvSeq         = load_uint64_be(&p[44]);
+    p      += 52;
+    remain -= 52;
+
+    if (!getFieldV2(&p, &remain, &mech) ||
+        !getFieldV2(&p, &remain, &v2->key) ||
+        !getFieldV2(&p, &remain, &v2->initiatorName) ||
+        !getFieldV2(&p, &remain, &v2->acceptorName) ||
+        !getFieldV2(&p, &remain, &v2->attributes) ||
+        !getFieldV2(&p, &remain, &v2->seqState)) {
+        *minor = GSSEAP_TOK_TRUNC;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
+    v2->mechanismUsed.length = mech.length;
+    v2->mechanismUsed.elements = mech.value;
+
+    v2->partialCtx.length = remain;
+    v2->partialCtx.value = (remain != 0) ? p : NULL;
+
+    *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+
+    if (v2->state < GSSEAP_STATE_INITIAL ||
+        v2->state > GSSEAP_STATE_ESTABLISHED)
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    initiator   = ((v2->flags & CTX_FLAG_INITIATOR) != 0);
+    established = (v2->state == GSSEAP_STATE_ESTABLISHED);
+    partial     = (!initiator && !established &&
+                   (v2->flags & CTX_FLAG_KRB_REAUTH) == 0);
+
+    /* Only acceptor can export partial context tokens */
+    if (initiator && !established)
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    if (mech.length == 0 ||
+        !validNameV2(&v2->initiatorName) ||
+        !validNameV2(&v2->acceptorName))
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    /* Attributes are those of the initiator, as seen by the acceptor */
+    if (v2->attributes.length != 0 &&
+        (initiator || v2->initiatorName.length == 0))
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    if (v2->seqState.length != 0 &&
+        v2->seqState.length != sequenceSize(NULL))
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    /* An established context needs a peer name, a key and a sequence */
+    if (established &&
+        ((initiator ? v2->acceptorName.length : v2->initiatorName.length) == 0 ||
+         v2->key.length == 0 || v2->encryptionType == ENCTYPE_NULL ||
+         v2->seqState.length == 0))
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    /* The partial context is the last field, if any */
+    if (partial ? v2->partialCtx.length < 4 ||
+                  load_uint32_be(v2->partialCtx.value) != remain - 4
+                : v2->partialCtx.length != 0)
+        return GSS_S_DEFECTIVE_TOKEN;
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+importContextV2(OM_uint32 *minor,
+                gss_buffer_t token,
+                gss_ctx_id_t ctx)
+{
+    OM_uint32 major;
+    struct gss_eap_context_v2 v2;
+    unsigned char *p;
+    size_t remain;
+
+    major = parseContextV2(minor, token, &v2);
+    if (GSS_ERROR(major))
+        return major;
+
+    /* The mechanism OID maps to static storage */
+    major = gssEapCanonicalizeOid(minor, &v2.mechanismUsed, 0,
+                                  &ctx->mechanismUsed);
+    if (GSS_ERROR(major))
+        return major;
+
+    ctx->state          = v2.state;
+    ctx->flags          = v2.flags;
+    ctx->gssFlags       = v2.gssFlags;
+    ctx->checksumType   = v2.checksumType;
+    ctx->encryptionType = v2.encryptionType;
+    ctx->expiryTime     = (time_t)v2.expiryTime;
+    ctx->sendSeq        = v2.sendSeq;
+    ctx->recvSeq        = v2.recvSeq;
+
+    /*
+     * Everything else is copied, as the caller may release the token
+     * as soon as we return.
+     */
+    if (v2.key.length != 0) {
+        KRB_KEY_DATA(&ctx->rfc3961Key) = KRB_MALLOC(v2.key.length);
+        if (KRB_KEY_DATA(&ctx->rfc3961Key) == NULL) {
+            *minor = ENOMEM;
+            return GSS_S_FAILURE;
+        }
+        memcpy(KRB_KEY_DATA(&ctx->rfc3961Key), v2.key.value, v2.key.length);
+        KRB_KEY_LENGTH(&ctx->rfc3961Key) = v2.key.length;
+        KRB_KEY_TYPE(&ctx->rfc3961Key) = v2.encryptionType;
+    }
+
+    if (v2.initiatorName.length != 0) {
+        major = gssEapImportNameInternal(minor, &v2.initiatorName,
+                                         &ctx->initiatorName, 0);
+        if (GSS_ERROR(major))
+            return major;
+    }
+
+    if (v2.acceptorName.length != 0) {
+        major = gssEapImportNameInternal(minor, &v2.acceptorName,
+                                         &ctx->acceptorName, 0);
+        if (GSS_ERROR(major))
+            return major;
+    }
+
+#ifdef GSSEAP_ENABLE_ACCEPTOR
+    if (v2.attributes.length != 0) {
+        major = gssEapSetSamlAttributes(minor, ctx->initiatorName,
+                                        &v2.attributes);
+        if (GSS_ERROR(major))
+            return major;
+    }
+#endif
+
+    if (v2.seqState.length != 0) {
+        p = (unsigned char *)v2.seqState.value;
+        remain = v2.seqState.length;
+
+        major = sequenceInternalize(minor, &ctx->seqState, &p, &remain);
+        if (GSS_ERROR(major))
+            return major;
+    }
+
+#ifdef GSSEAP_ENABLE_ACCEPTOR
+    if (v2.partialCtx.length != 0) {
+        p = (unsigned char *)v2.partialCtx.value;
+        remain = v2.partialCtx.length;
+
+        major = gssEapImportPartialContext(minor, &p, &remain, ctx);
+        if (GSS_ERROR(major))
+            return major;
+    }
+#endif
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+#endif /* !MECH_EAP */
+
 OM_uint32
 gssEapImportContext(OM_uint32 *minor,
                     gss_buffer_t token,
@@ -197,6 +522,14 @@ gssEapImportContext(OM_uint32 *minor,
         *minor = GSSEAP_TOK_TRUNC;
         return GSS_S_DEFECTIVE_TOKEN;
     }
+#ifdef GSSEAP_ENABLE_BENCH
+    if (load_uint32_be(&p[0]) == EAP_EXPORT_CONTEXT_BENCH)
+        return importBenchContext(minor, p, remain, ctx);
+#endif
+#ifndef MECH_EAP
+    if (load_uint32_be(&p[0]) == EAP_EXPORT_CONTEXT_V2)
+        return importContextV2(minor, token, ctx);
+#endif
     if (load_uint32_be(&p[0]) != EAP_EXPORT_CONTEXT_V1) {
         *minor = GSSEAP_BAD_CONTEXT_TOKEN;
         return GSS_S_DEFECTIVE_TOKEN;
@@ -277,7 +610,6 @@ gss_import_sec_context(OM_uint32 *minor,
                        gss_buffer_t interprocess_token,
                        gss_ctx_id_t *context_handle)
 {
-#ifdef MECH_EAP
     OM_uint32 major, tmpMinor;
     gss_ctx_id_t ctx = GSS_C_NO_CONTEXT;
 
@@ -304,7 +636,4 @@ cleanup:
         gssEapReleaseContext(&tmpMinor, &ctx);
 
     return major;
-#else
-    return GSS_S_UNAVAILABLE;
-#endif
 }
@@ -46,6 +46,7 @@
 #define SAML_EC_IDP		"SAML_EC_IDP"
 #define SAML_EC_USER_CERT	"SAML_EC_USER_CERT"
 #define SAML_EC_USER_KEY	"SAML_EC_USER_KEY"
+#define SAML_EC_IDP_CA		"SAML_EC_IDP_CA"
 
 #define SOAP_FAULT_MSG "<?xml version='1.0' encoding='UTF-8'?>" \
 		"<S:Envelope xmlns:S=\"http://schemas.xmlsoap.org/soap/envelope/\">" \
@@ -58,8 +59,6 @@
 		"  </S:Body>" \
 		"</S:Envelope>"
 
-static xmlChar *gl_generated_key = NULL;
-
 #ifdef MECH_EAP
 
 static OM_uint32
@@ -354,8 +353,8 @@ initReady(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 reqFlags)
                                    &ctx->rfc3961Key);
 #else
     major = gssEapDeriveRfc3961Key(minor,
-                                   gl_generated_key,
-                                   strlen(gl_generated_key),
+                                   (unsigned char *)ctx->initiatorCtx.generatedKey,
+                                   strlen(ctx->initiatorCtx.generatedKey),
                                    ctx->encryptionType,
                                    &ctx->rfc3961Key);
 #endif
@@ -423,9 +422,9 @@ initBegin(OM_uint32 *minor,
             GSSEAP_MUTEX_UNLOCK(&target->mutex);
             return major;
         }
-        if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "TARGET NAME IS (%.*s)\n",
-                    target->username.length,  (char *)(target->username.value));
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "TARGET NAME IS (%.*s)\n",
+                     (int)target->username.length,
+                     (char *)(target->username.value));
 
         GSSEAP_MUTEX_UNLOCK(&target->mutex);
     }
@@ -608,8 +607,40 @@ write_data(void *buffer, size_t size, size_t nmemb, void *userp)
 
 char curl_err_msg[CURL_ERROR_SIZE+1];
 
+/*
+ * Attribute the time curl spent on each stage of the exchange to the
+ * context's phases. curl reports each stage as the time from the start
+ * of the transfer to its end; appconnect is zero without TLS.
+ */
+static void
+recordIdPTimes(gss_ctx_id_t ctx, CURL *curl)
+{
+    double lookup = 0, connect = 0, appconnect = 0, total = 0;
+    double last;
+
+    if (curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &lookup) != CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect) != CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appconnect) != CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total) != CURLE_OK)
+        return;
+
+    ctx->phaseTimes[GSS_EAP_PHASE_IDP_DNS] += (uint64_t)(lookup * 1e6);
+    if (connect > lookup)
+        ctx->phaseTimes[GSS_EAP_PHASE_IDP_CONNECT] +=
+            (uint64_t)((connect - lookup) * 1e6);
+    last = connect;
+    if (appconnect > connect) {
+        ctx->phaseTimes[GSS_EAP_PHASE_IDP_TLS] +=
+            (uint64_t)((appconnect - connect) * 1e6);
+        last = appconnect;
+    }
+    if (total > last)
+        ctx->phaseTimes[GSS_EAP_PHASE_IDP_TRANSFER] +=
+            (uint64_t)((total - last) * 1e6);
+}
+
 OM_uint32
-sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
+sendToIdP(OM_uint32 *minor, gss_ctx_id_t ctx, xmlDocPtr doc, char *idp,
           gss_cred_id_t cred, gss_buffer_t response)
 {
     CURL *curl = NULL;
@@ -620,51 +651,54 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
     char *password = cred->password.value;
     char *certfile = getenv(SAML_EC_USER_CERT);
     char *keyfile = getenv(SAML_EC_USER_KEY);
+    char *cafile = getenv(SAML_EC_IDP_CA);
     OM_uint32 major = GSS_S_COMPLETE;
 
-    if (MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "USER IS (%s)\n", user?:"");
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "USER IS (%s)\n", user?:"");
 
     if ((certfile && !keyfile) || (keyfile && !certfile)) {
-        fprintf(stderr, "NOTICE: One of either SAML_EC_USER_CERT or "
-                        "SAML_EC_USER_KEY is not set. Unable to use "
-                        "certificate authentication.\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                     "NOTICE: One of either SAML_EC_USER_CERT or "
+                     "SAML_EC_USER_KEY is not set. Unable to use "
+                     "certificate authentication.\n");
         certfile = keyfile = NULL;
     }
 
     if ((user && !password) || (password && !user)) {
-        fprintf(stderr, "NOTICE: One of either username or "
-                        "password is NULL. Unable to use username/password "
-                        "for authentication.\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_WARNING, "NOTICE: One of either username or "
+                     "password is NULL. Unable to use username/password "
+                     "for authentication.\n");
         user = password = NULL;
     }
 
     if (certfile && keyfile) {
-        if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "DOING HTTPS POST to IdP (%s) using Cert Auth cert"
-                    " (%s) key (%s)\n", idp, certfile, keyfile);
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                     "DOING HTTPS POST to IdP (%s) using Cert Auth cert"
+                     " (%s) key (%s)\n", idp, certfile, keyfile);
     }
     if (user && password) {
-        if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "DOING HTTPS POST to IdP (%s) using Basic Auth user"
-                    " (%s)\n", idp, user);
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                     "DOING HTTPS POST to IdP (%s) using Basic Auth user"
+                     " (%s)\n", idp, user);
     }
     if (!user && !password && !certfile && !keyfile) {
-        fprintf(stderr, "ERROR: NO user/password info in credential; "
-                        "please supply a credential acquired with "
-                        "gss_acquire_cred_with_password() or variants;\n"
-                        "You can also alternatively specify client cert/key "
-                        "files by setting env vars SAML_EC_USER_CERT and "
-                        "SAML_EC_USER_KEY. Client certificate will be used "
-                        "if set instead of username/password.\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: NO user/password info in credential; "
+                     "please supply a credential acquired with "
+                     "gss_acquire_cred_with_password() or variants;\n"
+                     "You can also alternatively specify client cert/key "
+                     "files by setting env vars SAML_EC_USER_CERT and "
+                     "SAML_EC_USER_KEY. Client certificate will be used "
+                     "if set instead of username/password.\n");
         *minor = GSSEAP_BAD_CRED_OPTION;
         return GSS_S_FAILURE;
     }
 
     xmlDocDumpFormatMemory(doc, &mem, &size, 0);
     if (mem == NULL || size == 0) {
-        fprintf(stderr, "ERROR: xmlDocDumpFormatMemory failed to parse "
-                        "the XML doc to be sent to IdP\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: xmlDocDumpFormatMemory failed to parse "
+                     "the XML doc to be sent to IdP\n");
         *minor = GSSEAP_BAD_CONTEXT_TOKEN;
         return GSS_S_FAILURE;
     }
@@ -672,7 +706,7 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
     curl = curl_easy_init();
 
     if (!curl) {
-        fprintf(stderr, "ERROR: curl_easy_init failed\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "ERROR: curl_easy_init failed\n");
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
     }
@@ -680,7 +714,7 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
     struct curl_slist *headersList = NULL;
     headersList = curl_slist_append(headersList, "Content-Type: text/xml");
     if (headersList == NULL) {
-        fprintf(stderr, "ERROR: curl_slist_append failed\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "ERROR: curl_slist_append failed\n");
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -692,6 +726,8 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
         (res = curl_easy_setopt(curl, CURLOPT_URL, idp)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L)) != CURLE_OK ||
+        /* Trust anchors for the IdP other than the system's, e.g. test IdPs */
+        (cafile && (res = curl_easy_setopt(curl, CURLOPT_CAINFO, cafile)) != CURLE_OK) ||
         /* Per curl_easy_opt(3) this is for FTP but perhaps also for HTTP? */
         (res = curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_ALL)) != CURLE_OK ||
         (user && ((res = curl_easy_setopt(curl, CURLOPT_USERNAME, user)) != CURLE_OK ||
@@ -703,23 +739,30 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
         (keyfile && ((res = curl_easy_setopt(curl, CURLOPT_SSLKEY, keyfile)) != CURLE_OK ||
                       (res = curl_easy_setopt(curl, CURLOPT_SSLKEYTYPE, "PEM")) != CURLE_OK ||
                       (res = curl_easy_setopt(curl, CURLOPT_KEYPASSWD, "")) != CURLE_OK)) ||
-        (res = curl_easy_setopt(curl, CURLOPT_VERBOSE, 1)) != CURLE_OK ||
+        (res = curl_easy_setopt(curl, CURLOPT_VERBOSE,
+                                GSSEAP_TRACING(GSSEAP_TRACE_DEBUG) ? 1L : 0L)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_POST, 1)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_POSTFIELDS, mem)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, size)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, response)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data)) != CURLE_OK ||
         (res = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headersList)) != CURLE_OK) {
-        fprintf(stderr, "ERROR: curl_easy_setopt failure; %s\n", curl_easy_strerror(res));
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: curl_easy_setopt failure; %s\n", curl_easy_strerror(res));
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
     }
 
+    GSSEAP_PROBE1(idp__request__start, ctx);
     res = curl_easy_perform(curl);
+    GSSEAP_PROBE2(idp__request__done, ctx, res);
+    recordIdPTimes(ctx, curl);
     if (res) {
-        fprintf(stderr, "ERROR: curl_easy_perform failed with return code "
-                        "(%d) and error (%s)\n", res, curl_err_msg);
+        gssEapMetricIncrement(GSSEAP_METRIC_IDP_HTTP);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: curl_easy_perform failed with return code "
+                     "(%d) and error (%s)\n", res, curl_err_msg);
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -728,15 +771,19 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
     long http_code = 0;
     res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
     if (res != CURLE_OK) {
-        fprintf(stderr, "ERROR: curl_easy_getinfo failed with return code "
-                        "(%d) and error (%s)\n", res, curl_err_msg);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: curl_easy_getinfo failed with return code "
+                     "(%d) and error (%s)\n", res, curl_err_msg);
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
     }
+    if (http_code >= 100 && http_code < 100 * GSSEAP_METRICS_HTTP_CLASSES)
+        gssEapMetricIncrement(GSSEAP_METRIC_IDP_HTTP + http_code / 100);
     if (http_code != 200) {
-        fprintf(stderr, "ERROR: HTTPS failed with status code (%d)\n",
-                                 http_code);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: HTTPS failed with status code (%ld)\n",
+                     http_code);
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -745,22 +792,25 @@ sendToIdP(OM_uint32 *minor, xmlDocPtr doc, char *idp,
     char *content_type = NULL;
     res = curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
     if (res != CURLE_OK) {
-        fprintf(stderr, "ERROR: curl_easy_getinfo failed with return code "
-                        "(%d) and error (%s)\n", res, curl_err_msg);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: curl_easy_getinfo failed with return code "
+                     "(%d) and error (%s)\n", res, curl_err_msg);
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
     }
     if (content_type == NULL) {
-        fprintf(stderr, "ERROR: IdP DID NOT SEND A CONTENT TYPE IN HEADER.\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: IdP DID NOT SEND A CONTENT TYPE IN HEADER.\n");
         *minor = GSSEAP_BAD_USAGE;
         major = GSS_S_FAILURE;
         goto cleanup;
     } else {
-        if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "CONTENT TYPE FROM IDP IS: %s", content_type);
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                     "CONTENT TYPE FROM IDP IS: %s", content_type);
         if (!strcasestr(content_type, "xml")) {
-            fprintf(stderr, "ERROR: IdP DID NOT SEND XML DOCUMENT BACK.\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: IdP DID NOT SEND XML DOCUMENT BACK.\n");
             *minor = GSSEAP_BAD_USAGE;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -813,25 +863,24 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
         idp = cred->ecpSsoLocation.value;
     }
 
-    if (MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "IdP IS (%s)\n", idp?:"");
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "IdP IS (%s)\n", idp?:"");
 
     if (idp == NULL) {
-        fprintf(stderr, "ERROR: NO IDP specified; please specify an IdP"
-                " using the environment variable (%s)\n", SAML_EC_IDP);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: NO IDP specified; please specify an IdP"
+                     " using the environment variable (%s)\n", SAML_EC_IDP);
         *minor = GSSEAP_BAD_SERVICE_NAME;
         return GSS_S_FAILURE;
     }
 
     doc_from_sp = xmlReadMemory(request->value, request->length, "FROMSP", NULL, 0);
     if (doc_from_sp != NULL) {
-        if (MECH_SAML_EC_DEBUG) {
-            fprintf(stdout, "\n\nREQUEST FROM SP AS SEEN BY XML:\n");
-            xmlDocDump(stdout, doc_from_sp);
-        }
+        traceXmlDoc(GSSEAP_TRACE_DEBUG,
+                    "\n\nREQUEST FROM SP AS SEEN BY XML:\n", doc_from_sp);
     } else {
-        fprintf(stderr, "ERROR: Failure parsing document from SP:\n%.*s\n",
-                        request->length, request->value);
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: Failure parsing document from SP:\n%.*s\n",
+                     (int)request->length, (char *)request->value);
         *minor = GSSEAP_BAD_CONTEXT_TOKEN;
         return GSS_S_FAILURE;
     }
@@ -839,7 +888,8 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
     /* Exclude header */
     header_from_sp = getXmlElement(xmlDocGetRootElement(doc_from_sp), "Header", MECH_SAML_EC_SOAP11_NS);
     if (header_from_sp == NULL) {
-        fprintf(stderr, "ERROR: No Header in SAML Request from SP\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: No Header in SAML Request from SP\n");
         *minor = GSSEAP_BAD_TOK_HEADER;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -857,7 +907,8 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
 
         major = readChannelBindingsType(&tmpMinor, &cb_type);
         if (major != GSS_S_COMPLETE) {
-            fprintf(stderr, "ERROR: Couldn't find Channel Bindings Type\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: Couldn't find Channel Bindings Type\n");
             goto cleanup;
         }
 
@@ -881,7 +932,8 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
         char *algorithm = xmlGetNsProp(session_key, "EncType", MECH_SAML_EC_SAMLEC_NS);
 
         if (algorithm != NULL) {
-            fprintf(stderr, "ERROR: Algorithm (%s) NOT supported\n", algorithm);
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: Algorithm (%s) NOT supported\n", algorithm);
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -893,8 +945,9 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
             char *tmp = xmlNodeGetContent(encryption_type);
 
             if (tmp == NULL) {
-                fprintf(stderr, "ERROR: Failure of xmlNodeGetContent for "
-                                "EncType in SessionKey.");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: Failure of xmlNodeGetContent for "
+                             "EncType in SessionKey.");
                 *minor = GSSEAP_BAD_TOK_HEADER;
                 major = GSS_S_FAILURE;
                 goto cleanup;
@@ -905,14 +958,16 @@ processSAMLRequest(OM_uint32 *minor, gss_ctx_id_t ctx, OM_uint32 req_flags,
         }
 
         if (ctx->encryptionType == ENCTYPE_NULL) {
-            fprintf(stderr, "ERROR: EncType is non-existent in SessionKey or is empty.");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: EncType is non-existent in SessionKey or is empty.");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
         }
     } else {
-        fprintf(stderr, "ERROR: Authentication Request from Service Provider"
-                " doesn't contain SessionKey header block\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: Authentication Request from Service Provider"
+                     " doesn't contain SessionKey header block\n");
         *minor = GSSEAP_BAD_TOK_HEADER;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -927,35 +982,34 @@ xmlNodeSetContent(signature_value, val);
 }
 */
 
-    if (MECH_SAML_EC_DEBUG) {
-        fprintf(stdout, "\nSENDING TO IDP:\n");
-        xmlDocDump(stdout, doc_from_sp);
-    }
+    traceXmlDoc(GSSEAP_TRACE_DEBUG, "\nSENDING TO IDP:\n", doc_from_sp);
 
     /* Send doc to IdP */
     /* TODO: Error checking here and elsewhere */
-    major = sendToIdP(minor, doc_from_sp, idp, ctx->cred, &response_from_idp);
+    major = sendToIdP(minor, ctx, doc_from_sp, idp, ctx->cred,
+                      &response_from_idp);
     if (major != GSS_S_COMPLETE) {
-        fprintf(stderr, "ERROR: Failure communicating with IdP\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: Failure communicating with IdP\n");
         goto cleanup;
     }
 
     if (response_from_idp.value == NULL) {
-        fprintf(stderr, "ERROR: No response from IdP\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "ERROR: No response from IdP\n");
         *minor = GSSEAP_IDENTITY_SERVICE_UNKNOWN_ERROR;
         major = GSS_S_FAILURE;
         goto cleanup;
     }
 
-    if (MECH_SAML_EC_DEBUG)
-        fprintf(stdout, "\n\nRECEIVED FROM IDP:\n%s\n", (char *) response_from_idp.value);
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                 "\n\nRECEIVED FROM IDP:\n%s\n", (char *) response_from_idp.value);
 
     /* Empty the header from IdP and populate with RelayState from
      *     header received from SP */
     doc_from_idp = xmlReadMemory(response_from_idp.value,
                   response_from_idp.length, "FROMIDP", NULL, 0);
     if (doc_from_idp == NULL) {
-        fprintf(stderr, "ERROR: No response from IdP\n");
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR, "ERROR: No response from IdP\n");
         *minor = GSSEAP_IDENTITY_SERVICE_UNKNOWN_ERROR;
         major = GSS_S_FAILURE;
         goto cleanup;
@@ -967,16 +1021,14 @@ xmlNodeSetContent(signature_value, val);
         char *responseConsumerURL = NULL;
         char *AssertionConsumerServiceURL = NULL;
 
-        if (MECH_SAML_EC_DEBUG) {
-            fprintf(stdout, "AS SEEN BY XML:\n");
-            xmlDocDump(stdout, doc_from_idp);
-        }
+        traceXmlDoc(GSSEAP_TRACE_DEBUG, "AS SEEN BY XML:\n", doc_from_idp);
 
         /* Compare responseConsumerURL from original request with
          * AssertionConsumerServiceURL from response from IdP */
         request_from_sp = getXmlElement(header_from_sp, "Request", MECH_SAML_EC_PAOS_NS);
         if (request_from_sp == NULL) {
-            fprintf(stderr, "ERROR: No Request element in SAML Request Header from SP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No Request element in SAML Request Header from SP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -984,7 +1036,8 @@ xmlNodeSetContent(signature_value, val);
 
         responseConsumerURL = xmlGetProp(request_from_sp, "responseConsumerURL");
         if (responseConsumerURL == NULL) {
-            fprintf(stderr, "ERROR: No responseConsumerURL attribute in SAML Request Header from SP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No responseConsumerURL attribute in SAML Request Header from SP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -992,7 +1045,8 @@ xmlNodeSetContent(signature_value, val);
 
         response_from_idp = getXmlElement(xmlDocGetRootElement(doc_from_idp), "Response", MECH_SAML_EC_ECP_NS);
         if (response_from_idp == NULL) {
-            fprintf(stderr, "ERROR: No Response element in SAML Response from IdP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No Response element in SAML Response from IdP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -1000,62 +1054,71 @@ xmlNodeSetContent(signature_value, val);
 
         AssertionConsumerServiceURL = xmlGetProp(response_from_idp, "AssertionConsumerServiceURL");
         if (AssertionConsumerServiceURL == NULL) {
-            fprintf(stderr, "ERROR: No AssertionConsumerServiceURL attribute in SAML Response from IdP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No AssertionConsumerServiceURL attribute in SAML Response from IdP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
         }
 
         if(strcmp(responseConsumerURL, AssertionConsumerServiceURL)) {
-            fprintf(stderr, "ERROR: responseConsumerURL (%s) and "
-                    "AssertionConsumerServiceURL (%s) do not match\n",
-                    responseConsumerURL, AssertionConsumerServiceURL);
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: responseConsumerURL (%s) and "
+                         "AssertionConsumerServiceURL (%s) do not match\n",
+                         responseConsumerURL, AssertionConsumerServiceURL);
             *minor = GSSEAP_PEER_AUTH_FAILURE;
             major = GSS_S_FAILURE;
             goto cleanup;
-        } else if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "NOTE: responseConsumerURL (%s) and "
-                    "AssertionConsumerServiceURL (%s) match\n",
-                    responseConsumerURL, AssertionConsumerServiceURL);
+        }
+        GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                     "NOTE: responseConsumerURL (%s) and "
+                     "AssertionConsumerServiceURL (%s) match\n",
+                     responseConsumerURL, AssertionConsumerServiceURL);
 
         if(strlen(AssertionConsumerServiceURL) != ctx->acceptorName->username.length
            ||
            strncmp(AssertionConsumerServiceURL, ctx->acceptorName->username.value,
                    ctx->acceptorName->username.length)) {
-            fprintf(stderr, "ERROR: Target name (%.*s) and "
-                    "AssertionConsumerServiceURL (%s) do not match\n",
-                    ctx->acceptorName->username.length,
-                    ctx->acceptorName->username.value, AssertionConsumerServiceURL);
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: Target name (%.*s) and "
+                         "AssertionConsumerServiceURL (%s) do not match\n",
+                         (int)ctx->acceptorName->username.length,
+                         (char *)ctx->acceptorName->username.value,
+                         AssertionConsumerServiceURL);
             *minor = GSSEAP_PEER_AUTH_FAILURE;
             major = GSS_S_FAILURE;
             goto cleanup;
-        } else if (MECH_SAML_EC_DEBUG)
-            fprintf(stdout, "NOTE: Target name (%.*s) and "
-                    "AssertionConsumerServiceURL (%s) match\n",
-                    ctx->acceptorName->username.length,
-                    ctx->acceptorName->username.value, AssertionConsumerServiceURL);
+        }
+        GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                     "NOTE: Target name (%.*s) and "
+                     "AssertionConsumerServiceURL (%s) match\n",
+                     (int)ctx->acceptorName->username.length,
+                     (char *)ctx->acceptorName->username.value,
+                     AssertionConsumerServiceURL);
 
         mutual_auth = getXmlElement(xmlDocGetRootElement(doc_from_idp), "RequestAuthenticated", MECH_SAML_EC_ECP_NS);
         if (mutual_auth != NULL) {
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "NOTE: IdP has reported ecp:RequestAuthenticated\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: IdP has reported ecp:RequestAuthenticated\n");
             ctx->gssFlags |= GSS_C_MUTUAL_FLAG;
         } else if (signature_value != NULL) { // SP did send a signature across
             /* VSY TODO: ecp:RequestAuthenticated not yet supported by most
                IdPs, so assume mutual auth succeeded if we are forced */
             if (getenv("MECH_SAML_EC_FORCE_MUTUAL_AUTH_FLAG")) {
-                fprintf(stderr, "WARNING: IdP did NOT report ecp:RequestAuthenticated"
-                            " but server did send a sign request and "
-                            "MECH_SAML_EC_FORCE_MUTUAL_AUTH_FLAG is set in "
-                            "environment so force-setting GSS_C_MUTUAL_FLAG assuming "
-                            " IdP has checked signature but has not implemented "
-                            "ecp:RequestAuthenticated yet!!!\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                             "WARNING: IdP did NOT report ecp:RequestAuthenticated"
+                             " but server did send a sign request and "
+                             "MECH_SAML_EC_FORCE_MUTUAL_AUTH_FLAG is set in "
+                             "environment so force-setting GSS_C_MUTUAL_FLAG assuming "
+                             " IdP has checked signature but has not implemented "
+                             "ecp:RequestAuthenticated yet!!!\n");
                 ctx->gssFlags |= GSS_C_MUTUAL_FLAG;
             } else {
-                fprintf(stderr, "ERROR: IdP did NOT report ecp:RequestAuthenticated"
-                            " but server did sign the request. To force-set GSS_C_MUTUAL_FLAG assuming "
-                            " IdP has checked the signature set "
-                            "MECH_SAML_EC_FORCE_MUTUAL_AUTH_FLAG in environment!!!\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: IdP did NOT report ecp:RequestAuthenticated"
+                             " but server did sign the request. To force-set GSS_C_MUTUAL_FLAG assuming "
+                             " IdP has checked the signature set "
+                             "MECH_SAML_EC_FORCE_MUTUAL_AUTH_FLAG in environment!!!\n");
                 *minor = GSSEAP_PEER_AUTH_FAILURE;
                 major = GSS_S_FAILURE;
                 goto cleanup;
@@ -1065,9 +1128,10 @@ xmlNodeSetContent(signature_value, val);
         /* TODO VSY: DELETE THIS GeneratedKey ADDED FOR TEST PURPOSES!!! */
         if ((elem = getXmlElement(xmlDocGetRootElement(doc_from_idp), "GeneratedKey", MECH_SAML_EC_SAMLEC_NS)) == NULL && getenv("MECH_SAML_EC_FORCE_SAMPLE_KEY")) {
             xmlNsPtr samlec_ns;
-            fprintf(stderr, "WARNING: No GeneratedKey in SAML Response from IdP; "
-                            "Since MECH_SAML_EC_FORCE_SAMPLE_KEY is set in the "
-                            "environment, forcing use of a sample key!\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_WARNING,
+                         "WARNING: No GeneratedKey in SAML Response from IdP; "
+                         "Since MECH_SAML_EC_FORCE_SAMPLE_KEY is set in the "
+                         "environment, forcing use of a sample key!\n");
             elem = getXmlElement(xmlDocGetRootElement(doc_from_idp), "Response", MECH_SAML_EC_ECP_NS);
             gen_key = xmlNewNode(NULL, "GeneratedKey");
             // Check if this NS already exists?
@@ -1078,7 +1142,12 @@ xmlNodeSetContent(signature_value, val);
         }
 
         if ((gen_key = getXmlElement(xmlDocGetRootElement(doc_from_idp), "GeneratedKey", MECH_SAML_EC_SAMLEC_NS)) != NULL) {
-            gl_generated_key = xmlNodeGetContent(gen_key);
+            ctx->initiatorCtx.generatedKey = (char *)xmlNodeGetContent(gen_key);
+            if (ctx->initiatorCtx.generatedKey == NULL) {
+                *minor = ENOMEM;
+                major = GSS_S_FAILURE;
+                goto cleanup;
+            }
 
             /* Add SessionKey/EncType as sibling of gen_key */
             session_key = xmlNewNode(NULL, "SessionKey");
@@ -1091,15 +1160,16 @@ xmlNodeSetContent(signature_value, val);
             GSSEAP_KRB_INIT(&krbContext);
             if  (krbEnctypeToString(krbContext, ctx->encryptionType, "", &buffer) != 0 ||
                  bufferToString(&tmpMinor, &buffer, &tmp) != GSS_S_COMPLETE) {
-                fprintf(stderr, "ERROR: Failed to convert context's encryption type to string\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: Failed to convert context's encryption type to string\n");
                 *minor = GSSEAP_KEY_UNAVAILABLE;
                 major = GSS_S_FAILURE;
                 goto cleanup;
             }
             encryption_type = xmlNewNode(samlec_ns, "EncType");
             xmlNodeSetContent(encryption_type, tmp);
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "NOTE: Encryption Type for session key is (%s)\n", tmp);
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: Encryption Type for session key is (%s)\n", tmp);
             GSSEAP_FREE(buffer.value); buffer.value = NULL;
             free(tmp); tmp = NULL;
             xmlAddChild(session_key, encryption_type);
@@ -1111,10 +1181,11 @@ xmlNodeSetContent(signature_value, val);
             xmlUnlinkNode(gen_key);
             xmlFreeNode(gen_key); gen_key = NULL;
         } else { // RFC requires support for GSS_C_CONF_FLAG, GSS_C_INTEG_FLAG
-            fprintf(stderr, "ERROR: No GeneratedKey in SAML header block from IdP; "
-                            "To force use of a sample key set "
-                            "MECH_SAML_EC_FORCE_SAMPLE_KEY in the "
-                            "environment!\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No GeneratedKey in SAML header block from IdP; "
+                         "To force use of a sample key set "
+                         "MECH_SAML_EC_FORCE_SAMPLE_KEY in the "
+                         "environment!\n");
             *minor = GSSEAP_KEY_UNAVAILABLE;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -1124,12 +1195,13 @@ xmlNodeSetContent(signature_value, val);
                                           MECH_SAML_EC_SAMLEC_NS) != NULL)
             if (req_flags & GSS_C_DELEG_FLAG) {
                 ctx->gssFlags |= GSS_C_DELEG_FLAG;
-                if (MECH_SAML_EC_DEBUG)
-                    fprintf(stdout, "NOTE: Credential being delegated to acceptor\n");
+                GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                             "NOTE: Credential being delegated to acceptor\n");
             } else {
-                fprintf(stderr, "ERROR: Credential Delegation was NOT requested "
-                            "but IdP has delegated a credential possibly at  "
-                            "the request of the server. \n");
+                GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                             "ERROR: Credential Delegation was NOT requested "
+                             "but IdP has delegated a credential possibly at  "
+                             "the request of the server. \n");
                 *minor = GSSEAP_BAD_CONTEXT_OPTION;
                 major = GSS_S_FAILURE;
                 goto cleanup;
@@ -1137,7 +1209,8 @@ xmlNodeSetContent(signature_value, val);
 
         header_from_idp = getXmlElement(xmlDocGetRootElement(doc_from_idp), "Header", MECH_SAML_EC_SOAP11_NS);
         if (header_from_idp == NULL) {
-            fprintf(stderr, "ERROR: No Header element in SAML Response from IdP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No Header element in SAML Response from IdP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
@@ -1147,23 +1220,23 @@ xmlNodeSetContent(signature_value, val);
         /* freeChildren(header_from_idp); */
         relay_state = getXmlElement(header_from_sp, "RelayState", MECH_SAML_EC_ECP_NS);
         if (relay_state == NULL) {
-            fprintf(stderr, "ERROR: No RelayState element in SAML Request from SP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: No RelayState element in SAML Request from SP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
         }
 
         if (xmlAddChild(header_from_idp, xmlCopyNode(relay_state, 1)) == NULL) {
-            fprintf(stderr, "ERROR: Failure adding RelayState to Header from IdP\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: Failure adding RelayState to Header from IdP\n");
             *minor = GSSEAP_BAD_TOK_HEADER;
             major = GSS_S_FAILURE;
             goto cleanup;
         }
 
-        if (MECH_SAML_EC_DEBUG) {
-            fprintf(stdout, "SENDING TO SP >>>>>>>>>>>>>>>>>>>\n");
-            xmlDocDump(stdout, doc_from_idp);
-        }
+        traceXmlDoc(GSSEAP_TRACE_DEBUG, "SENDING TO SP >>>>>>>>>>>>>>>>>>>\n",
+                    doc_from_idp);
 
         xmlDocDumpMemory(doc_from_idp, (char *)&response->value,
                   (int *)&response->length);
@@ -1475,17 +1548,20 @@ gssEapInitSecContext(OM_uint32 *minor,
 {
     OM_uint32 major, tmpMinor;
     int initialContextToken = (ctx->mechanismUsed == GSS_C_NO_OID);
+    int credLocked = FALSE, ctxCredLocked = FALSE;
 
-#ifndef MECH_EAP
-    if (ctx->state == GSSEAP_STATE_ACQUIRE) {
-#endif
     /*
      * XXX is acquiring the credential lock here necessary? The password is
      * mutable but the contract could specify that this is not updated whilst
      * a context is being initialized.
+     *
+     * It is needed for SAML EC, as the credential caches reauthentication
+     * tickets. It is dropped before the exchange with the IdP, below.
      */
-    if (cred != GSS_C_NO_CREDENTIAL)
+    if (cred != GSS_C_NO_CREDENTIAL) {
         GSSEAP_MUTEX_LOCK(&cred->mutex);
+        credLocked = TRUE;
+    }
 #if 0
     else {
         *minor = GSSEAP_BAD_CRED_OPTION;
@@ -1493,6 +1569,26 @@ gssEapInitSecContext(OM_uint32 *minor,
     }
 #endif
 
+#ifndef MECH_EAP
+    if (ctx->state == GSSEAP_STATE_AUTHENTICATE &&
+        (ctx->flags & CTX_FLAG_KRB_REAUTH)) {
+        major = gssEapReauthInitiatorComplete(minor, ctx, input_token);
+        if (major == GSS_S_COMPLETE) {
+            /* The ticket just used is still good, no need for another */
+            ctx->flags &= ~(CTX_FLAG_REAUTH_CREDS);
+        } else if (*minor == GSSEAP_BAD_REAUTH_RESPONSE) {
+            goto cleanup;
+        } else {
+            /* The acceptor wants a full login */
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: reauthentication declined by acceptor\n");
+            gssEapReauthInitiatorAbandon(ctx, cred);
+            ctx->state = GSSEAP_STATE_ACQUIRE;
+        }
+    }
+
+    if (ctx->state == GSSEAP_STATE_ACQUIRE) {
+#endif
     if (ctx->cred == GSS_C_NO_CREDENTIAL) {
         major = gssEapResolveInitiatorCred(minor, cred, target_name, &ctx->cred);
         if (GSS_ERROR(major))
@@ -1502,6 +1598,7 @@ gssEapInitSecContext(OM_uint32 *minor,
     }
 
     GSSEAP_MUTEX_LOCK(&ctx->cred->mutex);
+    ctxCredLocked = TRUE;
 
     GSSEAP_ASSERT(ctx->cred->flags & CRED_FLAG_RESOLVED);
     GSSEAP_ASSERT(ctx->cred->flags & CRED_FLAG_INITIATE);
@@ -1543,9 +1640,9 @@ gssEapInitSecContext(OM_uint32 *minor,
                 GSSEAP_MUTEX_UNLOCK(&target_name->mutex);
                 goto cleanup;
             }
-            if (MECH_SAML_EC_DEBUG)
-                fprintf(stdout, "TARGET NAME IS (%.*s)\n",
-                        target_name->username.length,  (char *)(target_name->username.value));
+            GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "TARGET NAME IS (%.*s)\n",
+                         (int)target_name->username.length,
+                         (char *)(target_name->username.value));
 
             GSSEAP_MUTEX_UNLOCK(&target_name->mutex);
         }
@@ -1557,6 +1654,26 @@ gssEapInitSecContext(OM_uint32 *minor,
         if (GSS_ERROR(major))
             goto cleanup;
 
+        if (gssEapCanReauthP(cred, ctx->acceptorName, time_req)) {
+            major = gssEapReauthInitiatorRequest(minor, ctx, cred,
+                                                 ctx->acceptorName, req_flags,
+                                                 input_chan_bindings,
+                                                 output_token);
+            if (GSS_ERROR(major))
+                gssEapReauthInitiatorAbandon(ctx, cred);
+        }
+
+        /* Ask for a ticket with which to skip the IdP next time */
+        if (cred != GSS_C_NO_CREDENTIAL &&
+            (cred->flags & GSS_EAP_ENABLE_REAUTH_FLAG))
+            ctx->flags |= CTX_FLAG_REAUTH_CREDS;
+
+        if (ctx->flags & CTX_FLAG_KRB_REAUTH) {
+            major = GSS_S_CONTINUE_NEEDED;
+            ctx->state = GSSEAP_STATE_AUTHENTICATE;
+            goto reauth;
+        }
+
         gss_buffer_desc innerToken = GSS_C_EMPTY_BUFFER;
 
         /* Holder-of-key (HOK) not supported yet */
@@ -1579,23 +1696,69 @@ gssEapInitSecContext(OM_uint32 *minor,
                 goto cleanup;
         }
 
+        if (ctx->flags & CTX_FLAG_REAUTH_CREDS) {
+            major = addToStringBuffer(minor, "," MECH_SAML_EC_REAUTH_REQ,
+                                      strlen("," MECH_SAML_EC_REAUTH_REQ),
+                                      &innerToken);
+            if (major != GSS_S_COMPLETE)
+                goto cleanup;
+        }
+
         major = gssEapMakeToken(minor, ctx, &innerToken, -1,
                    output_token);
+        gss_release_buffer(&tmpMinor, &innerToken);
         if (major == GSS_S_COMPLETE) {
             major = GSS_S_CONTINUE_NEEDED;
             ctx->state = GSSEAP_STATE_ACQUIRE;
         }
+    } else if (ctx->state == GSSEAP_STATE_ESTABLISHED &&
+               (ctx->flags & CTX_FLAG_REAUTH_CREDS)) {
+        /* Failing to cache a ticket does not fail the context */
+        major = gssEapStoreReauthCreds(minor, ctx, cred, input_token);
+        if (GSS_ERROR(major))
+            GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                         "NOTE: reauthentication ticket not stored\n");
+        ctx->flags &= ~(CTX_FLAG_REAUTH_CREDS);
+        major = GSS_S_COMPLETE;
+        *minor = 0;
+    } else if (ctx->state == GSSEAP_STATE_ESTABLISHED &&
+               (ctx->flags & CTX_FLAG_KRB_REAUTH)) {
+        /* Completed by gssEapReauthInitiatorComplete() */
+        major = GSS_S_COMPLETE;
     } else if (ctx->state == GSSEAP_STATE_AUTHENTICATE){
+        /*
+         * The IdP round trip reads ctx->cred, a copy private to this
+         * context made when the credential was resolved, and keeps its
+         * results, such as the GeneratedKey, in the context. Unlock both
+         * credentials so that other contexts sharing the caller's do not
+         * wait for the IdP.
+         */
+        if (credLocked) {
+            GSSEAP_MUTEX_UNLOCK(&cred->mutex);
+            credLocked = FALSE;
+        }
+        if (ctxCredLocked) {
+            GSSEAP_MUTEX_UNLOCK(&ctx->cred->mutex);
+            ctxCredLocked = FALSE;
+        }
+
         major = processSAMLRequest(minor, ctx, req_flags, input_chan_bindings,
                                      input_token, output_token);
         if (major != GSS_S_COMPLETE) {
-            fprintf(stderr, "ERROR: SOAP FAULT RESPONSE BEING SENT>>>>>>>>>>>>>>>\n");
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: SOAP FAULT RESPONSE BEING SENT>>>>>>>>>>>>>>>\n");
             makeStringBuffer(&tmpMinor, SOAP_FAULT_MSG, output_token);
         } else {
             ctx->state = GSSEAP_STATE_ESTABLISHED;
             major = initReady(minor, ctx, req_flags);
+            /* Wait for the acceptor to send a reauthentication ticket */
+            if (major == GSS_S_COMPLETE &&
+                (ctx->flags & CTX_FLAG_REAUTH_CREDS))
+                major = GSS_S_CONTINUE_NEEDED;
         }
     }
+
+reauth:
 #endif
     if (GSS_ERROR(major))
         goto cleanup;
@@ -1618,9 +1781,9 @@ gssEapInitSecContext(OM_uint32 *minor,
     GSSEAP_ASSERT(CTX_IS_ESTABLISHED(ctx) || major == GSS_S_CONTINUE_NEEDED);
 
 cleanup:
-    if (cred != GSS_C_NO_CREDENTIAL)
+    if (credLocked)
         GSSEAP_MUTEX_UNLOCK(&cred->mutex);
-    if (ctx->cred != GSS_C_NO_CREDENTIAL)
+    if (ctxCredLocked)
         GSSEAP_MUTEX_UNLOCK(&ctx->cred->mutex);
 
     return major;
@@ -1680,13 +1843,23 @@ gss_init_sec_context(OM_uint32 *minor,
                                  ret_flags,
                                  time_rec);
 
+    GSSEAP_PROBE3(init__done, ctx, major, *minor);
+
+    if (major == GSS_S_COMPLETE) {
+        gssEapMetricIncrement(GSSEAP_METRIC_INIT_COMPLETE);
+        gssEapTracePhaseTimes(ctx);
+    } else if (GSS_ERROR(major))
+        gssEapMetricFailure(GSSEAP_METRIC_INIT_FAILURE, *minor);
+    else
+        gssEapMetricIncrement(GSSEAP_METRIC_INIT_CONTINUE);
+
     GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
 
     if (GSS_ERROR(major))
         gssEapReleaseContext(&tmpMinor, context_handle);
 #ifndef MECH_EAP
-    else if (MECH_SAML_EC_DEBUG)
-        printBuffer(stdout, output_token);
+    else
+        traceBuffer(GSSEAP_TRACE_DEBUG, "", output_token);
 #endif
 
     return major;
@@ -96,6 +96,42 @@ inquireNegoExKey(OM_uint32 *minor,
     return major;
 }
 
+static OM_uint32
+inquirePhaseTimes(OM_uint32 *minor,
+                  const gss_ctx_id_t ctx,
+                  const gss_OID desired_object GSSEAP_UNUSED,
+                  gss_buffer_set_t *dataSet)
+{
+    OM_uint32 major, tmpMinor;
+    unsigned char entry[12];
+    gss_buffer_desc buf;
+    int phase;
+
+    major = gss_create_empty_buffer_set(minor, dataSet);
+    if (GSS_ERROR(major))
+        return major;
+
+    buf.length = sizeof(entry);
+    buf.value = entry;
+
+    for (phase = 1; phase <= GSS_EAP_PHASE_MAX; phase++) {
+        if (ctx->phaseTimes[phase] == 0)
+            continue;
+
+        store_uint32_be(phase, &entry[0]);
+        store_uint64_be(ctx->phaseTimes[phase], &entry[4]);
+
+        major = gss_add_buffer_set_member(minor, &buf, dataSet);
+        if (GSS_ERROR(major)) {
+            gss_release_buffer_set(&tmpMinor, dataSet);
+            return major;
+        }
+    }
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
 static struct {
     gss_OID_desc oid;
     OM_uint32 (*inquire)(OM_uint32 *, const gss_ctx_id_t,
@@ -116,8 +152,15 @@ static struct {
         { 11, "\x2a\x86\x48\x86\xf7\x12\x01\x02\x02\x05\x07" },
         inquireNegoExKey
     },
+    {
+        /* 1.3.6.1.4.1.5322.22.3.4.1 */
+        { 11, "\x2B\x06\x01\x04\x01\xA9\x4A\x16\x03\x04\x01" },
+        inquirePhaseTimes
+    },
 };
 
+gss_OID GSS_EAP_INQ_CTX_PHASE_TIMES             = &inquireCtxOps[3].oid;
+
 OM_uint32 GSSAPI_CALLCONV
 gss_inquire_sec_context_by_oid(OM_uint32 *minor,
                                const gss_ctx_id_t ctx,
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Differential check of the AES-NI/SHA-NI path in util_aesni.c against
+ * the krb5 library, run by make check. Random keys, usages and buffer
+ * layouts are encrypted by one implementation and decrypted by the
+ * other, and checksums from both must be identical. Any argument is
+ * taken as the random seed, which is printed on failure.
+ */
+
+#include "gssapiP_eap.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef GSSEAP_HAVE_AESNI
+
+#define T_ROUNDS            2000
+#define T_MAX_IOV           8
+#define T_MAX_USAGE         1024
+#define T_HEADER_LENGTH     16
+#define T_TRAILER_LENGTH    12
+
+struct t_layout {
+    krb5_crypto_iov iov[T_MAX_IOV];
+    size_t iovCount;
+    unsigned char *buf;
+    size_t length;
+};
+
+static unsigned int seed;
+static int failures;
+
+static void
+fail(const char *what, krb5_enctype enctype, int round, krb5_error_code code)
+{
+    fprintf(stderr, "t_aesni: %s (enctype %d round %d code %d seed %u)\n",
+            what, (int)enctype, round, (int)code, seed);
+    failures++;
+}
+
+static size_t
+randomLength(void)
+{
+    switch (rand() % 4) {
+    case 0:
+        return rand() % 3;
+    case 1:
+        return rand() % 48;
+    case 2:
+        return 16 * (rand() % 8);
+    default:
+        return rand() % 4096;
+    }
+}
+
+/*
+ * HEADER | n[DATA or SIGN_ONLY] | DATA | PADDING | TRAILER, or for a
+ * checksum n[DATA or SIGN_ONLY] | SIGN_ONLY | CHECKSUM
+ */
+static void
+makeLayout(struct t_layout *l, int checksum)
+{
+    krb5_cryptotype types[T_MAX_IOV];
+    size_t lengths[T_MAX_IOV], offset = 0;
+    int i, n = 0, extra = rand() % (T_MAX_IOV - 4);
+
+    if (!checksum) {
+        types[n] = KRB5_CRYPTO_TYPE_HEADER;
+        lengths[n++] = T_HEADER_LENGTH;
+    }
+    for (i = 0; i < extra; i++) {
+        types[n] = (rand() % 4 == 0) ? KRB5_CRYPTO_TYPE_SIGN_ONLY
+                                     : KRB5_CRYPTO_TYPE_DATA;
+        lengths[n++] = randomLength();
+    }
+    if (!checksum) {
+        types[n] = KRB5_CRYPTO_TYPE_DATA;
+        lengths[n++] = randomLength();
+        types[n] = KRB5_CRYPTO_TYPE_PADDING;
+        lengths[n++] = 0;
+        types[n] = KRB5_CRYPTO_TYPE_TRAILER;
+        lengths[n++] = T_TRAILER_LENGTH;
+    } else {
+        types[n] = KRB5_CRYPTO_TYPE_SIGN_ONLY;
+        lengths[n++] = randomLength();
+        types[n] = KRB5_CRYPTO_TYPE_CHECKSUM;
+        lengths[n++] = T_TRAILER_LENGTH;
+    }
+
+    l->iovCount = n;
+    l->length = 0;
+    for (i = 0; i < n; i++)
+        l->length += lengths[i];
+
+    l->buf = malloc(l->length + 1);
+    if (l->buf == NULL) {
+        perror("t_aesni");
+        exit(1);
+    }
+    for (i = 0; i < (int)l->length; i++)
+        l->buf[i] = rand();
+
+    for (i = 0; i < n; i++) {
+        l->iov[i].flags = types[i];
+        l->iov[i].data.length = lengths[i];
+        l->iov[i].data.data = (char *)l->buf + offset;
+        offset += lengths[i];
+    }
+}
+
+static void
+copyLayout(struct t_layout *dst, const struct t_layout *src)
+{
+    size_t i;
+
+    *dst = *src;
+    dst->buf = malloc(src->length + 1);
+    if (dst->buf == NULL) {
+        perror("t_aesni");
+        exit(1);
+    }
+    memcpy(dst->buf, src->buf, src->length);
+    for (i = 0; i < src->iovCount; i++) {
+        dst->iov[i].data.data = (char *)dst->buf +
+            ((unsigned char *)src->iov[i].data.data - src->buf);
+    }
+}
+
+/* Compare what lies between the header and the trailer */
+static int
+samePlaintext(const struct t_layout *a, const struct t_layout *b)
+{
+    return memcmp(a->buf + T_HEADER_LENGTH, b->buf + T_HEADER_LENGTH,
+                  a->length - T_HEADER_LENGTH - T_TRAILER_LENGTH) == 0;
+}
+
+static void
+checkEncryption(krb5_context krbContext,
+                krb5_keyblock *kb,
+                struct gss_eap_aesni_key *key,
+                int round)
+{
+    krb5_keyusage usage = 1 + rand() % T_MAX_USAGE;
+    krb5_enctype enctype = KRB_KEY_TYPE(kb);
+    struct t_layout plain, a, b;
+    krb5_error_code code;
+
+    makeLayout(&plain, 0);
+
+    /* krb5 encrypts, AES-NI decrypts */
+    copyLayout(&a, &plain);
+    code = krb5_c_encrypt_iov(krbContext, kb, usage, NULL, a.iov, a.iovCount);
+    if (code != 0)
+        fail("krb5_c_encrypt_iov", enctype, round, code);
+    else {
+        code = gssEapAesNiDecryptIov(krbContext, key, usage, a.iov, a.iovCount);
+        if (code != 0 || !samePlaintext(&a, &plain))
+            fail("AES-NI decryption of krb5 ciphertext", enctype, round, code);
+    }
+
+    /* AES-NI encrypts, krb5 decrypts */
+    copyLayout(&b, &plain);
+    code = gssEapAesNiEncryptIov(krbContext, key, usage, b.iov, b.iovCount);
+    if (code != 0)
+        fail("AES-NI encryption", enctype, round, code);
+    else {
+        b.buf[T_HEADER_LENGTH + rand() % (b.length - T_HEADER_LENGTH)] ^= 0x01;
+        if (gssEapAesNiDecryptIov(krbContext, key, usage,
+                                  b.iov, b.iovCount) == 0)
+            fail("AES-NI accepted a modified token", enctype, round, 0);
+        free(b.buf);
+
+        copyLayout(&b, &plain);
+        gssEapAesNiEncryptIov(krbContext, key, usage, b.iov, b.iovCount);
+        code = krb5_c_decrypt_iov(krbContext, kb, usage, NULL,
+                                  b.iov, b.iovCount);
+        if (code != 0 || !samePlaintext(&b, &plain))
+            fail("krb5 decryption of AES-NI ciphertext", enctype, round, code);
+    }
+
+    free(plain.buf);
+    free(a.buf);
+    free(b.buf);
+}
+
+static void
+checkChecksum(krb5_context krbContext,
+              krb5_keyblock *kb,
+              struct gss_eap_aesni_key *key,
+              krb5_cksumtype cksumtype,
+              int round)
+{
+    krb5_keyusage usage = 1 + rand() % T_MAX_USAGE;
+    krb5_enctype enctype = KRB_KEY_TYPE(kb);
+    struct t_layout a, b;
+    krb5_error_code code;
+    krb5_boolean krbValid = FALSE;
+    int valid = 0;
+
+    makeLayout(&a, 1);
+    copyLayout(&b, &a);
+
+    code = krb5_c_make_checksum_iov(krbContext, cksumtype, kb, usage,
+                                    a.iov, a.iovCount);
+    if (code != 0)
+        fail("krb5_c_make_checksum_iov", enctype, round, code);
+
+    code = gssEapAesNiChecksumIov(key, cksumtype, usage,
+                                  b.iov, b.iovCount, 0, NULL);
+    if (code != 0)
+        fail("AES-NI checksum", enctype, round, code);
+
+    if (memcmp(a.buf, b.buf, a.length) != 0)
+        fail("checksums differ", enctype, round, 0);
+
+    /* Both must agree on a modified message too */
+    b.buf[rand() % b.length] ^= 0x01;
+    krb5_c_verify_checksum_iov(krbContext, cksumtype, kb, usage,
+                               b.iov, b.iovCount, &krbValid);
+    gssEapAesNiChecksumIov(key, cksumtype, usage,
+                           b.iov, b.iovCount, 1, &valid);
+    if ((krbValid != 0) != (valid != 0))
+        fail("checksum verification differs", enctype, round, 0);
+
+    free(a.buf);
+    free(b.buf);
+}
+
+static int
+checkEnctype(krb5_context krbContext, krb5_enctype enctype)
+{
+    struct gss_ctx_id_struct ctx;
+    struct gss_eap_aesni_key *key;
+    krb5_cksumtype cksumtype;
+    krb5_keyblock *kb = &ctx.rfc3961Key;
+    krb5_error_code code;
+    int round, haveAesNi = 1;
+
+    cksumtype = (enctype == ENCTYPE_AES128_CTS_HMAC_SHA1_96)
+                ? CKSUMTYPE_HMAC_SHA1_96_AES128
+                : CKSUMTYPE_HMAC_SHA1_96_AES256;
+
+    for (round = 0; round < T_ROUNDS; round++) {
+        memset(&ctx, 0, sizeof(ctx));
+
+        code = krb5_c_make_random_key(krbContext, enctype, kb);
+        if (code != 0) {
+            fail("krb5_c_make_random_key", enctype, round, code);
+            return -1;
+        }
+
+        key = gssEapAesNiContextKey(&ctx);
+        if (key == NULL) {
+            krb5_free_keyblock_contents(krbContext, kb);
+            return 77;
+        }
+
+        if (haveAesNi) {
+            struct t_layout probe;
+
+            makeLayout(&probe, 0);
+            if (gssEapAesNiEncryptIov(krbContext, key, 1, probe.iov,
+                                      probe.iovCount) == KRB5_BAD_ENCTYPE) {
+                printf("t_aesni: no AES-NI; checking checksums only\n");
+                haveAesNi = 0;
+            }
+            free(probe.buf);
+        }
+
+        if (haveAesNi)
+            checkEncryption(krbContext, kb, key, round);
+        checkChecksum(krbContext, kb, key, cksumtype, round);
+
+        gssEapAesNiReleaseKey(&ctx.aesNiKey);
+        krb5_free_keyblock_contents(krbContext, kb);
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    krb5_context krbContext;
+    krb5_error_code code;
+    int ret;
+
+    seed = (argc > 1) ? (unsigned int)strtoul(argv[1], NULL, 0)
+                      : (unsigned int)time(NULL);
+    srand(seed);
+
+    code = krb5_init_context(&krbContext);
+    if (code != 0) {
+        fprintf(stderr, "t_aesni: krb5_init_context: %d\n", (int)code);
+        return 1;
+    }
+
+    ret = checkEnctype(krbContext, ENCTYPE_AES128_CTS_HMAC_SHA1_96);
+    if (ret == 0)
+        ret = checkEnctype(krbContext, ENCTYPE_AES256_CTS_HMAC_SHA1_96);
+
+    krb5_free_context(krbContext);
+
+    if (ret == 77) {
+        printf("t_aesni: fast path disabled; skipped\n");
+        return 77;
+    }
+
+    return (ret != 0 || failures != 0) ? 1 : 0;
+}
+
+#else
+
+int
+main(void)
+{
+    printf("t_aesni: built without the AES-NI path; skipped\n");
+    return 77;
+}
+
+#endif /* GSSEAP_HAVE_AESNI */
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Initiator name attributes, run by make check. An acceptor context
+ * token is given attributes by splicing a list into its empty
+ * attributes field, following the field order of exportContextV2().
+ * Every attribute must be found with its value, the first of two with
+ * the same name must win and an absent one must not be found, whether
+ * the name came from the context, gss_duplicate_name() or a composite
+ * export, and whether the list is small or large enough to be indexed
+ * over several resizes.
+ */
+
+#include "t_mech.h"
+
+const char *tProgram = "t_attributes";
+
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+
+static const char seed[] = "t_attributes session key";
+
+static size_t
+attrName(char *buf, size_t size, size_t i)
+{
+    return snprintf(buf, size, "urn:t_attributes:%lu", (unsigned long)i);
+}
+
+static size_t
+attrValue(char *buf, size_t size, size_t i)
+{
+    return snprintf(buf, size, "value-%lu", (unsigned long)i);
+}
+
+static unsigned char *
+storeAttr(unsigned char *p, const char *attr, size_t attrLength,
+          const char *value, size_t valueLength)
+{
+    store_uint32_be(attrLength, p);
+    memcpy(p + 4, attr, attrLength);
+    p += 4 + attrLength;
+    store_uint32_be(valueLength, p);
+    memcpy(p + 4, value, valueLength);
+
+    return p + 4 + valueLength;
+}
+
+/* count attributes, then the first again with another value */
+static gss_buffer_desc
+attributeContextToken(int enctype, size_t count)
+{
+    static const char shadowed[] = "shadowed";
+    gss_buffer_desc token, spliced;
+    unsigned char *p;
+    size_t i, offset, attrsLength = 0;
+    char attr[64], value[64];
+    int field;
+
+    token = tExportBenchContext(enctype, seed);
+
+    /* Skip mechanismUsed, rfc3961Key, initiatorName and acceptorName */
+    offset = 52;
+    for (field = 0; field < 4; field++)
+        offset += 4 + load_uint32_be((unsigned char *)token.value + offset);
+
+    if (load_uint32_be((unsigned char *)token.value + offset) != 0)
+        tFail("bench context already has attributes");
+
+    for (i = 0; i < count; i++)
+        attrsLength += 8 + attrName(attr, sizeof(attr), i) +
+                       attrValue(value, sizeof(value), i);
+    attrsLength += 8 + attrName(attr, sizeof(attr), 0) + sizeof(shadowed) - 1;
+
+    spliced.length = token.length + attrsLength;
+    spliced.value = p = tMalloc(spliced.length);
+
+    memcpy(p, token.value, offset);
+    store_uint32_be(spliced.length, &p[4]);
+    p += offset;
+    store_uint32_be(attrsLength, p);
+    p += 4;
+
+    for (i = 0; i < count; i++) {
+        size_t attrLength = attrName(attr, sizeof(attr), i);
+        size_t valueLength = attrValue(value, sizeof(value), i);
+
+        p = storeAttr(p, attr, attrLength, value, valueLength);
+    }
+    p = storeAttr(p, attr, attrName(attr, sizeof(attr), 0),
+                  shadowed, sizeof(shadowed) - 1);
+
+    memcpy(p, (unsigned char *)token.value + offset + 4,
+           token.length - offset - 4);
+
+    memset(token.value, 0, token.length);
+    free(token.value);
+
+    return spliced;
+}
+
+static void
+checkAttributes(gss_name_t name, size_t count, const char *how)
+{
+    gss_buffer_desc attrBuf, value, displayValue;
+    OM_uint32 major, minor;
+    char attr[64], expected[64];
+    size_t i, expectedLength;
+    int authenticated, complete, more;
+
+    attrBuf.value = attr;
+
+    for (i = 0; i <= count; i++) {
+        attrBuf.length = attrName(attr, sizeof(attr), i);
+        more = -1;
+        major = gss_get_name_attribute(&minor, name, &attrBuf,
+                                       &authenticated, &complete,
+                                       &value, &displayValue, &more);
+        if (i == count) {
+            if (major != GSS_S_UNAVAILABLE)
+                tFail("%s, %lu attributes: absent %s was found",
+                      how, (unsigned long)count, attr);
+            break;
+        }
+        tCheck("gss_get_name_attribute", major, minor);
+
+        expectedLength = attrValue(expected, sizeof(expected), i);
+        if (value.length != expectedLength ||
+            memcmp(value.value, expected, expectedLength) != 0)
+            tFail("%s, %lu attributes: %s is %.*s, not %s",
+                  how, (unsigned long)count, attr,
+                  (int)value.length, (char *)value.value, expected);
+
+        gss_release_buffer(&minor, &value);
+        gss_release_buffer(&minor, &displayValue);
+    }
+}
+
+int
+main(void)
+{
+    static const size_t counts[] = { 1, 16, 4096 };
+    gss_buffer_desc token;
+    gss_ctx_id_t ctx;
+    gss_name_t name, copy, imported;
+    OM_uint32 major, minor;
+    unsigned int c;
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        token = attributeContextToken(ENCTYPE_AES256_CTS_HMAC_SHA1_96,
+                                      counts[c]);
+        ctx = GSS_C_NO_CONTEXT;
+        major = gss_import_sec_context(&minor, &token, &ctx);
+        tCheck("gss_import_sec_context with attributes", major, minor);
+        free(token.value);
+
+        major = gss_inquire_context(&minor, ctx, &name, NULL, NULL,
+                                    NULL, NULL, NULL, NULL);
+        tCheck("gss_inquire_context", major, minor);
+        checkAttributes(name, counts[c], "context");
+
+        major = gss_duplicate_name(&minor, name, &copy);
+        tCheck("gss_duplicate_name", major, minor);
+        checkAttributes(copy, counts[c], "duplicate");
+
+        major = gss_export_name_composite(&minor, name, &token);
+        tCheck("gss_export_name_composite", major, minor);
+        major = gss_import_name(&minor, &token, GSS_C_NT_COMPOSITE_EXPORT,
+                                &imported);
+        tCheck("gss_import_name", major, minor);
+        checkAttributes(imported, counts[c], "composite");
+
+        gss_release_buffer(&minor, &token);
+        gss_release_name(&minor, &imported);
+        gss_release_name(&minor, &copy);
+        gss_release_name(&minor, &name);
+        gss_delete_sec_context(&minor, &ctx, GSS_C_NO_BUFFER);
+    }
+
+    return 0;
+}
+
+#else
+
+/* Attributes are only carried by acceptor names */
+int
+main(void)
+{
+    return 77;
+}
+
+#endif /* GSSEAP_ENABLE_ACCEPTOR && !MECH_EAP */
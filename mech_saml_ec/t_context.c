@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Version 2 context tokens, run by make check. The importer must
+ * reject every truncation of a valid token and must survive every
+ * single bit flip, either rejecting the token or producing a context
+ * that can be released. An intact token must import to a context that
+ * exports the same token again and unwraps what its peer wraps.
+ */
+
+#include "t_mech.h"
+
+const char *tProgram = "t_context";
+
+static const char seed[] = "t_context session key";
+
+static void
+checkDamagedTokens(gss_buffer_t token, int enctype)
+{
+    gss_ctx_id_t ctx = GSS_C_NO_CONTEXT;
+    gss_buffer_desc damaged;
+    unsigned char *p = tMalloc(token->length);
+    OM_uint32 major, minor;
+    long accepted = 0, rejected = 0;
+    size_t i;
+    int bit;
+
+    damaged.value = p;
+
+    for (i = 0; i < token->length; i++) {
+        memcpy(p, token->value, i);
+        damaged.length = i;
+        major = gss_import_sec_context(&minor, &damaged, &ctx);
+        if (!GSS_ERROR(major))
+            tFail("enctype %d: token truncated to %lu of %lu bytes "
+                  "was accepted", enctype, (unsigned long)i,
+                  (unsigned long)token->length);
+        rejected++;
+    }
+
+    damaged.length = token->length;
+    for (i = 0; i < token->length; i++) {
+        for (bit = 0; bit < 8; bit++) {
+            memcpy(p, token->value, token->length);
+            p[i] ^= 1 << bit;
+            major = gss_import_sec_context(&minor, &damaged, &ctx);
+            if (GSS_ERROR(major)) {
+                rejected++;
+            } else {
+                accepted++;
+                gss_delete_sec_context(&minor, &ctx, GSS_C_NO_BUFFER);
+            }
+        }
+    }
+
+    free(p);
+
+    printf("t_context: enctype %d: %ld damaged tokens rejected, "
+           "%ld imported\n", enctype, rejected, accepted);
+}
+
+static void
+checkRoundTrip(gss_buffer_t token, int enctype)
+{
+    gss_ctx_id_t initiator, acceptor = GSS_C_NO_CONTEXT;
+    gss_buffer_desc in, wrapped, out, again;
+    OM_uint32 major, minor;
+    int conf_state;
+
+    major = gss_import_sec_context(&minor, token, &acceptor);
+    tCheck("gss_import_sec_context", major, minor);
+
+    major = gss_export_sec_context(&minor, &acceptor, &again);
+    tCheck("gss_export_sec_context of an imported context", major, minor);
+
+    if (again.length != token->length ||
+        memcmp(again.value, token->value, token->length) != 0)
+        tFail("enctype %d: imported context exports a different token",
+              enctype);
+
+    major = gss_import_sec_context(&minor, &again, &acceptor);
+    tCheck("gss_import_sec_context", major, minor);
+    gss_release_buffer(&minor, &again);
+
+    initiator = tBenchContext(enctype, 1, seed);
+
+    in.value = (void *)seed;
+    in.length = sizeof(seed) - 1;
+
+    major = gss_wrap(&minor, initiator, 1, GSS_C_QOP_DEFAULT, &in,
+                     &conf_state, &wrapped);
+    tCheck("gss_wrap", major, minor);
+
+    major = gss_unwrap(&minor, acceptor, &wrapped, &out, &conf_state, NULL);
+    tCheck("gss_unwrap with an imported context", major, minor);
+
+    if (out.length != in.length || memcmp(out.value, in.value, in.length) != 0)
+        tFail("enctype %d: imported context unwrapped the wrong data",
+              enctype);
+
+    gss_release_buffer(&minor, &wrapped);
+    gss_release_buffer(&minor, &out);
+    gss_delete_sec_context(&minor, &initiator, GSS_C_NO_BUFFER);
+    gss_delete_sec_context(&minor, &acceptor, GSS_C_NO_BUFFER);
+}
+
+int
+main(void)
+{
+    static const int enctypes[] = {
+        ENCTYPE_AES128_CTS_HMAC_SHA1_96,
+        ENCTYPE_AES256_CTS_HMAC_SHA1_96,
+    };
+    gss_buffer_desc token;
+    OM_uint32 minor;
+    size_t e;
+
+    for (e = 0; e < sizeof(enctypes) / sizeof(enctypes[0]); e++) {
+        token = tExportBenchContext(enctypes[e], seed);
+        checkDamagedTokens(&token, enctypes[e]);
+        checkRoundTrip(&token, enctypes[e]);
+        gss_release_buffer(&minor, &token);
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The default initiator identity, run by make check. The identity file
+ * is cached between calls, so it must be read again when it is
+ * replaced, rewritten in place or named by a different
+ * GSSEAP_IDENTITY, and not otherwise change.
+ */
+
+#include "t_mech.h"
+
+const char *tProgram = "t_identity";
+
+static char path[] = "/tmp/t_identity.XXXXXX";
+static char otherPath[sizeof(path) + 8];
+
+static void
+writeFile(const char *filePath, const char *identity)
+{
+    FILE *fp;
+
+    fp = fopen(filePath, "w");
+    if (fp == NULL || fprintf(fp, "%s\nt_identity password\n", identity) < 0 ||
+        fclose(fp) != 0)
+        tFail("cannot write %s", filePath);
+}
+
+/* Replace the file, as an editor saving it would */
+static void
+replaceFile(const char *filePath, const char *identity)
+{
+    char tmpPath[sizeof(otherPath) + 8];
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.new", filePath);
+    writeFile(tmpPath, identity);
+    if (rename(tmpPath, filePath) != 0)
+        tFail("cannot rename %s", tmpPath);
+}
+
+static void
+checkIdentity(const char *identity, const char *what)
+{
+    gss_cred_id_t cred;
+    gss_name_t name;
+    gss_buffer_desc display;
+    OM_uint32 major, minor;
+
+    major = gss_acquire_cred(&minor, GSS_C_NO_NAME, GSS_C_INDEFINITE,
+                             GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                             &cred, NULL, NULL);
+    tCheck("gss_acquire_cred", major, minor);
+    major = gss_inquire_cred(&minor, cred, &name, NULL, NULL, NULL);
+    tCheck("gss_inquire_cred", major, minor);
+    major = gss_display_name(&minor, name, &display, NULL);
+    tCheck("gss_display_name", major, minor);
+
+    if (display.length != strlen(identity) ||
+        memcmp(display.value, identity, display.length) != 0) {
+        unlink(path);
+        unlink(otherPath);
+        tFail("%s: default identity is %.*s, not %s", what,
+              (int)display.length, (char *)display.value, identity);
+    }
+
+    gss_release_buffer(&minor, &display);
+    gss_release_name(&minor, &name);
+    gss_release_cred(&minor, &cred);
+}
+
+int
+main(void)
+{
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+        tFail("cannot create %s", path);
+    close(fd);
+    snprintf(otherPath, sizeof(otherPath), "%s.other", path);
+
+    setenv("GSSEAP_IDENTITY", path, 1);
+
+    replaceFile(path, "first@example.org");
+    checkIdentity("first@example.org", "new file");
+    checkIdentity("first@example.org", "unchanged file");
+
+    replaceFile(path, "second@example.org");
+    checkIdentity("second@example.org", "replaced file");
+
+    /* Same inode; a different length changes the size whatever the clock */
+    writeFile(path, "rewritten@example.org");
+    checkIdentity("rewritten@example.org", "file rewritten in place");
+
+    replaceFile(otherPath, "other@example.org");
+    setenv("GSSEAP_IDENTITY", otherPath, 1);
+    checkIdentity("other@example.org", "another file");
+
+    setenv("GSSEAP_IDENTITY", path, 1);
+    checkIdentity("rewritten@example.org", "first file again");
+
+    unlink(path);
+    unlink(otherPath);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name comparison, run by make check. With interning, equal names must
+ * share a table entry however they were made, different names must
+ * not, and entries must outlive all but their last reference while
+ * threads import and release the same names. Without interning the
+ * same comparisons are made byte by byte.
+ */
+
+#include "t_mech.h"
+
+#include <pthread.h>
+
+const char *tProgram = "t_intern";
+
+/* Enough names to grow the table several times */
+#define T_NAME_COUNT            5000
+#define T_THREADS               4
+#define T_THREAD_ROUNDS         50
+#define T_THREAD_NAMES          256
+
+static const char format[] =
+    "user%05lu@example.org!"
+    "urn:oasis:names:tc:SAML:2.0:nameid-format:persistent!"
+    "https://idp.example.org/idp/shibboleth!"
+    "https://sp.example.org/shibboleth!";
+
+static gss_name_t names[T_NAME_COUNT];
+
+static gss_name_t
+importName(size_t i, const char *suffix)
+{
+    gss_buffer_desc buf;
+    gss_name_t name;
+    OM_uint32 major, minor;
+    char user[256];
+    int length;
+
+    length = snprintf(user, sizeof(user), format, (unsigned long)i);
+    snprintf(user + length, sizeof(user) - length, "%s", suffix);
+
+    buf.value = user;
+    buf.length = strlen(user);
+
+    major = gss_import_name(&minor, &buf, GSS_C_NT_USER_NAME, &name);
+    tCheck("gss_import_name", major, minor);
+
+    return name;
+}
+
+static void
+checkEqual(gss_name_t name1, gss_name_t name2, int expected,
+           const char *what, size_t i)
+{
+    OM_uint32 major, minor;
+    int equal = -1;
+
+    major = gss_compare_name(&minor, name1, name2, &equal);
+    tCheck("gss_compare_name", major, minor);
+
+    if (equal != expected)
+        tFail("%s %lu compared %s", what, (unsigned long)i,
+              equal ? "equal" : "unequal");
+}
+
+static void *
+threadMain(void *arg)
+{
+    gss_name_t name;
+    OM_uint32 minor;
+    size_t i;
+    int round;
+
+    (void)arg;
+
+    for (round = 0; round < T_THREAD_ROUNDS; round++) {
+        for (i = 0; i < T_THREAD_NAMES; i++) {
+            name = importName(i, "");
+            checkEqual(name, names[i], 1, "name imported by a thread", i);
+            checkEqual(name, names[i + 1], 0, "name imported by a thread", i);
+            gss_release_name(&minor, &name);
+
+            /* Nobody else holds this one, so its entry comes and goes */
+            name = importName(i, "!thread");
+            gss_release_name(&minor, &name);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(void)
+{
+    pthread_t threads[T_THREADS];
+    gss_name_t name, copy;
+    OM_uint32 major, minor;
+    size_t i;
+    int t;
+
+    for (i = 0; i < T_NAME_COUNT; i++)
+        names[i] = importName(i, "");
+
+    for (i = 0; i < T_NAME_COUNT; i++) {
+        name = importName(i, "");
+        checkEqual(name, names[i], 1, "separately imported name", i);
+        if (i + 1 < T_NAME_COUNT)
+            checkEqual(name, names[i + 1], 0, "neighbouring name", i);
+
+        major = gss_duplicate_name(&minor, name, &copy);
+        tCheck("gss_duplicate_name", major, minor);
+        gss_release_name(&minor, &name);
+
+        /* The duplicate keeps the entry alive */
+        checkEqual(copy, names[i], 1, "duplicate of a released name", i);
+        gss_release_name(&minor, &copy);
+
+        /* Prefixes and extensions differ only in length */
+        name = importName(i, "x");
+        checkEqual(name, names[i], 0, "extended name", i);
+        gss_release_name(&minor, &name);
+    }
+
+    for (t = 0; t < T_THREADS; t++) {
+        if (pthread_create(&threads[t], NULL, threadMain, NULL) != 0)
+            tFail("cannot create thread");
+    }
+    for (t = 0; t < T_THREADS; t++)
+        pthread_join(threads[t], NULL);
+
+    /* Release every name, then make them again from an empty table */
+    for (i = 0; i < T_NAME_COUNT; i++)
+        gss_release_name(&minor, &names[i]);
+    for (i = 0; i < T_NAME_COUNT; i++)
+        names[i] = importName(i, "");
+    for (i = 0; i < T_NAME_COUNT; i++) {
+        name = importName(i, "");
+        checkEqual(name, names[i], 1, "name imported again", i);
+        gss_release_name(&minor, &name);
+        gss_release_name(&minor, &names[i]);
+    }
+
+    return 0;
+}
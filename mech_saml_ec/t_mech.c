@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Helpers shared by the make check programs; see t_mech.h.
+ */
+
+#include "t_mech.h"
+
+#include <stdarg.h>
+
+void
+tFail(const char *format, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s: ", tProgram);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+
+    exit(1);
+}
+
+void
+tCheck(const char *what, OM_uint32 major, OM_uint32 minor)
+{
+    gss_buffer_desc message = GSS_C_EMPTY_BUFFER;
+    OM_uint32 context = 0, tmpMinor;
+
+    if (!GSS_ERROR(major))
+        return;
+
+    gss_display_status(&tmpMinor, minor, GSS_C_MECH_CODE, GSS_C_NO_OID,
+                       &context, &message);
+    tFail("%s: major %08x minor %u (%.*s)", what, major, minor,
+          (int)message.length, (char *)message.value);
+}
+
+void *
+tMalloc(size_t length)
+{
+    void *p = malloc(length ? length : 1);
+
+    if (p == NULL)
+        tFail("out of memory");
+
+    return p;
+}
+
+gss_ctx_id_t
+tBenchContext(int enctype, int initiator, const char *seed)
+{
+    size_t seedLength = strlen(seed);
+    unsigned char *token = tMalloc(20 + seedLength);
+    gss_buffer_desc buf;
+    gss_ctx_id_t ctx = GSS_C_NO_CONTEXT;
+    OM_uint32 major, minor;
+
+    store_uint32_be(EAP_EXPORT_CONTEXT_BENCH, &token[0]);
+    store_uint32_be(initiator ? CTX_FLAG_INITIATOR : 0, &token[4]);
+    store_uint32_be(T_GSS_FLAGS, &token[8]);
+    store_uint32_be(enctype, &token[12]);
+    store_uint32_be(seedLength, &token[16]);
+    memcpy(&token[20], seed, seedLength);
+
+    buf.length = 20 + seedLength;
+    buf.value = token;
+
+    major = gss_import_sec_context(&minor, &buf, &ctx);
+    tCheck("importing a bench context", major, minor);
+
+    free(token);
+
+    return ctx;
+}
+
+gss_buffer_desc
+tExportBenchContext(int enctype, const char *seed)
+{
+    gss_ctx_id_t ctx = tBenchContext(enctype, 0, seed);
+    gss_buffer_desc token;
+    OM_uint32 major, minor;
+
+    major = gss_export_sec_context(&minor, &ctx, &token);
+    tCheck("gss_export_sec_context", major, minor);
+
+    return token;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Helpers shared by the make check programs that call the mechanism
+ * through the GSS-API. They link libmech_saml_ec_check.la, which is
+ * built with GSSEAP_ENABLE_BENCH so that established contexts can be
+ * made from a fixed key without an IdP.
+ */
+
+#ifndef _T_MECH_H_
+#define _T_MECH_H_ 1
+
+#include "gssapiP_eap.h"
+
+#include <stdio.h>
+
+#define T_GSS_FLAGS         (GSS_C_MUTUAL_FLAG | GSS_C_CONF_FLAG | \
+                             GSS_C_INTEG_FLAG)
+
+/* Defined by each program, for messages */
+extern const char *tProgram;
+
+/* Print the program name, what failed and the status, and exit */
+void
+tCheck(const char *what, OM_uint32 major, OM_uint32 minor);
+
+void
+tFail(const char *format, ...);
+
+void *
+tMalloc(size_t length);
+
+/* An established context with the fixed names and the given key */
+gss_ctx_id_t
+tBenchContext(int enctype, int initiator, const char *seed);
+
+/* Export an acceptor context made by tBenchContext() */
+gss_buffer_desc
+tExportBenchContext(int enctype, const char *seed);
+
+#endif /* _T_MECH_H_ */
@@ -194,7 +194,8 @@ unwrapToken(OM_uint32 *minor,
             /* Decrypt */
             code = gssEapDecrypt(krbContext,
                                  ((ctx->gssFlags & GSS_C_DCE_STYLE) != 0),
-                                 ec, rrc, KRB_CRYPTO_CONTEXT(ctx), keyUsage,
+                                 ec, rrc, KRB_CRYPTO_CONTEXT(ctx),
+                                 gssEapAesNiContextKey(ctx), keyUsage,
                                  iov, iov_count);
             if (code != 0) {
                 major = GSS_S_BAD_SIG;
@@ -225,7 +226,8 @@ unwrapToken(OM_uint32 *minor,
             store_uint16_be(0, ptr + 6);
 
             code = gssEapVerify(krbContext, ctx->checksumType, rrc,
-                                KRB_CRYPTO_CONTEXT(ctx), keyUsage,
+                                KRB_CRYPTO_CONTEXT(ctx),
+                                gssEapAesNiContextKey(ctx), keyUsage,
                                 iov, iov_count, &valid);
             if (code != 0 || valid == FALSE) {
                 major = GSS_S_BAD_SIG;
@@ -251,7 +253,8 @@ unwrapToken(OM_uint32 *minor,
          */
         code = gssEapVerify(krbContext, ctx->checksumType,
                             trailer != NULL ? 0 : header->buffer.length - 16,
-                            KRB_CRYPTO_CONTEXT(ctx), keyUsage,
+                            KRB_CRYPTO_CONTEXT(ctx),
+                            gssEapAesNiContextKey(ctx), keyUsage,
                             iov, iov_count, &valid);
         if (code != 0 || valid == FALSE) {
             major = GSS_S_BAD_SIG;
@@ -317,6 +320,11 @@ rotateLeft(void *ptr, size_t bufsiz, size_t rc)
 static OM_uint32
 unwrapStream(OM_uint32 *minor,
              gss_ctx_id_t ctx,
+#ifdef HAVE_HEIMDAL_VERSION
+             krb5_crypto krbCrypto,
+#else
+             krb5_keyblock *unused GSSEAP_UNUSED,
+#endif
              int *conf_state,
              gss_qop_t *qop_state,
              gss_iov_buffer_desc *iov,
@@ -332,7 +340,7 @@ unwrapStream(OM_uint32 *minor,
     gss_iov_buffer_t stream, data = NULL;
     gss_iov_buffer_t theader, tdata = NULL, tpadding, ttrailer;
 #ifdef HAVE_HEIMDAL_VERSION
-    krb5_crypto krbCrypto = NULL;
+    int freeCrypto = (krbCrypto == NULL);
 #endif
 
     GSSEAP_KRB_INIT(&krbContext);
@@ -403,9 +411,12 @@ unwrapStream(OM_uint32 *minor,
     ttrailer->type = GSS_IOV_BUFFER_TYPE_TRAILER;
 
 #ifdef HAVE_HEIMDAL_VERSION
-    code = krb5_crypto_init(krbContext, &ctx->rfc3961Key, ETYPE_NULL, &krbCrypto);
-    if (code != 0)
-        goto cleanup;
+    if (krbCrypto == NULL) {
+        code = krb5_crypto_init(krbContext, &ctx->rfc3961Key,
+                                ETYPE_NULL, &krbCrypto);
+        if (code != 0)
+            goto cleanup;
+    }
 #endif
 
     {
@@ -497,7 +508,7 @@ cleanup:
     if (tiov != NULL)
         GSSEAP_FREE(tiov);
 #ifdef HAVE_HEIMDAL_VERSION
-    if (krbCrypto != NULL)
+    if (freeCrypto && krbCrypto != NULL)
         krb5_crypto_destroy(krbContext, krbCrypto);
 #endif
 
@@ -506,6 +517,25 @@ cleanup:
     return major;
 }
 
+/* Count a message that was unwrapped, or a MIC that was verified */
+static void
+countToken(gss_ctx_id_t ctx,
+           gss_iov_buffer_desc *iov,
+           int iov_count,
+           enum gss_eap_token_type toktype)
+{
+    size_t dataLength, assocDataLength;
+
+    if (toktype == TOK_TYPE_WRAP) {
+        gssEapIovMessageLength(iov, iov_count,
+                               &dataLength, &assocDataLength);
+        gssEapMetricIncrement(GSSEAP_METRIC_UNWRAP);
+        gssEapMetricBytes(GSSEAP_METRIC_UNWRAP_BYTES, ctx->encryptionType,
+                          dataLength - assocDataLength);
+    } else if (toktype == TOK_TYPE_MIC)
+        gssEapMetricIncrement(GSSEAP_METRIC_VERIFY_MIC);
+}
+
 OM_uint32
 gssEapUnwrapOrVerifyMIC(OM_uint32 *minor,
                         gss_ctx_id_t ctx,
@@ -523,7 +553,9 @@ gssEapUnwrapOrVerifyMIC(OM_uint32 *minor,
     }
 
     if (gssEapLocateIov(iov, iov_count, GSS_IOV_BUFFER_TYPE_STREAM) != NULL) {
-        major = unwrapStream(minor, ctx, conf_state, qop_state,
+        major = unwrapStream(minor, ctx,
+                             NULL, /* krbCrypto */
+                             conf_state, qop_state,
                              iov, iov_count, toktype);
     } else {
         major = unwrapToken(minor, ctx,
@@ -532,6 +564,9 @@ gssEapUnwrapOrVerifyMIC(OM_uint32 *minor,
                             iov, iov_count, toktype);
     }
 
+    if (major == GSS_S_COMPLETE)
+        countToken(ctx, iov, iov_count, toktype);
+
     return major;
 }
 
@@ -570,3 +605,104 @@ cleanup:
 
     return major;
 }
+
+/*
+ * Unwrap a batch of messages under a single acquisition of the context
+ * lock and, on Heimdal, a single crypto context. Messages are processed
+ * in array order, so sequence checking sees them in the order given.
+ * The status of each message is returned in its batch element; the
+ * return value is that of the first message that failed.
+ */
+OM_uint32 GSSAPI_CALLCONV
+gss_unwrap_iov_batch(OM_uint32 *minor,
+                     gss_ctx_id_t ctx,
+                     gss_iov_batch_desc *batch,
+                     int batch_count)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+#ifdef HAVE_HEIMDAL_VERSION
+    krb5_context krbContext;
+    krb5_crypto krbCrypto = NULL;
+    krb5_error_code code;
+#endif
+
+    if (ctx == GSS_C_NO_CONTEXT) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    }
+
+    if (batch == NULL && batch_count != 0) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ;
+    }
+
+    *minor = 0;
+
+    GSSEAP_MUTEX_LOCK(&ctx->mutex);
+
+    if (!CTX_IS_ESTABLISHED(ctx)) {
+        major = GSS_S_NO_CONTEXT;
+        *minor = GSSEAP_CONTEXT_INCOMPLETE;
+        goto cleanup;
+    }
+
+    if (ctx->encryptionType == ENCTYPE_NULL) {
+        major = GSS_S_UNAVAILABLE;
+        *minor = GSSEAP_KEY_UNAVAILABLE;
+        goto cleanup;
+    }
+
+#ifdef HAVE_HEIMDAL_VERSION
+    major = gssEapKerberosInit(minor, &krbContext);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    code = krb5_crypto_init(krbContext, &ctx->rfc3961Key,
+                            ETYPE_NULL, &krbCrypto);
+    if (code != 0) {
+        major = GSS_S_FAILURE;
+        *minor = code;
+        goto cleanup;
+    }
+#endif
+
+    for (i = 0; i < batch_count; i++) {
+        gss_iov_batch_t msg = &batch[i];
+
+        msg->conf_state = 0;
+        msg->qop_state = GSS_C_QOP_DEFAULT;
+
+        if (gssEapLocateIov(msg->iov, msg->iov_count,
+                            GSS_IOV_BUFFER_TYPE_STREAM) != NULL) {
+            msg->major_status = unwrapStream(&msg->minor_status, ctx,
+                                             KRB_CRYPTO_CONTEXT(ctx),
+                                             &msg->conf_state,
+                                             &msg->qop_state,
+                                             msg->iov, msg->iov_count,
+                                             TOK_TYPE_WRAP);
+        } else {
+            msg->major_status = unwrapToken(&msg->minor_status, ctx,
+                                            KRB_CRYPTO_CONTEXT(ctx),
+                                            &msg->conf_state,
+                                            &msg->qop_state,
+                                            msg->iov, msg->iov_count,
+                                            TOK_TYPE_WRAP);
+        }
+        if (msg->major_status == GSS_S_COMPLETE)
+            countToken(ctx, msg->iov, msg->iov_count, TOK_TYPE_WRAP);
+        if (GSS_ERROR(msg->major_status) && !GSS_ERROR(major)) {
+            major = msg->major_status;
+            *minor = msg->minor_status;
+        }
+    }
+
+cleanup:
+#ifdef HAVE_HEIMDAL_VERSION
+    if (krbCrypto != NULL)
+        krb5_crypto_destroy(krbContext, krbCrypto);
+#endif
+    GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
+
+    return major;
+}
@@ -95,6 +95,47 @@ extern "C" {
 #define GSSEAP_UNUSED
 #endif
 
+/* util_aesni.c */
+#if defined(GSSEAP_ENABLE_AESNI) && !defined(HAVE_HEIMDAL_VERSION) && \
+    defined(__GNUC__) && defined(__x86_64__)
+#define GSSEAP_HAVE_AESNI 1
+#endif
+
+struct gss_eap_aesni_key;
+
+#ifdef GSSEAP_HAVE_AESNI
+struct gss_eap_aesni_key *
+gssEapAesNiContextKey(gss_ctx_id_t ctx);
+
+void
+gssEapAesNiReleaseKey(struct gss_eap_aesni_key **pKey);
+
+krb5_error_code
+gssEapAesNiEncryptIov(krb5_context krbContext,
+                      struct gss_eap_aesni_key *key,
+                      krb5_keyusage usage,
+                      krb5_crypto_iov *data,
+                      size_t num_data);
+
+krb5_error_code
+gssEapAesNiDecryptIov(krb5_context krbContext,
+                      struct gss_eap_aesni_key *key,
+                      krb5_keyusage usage,
+                      krb5_crypto_iov *data,
+                      size_t num_data);
+
+krb5_error_code
+gssEapAesNiChecksumIov(struct gss_eap_aesni_key *key,
+                       krb5_cksumtype cksumtype,
+                       krb5_keyusage usage,
+                       krb5_crypto_iov *data,
+                       size_t num_data,
+                       int verify,
+                       int *valid);
+#else
+#define gssEapAesNiContextKey(ctx)      ((struct gss_eap_aesni_key *)NULL)
+#endif /* GSSEAP_HAVE_AESNI */
+
 /* util_buffer.c */
 OM_uint32
 makeStringBuffer(OM_uint32 *minor,
@@ -125,7 +166,13 @@ duplicateBuffer(OM_uint32 *minor,
                 gss_buffer_t dst);
 
 void
-printBuffer(FILE *stream, const gss_buffer_t src);
+traceBuffer(int level, const char *label, const gss_buffer_t src);
+
+uint32_t
+gssEapHashBytes(const void *data, size_t length);
+
+void
+gssEapSecureZero(void *data, size_t length);
 
 #define duplicateBufferOrCleanup(src, dst)              \
     do {                                                \
@@ -162,6 +209,7 @@ gssEapSign(krb5_context context,
 #else
            krb5_keyblock *key,
 #endif
+           struct gss_eap_aesni_key *aesNiKey,
            krb5_keyusage sign_usage,
            gss_iov_buffer_desc *iov,
            int iov_count);
@@ -175,6 +223,7 @@ gssEapVerify(krb5_context context,
 #else
              krb5_keyblock *key,
 #endif
+             struct gss_eap_aesni_key *aesNiKey,
              krb5_keyusage sign_usage,
              gss_iov_buffer_desc *iov,
              int iov_count,
@@ -189,6 +238,10 @@ gssEapEncodeGssChannelBindings(OM_uint32 *minor,
 
 /* util_context.c */
 #define EAP_EXPORT_CONTEXT_V1           1
+#define EAP_EXPORT_CONTEXT_V2           2   /* see export_sec_context.c */
+#ifdef GSSEAP_ENABLE_BENCH
+#define EAP_EXPORT_CONTEXT_BENCH        0x42454E43  /* "BENC" */
+#endif
 
 enum gss_eap_token_type {
     TOK_TYPE_NONE                    = 0x0000,  /* no token */
@@ -260,6 +313,29 @@ gssEapVerifyTokenMIC(OM_uint32 *minor,
                      gss_ctx_id_t ctx,
                      const gss_buffer_t tokenMIC);
 
+uint64_t
+gssEapBeginPhase(gss_ctx_id_t ctx, int phase);
+
+void
+gssEapAddPhaseTime(gss_ctx_id_t ctx, int phase, uint64_t start);
+
+void
+gssEapTracePhaseTimes(gss_ctx_id_t ctx);
+
+/* util_config.c */
+enum gss_eap_config_file_type {
+    GSSEAP_CONFIG_IDENTITY = 0,
+    GSSEAP_CONFIG_CB_TYPE,
+    GSSEAP_CONFIG_MAX
+};
+
+OM_uint32
+gssEapReadConfigFile(OM_uint32 *minor,
+                     enum gss_eap_config_file_type type,
+                     gss_buffer_t line1,
+                     gss_buffer_t line2,
+                     char **pPath);
+
 /* util_cred.c */
 OM_uint32 gssEapAllocCred(OM_uint32 *minor, gss_cred_id_t *pCred);
 OM_uint32 gssEapReleaseCred(OM_uint32 *minor, gss_cred_id_t *pCred);
@@ -315,6 +391,7 @@ gssEapEncrypt(krb5_context context, int dce_style, size_t ec,
 #else
               krb5_keyblock *key,
 #endif
+              struct gss_eap_aesni_key *aesNiKey,
               int usage,
               gss_iov_buffer_desc *iov, int iov_count);
 
@@ -326,6 +403,7 @@ gssEapDecrypt(krb5_context context, int dce_style, size_t ec,
 #else
               krb5_keyblock *key,
 #endif
+              struct gss_eap_aesni_key *aesNiKey,
               int usage,
               gss_iov_buffer_desc *iov, int iov_count);
 
@@ -505,6 +583,19 @@ gssEapExportLucidSecContext(OM_uint32 *minor,
                             const gss_OID desiredObject,
                             gss_buffer_set_t *data_set);
 
+/* util_localname.c */
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+OM_uint32
+gssEapLocalLoginUser(OM_uint32 *minor,
+                     gss_name_t name,
+                     gss_buffer_t localLogin);
+
+int
+gssEapLocalLoginUserMatch(const gss_buffer_t localLogin,
+                          const void *account,
+                          size_t accountLength);
+#endif
+
 /* util_mech.c */
 #ifdef MECH_EAP
 extern gss_OID GSS_EAP_MECHANISM;
@@ -576,6 +667,10 @@ libMoonshotResolveInitiatorCred(OM_uint32 *minor,
 #define EXPORT_NAME_FLAG_COMPOSITE              0x2
 #define EXPORT_NAME_FLAG_ALLOW_COMPOSITE        0x4
 
+/* Binary attributes in composite exported names, see util_name.c */
+#define EAP_EXPORT_ATTRS_V2                     2
+#define EAP_EXPORT_ATTRS_TAG_SAML               1
+
 OM_uint32 gssEapAllocName(OM_uint32 *minor, gss_name_t *pName);
 OM_uint32 gssEapReleaseName(OM_uint32 *minor, gss_name_t *pName);
 OM_uint32 gssEapExportName(OM_uint32 *minor,
@@ -617,6 +712,46 @@ gssEapCompareName(OM_uint32 *minor,
                   gss_name_t name2,
                   int *name_equal);
 
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+struct gss_eap_saml_resolution;
+
+OM_uint32
+gssEapImportSamlAttributes(OM_uint32 *minor,
+                           gss_name_t name,
+                           struct gss_eap_saml_resolution *resolution);
+
+OM_uint32
+gssEapMaterializeSamlAttributes(OM_uint32 *minor, gss_name_t name);
+
+void
+gssEapReleaseSamlAttributes(gss_name_t name);
+
+void
+gssEapGetSamlAttributesList(gss_name_t name, gss_buffer_t list);
+
+OM_uint32
+gssEapSetSamlAttributes(OM_uint32 *minor,
+                        gss_name_t name,
+                        const gss_buffer_t attributes);
+
+int
+gssEapGetSamlAttribute(gss_name_t name, const char *attr, char **value);
+
+size_t
+gssEapSamlAttributesEncodedLength(gss_name_t name);
+
+unsigned char *
+gssEapEncodeSamlAttributes(gss_name_t name, unsigned char *p);
+
+int
+gssEapIsEncodedSamlAttributes(const gss_buffer_t buffer);
+
+OM_uint32
+gssEapDecodeSamlAttributes(OM_uint32 *minor,
+                           const gss_buffer_t buffer,
+                           gss_name_t name);
+#endif
+
 /* util_oid.c */
 OM_uint32
 composeOid(OM_uint32 *minor_status,
@@ -839,6 +974,10 @@ verifyTokenHeader(OM_uint32 *minor,
 #define GSSEAP_MUTEX_DESTROY(m)         DeleteCriticalSection((m))
 #define GSSEAP_MUTEX_LOCK(m)            EnterCriticalSection((m))
 #define GSSEAP_MUTEX_UNLOCK(m)          LeaveCriticalSection((m))
+
+#define GSSEAP_REFCOUNT                 volatile LONG
+#define GSSEAP_REFCOUNT_INCREMENT(r)    InterlockedIncrement((r))
+#define GSSEAP_REFCOUNT_DECREMENT(r)    InterlockedDecrement((r))
 #define GSSEAP_ONCE_LEAVE		do { return TRUE; } while (0)
 
 /* Thread-local is handled separately */
@@ -860,6 +999,10 @@ verifyTokenHeader(OM_uint32 *minor,
 #define GSSEAP_MUTEX_LOCK(m)            pthread_mutex_lock((m))
 #define GSSEAP_MUTEX_UNLOCK(m)          pthread_mutex_unlock((m))
 
+#define GSSEAP_REFCOUNT                 volatile int
+#define GSSEAP_REFCOUNT_INCREMENT(r)    __sync_add_and_fetch((r), 1)
+#define GSSEAP_REFCOUNT_DECREMENT(r)    __sync_sub_and_fetch((r), 1)
+
 #define GSSEAP_THREAD_KEY               pthread_key_t
 #define GSSEAP_KEY_CREATE(k, d)         pthread_key_create((k), (d))
 #define GSSEAP_GETSPECIFIC(k)           pthread_getspecific((k))
@@ -874,6 +1017,21 @@ verifyTokenHeader(OM_uint32 *minor,
 #endif /* WIN32 */
 
 /* Helper functions */
+
+/* Monotonic clock in microseconds, for timing the phases of a context */
+static inline uint64_t
+gssEapMonotonicMicros(void)
+{
+#ifdef WIN32
+    return (uint64_t)GetTickCount64() * 1000;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
 static inline void
 store_uint16_be(uint16_t val, void *vp)
 {
@@ -1022,12 +1180,49 @@ gssBufferToKrbData(gss_buffer_t buffer, krb5_data *data)
     data->length = buffer->length;
 }
 
+/* util_intern.c */
+struct gss_eap_interned_name;
+
+void
+gssEapInternName(const gss_buffer_t buffer,
+                 struct gss_eap_interned_name **pInterned);
+
+struct gss_eap_interned_name *
+gssEapReferenceInternedName(struct gss_eap_interned_name *interned);
+
+void
+gssEapReleaseInternedName(struct gss_eap_interned_name **pInterned);
+
+/* util_pool.c */
+enum gss_eap_pool_type {
+    GSSEAP_POOL_CONTEXT = 0,
+    GSSEAP_POOL_NAME,
+    GSSEAP_POOL_CRED,
+    GSSEAP_POOL_MAX
+};
+
+struct gss_eap_object_pool;
+
+OM_uint32
+gssEapPoolAlloc(OM_uint32 *minor,
+                enum gss_eap_pool_type type,
+                void **pObject);
+
+void
+gssEapPoolRelease(enum gss_eap_pool_type type, void *object);
+
+void
+gssEapDestroyObjectPool(struct gss_eap_object_pool *pool);
+
 /* util_tld.c */
 struct gss_eap_status_info;
 
 struct gss_eap_thread_local_data {
     krb5_context krbContext;
     struct gss_eap_status_info *statusInfo;
+    struct gss_eap_object_pool *objectPool;
+    struct gss_eap_metrics_slot *metricsSlot;
+    struct gss_eap_random_pool *randomPool;
 };
 
 struct gss_eap_thread_local_data *
@@ -1039,13 +1234,6 @@ gssEapDestroyStatusInfo(struct gss_eap_status_info *status);
 void
 gssEapDestroyKrbContext(krb5_context context);
 
-extern
-int mech_saml_ec_debug;
-
-#define MECH_SAML_EC_DEBUG ((mech_saml_ec_debug == -1)? \
-                            (mech_saml_ec_debug = (getenv("MECH_SAML_EC_DEBUG")?1:0)) : \
-                            (mech_saml_ec_debug))
-
 #define MECH_SAML_EC_MUTUAL_AUTH "urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp:2.0:WantAuthnRequestsSigned"
 
 #define MECH_SAML_EC_DELEG_REQ  "urn:oasis:names:tc:SAML:2.0:conditions:delegation"
@@ -1061,6 +1249,9 @@ int mech_saml_ec_debug;
 
 #ifndef MECH_EAP
 #include <libxml/xmlreader.h>
+
+void
+traceXmlDoc(int level, const char *label, xmlDocPtr doc);
 #endif
 
 #ifdef __cplusplus
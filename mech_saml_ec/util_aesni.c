@@ -0,0 +1,1268 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Native aes128-cts-hmac-sha1-96 and aes256-cts-hmac-sha1-96 (RFC 3962)
+ * using the AES-NI and, where present, SHA-NI instructions. This is used
+ * in place of krb5_c_encrypt_iov() and friends for per-message tokens
+ * when the CPU supports it; the output is identical to that of the
+ * krb5 library. Derived keys and HMAC pad states are computed once per
+ * context and key usage.
+ *
+ * Checksums (MIC tokens) need AES only to derive Kc, so they take the
+ * native path even without AES-NI, deriving with a portable AES.
+ */
+
+#include "gssapiP_eap.h"
+
+#ifdef GSSEAP_HAVE_AESNI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AESNI_TARGET    __attribute__ ((__target__("aes,sse4.1,ssse3")))
+#define SHANI_TARGET    __attribute__ ((__target__("sha,sse4.1,ssse3")))
+
+#ifndef bit_SHA
+#define bit_SHA         (1 << 29)
+#endif
+
+#define AES_BLOCK_SIZE          16
+#define AES_MAX_ROUNDS          14
+#define SHA1_BLOCK_SIZE         64
+#define SHA1_DIGEST_SIZE        20
+#define HMAC_SHA1_96_SIZE       12
+
+#define DK_CONSTANT_KC          0x99
+#define DK_CONSTANT_KE          0xAA
+#define DK_CONSTANT_KI          0x55
+
+/* Derived keys are cached for this many key usages per context */
+#define AESNI_USAGE_SLOTS       4
+
+struct aesni_schedule {
+    unsigned int rounds;
+    __m128i enc[AES_MAX_ROUNDS + 1];
+    __m128i dec[AES_MAX_ROUNDS + 1];
+};
+
+struct sha1_state {
+    uint32_t h[5];
+    uint64_t length;
+    unsigned char buf[SHA1_BLOCK_SIZE];
+    size_t buflen;
+};
+
+/* SHA-1 state after absorbing the inner and outer HMAC pads */
+struct hmac_sha1_key {
+    uint32_t inner[5];
+    uint32_t outer[5];
+};
+
+struct aesni_usage_keys {
+    krb5_keyusage usage;
+#define AESNI_HAVE_KE           0x01
+#define AESNI_HAVE_KI           0x02
+#define AESNI_HAVE_KC           0x04
+    unsigned int flags;
+    struct aesni_schedule ke;
+    struct hmac_sha1_key ki;
+    struct hmac_sha1_key kc;
+};
+
+struct gss_eap_aesni_key {
+    krb5_enctype enctype;
+    krb5_cksumtype cksumtype;
+    size_t keyLength;
+    int haveAesNi;
+    unsigned char keyData[32];
+    struct aesni_schedule base;     /* only if haveAesNi */
+    struct aesni_usage_keys usages[AESNI_USAGE_SLOTS];
+};
+
+typedef void (*sha1_compress_fn)(uint32_t h[5],
+                                 const unsigned char *p,
+                                 size_t nblocks);
+
+static GSSEAP_THREAD_ONCE aesNiOnce = GSSEAP_ONCE_INITIALIZER;
+static int aesNiEnabled;
+static int aesNiSupported;
+static sha1_compress_fn sha1Compress;
+
+/*
+ * AES
+ */
+
+#define AES_KEY_EXP_128(s, i, rcon) do {                            \
+        __m128i t = _mm_aeskeygenassist_si128((s)[(i) - 1], (rcon));\
+        (s)[(i)] = aes128KeyAssist((s)[(i) - 1], t);                \
+    } while (0)
+
+static inline AESNI_TARGET __m128i
+aes128KeyAssist(__m128i k, __m128i t)
+{
+    t = _mm_shuffle_epi32(t, 0xFF);
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, t);
+}
+
+static inline AESNI_TARGET __m128i
+aes256KeyAssist1(__m128i k, __m128i t)
+{
+    t = _mm_shuffle_epi32(t, 0xFF);
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, t);
+}
+
+static inline AESNI_TARGET __m128i
+aes256KeyAssist2(__m128i k1, __m128i k3)
+{
+    __m128i t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k1, 0x00), 0xAA);
+
+    k3 = _mm_xor_si128(k3, _mm_slli_si128(k3, 4));
+    k3 = _mm_xor_si128(k3, _mm_slli_si128(k3, 4));
+    k3 = _mm_xor_si128(k3, _mm_slli_si128(k3, 4));
+    return _mm_xor_si128(k3, t);
+}
+
+#define AES_KEY_EXP_256(s, i, rcon) do {                            \
+        __m128i t = _mm_aeskeygenassist_si128((s)[(i) - 1], (rcon));\
+        (s)[(i)] = aes256KeyAssist1((s)[(i) - 2], t);               \
+    } while (0)
+
+static AESNI_TARGET void
+aesExpandKey(const unsigned char *key, size_t keyLength,
+             struct aesni_schedule *sched)
+{
+    __m128i *s = sched->enc;
+    unsigned int i;
+
+    if (keyLength == 16) {
+        sched->rounds = 10;
+        s[0] = _mm_loadu_si128((const __m128i *)key);
+        AES_KEY_EXP_128(s, 1, 0x01);
+        AES_KEY_EXP_128(s, 2, 0x02);
+        AES_KEY_EXP_128(s, 3, 0x04);
+        AES_KEY_EXP_128(s, 4, 0x08);
+        AES_KEY_EXP_128(s, 5, 0x10);
+        AES_KEY_EXP_128(s, 6, 0x20);
+        AES_KEY_EXP_128(s, 7, 0x40);
+        AES_KEY_EXP_128(s, 8, 0x80);
+        AES_KEY_EXP_128(s, 9, 0x1B);
+        AES_KEY_EXP_128(s, 10, 0x36);
+    } else {
+        sched->rounds = 14;
+        s[0] = _mm_loadu_si128((const __m128i *)key);
+        s[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+        for (i = 2; i < 14; i += 2) {
+            /* the round constant must be an immediate */
+            switch (i) {
+            case 2:  AES_KEY_EXP_256(s, 2, 0x01);  break;
+            case 4:  AES_KEY_EXP_256(s, 4, 0x02);  break;
+            case 6:  AES_KEY_EXP_256(s, 6, 0x04);  break;
+            case 8:  AES_KEY_EXP_256(s, 8, 0x08);  break;
+            case 10: AES_KEY_EXP_256(s, 10, 0x10); break;
+            case 12: AES_KEY_EXP_256(s, 12, 0x20); break;
+            }
+            s[i + 1] = aes256KeyAssist2(s[i], s[i - 1]);
+        }
+        AES_KEY_EXP_256(s, 14, 0x40);
+    }
+
+    sched->dec[0] = s[sched->rounds];
+    for (i = 1; i < sched->rounds; i++)
+        sched->dec[i] = _mm_aesimc_si128(s[sched->rounds - i]);
+    sched->dec[sched->rounds] = s[0];
+}
+
+static inline AESNI_TARGET __m128i
+aesEncryptBlock(const struct aesni_schedule *sched, __m128i b)
+{
+    unsigned int i;
+
+    b = _mm_xor_si128(b, sched->enc[0]);
+    for (i = 1; i < sched->rounds; i++)
+        b = _mm_aesenc_si128(b, sched->enc[i]);
+    return _mm_aesenclast_si128(b, sched->enc[sched->rounds]);
+}
+
+static inline AESNI_TARGET __m128i
+aesDecryptBlock(const struct aesni_schedule *sched, __m128i b)
+{
+    unsigned int i;
+
+    b = _mm_xor_si128(b, sched->dec[0]);
+    for (i = 1; i < sched->rounds; i++)
+        b = _mm_aesdec_si128(b, sched->dec[i]);
+    return _mm_aesdeclast_si128(b, sched->dec[sched->rounds]);
+}
+
+/* Decrypt four independent blocks, interleaving the rounds */
+static inline AESNI_TARGET void
+aesDecryptBlocks4(const struct aesni_schedule *sched, __m128i b[4])
+{
+    unsigned int i;
+
+    b[0] = _mm_xor_si128(b[0], sched->dec[0]);
+    b[1] = _mm_xor_si128(b[1], sched->dec[0]);
+    b[2] = _mm_xor_si128(b[2], sched->dec[0]);
+    b[3] = _mm_xor_si128(b[3], sched->dec[0]);
+    for (i = 1; i < sched->rounds; i++) {
+        b[0] = _mm_aesdec_si128(b[0], sched->dec[i]);
+        b[1] = _mm_aesdec_si128(b[1], sched->dec[i]);
+        b[2] = _mm_aesdec_si128(b[2], sched->dec[i]);
+        b[3] = _mm_aesdec_si128(b[3], sched->dec[i]);
+    }
+    b[0] = _mm_aesdeclast_si128(b[0], sched->dec[sched->rounds]);
+    b[1] = _mm_aesdeclast_si128(b[1], sched->dec[sched->rounds]);
+    b[2] = _mm_aesdeclast_si128(b[2], sched->dec[sched->rounds]);
+    b[3] = _mm_aesdeclast_si128(b[3], sched->dec[sched->rounds]);
+}
+
+static AESNI_TARGET void
+aesEncryptRaw(const struct aesni_schedule *sched,
+              const unsigned char *in, unsigned char *out)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)in);
+
+    _mm_storeu_si128((__m128i *)out, aesEncryptBlock(sched, b));
+}
+
+/*
+ * Portable AES encryption, used only for key derivation when AES-NI
+ * is unavailable. Table driven and not hardened against cache timing,
+ * but it runs once per context and key usage, not per message.
+ */
+
+static const unsigned char aesSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+    0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+    0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+    0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+    0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+    0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+    0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+    0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+    0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+    0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+    0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+    0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+#define XTIME(x)        ((unsigned char)(((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+
+static void
+aesEncryptPortable(const unsigned char *key, size_t keyLength,
+                   const unsigned char *in, unsigned char *out)
+{
+    unsigned char rk[16 * (AES_MAX_ROUNDS + 1)];
+    unsigned char s[AES_BLOCK_SIZE], t[AES_BLOCK_SIZE], tmp[4], rcon = 1;
+    size_t nk = keyLength / 4, rounds = nk + 6, i, j, r;
+
+    /* Key expansion (FIPS-197 section 5.2) */
+    memcpy(rk, key, keyLength);
+    for (i = nk; i < 4 * (rounds + 1); i++) {
+        memcpy(tmp, &rk[4 * (i - 1)], 4);
+        if (i % nk == 0) {
+            unsigned char u = tmp[0];
+
+            tmp[0] = aesSbox[tmp[1]] ^ rcon;
+            tmp[1] = aesSbox[tmp[2]];
+            tmp[2] = aesSbox[tmp[3]];
+            tmp[3] = aesSbox[u];
+            rcon = XTIME(rcon);
+        } else if (nk > 6 && i % nk == 4) {
+            for (j = 0; j < 4; j++)
+                tmp[j] = aesSbox[tmp[j]];
+        }
+        for (j = 0; j < 4; j++)
+            rk[4 * i + j] = rk[4 * (i - nk) + j] ^ tmp[j];
+    }
+
+    for (i = 0; i < AES_BLOCK_SIZE; i++)
+        s[i] = in[i] ^ rk[i];
+
+    for (r = 1; r <= rounds; r++) {
+        /* SubBytes and ShiftRows */
+        for (i = 0; i < AES_BLOCK_SIZE; i++)
+            t[i] = aesSbox[s[(i + 4 * (i % 4)) % AES_BLOCK_SIZE]];
+
+        /* MixColumns */
+        if (r != rounds) {
+            for (i = 0; i < AES_BLOCK_SIZE; i += 4) {
+                unsigned char a0 = t[i], a1 = t[i + 1];
+                unsigned char a2 = t[i + 2], a3 = t[i + 3];
+                unsigned char x = a0 ^ a1 ^ a2 ^ a3;
+
+                t[i]     = a0 ^ x ^ XTIME(a0 ^ a1);
+                t[i + 1] = a1 ^ x ^ XTIME(a1 ^ a2);
+                t[i + 2] = a2 ^ x ^ XTIME(a2 ^ a3);
+                t[i + 3] = a3 ^ x ^ XTIME(a3 ^ a0);
+            }
+        }
+
+        for (i = 0; i < AES_BLOCK_SIZE; i++)
+            s[i] = t[i] ^ rk[16 * r + i];
+    }
+
+    memcpy(out, s, AES_BLOCK_SIZE);
+
+    memset(rk, 0, sizeof(rk));
+    memset(s, 0, sizeof(s));
+    memset(t, 0, sizeof(t));
+    memset(tmp, 0, sizeof(tmp));
+}
+
+/*
+ * SHA-1
+ */
+
+#define ROTL32(x, n)    (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1CompressScalar(uint32_t h[5], const unsigned char *p, size_t nblocks)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e, f, k, t;
+    unsigned int i;
+
+    while (nblocks-- > 0) {
+        for (i = 0; i < 16; i++)
+            w[i] = load_uint32_be(p + 4 * i);
+        for (i = 16; i < 80; i++)
+            w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+
+        for (i = 0; i < 80; i++) {
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            t = ROTL32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ROTL32(b, 30);
+            b = a;
+            a = t;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        p += SHA1_BLOCK_SIZE;
+    }
+
+    memset(w, 0, sizeof(w));
+}
+
+/*
+ * Four rounds of SHA-1 with the SHA-NI extensions; g is the round group
+ * (0..19) and f the round function (g / 5). The message schedule for
+ * group g is computed into the slot that held that for group g - 4.
+ */
+#define SHA1NI_ROUNDS4(g, f) do {                                       \
+        if ((g) >= 4)                                                   \
+            m[(g) & 3] = _mm_sha1msg2_epu32(                            \
+                _mm_xor_si128(_mm_sha1msg1_epu32(m[(g) & 3],            \
+                                                 m[((g) + 1) & 3]),     \
+                              m[((g) + 2) & 3]),                        \
+                m[((g) + 3) & 3]);                                      \
+        if ((g) == 0)                                                   \
+            e = _mm_add_epi32(e0, m[0]);                                \
+        else                                                            \
+            e = _mm_sha1nexte_epu32(prev, m[(g) & 3]);                  \
+        prev = abcd;                                                    \
+        abcd = _mm_sha1rnds4_epu32(abcd, e, (f));                       \
+    } while (0)
+
+static SHANI_TARGET void
+sha1CompressShaNi(uint32_t h[5], const unsigned char *p, size_t nblocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcdSave, e0, e0Save, e, prev = _mm_setzero_si128();
+    __m128i m[4];
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1B);
+    e0 = _mm_set_epi32((int)h[4], 0, 0, 0);
+
+    while (nblocks-- > 0) {
+        abcdSave = abcd;
+        e0Save = e0;
+
+        m[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), mask);
+        m[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), mask);
+        m[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), mask);
+        m[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), mask);
+
+        SHA1NI_ROUNDS4(0, 0);
+        SHA1NI_ROUNDS4(1, 0);
+        SHA1NI_ROUNDS4(2, 0);
+        SHA1NI_ROUNDS4(3, 0);
+        SHA1NI_ROUNDS4(4, 0);
+        SHA1NI_ROUNDS4(5, 1);
+        SHA1NI_ROUNDS4(6, 1);
+        SHA1NI_ROUNDS4(7, 1);
+        SHA1NI_ROUNDS4(8, 1);
+        SHA1NI_ROUNDS4(9, 1);
+        SHA1NI_ROUNDS4(10, 2);
+        SHA1NI_ROUNDS4(11, 2);
+        SHA1NI_ROUNDS4(12, 2);
+        SHA1NI_ROUNDS4(13, 2);
+        SHA1NI_ROUNDS4(14, 2);
+        SHA1NI_ROUNDS4(15, 3);
+        SHA1NI_ROUNDS4(16, 3);
+        SHA1NI_ROUNDS4(17, 3);
+        SHA1NI_ROUNDS4(18, 3);
+        SHA1NI_ROUNDS4(19, 3);
+
+        e0 = _mm_sha1nexte_epu32(prev, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+
+        p += SHA1_BLOCK_SIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static void
+sha1Init(struct sha1_state *s, const uint32_t h[5], uint64_t length)
+{
+    memcpy(s->h, h, sizeof(s->h));
+    s->length = length;
+    s->buflen = 0;
+}
+
+static void
+sha1Update(struct sha1_state *s, const unsigned char *p, size_t len)
+{
+    size_t n;
+
+    s->length += len;
+
+    if (s->buflen != 0) {
+        n = SHA1_BLOCK_SIZE - s->buflen;
+        if (n > len)
+            n = len;
+        memcpy(s->buf + s->buflen, p, n);
+        s->buflen += n;
+        p += n;
+        len -= n;
+        if (s->buflen < SHA1_BLOCK_SIZE)
+            return;
+        sha1Compress(s->h, s->buf, 1);
+        s->buflen = 0;
+    }
+
+    n = len / SHA1_BLOCK_SIZE;
+    if (n != 0) {
+        sha1Compress(s->h, p, n);
+        p += n * SHA1_BLOCK_SIZE;
+        len -= n * SHA1_BLOCK_SIZE;
+    }
+
+    if (len != 0) {
+        memcpy(s->buf, p, len);
+        s->buflen = len;
+    }
+}
+
+static void
+sha1Final(struct sha1_state *s, unsigned char digest[SHA1_DIGEST_SIZE])
+{
+    uint64_t bits = s->length * 8;
+    unsigned int i;
+
+    s->buf[s->buflen++] = 0x80;
+    if (s->buflen > SHA1_BLOCK_SIZE - 8) {
+        memset(s->buf + s->buflen, 0, SHA1_BLOCK_SIZE - s->buflen);
+        sha1Compress(s->h, s->buf, 1);
+        s->buflen = 0;
+    }
+    memset(s->buf + s->buflen, 0, SHA1_BLOCK_SIZE - 8 - s->buflen);
+    store_uint64_be(bits, s->buf + SHA1_BLOCK_SIZE - 8);
+    sha1Compress(s->h, s->buf, 1);
+
+    for (i = 0; i < 5; i++)
+        store_uint32_be(s->h[i], digest + 4 * i);
+
+    memset(s, 0, sizeof(*s));
+}
+
+/*
+ * HMAC-SHA1, with the pad blocks absorbed once per key
+ */
+
+static const uint32_t sha1InitialState[5] = {
+    0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+static void
+hmacSha1Prepare(struct hmac_sha1_key *hk,
+                const unsigned char *key, size_t keyLength)
+{
+    unsigned char pad[SHA1_BLOCK_SIZE];
+    unsigned int i;
+
+    GSSEAP_ASSERT(keyLength <= SHA1_BLOCK_SIZE);
+
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < keyLength; i++)
+        pad[i] ^= key[i];
+    memcpy(hk->inner, sha1InitialState, sizeof(hk->inner));
+    sha1Compress(hk->inner, pad, 1);
+
+    memset(pad, 0x5C, sizeof(pad));
+    for (i = 0; i < keyLength; i++)
+        pad[i] ^= key[i];
+    memcpy(hk->outer, sha1InitialState, sizeof(hk->outer));
+    sha1Compress(hk->outer, pad, 1);
+
+    memset(pad, 0, sizeof(pad));
+}
+
+#define SIGN_DATA(f)    ((f) == KRB5_CRYPTO_TYPE_DATA ||        \
+                         (f) == KRB5_CRYPTO_TYPE_SIGN_ONLY ||   \
+                         (f) == KRB5_CRYPTO_TYPE_HEADER ||      \
+                         (f) == KRB5_CRYPTO_TYPE_PADDING)
+
+#define ENCRYPT_DATA(f) ((f) == KRB5_CRYPTO_TYPE_DATA ||        \
+                         (f) == KRB5_CRYPTO_TYPE_HEADER ||      \
+                         (f) == KRB5_CRYPTO_TYPE_PADDING)
+
+/* HMAC-SHA1 over the signed buffers, truncated to 96 bits */
+static void
+hmacSha1Iov(const struct hmac_sha1_key *hk,
+            const krb5_crypto_iov *data,
+            size_t num_data,
+            unsigned char mac[HMAC_SHA1_96_SIZE])
+{
+    struct sha1_state s;
+    unsigned char digest[SHA1_DIGEST_SIZE];
+    size_t i;
+
+    sha1Init(&s, hk->inner, SHA1_BLOCK_SIZE);
+    for (i = 0; i < num_data; i++) {
+        if (SIGN_DATA(data[i].flags) && data[i].data.length != 0)
+            sha1Update(&s, (unsigned char *)data[i].data.data,
+                       data[i].data.length);
+    }
+    sha1Final(&s, digest);
+
+    sha1Init(&s, hk->outer, SHA1_BLOCK_SIZE);
+    sha1Update(&s, digest, sizeof(digest));
+    sha1Final(&s, digest);
+
+    memcpy(mac, digest, HMAC_SHA1_96_SIZE);
+    memset(digest, 0, sizeof(digest));
+}
+
+/*
+ * RFC 3961 key derivation
+ */
+
+/* n-fold as described in RFC 3961 section 5.1 */
+static void
+nfold(size_t inbits, const unsigned char *in,
+      size_t outbits, unsigned char *out)
+{
+    size_t a, b, c, lcm;
+    unsigned int byte = 0;
+    size_t msbit;
+    long i;
+
+    inbits >>= 3;
+    outbits >>= 3;
+
+    a = outbits;
+    b = inbits;
+    while (b != 0) {
+        c = b;
+        b = a % b;
+        a = c;
+    }
+    lcm = outbits * inbits / a;
+
+    memset(out, 0, outbits);
+
+    for (i = (long)lcm - 1; i >= 0; i--) {
+        msbit = (((inbits << 3) - 1) +
+                 (((inbits << 3) + 13) * (i / inbits)) +
+                 ((inbits - (i % inbits)) << 3)) % (inbits << 3);
+
+        byte += (((in[((inbits - 1) - (msbit >> 3)) % inbits] << 8) |
+                  (in[((inbits) - (msbit >> 3)) % inbits]))
+                 >> ((msbit & 7) + 1)) & 0xFF;
+        byte += out[i % outbits];
+        out[i % outbits] = byte & 0xFF;
+        byte >>= 8;
+    }
+
+    if (byte != 0) {
+        for (i = (long)outbits - 1; i >= 0; i--) {
+            byte += out[i];
+            out[i] = byte & 0xFF;
+            byte >>= 8;
+        }
+    }
+}
+
+/* DK(base, usage | constant); random-to-key is the identity for AES */
+static void
+deriveKey(const struct gss_eap_aesni_key *key,
+          krb5_keyusage usage,
+          unsigned char constant,
+          unsigned char *derived)
+{
+    unsigned char in[5], block[AES_BLOCK_SIZE];
+    size_t n;
+
+    store_uint32_be(usage, in);
+    in[4] = constant;
+
+    nfold(sizeof(in) * 8, in, sizeof(block) * 8, block);
+
+    for (n = 0; n < key->keyLength; n += AES_BLOCK_SIZE) {
+        if (key->haveAesNi)
+            aesEncryptRaw(&key->base, block, block);
+        else
+            aesEncryptPortable(key->keyData, key->keyLength, block, block);
+        memcpy(derived + n, block, AES_BLOCK_SIZE);
+    }
+
+    memset(block, 0, sizeof(block));
+}
+
+static struct aesni_usage_keys *
+usageKeys(struct gss_eap_aesni_key *key,
+          krb5_keyusage usage,
+          unsigned int flags,
+          struct aesni_usage_keys *tmp)
+{
+    struct aesni_usage_keys *uk = NULL;
+    unsigned char derived[32];
+    unsigned int i;
+
+    for (i = 0; i < AESNI_USAGE_SLOTS; i++) {
+        if (key->usages[i].flags == 0 || key->usages[i].usage == usage) {
+            uk = &key->usages[i];
+            break;
+        }
+    }
+
+    /* More distinct usages than we cache; derive for this call only */
+    if (uk == NULL) {
+        uk = tmp;
+        uk->flags = 0;
+    }
+
+    uk->usage = usage;
+
+    if ((flags & AESNI_HAVE_KE) && (uk->flags & AESNI_HAVE_KE) == 0) {
+        deriveKey(key, usage, DK_CONSTANT_KE, derived);
+        aesExpandKey(derived, key->keyLength, &uk->ke);
+        uk->flags |= AESNI_HAVE_KE;
+    }
+    if ((flags & AESNI_HAVE_KI) && (uk->flags & AESNI_HAVE_KI) == 0) {
+        deriveKey(key, usage, DK_CONSTANT_KI, derived);
+        hmacSha1Prepare(&uk->ki, derived, key->keyLength);
+        uk->flags |= AESNI_HAVE_KI;
+    }
+    if ((flags & AESNI_HAVE_KC) && (uk->flags & AESNI_HAVE_KC) == 0) {
+        deriveKey(key, usage, DK_CONSTANT_KC, derived);
+        hmacSha1Prepare(&uk->kc, derived, key->keyLength);
+        uk->flags |= AESNI_HAVE_KC;
+    }
+
+    memset(derived, 0, sizeof(derived));
+
+    return uk;
+}
+
+/*
+ * CBC-CTS over the encrypted buffers of an IOV array
+ */
+
+struct iov_cursor {
+    krb5_crypto_iov *data;
+    size_t num_data;
+    size_t i;
+    size_t off;
+};
+
+static void
+cursorInit(struct iov_cursor *c, krb5_crypto_iov *data, size_t num_data)
+{
+    c->data = data;
+    c->num_data = num_data;
+    c->i = 0;
+    c->off = 0;
+}
+
+/* Return the contiguous length available at the cursor */
+static size_t
+cursorContig(struct iov_cursor *c)
+{
+    while (c->i < c->num_data) {
+        krb5_crypto_iov *iov = &c->data[c->i];
+
+        if (ENCRYPT_DATA(iov->flags) && c->off < iov->data.length)
+            return iov->data.length - c->off;
+
+        c->i++;
+        c->off = 0;
+    }
+
+    return 0;
+}
+
+static unsigned char *
+cursorPtr(struct iov_cursor *c)
+{
+    return (unsigned char *)c->data[c->i].data.data + c->off;
+}
+
+static void
+cursorCopy(struct iov_cursor *c, unsigned char *buf, size_t len, int in)
+{
+    while (len != 0) {
+        size_t n = cursorContig(c);
+
+        GSSEAP_ASSERT(n != 0);
+
+        if (n > len)
+            n = len;
+        if (in)
+            memcpy(buf, cursorPtr(c), n);
+        else
+            memcpy(cursorPtr(c), buf, n);
+        buf += n;
+        len -= n;
+        c->off += n;
+    }
+}
+
+static size_t
+encryptedLength(const krb5_crypto_iov *data, size_t num_data)
+{
+    size_t i, len = 0;
+
+    for (i = 0; i < num_data; i++) {
+        if (ENCRYPT_DATA(data[i].flags))
+            len += data[i].data.length;
+    }
+
+    return len;
+}
+
+static AESNI_TARGET krb5_error_code
+cbcCtsEncrypt(const struct aesni_schedule *sched,
+              krb5_crypto_iov *data, size_t num_data)
+{
+    struct iov_cursor cur, save;
+    size_t len, nblocks, avail, tailLen, m;
+    unsigned char tail[2 * AES_BLOCK_SIZE];
+    __m128i iv = _mm_setzero_si128(), x, y;
+
+    len = encryptedLength(data, num_data);
+    if (len < AES_BLOCK_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    cursorInit(&cur, data, num_data);
+
+    if (len == AES_BLOCK_SIZE) {
+        save = cur;
+        cursorCopy(&cur, tail, AES_BLOCK_SIZE, 1);
+        aesEncryptRaw(sched, tail, tail);
+        cursorCopy(&save, tail, AES_BLOCK_SIZE, 0);
+        return 0;
+    }
+
+    /* All but the last two blocks are plain CBC */
+    nblocks = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE - 2;
+
+    while (nblocks != 0) {
+        avail = cursorContig(&cur) / AES_BLOCK_SIZE;
+        if (avail != 0) {
+            unsigned char *p = cursorPtr(&cur);
+
+            if (avail > nblocks)
+                avail = nblocks;
+            nblocks -= avail;
+            cur.off += avail * AES_BLOCK_SIZE;
+
+            while (avail-- != 0) {
+                x = _mm_loadu_si128((const __m128i *)p);
+                iv = aesEncryptBlock(sched, _mm_xor_si128(x, iv));
+                _mm_storeu_si128((__m128i *)p, iv);
+                p += AES_BLOCK_SIZE;
+            }
+        } else {
+            /* block straddles buffers */
+            save = cur;
+            cursorCopy(&cur, tail, AES_BLOCK_SIZE, 1);
+            x = _mm_loadu_si128((const __m128i *)tail);
+            iv = aesEncryptBlock(sched, _mm_xor_si128(x, iv));
+            _mm_storeu_si128((__m128i *)tail, iv);
+            cursorCopy(&save, tail, AES_BLOCK_SIZE, 0);
+            nblocks--;
+        }
+    }
+
+    /* Ciphertext stealing: swap the final two blocks */
+    tailLen = len - ((len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE - 2) *
+                    AES_BLOCK_SIZE;
+    m = tailLen - AES_BLOCK_SIZE;
+
+    save = cur;
+    memset(tail, 0, sizeof(tail));
+    cursorCopy(&cur, tail, tailLen, 1);
+
+    x = _mm_loadu_si128((const __m128i *)tail);
+    x = aesEncryptBlock(sched, _mm_xor_si128(x, iv));
+    y = _mm_loadu_si128((const __m128i *)(tail + AES_BLOCK_SIZE));
+    y = aesEncryptBlock(sched, _mm_xor_si128(y, x));
+
+    _mm_storeu_si128((__m128i *)(tail + AES_BLOCK_SIZE), x);
+    _mm_storeu_si128((__m128i *)tail, y);
+    cursorCopy(&save, tail, AES_BLOCK_SIZE + m, 0);
+
+    memset(tail, 0, sizeof(tail));
+
+    return 0;
+}
+
+static AESNI_TARGET krb5_error_code
+cbcCtsDecrypt(const struct aesni_schedule *sched,
+              krb5_crypto_iov *data, size_t num_data)
+{
+    struct iov_cursor cur, save;
+    size_t len, nblocks, avail, tailLen, m, i;
+    unsigned char tail[2 * AES_BLOCK_SIZE], d[AES_BLOCK_SIZE];
+    __m128i iv = _mm_setzero_si128(), c, b[4];
+
+    len = encryptedLength(data, num_data);
+    if (len < AES_BLOCK_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    cursorInit(&cur, data, num_data);
+
+    if (len == AES_BLOCK_SIZE) {
+        save = cur;
+        cursorCopy(&cur, tail, AES_BLOCK_SIZE, 1);
+        c = aesDecryptBlock(sched, _mm_loadu_si128((const __m128i *)tail));
+        _mm_storeu_si128((__m128i *)tail, c);
+        cursorCopy(&save, tail, AES_BLOCK_SIZE, 0);
+        return 0;
+    }
+
+    nblocks = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE - 2;
+
+    while (nblocks != 0) {
+        avail = cursorContig(&cur) / AES_BLOCK_SIZE;
+        if (avail != 0) {
+            unsigned char *p = cursorPtr(&cur);
+
+            if (avail > nblocks)
+                avail = nblocks;
+            nblocks -= avail;
+            cur.off += avail * AES_BLOCK_SIZE;
+
+            for (; avail >= 4; avail -= 4) {
+                __m128i c0, c1, c2, c3;
+
+                c0 = b[0] = _mm_loadu_si128((const __m128i *)(p + 0));
+                c1 = b[1] = _mm_loadu_si128((const __m128i *)(p + 16));
+                c2 = b[2] = _mm_loadu_si128((const __m128i *)(p + 32));
+                c3 = b[3] = _mm_loadu_si128((const __m128i *)(p + 48));
+                aesDecryptBlocks4(sched, b);
+                _mm_storeu_si128((__m128i *)(p + 0), _mm_xor_si128(b[0], iv));
+                _mm_storeu_si128((__m128i *)(p + 16), _mm_xor_si128(b[1], c0));
+                _mm_storeu_si128((__m128i *)(p + 32), _mm_xor_si128(b[2], c1));
+                _mm_storeu_si128((__m128i *)(p + 48), _mm_xor_si128(b[3], c2));
+                iv = c3;
+                p += 4 * AES_BLOCK_SIZE;
+            }
+            for (; avail != 0; avail--) {
+                c = _mm_loadu_si128((const __m128i *)p);
+                _mm_storeu_si128((__m128i *)p,
+                                 _mm_xor_si128(aesDecryptBlock(sched, c), iv));
+                iv = c;
+                p += AES_BLOCK_SIZE;
+            }
+        } else {
+            save = cur;
+            cursorCopy(&cur, tail, AES_BLOCK_SIZE, 1);
+            c = _mm_loadu_si128((const __m128i *)tail);
+            _mm_storeu_si128((__m128i *)tail,
+                             _mm_xor_si128(aesDecryptBlock(sched, c), iv));
+            iv = c;
+            cursorCopy(&save, tail, AES_BLOCK_SIZE, 0);
+            nblocks--;
+        }
+    }
+
+    tailLen = len - ((len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE - 2) *
+                    AES_BLOCK_SIZE;
+    m = tailLen - AES_BLOCK_SIZE;
+
+    save = cur;
+    cursorCopy(&cur, tail, tailLen, 1);
+
+    /* D = Dec(C[n-1]); C[n] is padded with the tail of D */
+    c = aesDecryptBlock(sched, _mm_loadu_si128((const __m128i *)tail));
+    _mm_storeu_si128((__m128i *)d, c);
+    memcpy(tail + AES_BLOCK_SIZE + m, d + m, AES_BLOCK_SIZE - m);
+    for (i = 0; i < m; i++)
+        d[i] ^= tail[AES_BLOCK_SIZE + i];
+
+    c = _mm_loadu_si128((const __m128i *)(tail + AES_BLOCK_SIZE));
+    _mm_storeu_si128((__m128i *)tail,
+                     _mm_xor_si128(aesDecryptBlock(sched, c), iv));
+    memcpy(tail + AES_BLOCK_SIZE, d, m);
+
+    cursorCopy(&save, tail, AES_BLOCK_SIZE + m, 0);
+
+    memset(tail, 0, sizeof(tail));
+    memset(d, 0, sizeof(d));
+
+    return 0;
+}
+
+static krb5_crypto_iov *
+locateKiov(krb5_crypto_iov *data, size_t num_data, krb5_cryptotype type)
+{
+    size_t i;
+    krb5_crypto_iov *iov = NULL;
+
+    for (i = 0; i < num_data; i++) {
+        if (data[i].flags == type) {
+            if (iov != NULL)
+                return NULL;
+            iov = &data[i];
+        }
+    }
+
+    return iov;
+}
+
+static int
+constantTimeCompare(const unsigned char *a, const unsigned char *b, size_t n)
+{
+    unsigned char diff = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        diff |= a[i] ^ b[i];
+
+    return diff;
+}
+
+/*
+ * Entry points
+ */
+
+static GSSEAP_ONCE_CALLBACK(aesNiInit)
+{
+    unsigned int a, b, c, d;
+
+    sha1Compress = sha1CompressScalar;
+
+    if (getenv("GSSEAP_DISABLE_AESNI") != NULL)
+        GSSEAP_ONCE_LEAVE;
+
+    aesNiEnabled = 1;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        GSSEAP_ONCE_LEAVE;
+
+    if ((c & bit_SSE4_1) == 0 || (c & bit_SSSE3) == 0)
+        GSSEAP_ONCE_LEAVE;
+
+    if (c & bit_AES)
+        aesNiSupported = 1;
+
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, a, b, c, d);
+        if (b & bit_SHA)
+            sha1Compress = sha1CompressShaNi;
+    }
+
+    GSSEAP_ONCE_LEAVE;
+}
+
+/*
+ * Return the native key for the context, creating it on first use, or
+ * NULL if the fast path is disabled or the enctype is not supported.
+ * Without AES-NI the key serves checksums only. The caller must hold
+ * the context mutex.
+ */
+struct gss_eap_aesni_key *
+gssEapAesNiContextKey(gss_ctx_id_t ctx)
+{
+    struct gss_eap_aesni_key *key = ctx->aesNiKey;
+    krb5_keyblock *kb = &ctx->rfc3961Key;
+    size_t keyLength;
+
+    if (key != NULL && key->enctype == KRB_KEY_TYPE(kb))
+        return key;
+
+    GSSEAP_ONCE(&aesNiOnce, aesNiInit);
+
+    if (!aesNiEnabled)
+        return NULL;
+
+    switch (KRB_KEY_TYPE(kb)) {
+    case ENCTYPE_AES128_CTS_HMAC_SHA1_96:
+        keyLength = 16;
+        break;
+    case ENCTYPE_AES256_CTS_HMAC_SHA1_96:
+        keyLength = 32;
+        break;
+    default:
+        return NULL;
+    }
+
+    if (KRB_KEY_LENGTH(kb) != keyLength)
+        return NULL;
+
+    gssEapAesNiReleaseKey(&ctx->aesNiKey);
+
+    key = (struct gss_eap_aesni_key *)GSSEAP_CALLOC(1, sizeof(*key));
+    if (key == NULL)
+        return NULL;
+
+    key->enctype = KRB_KEY_TYPE(kb);
+    key->cksumtype = (keyLength == 16) ? CKSUMTYPE_HMAC_SHA1_96_AES128
+                                       : CKSUMTYPE_HMAC_SHA1_96_AES256;
+    key->keyLength = keyLength;
+    key->haveAesNi = aesNiSupported;
+    memcpy(key->keyData, KRB_KEY_DATA(kb), keyLength);
+    if (key->haveAesNi)
+        aesExpandKey(key->keyData, keyLength, &key->base);
+
+    ctx->aesNiKey = key;
+
+    return key;
+}
+
+void
+gssEapAesNiReleaseKey(struct gss_eap_aesni_key **pKey)
+{
+    struct gss_eap_aesni_key *key = *pKey;
+
+    if (key == NULL)
+        return;
+
+    memset(key, 0, sizeof(*key));
+    GSSEAP_FREE(key);
+
+    *pKey = NULL;
+}
+
+/*
+ * Equivalent of krb5_c_encrypt_iov() with a NULL cipher state. Returns
+ * KRB5_BAD_ENCTYPE if the CPU lacks AES-NI, in which case the caller
+ * should fall back to the krb5 library.
+ */
+krb5_error_code
+gssEapAesNiEncryptIov(krb5_context krbContext,
+                      struct gss_eap_aesni_key *key,
+                      krb5_keyusage usage,
+                      krb5_crypto_iov *data,
+                      size_t num_data)
+{
+    struct aesni_usage_keys tmp, *uk;
+    krb5_crypto_iov *header, *trailer, *padding;
+    krb5_error_code code;
+
+    if (!key->haveAesNi)
+        return KRB5_BAD_ENCTYPE;
+
+    header = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_HEADER);
+    if (header == NULL || header->data.length < AES_BLOCK_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    trailer = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
+    if (trailer == NULL || trailer->data.length < HMAC_SHA1_96_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    /* CTS needs no padding */
+    padding = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_PADDING);
+    if (padding != NULL)
+        padding->data.length = 0;
+
+    header->data.length = AES_BLOCK_SIZE;
+    code = krb5_c_random_make_octets(krbContext, &header->data);
+    if (code != 0)
+        return code;
+
+    uk = usageKeys(key, usage, AESNI_HAVE_KE | AESNI_HAVE_KI, &tmp);
+
+    hmacSha1Iov(&uk->ki, data, num_data,
+                (unsigned char *)trailer->data.data);
+    trailer->data.length = HMAC_SHA1_96_SIZE;
+
+    code = cbcCtsEncrypt(&uk->ke, data, num_data);
+
+    if (uk == &tmp)
+        memset(&tmp, 0, sizeof(tmp));
+
+    return code;
+}
+
+/* Equivalent of krb5_c_decrypt_iov() with a NULL cipher state */
+krb5_error_code
+gssEapAesNiDecryptIov(krb5_context krbContext GSSEAP_UNUSED,
+                      struct gss_eap_aesni_key *key,
+                      krb5_keyusage usage,
+                      krb5_crypto_iov *data,
+                      size_t num_data)
+{
+    struct aesni_usage_keys tmp, *uk;
+    krb5_crypto_iov *header, *trailer, *padding;
+    unsigned char mac[HMAC_SHA1_96_SIZE];
+    krb5_error_code code;
+
+    if (!key->haveAesNi)
+        return KRB5_BAD_ENCTYPE;
+
+    header = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_HEADER);
+    if (header == NULL || header->data.length != AES_BLOCK_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    trailer = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_TRAILER);
+    if (trailer == NULL || trailer->data.length != HMAC_SHA1_96_SIZE)
+        return KRB5_BAD_MSIZE;
+
+    padding = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_PADDING);
+    if (padding != NULL && padding->data.length != 0)
+        return KRB5_BAD_MSIZE;
+
+    uk = usageKeys(key, usage, AESNI_HAVE_KE | AESNI_HAVE_KI, &tmp);
+
+    code = cbcCtsDecrypt(&uk->ke, data, num_data);
+    if (code == 0) {
+        hmacSha1Iov(&uk->ki, data, num_data, mac);
+        if (constantTimeCompare(mac, (unsigned char *)trailer->data.data,
+                                HMAC_SHA1_96_SIZE) != 0)
+            code = KRB5KRB_AP_ERR_BAD_INTEGRITY;
+    }
+
+    if (uk == &tmp)
+        memset(&tmp, 0, sizeof(tmp));
+    memset(mac, 0, sizeof(mac));
+
+    return code;
+}
+
+/*
+ * Equivalent of krb5_c_make_checksum_iov() or, if verify is set,
+ * krb5_c_verify_checksum_iov(). Returns KRB5_BAD_ENCTYPE if the
+ * checksum type is not that of the key, in which case the caller
+ * should fall back to the krb5 library.
+ */
+krb5_error_code
+gssEapAesNiChecksumIov(struct gss_eap_aesni_key *key,
+                       krb5_cksumtype cksumtype,
+                       krb5_keyusage usage,
+                       krb5_crypto_iov *data,
+                       size_t num_data,
+                       int verify,
+                       int *valid)
+{
+    struct aesni_usage_keys tmp, *uk;
+    krb5_crypto_iov *checksum;
+    unsigned char mac[HMAC_SHA1_96_SIZE];
+
+    if (cksumtype != key->cksumtype)
+        return KRB5_BAD_ENCTYPE;
+
+    checksum = locateKiov(data, num_data, KRB5_CRYPTO_TYPE_CHECKSUM);
+    if (checksum == NULL ||
+        (verify ? checksum->data.length != HMAC_SHA1_96_SIZE
+                : checksum->data.length < HMAC_SHA1_96_SIZE))
+        return KRB5_BAD_MSIZE;
+
+    uk = usageKeys(key, usage, AESNI_HAVE_KC, &tmp);
+
+    hmacSha1Iov(&uk->kc, data, num_data, mac);
+
+    if (verify) {
+        *valid = (constantTimeCompare(mac, (unsigned char *)checksum->data.data,
+                                      HMAC_SHA1_96_SIZE) == 0);
+    } else {
+        memcpy(checksum->data.data, mac, HMAC_SHA1_96_SIZE);
+        checksum->data.length = HMAC_SHA1_96_SIZE;
+    }
+
+    if (uk == &tmp)
+        memset(&tmp, 0, sizeof(tmp));
+    memset(mac, 0, sizeof(mac));
+
+    return 0;
+}
+
+#endif /* GSSEAP_HAVE_AESNI */
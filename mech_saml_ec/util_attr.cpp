@@ -145,6 +145,7 @@ gss_eap_attr_ctx::unregisterProvider(unsigned int type)
 gss_eap_attr_ctx::gss_eap_attr_ctx(void)
 {
     m_flags = 0;
+    m_refs = 1;
 
     for (unsigned int i = ATTR_TYPE_MIN; i <= ATTR_TYPE_MAX; i++) {
         gss_eap_attr_provider *provider;
@@ -422,6 +423,33 @@ gss_eap_attr_ctx::~gss_eap_attr_ctx(void)
         delete m_providers[i];
 }
 
+gss_eap_attr_ctx *
+gss_eap_attr_ctx::reference(void)
+{
+    GSSEAP_REFCOUNT_INCREMENT(&m_refs);
+
+    return this;
+}
+
+void
+gss_eap_attr_ctx::release(void)
+{
+    if (GSSEAP_REFCOUNT_DECREMENT(&m_refs) == 0)
+        delete this;
+}
+
+/*
+ * A context referenced by more than one name must not be modified.
+ * Another name may drop its reference at any time, so this can err
+ * towards a needless copy, but new references are only taken by
+ * duplicating a name that holds one, under that name's mutex.
+ */
+bool
+gss_eap_attr_ctx::isShared(void) const
+{
+    return m_refs > 1;
+}
+
 /*
  * Locate provider for a given type
  */
@@ -942,11 +970,52 @@ gssEapGetNameAttribute(OM_uint32 *minor,
     return GSS_S_COMPLETE;
 }
 
+/*
+ * Give the name its own copy of a shared attribute context before it
+ * is modified.
+ */
+static OM_uint32
+unshareAttrContext(OM_uint32 *minor, gss_name_t name)
+{
+    gss_eap_attr_ctx *ctx = NULL;
+    OM_uint32 major = GSS_S_FAILURE;
+
+    if (!name->attrCtx->isShared()) {
+        *minor = 0;
+        return GSS_S_COMPLETE;
+    }
+
+    try {
+        ctx = new gss_eap_attr_ctx();
+
+        if (ctx->initWithExistingContext(name->attrCtx)) {
+            name->attrCtx->release();
+            name->attrCtx = ctx;
+            major = GSS_S_COMPLETE;
+            *minor = 0;
+        } else {
+            major = GSS_S_FAILURE;
+            *minor = GSSEAP_ATTR_CONTEXT_FAILURE;
+        }
+    } catch (std::exception &e) {
+        major = name->attrCtx->mapException(minor, e);
+    }
+
+    GSSEAP_ASSERT(major == GSS_S_COMPLETE || name->attrCtx != ctx);
+
+    if (GSS_ERROR(major))
+        delete ctx;
+
+    return major;
+}
+
 OM_uint32
 gssEapDeleteNameAttribute(OM_uint32 *minor,
                           gss_name_t name,
                           gss_buffer_t attr)
 {
+    OM_uint32 major;
+
     if (name->attrCtx == NULL) {
         *minor = GSSEAP_NO_ATTR_CONTEXT;
         return GSS_S_UNAVAILABLE;
@@ -955,6 +1024,10 @@ gssEapDeleteNameAttribute(OM_uint32 *minor,
     if (GSS_ERROR(gssEapAttrProvidersInit(minor)))
         return GSS_S_UNAVAILABLE;
 
+    major = unshareAttrContext(minor, name);
+    if (GSS_ERROR(major))
+        return major;
+
     try {
         if (!name->attrCtx->deleteAttribute(attr)) {
             *minor = GSSEAP_NO_SUCH_ATTR;
@@ -976,6 +1049,8 @@ gssEapSetNameAttribute(OM_uint32 *minor,
                        gss_buffer_t attr,
                        gss_buffer_t value)
 {
+    OM_uint32 major;
+
     if (name->attrCtx == NULL) {
         *minor = GSSEAP_NO_ATTR_CONTEXT;
         return GSS_S_UNAVAILABLE;
@@ -984,6 +1059,10 @@ gssEapSetNameAttribute(OM_uint32 *minor,
     if (GSS_ERROR(gssEapAttrProvidersInit(minor)))
         return GSS_S_UNAVAILABLE;
 
+    major = unshareAttrContext(minor, name);
+    if (GSS_ERROR(major))
+        return major;
+
     try {
         if (!name->attrCtx->setAttribute(complete, attr, value)) {
              *minor = GSSEAP_NO_SUCH_ATTR;
@@ -1062,44 +1141,21 @@ gssEapImportAttrContext(OM_uint32 *minor,
     return major;
 }
 
+/*
+ * Attribute contexts are not modified once shared, so the duplicate
+ * takes a reference rather than a copy; see unshareAttrContext().
+ */
 OM_uint32
 gssEapDuplicateAttrContext(OM_uint32 *minor,
                            gss_name_t in,
                            gss_name_t out)
 {
-    gss_eap_attr_ctx *ctx = NULL;
-    OM_uint32 major = GSS_S_FAILURE;
-
     GSSEAP_ASSERT(out->attrCtx == NULL);
 
-    if (in->attrCtx == NULL) {
-        *minor = 0;
-        return GSS_S_COMPLETE;
-    }
-
-    if (GSS_ERROR(gssEapAttrProvidersInit(minor)))
-        return GSS_S_UNAVAILABLE;
-
-    try {
-        ctx = new gss_eap_attr_ctx();
-
-        if (ctx->initWithExistingContext(in->attrCtx)) {
-            out->attrCtx = ctx;
-            major = GSS_S_COMPLETE;
-            *minor = 0;
-        } else {
-            major = GSS_S_FAILURE;
-            *minor = GSSEAP_ATTR_CONTEXT_FAILURE;
-        }
-    } catch (std::exception &e) {
-        major = in->attrCtx->mapException(minor, e);
-    }
-
-    GSSEAP_ASSERT(major == GSS_S_COMPLETE || out->attrCtx == NULL);
-
-    if (GSS_ERROR(major))
-        delete ctx;
+    if (in->attrCtx != NULL)
+        out->attrCtx = in->attrCtx->reference();
 
+    *minor = 0;
     return GSS_S_COMPLETE;
 }
 
@@ -1157,7 +1213,8 @@ gssEapReleaseAttrContext(OM_uint32 *minor,
                          gss_name_t name)
 {
     if (name->attrCtx != NULL)
-        delete name->attrCtx;
+        name->attrCtx->release();
+    name->attrCtx = NULL;
 
     *minor = 0;
     return GSS_S_COMPLETE;
@@ -253,6 +253,11 @@ public:
     time_t getExpiryTime(void) const;
     OM_uint32 mapException(OM_uint32 *minor, std::exception &e) const;
 
+    /* Contexts are shared between duplicated names, and copied on write */
+    gss_eap_attr_ctx *reference(void);
+    void release(void);
+    bool isShared(void) const;
+
 private:
     bool providerEnabled(unsigned int type) const;
     void releaseProvider(unsigned int type);
@@ -273,6 +278,7 @@ private:
 
     uint32_t m_flags;
     gss_eap_attr_provider *m_providers[ATTR_TYPE_MAX + 1];
+    GSSEAP_REFCOUNT m_refs;
 };
 
 #endif /* __cplusplus */
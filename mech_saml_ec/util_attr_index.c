@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Open-addressing hash index over attribute names, so that looking up
+ * an attribute does not scan every alias of every attribute.
+ */
+
+#include "gssapiP_eap.h"
+
+#define ATTR_INDEX_MIN_SIZE     8
+
+struct gss_eap_attr_index_slot {
+    const unsigned char *name;      /* NULL if the slot is empty */
+    size_t length;
+    size_t position;
+    uint32_t hash;
+};
+
+/*
+ * Return the slot holding name, or the empty slot where it belongs.
+ * The table is never more than half full, so there is always one.
+ */
+static struct gss_eap_attr_index_slot *
+findSlot(const struct gss_eap_attr_index *index,
+         const unsigned char *name,
+         size_t length,
+         uint32_t hash)
+{
+    size_t mask = index->size - 1;
+    size_t i = hash & mask;
+
+    for (;;) {
+        struct gss_eap_attr_index_slot *slot = &index->slots[i];
+
+        if (slot->name == NULL)
+            return slot;
+        if (slot->hash == hash && slot->length == length &&
+            memcmp(slot->name, name, length) == 0)
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+}
+
+static int
+resizeIndex(struct gss_eap_attr_index *index, size_t size)
+{
+    struct gss_eap_attr_index_slot *slots = index->slots;
+    size_t i, oldSize = index->size;
+
+    index->slots = GSSEAP_CALLOC(size, sizeof(*slots));
+    if (index->slots == NULL) {
+        index->slots = slots;
+        return 0;
+    }
+    index->size = size;
+
+    for (i = 0; i < oldSize; i++) {
+        if (slots[i].name != NULL)
+            *findSlot(index, slots[i].name, slots[i].length,
+                      slots[i].hash) = slots[i];
+    }
+
+    if (slots != NULL)
+        GSSEAP_FREE(slots);
+
+    return 1;
+}
+
+int
+gssEapAttrIndexInit(struct gss_eap_attr_index *index, size_t count)
+{
+    size_t size = ATTR_INDEX_MIN_SIZE;
+
+    gssEapAttrIndexRelease(index);
+
+    while (size < 2 * count)
+        size *= 2;
+
+    return resizeIndex(index, size);
+}
+
+int
+gssEapAttrIndexAdd(struct gss_eap_attr_index *index,
+                   const void *name,
+                   size_t length,
+                   size_t position)
+{
+    struct gss_eap_attr_index_slot *slot;
+    uint32_t hash;
+
+    if (2 * (index->count + 1) > index->size &&
+        !resizeIndex(index, index->size != 0 ? 2 * index->size
+                                             : ATTR_INDEX_MIN_SIZE))
+        return 0;
+
+    hash = gssEapHashBytes(name, length);
+
+    slot = findSlot(index, name, length, hash);
+    if (slot->name == NULL) {
+        slot->name = name;
+        slot->length = length;
+        slot->position = position;
+        slot->hash = hash;
+        index->count++;
+    }
+
+    return 1;
+}
+
+int
+gssEapAttrIndexFind(const struct gss_eap_attr_index *index,
+                    const void *name,
+                    size_t length,
+                    size_t *position)
+{
+    struct gss_eap_attr_index_slot *slot;
+
+    if (index->count == 0)
+        return 0;
+
+    slot = findSlot(index, name, length, gssEapHashBytes(name, length));
+    if (slot->name == NULL)
+        return 0;
+
+    *position = slot->position;
+
+    return 1;
+}
+
+void
+gssEapAttrIndexRelease(struct gss_eap_attr_index *index)
+{
+    if (index->slots != NULL)
+        GSSEAP_FREE(index->slots);
+
+    index->slots = NULL;
+    index->size = 0;
+    index->count = 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Hash index over attribute names.
+ */
+
+#ifndef _UTIL_ATTR_INDEX_H_
+#define _UTIL_ATTR_INDEX_H_ 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open-addressing index from attribute name to a position chosen by the
+ * caller. Names are referenced, not copied, so must outlive the index.
+ * If a name is added more than once, the first position is kept, which
+ * matches a linear scan.
+ */
+struct gss_eap_attr_index_slot;
+
+struct gss_eap_attr_index {
+    struct gss_eap_attr_index_slot *slots;
+    size_t size;                    /* power of two, or zero */
+    size_t count;
+};
+
+/* Empty the index and size it for count names; 0 if out of memory */
+int
+gssEapAttrIndexInit(struct gss_eap_attr_index *index, size_t count);
+
+/* 0 if out of memory */
+int
+gssEapAttrIndexAdd(struct gss_eap_attr_index *index,
+                   const void *name,
+                   size_t length,
+                   size_t position);
+
+/* 1 and the position if name is present */
+int
+gssEapAttrIndexFind(const struct gss_eap_attr_index *index,
+                    const void *name,
+                    size_t length,
+                    size_t *position);
+
+void
+gssEapAttrIndexRelease(struct gss_eap_attr_index *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_ATTR_INDEX_H_ */
@@ -36,8 +36,6 @@
 
 #include "gssapiP_eap.h"
 
-int mech_saml_ec_debug = -1;
-
 OM_uint32
 makeStringBuffer(OM_uint32 *minor,
                  const char *string,
@@ -123,18 +121,56 @@ duplicateBuffer(OM_uint32 *minor,
     return GSS_S_COMPLETE;
 }
 
+/* Trace a token's bytes in hex, as one message */
 void
-printBuffer(FILE *stream, const gss_buffer_t src)
+traceBuffer(int level, const char *label, const gss_buffer_t src)
 {
-    int i = 0;
+    static const char hex[] = "0123456789abcdef";
+    unsigned char *p;
+    char *s;
+    size_t i;
 
-    if (src == GSS_C_NO_BUFFER)
+    if (src == GSS_C_NO_BUFFER || !GSSEAP_TRACING(level))
+        return;
+
+    s = GSSEAP_MALLOC(3 * src->length + 1);
+    if (s == NULL)
         return;
 
-    fprintf(stream, "BYTES IN TOKEN ARE: (");
-    for (i = 0; i < src->length; i++)
-    {
-        fprintf(stream, "%x ", ((unsigned char *)src->value)[i]);
+    p = (unsigned char *)src->value;
+    for (i = 0; i < src->length; i++) {
+        s[3 * i] = hex[p[i] >> 4];
+        s[3 * i + 1] = hex[p[i] & 0xF];
+        s[3 * i + 2] = ' ';
+    }
+    s[3 * src->length] = '\0';
+
+    gssEapTrace(level, "%sBYTES IN TOKEN ARE: (%s)\n", label, s);
+
+    GSSEAP_FREE(s);
+}
+
+/* FNV-1a, for the mechanism's hash tables */
+uint32_t
+gssEapHashBytes(const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
     }
-    fprintf(stream, ")\n");
+
+    return hash;
+}
+
+/* Not optimised away, unlike a memset() of memory about to be freed */
+static void *(*volatile secureMemset)(void *, int, size_t) = memset;
+
+void
+gssEapSecureZero(void *data, size_t length)
+{
+    secureMemset(data, 0, length);
 }
@@ -57,6 +57,13 @@
 
 #include "gssapiP_eap.h"
 
+/*
+ * Enough for the header, checksum and a handful of data/sign-only
+ * buffers, which covers get_mic/verify_mic and typical IOV callers
+ * without touching the heap.
+ */
+#define GSSEAP_KIOV_STACK_COUNT     8
+
 static int
 gssEapChecksum(krb5_context context,
                krb5_cksumtype type,
@@ -66,6 +73,7 @@ gssEapChecksum(krb5_context context,
 #else
                krb5_keyblock *crypto,
 #endif
+               struct gss_eap_aesni_key *aesNiKey,
                krb5_keyusage sign_usage,
                gss_iov_buffer_desc *iov,
                int iov_count,
@@ -75,6 +83,7 @@ gssEapChecksum(krb5_context context,
     krb5_error_code code;
     gss_iov_buffer_desc *header;
     gss_iov_buffer_desc *trailer;
+    krb5_crypto_iov kiovStack[GSSEAP_KIOV_STACK_COUNT];
     krb5_crypto_iov *kiov;
     size_t kiov_count;
     int i = 0, j;
@@ -102,9 +111,13 @@ gssEapChecksum(krb5_context context,
         return KRB5_BAD_MSIZE;
 
     kiov_count = 2 + iov_count;
-    kiov = (krb5_crypto_iov *)GSSEAP_MALLOC(kiov_count * sizeof(krb5_crypto_iov));
-    if (kiov == NULL)
-        return ENOMEM;
+    if (kiov_count <= GSSEAP_KIOV_STACK_COUNT) {
+        kiov = kiovStack;
+    } else {
+        kiov = (krb5_crypto_iov *)GSSEAP_MALLOC(kiov_count * sizeof(krb5_crypto_iov));
+        if (kiov == NULL)
+            return ENOMEM;
+    }
 
     /* Checksum over ( Data | Header ) */
 
@@ -143,6 +156,14 @@ gssEapChecksum(krb5_context context,
                                         kiov, kiov_count, &type);
     }
 #else
+#ifdef GSSEAP_HAVE_AESNI
+    if (aesNiKey != NULL) {
+        code = gssEapAesNiChecksumIov(aesNiKey, type, sign_usage,
+                                      kiov, kiov_count, verify, valid);
+        if (code != KRB5_BAD_ENCTYPE)
+            goto cleanup;
+    }
+#endif
     if (verify) {
         krb5_boolean kvalid = FALSE;
 
@@ -156,7 +177,11 @@ gssEapChecksum(krb5_context context,
     }
 #endif /* HAVE_HEIMDAL_VERSION */
 
-    GSSEAP_FREE(kiov);
+#ifdef GSSEAP_HAVE_AESNI
+cleanup:
+#endif
+    if (kiov != kiovStack)
+        GSSEAP_FREE(kiov);
 
     return code;
 }
@@ -170,11 +195,12 @@ gssEapSign(krb5_context context,
 #else
            krb5_keyblock *crypto,
 #endif
+           struct gss_eap_aesni_key *aesNiKey,
            krb5_keyusage sign_usage,
            gss_iov_buffer_desc *iov,
            int iov_count)
 {
-    return gssEapChecksum(context, type, rrc, crypto,
+    return gssEapChecksum(context, type, rrc, crypto, aesNiKey,
                           sign_usage, iov, iov_count, 0, NULL);
 }
 
@@ -187,12 +213,13 @@ gssEapVerify(krb5_context context,
 #else
              krb5_keyblock *crypto,
 #endif
+             struct gss_eap_aesni_key *aesNiKey,
              krb5_keyusage sign_usage,
              gss_iov_buffer_desc *iov,
              int iov_count,
              int *valid)
 {
-    return gssEapChecksum(context, type, rrc, crypto,
+    return gssEapChecksum(context, type, rrc, crypto, aesNiKey,
                           sign_usage, iov, iov_count, 1, valid);
 }
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Process-wide cache of the small per-user configuration files: the
+ * static identity file (~/.gss_eap_id or $GSSEAP_IDENTITY) and the
+ * channel bindings type file (~/.gss_saml_ec_cb_type or
+ * $GSS_SAML_EC_CB_TYPE_FILE).
+ *
+ * These used to be located with getpwuid_r() and read with fopen() on
+ * every credential resolution and, for the channel bindings type, on
+ * every initial accept with bindings. Now the home directory is looked
+ * up once per user ID, and a file is only read again when its path, or
+ * its device, inode, size, modification or change time, differ from
+ * when it was last read; checking costs one stat(). A file rewritten
+ * within the same second with the same size is not noticed until one
+ * of these changes.
+ *
+ * The identity file holds a password, so cached lines are zeroed before
+ * they are freed, as are the caller's copies in util_cred.c.
+ */
+
+#include "gssapiP_eap.h"
+
+#include <sys/stat.h>
+
+#ifdef WIN32
+# include <shlobj.h>     /* may need to use ShFolder.h instead */
+#else
+# include <pwd.h>
+#endif
+
+#define CONFIG_MAX_LINES        2
+
+struct gss_eap_config_file {
+    const char *envName;
+    const char *baseName;
+    /* Protected by configMutex */
+    char *path;
+    struct stat st;
+    size_t lineCount;
+    gss_buffer_desc lines[CONFIG_MAX_LINES];
+};
+
+static struct gss_eap_config_file configFiles[GSSEAP_CONFIG_MAX] = {
+    { "GSSEAP_IDENTITY",            ".gss_eap_id" },
+    { "GSS_SAML_EC_CB_TYPE_FILE",   ".gss_saml_ec_cb_type" },
+};
+
+static GSSEAP_THREAD_ONCE configOnce = GSSEAP_ONCE_INITIALIZER;
+static GSSEAP_MUTEX configMutex;
+static OM_uint32 configInitStatus;
+
+/* Protected by configMutex */
+static char *homeDir;
+#ifndef WIN32
+static uid_t homeUid;
+#endif
+
+static GSSEAP_ONCE_CALLBACK(configInit)
+{
+    if (GSSEAP_MUTEX_INIT(&configMutex) != 0)
+        configInitStatus = GSSEAP_GET_LAST_ERROR();
+    GSSEAP_ONCE_LEAVE;
+}
+
+static void
+zeroAndReleaseLine(gss_buffer_t line)
+{
+    if (line->value != NULL) {
+        gssEapSecureZero(line->value, line->length);
+        GSSEAP_FREE(line->value);
+    }
+
+    line->value = NULL;
+    line->length = 0;
+}
+
+static void
+releaseConfigLines(struct gss_eap_config_file *file)
+{
+    size_t i;
+
+    for (i = 0; i < file->lineCount; i++)
+        zeroAndReleaseLine(&file->lines[i]);
+
+    file->lineCount = 0;
+}
+
+/* Return the user's home directory, with configMutex held */
+static OM_uint32
+getHomeDir(OM_uint32 *minor, const char **pHomeDir)
+{
+#ifdef WIN32
+    TCHAR szPath[MAX_PATH];
+
+    if (homeDir == NULL) {
+        if (!SUCCEEDED(SHGetFolderPath(NULL,
+                                       CSIDL_APPDATA, /* |CSIDL_FLAG_CREATE */
+                                       NULL, /* User access token */
+                                       0,    /* SHGFP_TYPE_CURRENT */
+                                       szPath))) {
+            *minor = GSSEAP_GET_LAST_ERROR(); /* XXX */
+            return GSS_S_CRED_UNAVAIL;
+        }
+
+        homeDir = strdup(szPath);
+    }
+#else
+    struct passwd *pw = NULL, pwd;
+    char pwbuf[BUFSIZ];
+    uid_t uid = getuid();
+
+    /* A server may change user ID between calls */
+    if (homeDir == NULL || homeUid != uid) {
+        if (getpwuid_r(uid, &pwd, pwbuf, sizeof(pwbuf), &pw) != 0 ||
+            pw == NULL || pw->pw_dir == NULL) {
+            *minor = GSSEAP_GET_LAST_ERROR();
+            return GSS_S_CRED_UNAVAIL;
+        }
+
+        GSSEAP_FREE(homeDir);
+        homeDir = strdup(pw->pw_dir);
+        homeUid = uid;
+    }
+#endif /* WIN32 */
+
+    if (homeDir == NULL) {
+        *minor = ENOMEM;
+        return GSS_S_FAILURE;
+    }
+
+    *pHomeDir = homeDir;
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static int
+sameFile(const struct stat *st1, const struct stat *st2)
+{
+    return st1->st_dev == st2->st_dev &&
+           st1->st_ino == st2->st_ino &&
+           st1->st_size == st2->st_size &&
+           st1->st_mtime == st2->st_mtime &&
+           st1->st_ctime == st2->st_ctime;
+}
+
+/*
+ * Read up to CONFIG_MAX_LINES lines, stopping at the first empty one,
+ * with configMutex held.
+ */
+static OM_uint32
+loadConfigFile(OM_uint32 *minor, struct gss_eap_config_file *file)
+{
+    OM_uint32 major;
+    FILE *fp;
+    char buf[BUFSIZ];
+    gss_buffer_desc src;
+
+    releaseConfigLines(file);
+
+    fp = fopen(file->path, "r");
+    if (fp == NULL) {
+        *minor = GSSEAP_GET_LAST_ERROR();
+        return GSS_S_CRED_UNAVAIL;
+    }
+
+    /* Describe the file that was opened, which may since have changed */
+    if (fstat(fileno(fp), &file->st) != 0) {
+        *minor = GSSEAP_GET_LAST_ERROR();
+        major = GSS_S_CRED_UNAVAIL;
+        goto cleanup;
+    }
+
+    while (file->lineCount < CONFIG_MAX_LINES &&
+           fgets(buf, sizeof(buf), fp) != NULL) {
+        src.length = strlen(buf);
+        src.value = buf;
+
+        if (src.length != 0 && buf[src.length - 1] == '\n')
+            buf[--src.length] = '\0';
+        if (src.length == 0)
+            break;
+
+        major = duplicateBuffer(minor, &src, &file->lines[file->lineCount]);
+        if (GSS_ERROR(major))
+            goto cleanup;
+
+        file->lineCount++;
+    }
+
+    major = GSS_S_COMPLETE;
+    *minor = 0;
+
+cleanup:
+    fclose(fp);
+    gssEapSecureZero(buf, sizeof(buf));
+
+    if (GSS_ERROR(major)) {
+        releaseConfigLines(file);
+        memset(&file->st, 0, sizeof(file->st));
+    }
+
+    return major;
+}
+
+/*
+ * Return copies of the leading non-empty lines of a configuration file,
+ * which the caller must zero and release; lines are empty if the file
+ * has fewer. Returns GSS_S_CRED_UNAVAIL if the file cannot be read, in
+ * which case *pPath, if requested, is still set for error messages.
+ */
+OM_uint32
+gssEapReadConfigFile(OM_uint32 *minor,
+                     enum gss_eap_config_file_type type,
+                     gss_buffer_t line1,
+                     gss_buffer_t line2,
+                     char **pPath)
+{
+    OM_uint32 major;
+    struct gss_eap_config_file *file = &configFiles[type];
+    gss_buffer_t lines[CONFIG_MAX_LINES];
+    const char *path, *dir;
+    char pathBuf[BUFSIZ];
+    struct stat st;
+    size_t i;
+
+    lines[0] = line1;
+    lines[1] = line2;
+
+    for (i = 0; i < CONFIG_MAX_LINES; i++) {
+        if (lines[i] != GSS_C_NO_BUFFER) {
+            lines[i]->length = 0;
+            lines[i]->value = NULL;
+        }
+    }
+    if (pPath != NULL)
+        *pPath = NULL;
+
+    GSSEAP_ONCE(&configOnce, configInit);
+    if (configInitStatus != 0) {
+        *minor = configInitStatus;
+        return GSS_S_FAILURE;
+    }
+
+    GSSEAP_MUTEX_LOCK(&configMutex);
+
+    path = getenv(file->envName);
+    if (path == NULL) {
+        major = getHomeDir(minor, &dir);
+        if (GSS_ERROR(major))
+            goto cleanup;
+
+        snprintf(pathBuf, sizeof(pathBuf), "%s/%s", dir, file->baseName);
+        path = pathBuf;
+    }
+
+    if (pPath != NULL) {
+        *pPath = strdup(path);
+        if (*pPath == NULL) {
+            major = GSS_S_FAILURE;
+            *minor = ENOMEM;
+            goto cleanup;
+        }
+    }
+
+    if (stat(path, &st) != 0) {
+        releaseConfigLines(file);
+        major = GSS_S_CRED_UNAVAIL;
+        *minor = GSSEAP_GET_LAST_ERROR();
+        goto cleanup;
+    }
+
+    if (file->path == NULL || strcmp(file->path, path) != 0) {
+        GSSEAP_FREE(file->path);
+        file->path = strdup(path);
+        if (file->path == NULL) {
+            major = GSS_S_FAILURE;
+            *minor = ENOMEM;
+            goto cleanup;
+        }
+        memset(&file->st, 0, sizeof(file->st));
+    }
+
+    if (file->lineCount == 0 || !sameFile(&file->st, &st)) {
+        gssEapMetricIncrement(GSSEAP_METRIC_CONFIG_MISS);
+        major = loadConfigFile(minor, file);
+        if (GSS_ERROR(major))
+            goto cleanup;
+    } else
+        gssEapMetricIncrement(GSSEAP_METRIC_CONFIG_HIT);
+
+    for (i = 0; i < file->lineCount; i++) {
+        if (lines[i] != GSS_C_NO_BUFFER) {
+            major = duplicateBuffer(minor, &file->lines[i], lines[i]);
+            if (GSS_ERROR(major))
+                goto cleanup;
+        }
+    }
+
+    major = GSS_S_COMPLETE;
+    *minor = 0;
+
+cleanup:
+    GSSEAP_MUTEX_UNLOCK(&configMutex);
+
+    if (GSS_ERROR(major)) {
+        for (i = 0; i < CONFIG_MAX_LINES; i++) {
+            if (lines[i] != GSS_C_NO_BUFFER)
+                zeroAndReleaseLine(lines[i]);
+        }
+        if (pPath != NULL && major != GSS_S_CRED_UNAVAIL) {
+            GSSEAP_FREE(*pPath);
+            *pPath = NULL;
+        }
+    }
+
+    return major;
+}
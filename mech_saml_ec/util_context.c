@@ -40,22 +40,14 @@ OM_uint32
 gssEapAllocContext(OM_uint32 *minor,
                    gss_ctx_id_t *pCtx)
 {
-    OM_uint32 tmpMinor;
+    OM_uint32 major;
     gss_ctx_id_t ctx;
 
     GSSEAP_ASSERT(*pCtx == GSS_C_NO_CONTEXT);
 
-    ctx = (gss_ctx_id_t)GSSEAP_CALLOC(1, sizeof(*ctx));
-    if (ctx == NULL) {
-        *minor = ENOMEM;
-        return GSS_S_FAILURE;
-    }
-
-    if (GSSEAP_MUTEX_INIT(&ctx->mutex) != 0) {
-        *minor = GSSEAP_GET_LAST_ERROR();
-        gssEapReleaseContext(&tmpMinor, &ctx);
-        return GSS_S_FAILURE;
-    }
+    major = gssEapPoolAlloc(minor, GSSEAP_POOL_CONTEXT, (void **)&ctx);
+    if (GSS_ERROR(major))
+        return major;
 
     ctx->state = GSSEAP_STATE_INITIAL;
     ctx->mechanismUsed = GSS_C_NO_OID;
@@ -85,11 +77,25 @@ gssEapAllocContext(OM_uint32 *minor,
     return GSS_S_COMPLETE;
 }
 
+#ifndef MECH_EAP
+static void
+releaseGeneratedKey(char **pKey)
+{
+    if (*pKey != NULL) {
+        gssEapSecureZero(*pKey, strlen(*pKey));
+        free(*pKey);
+        *pKey = NULL;
+    }
+}
+#endif
+
 static void
 releaseInitiatorContext(struct gss_eap_initiator_ctx *ctx)
 {
 #ifdef MECH_EAP
     eap_peer_sm_deinit(ctx->eap);
+#else
+    releaseGeneratedKey(&ctx->generatedKey);
 #endif
 }
 
@@ -110,7 +116,8 @@ releaseAcceptorContext(struct gss_eap_acceptor_ctx *ctx)
     if (ctx->vps != NULL)
         gssEapRadiusFreeAvps(&tmpMinor, &ctx->vps);
 #else
-    ctx = ctx;
+    releaseGeneratedKey(&ctx->generatedKey);
+    free(ctx->encryptionType);
 #endif
 }
 #endif /* GSSEAP_ENABLE_ACCEPTOR */
@@ -121,6 +128,7 @@ gssEapReleaseContext(OM_uint32 *minor,
 {
     OM_uint32 tmpMinor;
     gss_ctx_id_t ctx = *pCtx;
+    krb5_context krbContext;
 
     if (ctx == GSS_C_NO_CONTEXT) {
         return GSS_S_COMPLETE;
@@ -140,11 +148,14 @@ gssEapReleaseContext(OM_uint32 *minor,
     gssEapReleaseOid(&tmpMinor, &ctx->mechanismUsed);
     sequenceFree(&tmpMinor, &ctx->seqState);
     gssEapReleaseCred(&tmpMinor, &ctx->cred);
+#ifdef GSSEAP_HAVE_AESNI
+    gssEapAesNiReleaseKey(&ctx->aesNiKey);
+#endif
+    if (KRB_KEY_DATA(&ctx->rfc3961Key) != NULL &&
+        gssEapKerberosInit(&tmpMinor, &krbContext) == GSS_S_COMPLETE)
+        krb5_free_keyblock_contents(krbContext, &ctx->rfc3961Key);
 
-    GSSEAP_MUTEX_DESTROY(&ctx->mutex);
-
-    memset(ctx, 0, sizeof(*ctx));
-    GSSEAP_FREE(ctx);
+    gssEapPoolRelease(GSSEAP_POOL_CONTEXT, ctx);
     *pCtx = GSS_C_NO_CONTEXT;
 
     *minor = 0;
@@ -379,3 +390,70 @@ gssEapVerifyTokenMIC(OM_uint32 *minor,
 
     return gssEapMakeOrVerifyTokenMIC(minor, ctx, tokenMIC, 1);
 }
+
+/*
+ * Add the time since start, from gssEapMonotonicMicros(), to a phase.
+ * A phase may take place more than once, for example when a full login
+ * follows a declined reauthentication.
+ */
+void
+gssEapAddPhaseTime(gss_ctx_id_t ctx, int phase, uint64_t start)
+{
+    uint64_t elapsed = gssEapMonotonicMicros() - start;
+
+    GSSEAP_ASSERT(phase > 0 && phase <= GSS_EAP_PHASE_MAX);
+
+    ctx->phaseTimes[phase] += elapsed;
+    GSSEAP_PROBE3(phase__end, ctx, phase, elapsed);
+}
+
+/* Mark the start of a phase; pass the result to gssEapAddPhaseTime() */
+uint64_t
+gssEapBeginPhase(gss_ctx_id_t ctx, int phase)
+{
+    GSSEAP_PROBE2(phase__start, ctx, phase);
+
+    return gssEapMonotonicMicros();
+}
+
+static const char *phaseNames[GSS_EAP_PHASE_MAX + 1] = {
+    NULL,
+    "authn_request",
+    "verify_response",
+    "key_derivation",
+    "idp_dns",
+    "idp_connect",
+    "idp_tls",
+    "idp_transfer",
+};
+
+/*
+ * If MECH_SAML_EC_PHASE_TRACE is set, write the phase times of an
+ * established context to stderr as a single line of JSON, for latency
+ * histograms.
+ */
+void
+gssEapTracePhaseTimes(gss_ctx_id_t ctx)
+{
+    char line[512];
+    size_t length;
+    int phase;
+
+    if (!gssEapTracePhases)
+        return;
+
+    length = snprintf(line, sizeof(line), "{\"initiator\": %s",
+                      CTX_IS_INITIATOR(ctx) ? "true" : "false");
+
+    for (phase = 1; phase <= GSS_EAP_PHASE_MAX; phase++) {
+        if (ctx->phaseTimes[phase] == 0 || length >= sizeof(line))
+            continue;
+        length += snprintf(line + length, sizeof(line) - length,
+                           ", \"%s_us\": %llu", phaseNames[phase],
+                           (unsigned long long)ctx->phaseTimes[phase]);
+    }
+
+    /* Written whatever the trace level */
+    if (length < sizeof(line))
+        gssEapTrace(GSSEAP_TRACE_NONE, "%s}\n", line);
+}
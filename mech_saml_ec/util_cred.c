@@ -36,10 +36,7 @@
 
 #include "gssapiP_eap.h"
 
-#ifdef WIN32
-# include <shlobj.h>     /* may need to use ShFolder.h instead */
-#else
-# include <pwd.h>
+#ifndef WIN32
 # include <termios.h>
 #endif
 
@@ -48,22 +45,14 @@
 OM_uint32
 gssEapAllocCred(OM_uint32 *minor, gss_cred_id_t *pCred)
 {
-    OM_uint32 tmpMinor;
+    OM_uint32 major;
     gss_cred_id_t cred;
 
     *pCred = GSS_C_NO_CREDENTIAL;
 
-    cred = (gss_cred_id_t)GSSEAP_CALLOC(1, sizeof(*cred));
-    if (cred == NULL) {
-        *minor = ENOMEM;
-        return GSS_S_FAILURE;
-    }
-
-    if (GSSEAP_MUTEX_INIT(&cred->mutex) != 0) {
-        *minor = GSSEAP_GET_LAST_ERROR();
-        gssEapReleaseCred(&tmpMinor, &cred);
-        return GSS_S_FAILURE;
-    }
+    major = gssEapPoolAlloc(minor, GSSEAP_POOL_CRED, (void **)&cred);
+    if (GSS_ERROR(major))
+        return major;
 
     *pCred = cred;
 
@@ -99,6 +88,7 @@ gssEapReleaseCred(OM_uint32 *minor, gss_cred_id_t *pCred)
     zeroAndReleasePassword(&cred->password);
 #ifndef MECH_EAP
     zeroAndReleasePassword(&cred->deleg_assertions);
+    gssEapReleaseReauthCreds(&cred->reauthCreds);
 #endif
 
     gss_release_buffer(&tmpMinor, &cred->ecpSsoLocation);
@@ -108,101 +98,63 @@ gssEapReleaseCred(OM_uint32 *minor, gss_cred_id_t *pCred)
     gss_release_buffer(&tmpMinor, &cred->subjectNameConstraint);
     gss_release_buffer(&tmpMinor, &cred->subjectAltNameConstraint);
 
-    GSSEAP_MUTEX_DESTROY(&cred->mutex);
-    memset(cred, 0, sizeof(*cred));
-    GSSEAP_FREE(cred);
+    gssEapPoolRelease(GSSEAP_POOL_CRED, cred);
     *pCred = NULL;
 
     *minor = 0;
     return GSS_S_COMPLETE;
 }
 
-/* Derived from util_cred.c:readStaticIdentityFile() */
 OM_uint32
 readChannelBindingsType(OM_uint32 *minor, char **cb_type)
 {
     OM_uint32 major, tmpMinor;
-    FILE *fp = NULL;
-    char buf[BUFSIZ];
-    char *ccacheName;
-    int i = 0;
-#ifndef WIN32
-    struct passwd *pw = NULL, pwd;
-    char pwbuf[BUFSIZ];
-#endif
+    gss_buffer_desc type = GSS_C_EMPTY_BUFFER;
+    char *path = NULL;
 
     *cb_type = NULL;
 
-    ccacheName = getenv("GSS_SAML_EC_CB_TYPE_FILE");
-    if (ccacheName == NULL) {
-#ifdef WIN32
-        TCHAR szPath[MAX_PATH];
+    major = gssEapReadConfigFile(minor, GSSEAP_CONFIG_CB_TYPE,
+                                 &type, GSS_C_NO_BUFFER, &path);
 
-        if (!SUCCEEDED(SHGetFolderPath(NULL,
-                                       CSIDL_APPDATA, /* |CSIDL_FLAG_CREATE */
-                                       NULL, /* User access token */
-                                       0,    /* SHGFP_TYPE_CURRENT */
-                                       szPath))) {
-            major = GSS_S_CRED_UNAVAIL;
-            *minor = GSSEAP_GET_LAST_ERROR(); /* XXX */
-            goto cleanup;
-        }
+    if (path != NULL)
+        GSSEAP_TRACE(GSSEAP_TRACE_DEBUG,
+                     "Looking for Channel Bindings Type in (%s)\n", path);
 
-        snprintf(buf, sizeof(buf), "%s/.gss_saml_ec_cb_type", szPath);
-#else
-        if (getpwuid_r(getuid(), &pwd, pwbuf, sizeof(pwbuf), &pw) != 0 ||
-            pw == NULL || pw->pw_dir == NULL) {
-            major = GSS_S_CRED_UNAVAIL;
-            *minor = GSSEAP_GET_LAST_ERROR();
-            goto cleanup;
-        }
-
-        snprintf(buf, sizeof(buf), "%s/.gss_saml_ec_cb_type", pw->pw_dir);
-#endif /* WIN32 */
-        ccacheName = buf;
-    }
-
-    if (MECH_SAML_EC_DEBUG)
-        printf("Looking for Channel Bindings Type in (%s)\n", ccacheName);
-
-    fp = fopen(ccacheName, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "ERROR: Channel Bindings Type not specified in (%s) nor"
-                  " in a file pointed to by the environment variable: "
-                  " GSS_SAML_EC_CB_TYPE_FILE\n", ccacheName);
+    if (major == GSS_S_CRED_UNAVAIL) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: Channel Bindings Type not specified in (%s) nor"
+                     " in a file pointed to by the environment variable: "
+                     " GSS_SAML_EC_CB_TYPE_FILE\n", path ? path : "");
         major = GSS_S_BAD_BINDINGS;
         *minor = GSSEAP_SAML_BINDING_FAILURE;
         goto cleanup;
+    } else if (GSS_ERROR(major)) {
+        goto cleanup;
     }
 
-    if (fgets(buf, sizeof(buf), fp) != NULL) {
-
-        if (strlen(buf) && buf[strlen(buf) - 1] == '\n') {
-            buf[strlen(buf) - 1] = '\0';
-        }
-        *cb_type = strdup(buf);
-    }
-
-    if (*cb_type == NULL || strlen(*cb_type) == 0) {
-        fprintf(stderr, "ERROR: Channel Bindings Type not specified\n");
+    if (type.length == 0) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: Channel Bindings Type not specified\n");
         major = GSS_S_BAD_BINDINGS;
         *minor = GSSEAP_SAML_BINDING_FAILURE;
         goto cleanup;
     }
 
+    /* duplicateBuffer() terminates the copy */
+    *cb_type = strdup((char *)type.value);
+    if (*cb_type == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
     major = GSS_S_COMPLETE;
     *minor = 0;
 
 cleanup:
-    if (fp != NULL)
-        fclose(fp);
-
-    if (GSS_ERROR(major)) {
-        if (*cb_type)
-            free(*cb_type); *cb_type = NULL;
-    }
-
-    memset(buf, 0, sizeof(buf));
+    gss_release_buffer(&tmpMinor, &type);
+    GSSEAP_FREE(path);
 
     return major;
 }
@@ -292,111 +244,26 @@ readStaticIdentityFile(OM_uint32 *minor,
                        gss_buffer_t defaultPassword)
 {
     OM_uint32 major, tmpMinor;
-    FILE *fp = NULL;
-    char buf[BUFSIZ];
-    char *ccacheName;
-    int i = 0;
-#ifndef WIN32
-    struct passwd *pw = NULL, pwd;
-    char pwbuf[BUFSIZ];
-#endif
-
-    defaultIdentity->length = 0;
-    defaultIdentity->value = NULL;
-
-    if (defaultPassword != GSS_C_NO_BUFFER) {
-        defaultPassword->length = 0;
-        defaultPassword->value = NULL;
-    }
-
-    ccacheName = getenv("GSSEAP_IDENTITY");
-    if (ccacheName == NULL) {
-#ifdef WIN32
-        TCHAR szPath[MAX_PATH];
-
-        if (!SUCCEEDED(SHGetFolderPath(NULL,
-                                       CSIDL_APPDATA, /* |CSIDL_FLAG_CREATE */
-                                       NULL, /* User access token */
-                                       0,    /* SHGFP_TYPE_CURRENT */
-                                       szPath))) {
-            major = GSS_S_CRED_UNAVAIL;
-            *minor = GSSEAP_GET_LAST_ERROR(); /* XXX */
-            goto cleanup;
-        }
-
-        snprintf(buf, sizeof(buf), "%s/.gss_eap_id", szPath);
-#else
-        if (getpwuid_r(getuid(), &pwd, pwbuf, sizeof(pwbuf), &pw) != 0 ||
-            pw == NULL || pw->pw_dir == NULL) {
-            major = GSS_S_CRED_UNAVAIL;
-            *minor = GSSEAP_GET_LAST_ERROR();
-            goto cleanup;
-        }
-
-        snprintf(buf, sizeof(buf), "%s/.gss_eap_id", pw->pw_dir);
-#endif /* WIN32 */
-        ccacheName = buf;
-    }
 
-    fp = fopen(ccacheName, "r");
-    if (fp == NULL) {
-        major = GSS_S_CRED_UNAVAIL;
+    major = gssEapReadConfigFile(minor, GSSEAP_CONFIG_IDENTITY,
+                                 defaultIdentity, defaultPassword, NULL);
+    if (major == GSS_S_CRED_UNAVAIL) {
         *minor = GSSEAP_NO_DEFAULT_CRED;
-        goto cleanup;
-    }
-
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-        gss_buffer_desc src, *dst;
-
-        src.length = strlen(buf);
-        src.value = buf;
-
-        if (src.length == 0)
-            break;
-
-        if (buf[src.length - 1] == '\n') {
-            buf[src.length - 1] = '\0';
-            if (--src.length == 0)
-                break;
-        }
-
-        if (i == 0)
-            dst = defaultIdentity;
-        else if (i == 1)
-            dst = defaultPassword;
-        else
-            break;
-
-        if (dst != GSS_C_NO_BUFFER) {
-            major = duplicateBuffer(minor, &src, dst);
-            if (GSS_ERROR(major))
-                goto cleanup;
-        }
-
-        i++;
+        return major;
+    } else if (GSS_ERROR(major)) {
+        return major;
     }
 
     if (defaultIdentity->length == 0) {
-        major = GSS_S_CRED_UNAVAIL;
+        gss_release_buffer(&tmpMinor, defaultIdentity);
+        if (defaultPassword != GSS_C_NO_BUFFER)
+            zeroAndReleasePassword(defaultPassword);
         *minor = GSSEAP_NO_DEFAULT_CRED;
-        goto cleanup;
+        return GSS_S_CRED_UNAVAIL;
     }
 
-    major = GSS_S_COMPLETE;
     *minor = 0;
-
-cleanup:
-    if (fp != NULL)
-        fclose(fp);
-
-    if (GSS_ERROR(major)) {
-        gss_release_buffer(&tmpMinor, defaultIdentity);
-        zeroAndReleasePassword(defaultPassword);
-    }
-
-    memset(buf, 0, sizeof(buf));
-
-    return major;
+    return GSS_S_COMPLETE;
 }
 
 gss_OID
@@ -812,6 +679,8 @@ gssEapDuplicateCred(OM_uint32 *minor,
 
     dst->expiryTime = src->expiryTime;
 
+    if (src->ecpSsoLocation.value != NULL)
+        duplicateBufferOrCleanup(&src->ecpSsoLocation, &dst->ecpSsoLocation);
     if (src->radiusConfigFile.value != NULL)
         duplicateBufferOrCleanup(&src->radiusConfigFile, &dst->radiusConfigFile);
     if (src->radiusConfigStanza.value != NULL)
@@ -210,6 +210,7 @@ gssEapEncrypt(krb5_context context,
 #else
               krb5_keyblock *crypto,
 #endif
+              struct gss_eap_aesni_key *aesNiKey,
               int usage,
               gss_iov_buffer_desc *iov,
               int iov_count)
@@ -226,6 +227,12 @@ gssEapEncrypt(krb5_context context,
 #ifdef HAVE_HEIMDAL_VERSION
     code = krb5_encrypt_iov_ivec(context, crypto, usage, kiov, kiov_count, NULL);
 #else
+#ifdef GSSEAP_HAVE_AESNI
+    code = KRB5_BAD_ENCTYPE;
+    if (aesNiKey != NULL)
+        code = gssEapAesNiEncryptIov(context, aesNiKey, usage, kiov, kiov_count);
+    if (code == KRB5_BAD_ENCTYPE)
+#endif
     code = krb5_c_encrypt_iov(context, crypto, usage, NULL, kiov, kiov_count);
 #endif
     if (code != 0)
@@ -248,6 +255,7 @@ gssEapDecrypt(krb5_context context,
 #else
               krb5_keyblock *crypto,
 #endif
+              struct gss_eap_aesni_key *aesNiKey,
               int usage,
               gss_iov_buffer_desc *iov,
               int iov_count)
@@ -264,6 +272,12 @@ gssEapDecrypt(krb5_context context,
 #ifdef HAVE_HEIMDAL_VERSION
     code = krb5_decrypt_iov_ivec(context, crypto, usage, kiov, kiov_count, NULL);
 #else
+#ifdef GSSEAP_HAVE_AESNI
+    code = KRB5_BAD_ENCTYPE;
+    if (aesNiKey != NULL)
+        code = gssEapAesNiDecryptIov(context, aesNiKey, usage, kiov, kiov_count);
+    if (code == KRB5_BAD_ENCTYPE)
+#endif
     code = krb5_c_decrypt_iov(context, crypto, usage, NULL, kiov, kiov_count);
 #endif
 
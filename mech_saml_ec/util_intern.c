@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Process-wide table of interned name strings.
+ *
+ * Names imported or canonicalised by the mechanism hold a reference to
+ * the table entry for their string, so two such names are equal exactly
+ * when they hold the same entry, and gssEapCompareName() is a pointer
+ * comparison however long the names are. This matters for acceptors
+ * that check the composite SAML initiator name against a long list of
+ * permitted names. An entry is removed and freed when the last name
+ * referring to it is released.
+ *
+ * Configure with --disable-intern to compare names byte by byte
+ * instead, which avoids the table lock on import.
+ */
+
+#include "gssapiP_eap.h"
+
+#define INTERN_MIN_BUCKETS      256
+
+struct gss_eap_interned_name {
+    struct gss_eap_interned_name *next;
+    GSSEAP_REFCOUNT refs;
+    uint32_t hash;
+    size_t length;
+    unsigned char value[1];
+};
+
+#ifdef GSSEAP_ENABLE_INTERN
+static GSSEAP_THREAD_ONCE internOnce = GSSEAP_ONCE_INITIALIZER;
+static GSSEAP_MUTEX internMutex;
+static int internReady;
+
+/* Protected by internMutex */
+static struct gss_eap_interned_name **internBuckets;
+static size_t internBucketCount;    /* power of two, or zero */
+static size_t internCount;
+
+static GSSEAP_ONCE_CALLBACK(internInit)
+{
+    if (GSSEAP_MUTEX_INIT(&internMutex) == 0)
+        internReady = 1;
+    GSSEAP_ONCE_LEAVE;
+}
+
+/*
+ * Double the number of buckets. On failure the table is left as it
+ * was, only with longer chains.
+ */
+static void
+growTable(void)
+{
+    struct gss_eap_interned_name **buckets, *entry, *next;
+    size_t count, i;
+
+    count = internBucketCount ? 2 * internBucketCount : INTERN_MIN_BUCKETS;
+
+    buckets = GSSEAP_CALLOC(count, sizeof(*buckets));
+    if (buckets == NULL)
+        return;
+
+    for (i = 0; i < internBucketCount; i++) {
+        for (entry = internBuckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->next = buckets[entry->hash & (count - 1)];
+            buckets[entry->hash & (count - 1)] = entry;
+        }
+    }
+
+    GSSEAP_FREE(internBuckets);
+    internBuckets = buckets;
+    internBucketCount = count;
+}
+#endif /* GSSEAP_ENABLE_INTERN */
+
+/*
+ * Return a reference to the entry for the given string, adding it if it
+ * is not yet present. *pInterned is NULL if interning is disabled or
+ * memory runs out; callers then compare bytes.
+ */
+void
+gssEapInternName(const gss_buffer_t buffer,
+                 struct gss_eap_interned_name **pInterned)
+{
+#ifdef GSSEAP_ENABLE_INTERN
+    struct gss_eap_interned_name *entry;
+    uint32_t hash;
+
+    *pInterned = NULL;
+
+    GSSEAP_ONCE(&internOnce, internInit);
+    if (!internReady)
+        return;
+
+    hash = gssEapHashBytes(buffer->value, buffer->length);
+
+    GSSEAP_MUTEX_LOCK(&internMutex);
+
+    if (internCount >= internBucketCount)
+        growTable();
+
+    if (internBucketCount != 0) {
+        for (entry = internBuckets[hash & (internBucketCount - 1)];
+             entry != NULL;
+             entry = entry->next) {
+            if (entry->hash == hash &&
+                entry->length == buffer->length &&
+                memcmp(entry->value, buffer->value, buffer->length) == 0) {
+                GSSEAP_REFCOUNT_INCREMENT(&entry->refs);
+                gssEapMetricIncrement(GSSEAP_METRIC_INTERN_HIT);
+                *pInterned = entry;
+                goto cleanup;
+            }
+        }
+
+        gssEapMetricIncrement(GSSEAP_METRIC_INTERN_MISS);
+
+        entry = GSSEAP_MALLOC(sizeof(*entry) + buffer->length);
+        if (entry != NULL) {
+            entry->refs = 1;
+            entry->hash = hash;
+            entry->length = buffer->length;
+            if (buffer->length != 0)
+                memcpy(entry->value, buffer->value, buffer->length);
+            entry->next = internBuckets[hash & (internBucketCount - 1)];
+            internBuckets[hash & (internBucketCount - 1)] = entry;
+            internCount++;
+            *pInterned = entry;
+        }
+    }
+
+cleanup:
+    GSSEAP_MUTEX_UNLOCK(&internMutex);
+#else
+    *pInterned = NULL;
+#endif /* GSSEAP_ENABLE_INTERN */
+}
+
+/*
+ * Take another reference to an entry the caller already holds, which
+ * needs no lock.
+ */
+struct gss_eap_interned_name *
+gssEapReferenceInternedName(struct gss_eap_interned_name *interned)
+{
+    if (interned != NULL)
+        GSSEAP_REFCOUNT_INCREMENT(&interned->refs);
+
+    return interned;
+}
+
+/*
+ * Drop a reference, removing the entry when it was the last. The count
+ * only reaches zero with the table locked, so gssEapInternName() never
+ * finds an entry that is being freed.
+ */
+void
+gssEapReleaseInternedName(struct gss_eap_interned_name **pInterned)
+{
+#ifdef GSSEAP_ENABLE_INTERN
+    struct gss_eap_interned_name *entry = *pInterned, **pp;
+
+    if (entry == NULL)
+        return;
+
+    *pInterned = NULL;
+
+    GSSEAP_MUTEX_LOCK(&internMutex);
+
+    if (GSSEAP_REFCOUNT_DECREMENT(&entry->refs) == 0) {
+        for (pp = &internBuckets[entry->hash & (internBucketCount - 1)];
+             *pp != NULL;
+             pp = &(*pp)->next) {
+            if (*pp == entry) {
+                *pp = entry->next;
+                break;
+            }
+        }
+        internCount--;
+        GSSEAP_FREE(entry);
+    }
+
+    GSSEAP_MUTEX_UNLOCK(&internMutex);
+#else
+    *pInterned = NULL;
+#endif /* GSSEAP_ENABLE_INTERN */
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Mapping of initiator names to local accounts.
+ *
+ * The local account is the value of the initiator's local-login-user
+ * attribute, a ";"-separated list if the IdP released several. It is
+ * looked up once per name and kept with the name, so that repeated
+ * gss_localname() and gss_authorize_localname() calls, as made by
+ * sshd, do not search the attributes again.
+ *
+ * The mapping always comes from the name's own attributes, whose
+ * lookup is indexed. It is not shared between names: the composite
+ * name identifies the NameID but not the IdP that asserted it, so two
+ * IdPs could otherwise be given each other's accounts.
+ */
+
+#include "gssapiP_eap.h"
+
+#ifndef MECH_EAP
+
+/*
+ * Find the local account for a name, with the name locked. Only names
+ * carrying attributes from an authenticated exchange are mapped, so a
+ * name imported from a string never is.
+ */
+static OM_uint32
+mapLocalLoginUser(OM_uint32 *minor, gss_name_t name)
+{
+    char *value = NULL;
+
+    if ((name->samlResolution == NULL && name->samlAttrs == NULL) ||
+        gssEapGetSamlAttribute(name, "local-login-user", &value) != 1) {
+        *minor = GSSEAP_NO_LOCAL_MAPPING;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    /* Adopt the string; it is released with gss_release_buffer() */
+    name->localLogin.value = value;
+    name->localLogin.length = strlen(value);
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+/*
+ * Return the local account list for an initiator name. The mapping is
+ * made on the first call and kept with the name.
+ */
+OM_uint32
+gssEapLocalLoginUser(OM_uint32 *minor,
+                     gss_name_t name,
+                     gss_buffer_t localLogin)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+
+    localLogin->length = 0;
+    localLogin->value = NULL;
+
+    if (name == GSS_C_NO_NAME) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_BAD_NAME;
+    }
+
+    GSSEAP_MUTEX_LOCK(&name->mutex);
+
+    gssEapMetricIncrement(name->localLogin.value != NULL
+                          ? GSSEAP_METRIC_LOCALNAME_HIT
+                          : GSSEAP_METRIC_LOCALNAME_MISS);
+
+    if (name->localLogin.value == NULL)
+        major = mapLocalLoginUser(minor, name);
+    if (!GSS_ERROR(major))
+        major = duplicateBuffer(minor, &name->localLogin, localLogin);
+
+    GSSEAP_MUTEX_UNLOCK(&name->mutex);
+
+    return major;
+}
+
+/*
+ * Return true if account is one of the ";"-separated accounts in
+ * localLogin.
+ */
+int
+gssEapLocalLoginUserMatch(const gss_buffer_t localLogin,
+                          const void *account,
+                          size_t accountLength)
+{
+    const char *p = (const char *)localLogin->value;
+    const char *end = p + localLogin->length;
+    const char *sep;
+
+    while (p < end) {
+        sep = memchr(p, ';', end - p);
+        if (sep == NULL)
+            sep = end;
+
+        if ((size_t)(sep - p) == accountLength &&
+            memcmp(p, account, accountLength) == 0)
+            return 1;
+
+        p = sep + 1;
+    }
+
+    return 0;
+}
+
+#endif /* !MECH_EAP */
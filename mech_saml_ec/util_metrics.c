@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Process-wide counters, kept per thread and summed when read.
+ *
+ * Each thread claims a slot in the metrics segment the first time it
+ * counts something and is then the only writer of that slot, so
+ * counting is a load and a store with no lock or atomic instruction.
+ * Readers sum the slots; a count may be read a moment late but is
+ * never torn on platforms with 64-bit stores. When more threads run at
+ * once than there are slots, the rest share the last slot and add to
+ * it atomically.
+ *
+ * If MECH_SAML_EC_METRICS_SHM names a POSIX shared memory object (for
+ * example "/mech_saml_ec.%p", where %p is replaced by the process ID),
+ * the segment is created there so that an agent can read the counters
+ * without calling into the mechanism; see gss-sample/gss-metrics.c.
+ * An existing object is only replaced if the process that created it
+ * has exited; otherwise the segment is private to the process.
+ */
+
+#include "gssapiP_eap.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#endif
+
+#ifdef WIN32
+#define METRICS_ATOMIC_ADD(p, n)        InterlockedExchangeAdd64((volatile LONG64 *)(p), (n))
+#define METRICS_ATOMIC_CAS(p, o, n)     (InterlockedCompareExchange((volatile LONG *)(p), (n), (o)) == (LONG)(o))
+#define METRICS_BARRIER()               MemoryBarrier()
+#else
+#define METRICS_ATOMIC_ADD(p, n)        __sync_fetch_and_add((p), (n))
+#define METRICS_ATOMIC_CAS(p, o, n)     __sync_bool_compare_and_swap((p), (o), (n))
+#define METRICS_BARRIER()               __sync_synchronize()
+#endif
+
+#define METRICS_SHARED_SLOT             (GSSEAP_METRICS_SLOTS - 1)
+
+static GSSEAP_THREAD_ONCE metricsOnce = GSSEAP_ONCE_INITIALIZER;
+static struct gss_eap_metrics_segment *metricsSegment;
+
+#ifndef WIN32
+/* Expand %p in the object name to the process ID */
+static int
+metricsShmName(const char *pattern, char *name, size_t size)
+{
+    size_t i, len = 0;
+    int n;
+
+    for (i = 0; pattern[i] != '\0'; i++) {
+        if (pattern[i] == '%' && pattern[i + 1] == 'p') {
+            n = snprintf(&name[len], size - len, "%ld", (long)getpid());
+            if (n < 0 || (size_t)n >= size - len)
+                return -1;
+            len += n;
+            i++;
+        } else {
+            if (len + 1 >= size)
+                return -1;
+            name[len++] = pattern[i];
+        }
+    }
+    name[len] = '\0';
+
+    return 0;
+}
+
+/*
+ * An object left behind by a process that has exited, which may be
+ * replaced. One that is still being set up, or whose creator cannot be
+ * told, is not.
+ */
+static int
+isStaleSegment(const char *name)
+{
+    struct gss_eap_metrics_segment *segment;
+    struct stat st;
+    pid_t pid;
+    int fd, stale = 0;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return (errno == ENOENT);
+
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(*segment)) {
+        segment = mmap(NULL, sizeof(*segment), PROT_READ, MAP_SHARED, fd, 0);
+        if (segment != MAP_FAILED) {
+            pid = (pid_t)segment->pid;
+            if (segment->magic == GSSEAP_METRICS_MAGIC && pid > 0)
+                stale = (pid == getpid() ||
+                         (kill(pid, 0) != 0 && errno == ESRCH));
+            munmap(segment, sizeof(*segment));
+        }
+    }
+    close(fd);
+
+    return stale;
+}
+
+static struct gss_eap_metrics_segment *
+mapSharedSegment(const char *pattern)
+{
+    struct gss_eap_metrics_segment *segment;
+    char name[256];
+    int fd;
+
+    if (metricsShmName(pattern, name, sizeof(name)) != 0)
+        return NULL;
+
+    /* Never truncate a segment another process is still counting in */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0640);
+    if (fd < 0 && errno == EEXIST && isStaleSegment(name)) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0640);
+    }
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, sizeof(*segment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    segment = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+
+    return (segment == MAP_FAILED) ? NULL : segment;
+}
+#endif /* !WIN32 */
+
+static GSSEAP_ONCE_CALLBACK(metricsInit)
+{
+    struct gss_eap_metrics_segment *segment = NULL;
+#ifndef WIN32
+    const char *pattern = getenv("MECH_SAML_EC_METRICS_SHM");
+
+    if (pattern != NULL && pattern[0] != '\0')
+        segment = mapSharedSegment(pattern);
+#endif
+    if (segment == NULL)
+        segment = GSSEAP_CALLOC(1, sizeof(*segment));
+    if (segment == NULL)
+        GSSEAP_ONCE_LEAVE;
+
+    segment->version = GSSEAP_METRICS_VERSION;
+    segment->slotCount = GSSEAP_METRICS_SLOTS;
+    segment->counterCount = GSSEAP_METRIC_MAX;
+    segment->slotSize = sizeof(struct gss_eap_metrics_slot);
+    segment->minorBase = ERROR_TABLE_BASE_eapg;
+#ifdef WIN32
+    segment->pid = GetCurrentProcessId();
+#else
+    segment->pid = getpid();
+#endif
+    segment->slots[METRICS_SHARED_SLOT].state = GSSEAP_METRICS_SLOT_SHARED;
+
+    /* Readers check the magic last */
+    METRICS_BARRIER();
+    segment->magic = GSSEAP_METRICS_MAGIC;
+
+    metricsSegment = segment;
+
+    GSSEAP_ONCE_LEAVE;
+}
+
+static struct gss_eap_metrics_slot *
+claimSlot(void)
+{
+    struct gss_eap_metrics_slot *slot;
+    int i;
+
+    GSSEAP_ONCE(&metricsOnce, metricsInit);
+    if (metricsSegment == NULL)
+        return NULL;
+
+    for (i = 0; i < METRICS_SHARED_SLOT; i++) {
+        slot = &metricsSegment->slots[i];
+        if (slot->state == GSSEAP_METRICS_SLOT_FREE &&
+            METRICS_ATOMIC_CAS(&slot->state, GSSEAP_METRICS_SLOT_FREE,
+                               GSSEAP_METRICS_SLOT_OWNED))
+            return slot;
+    }
+
+    return &metricsSegment->slots[METRICS_SHARED_SLOT];
+}
+
+static struct gss_eap_metrics_slot *
+getMetricsSlot(void)
+{
+    struct gss_eap_thread_local_data *tld;
+
+    tld = gssEapGetThreadLocalData();
+    if (tld == NULL)
+        return NULL;
+
+    if (tld->metricsSlot == NULL)
+        tld->metricsSlot = claimSlot();
+
+    return tld->metricsSlot;
+}
+
+void
+gssEapMetricAdd(enum gss_eap_metric metric, uint64_t count)
+{
+    struct gss_eap_metrics_slot *slot = getMetricsSlot();
+    volatile uint64_t *counter;
+
+    if (slot == NULL)
+        return;
+
+    counter = &slot->counters[metric];
+    if (slot->state == GSSEAP_METRICS_SLOT_SHARED)
+        METRICS_ATOMIC_ADD(counter, count);
+    else
+        *counter = *counter + count;
+}
+
+/* Count a failed call, and its minor status if it is one of ours */
+void
+gssEapMetricFailure(enum gss_eap_metric metric, uint32_t minor)
+{
+    uint32_t code = minor - ERROR_TABLE_BASE_eapg;
+
+    if (minor < ERROR_TABLE_BASE_eapg ||
+        code >= GSSEAP_METRICS_MINOR_CODES - 1)
+        code = GSSEAP_METRICS_MINOR_CODES - 1;
+
+    gssEapMetricIncrement(metric);
+    gssEapMetricIncrement(GSSEAP_METRIC_FAILURE_MINOR + code);
+}
+
+void
+gssEapMetricBytes(enum gss_eap_metric metric, int32_t enctype, uint64_t count)
+{
+    if (enctype < 0 || enctype >= GSSEAP_METRICS_ENCTYPES - 1)
+        enctype = GSSEAP_METRICS_ENCTYPES - 1;
+
+    gssEapMetricAdd(metric + enctype, count);
+}
+
+/* Sum each counter over all slots */
+void
+gssEapMetricsSnapshot(uint64_t counters[GSSEAP_METRIC_MAX])
+{
+    const volatile struct gss_eap_metrics_slot *slot;
+    int i, j;
+
+    memset(counters, 0, GSSEAP_METRIC_MAX * sizeof(counters[0]));
+
+    GSSEAP_ONCE(&metricsOnce, metricsInit);
+    if (metricsSegment == NULL)
+        return;
+
+    for (i = 0; i < GSSEAP_METRICS_SLOTS; i++) {
+        slot = &metricsSegment->slots[i];
+        for (j = 0; j < GSSEAP_METRIC_MAX; j++)
+            counters[j] += slot->counters[j];
+    }
+}
+
+/*
+ * Give up a thread's slot on thread exit. Its counts stay in the
+ * segment and the next thread to claim it adds to them.
+ */
+void
+gssEapReleaseMetricsSlot(struct gss_eap_metrics_slot *slot)
+{
+    if (slot->state == GSSEAP_METRICS_SLOT_OWNED) {
+        METRICS_BARRIER();
+        slot->state = GSSEAP_METRICS_SLOT_FREE;
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Process-wide counters. This header describes the layout of the
+ * metrics segment and depends only on <stdint.h>, so that tools reading
+ * an exported segment can include it without the rest of the mechanism.
+ */
+
+#ifndef _UTIL_METRICS_H_
+#define _UTIL_METRICS_H_ 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GSSEAP_METRICS_MAGIC            0x4D534543  /* "MSEC" */
+#define GSSEAP_METRICS_VERSION          1
+
+/* Threads beyond this many at once share one slot, with atomic adds */
+#define GSSEAP_METRICS_SLOTS            64
+
+/* Minor codes counted individually, from the start of gsseap_err.et */
+#define GSSEAP_METRICS_MINOR_CODES      96
+
+/* Enctypes counted individually; larger enctypes use the last bucket */
+#define GSSEAP_METRICS_ENCTYPES         32
+
+/* IdP responses by status class; class 0 counts transport failures */
+#define GSSEAP_METRICS_HTTP_CLASSES     6
+
+enum gss_eap_metric {
+    /* Calls to gss_init_sec_context()/gss_accept_sec_context() by outcome */
+    GSSEAP_METRIC_INIT_COMPLETE = 0,
+    GSSEAP_METRIC_INIT_CONTINUE,
+    GSSEAP_METRIC_INIT_FAILURE,
+    GSSEAP_METRIC_ACCEPT_COMPLETE,
+    GSSEAP_METRIC_ACCEPT_CONTINUE,
+    GSSEAP_METRIC_ACCEPT_FAILURE,
+
+    /* Failures by minor code less ERROR_TABLE_BASE_eapg; the last is other */
+    GSSEAP_METRIC_FAILURE_MINOR,
+
+    /* Per-message tokens */
+    GSSEAP_METRIC_WRAP = GSSEAP_METRIC_FAILURE_MINOR + GSSEAP_METRICS_MINOR_CODES,
+    GSSEAP_METRIC_UNWRAP,
+    GSSEAP_METRIC_GET_MIC,
+    GSSEAP_METRIC_VERIFY_MIC,
+
+    /* Message bytes by enctype */
+    GSSEAP_METRIC_WRAP_BYTES,
+    GSSEAP_METRIC_UNWRAP_BYTES = GSSEAP_METRIC_WRAP_BYTES + GSSEAP_METRICS_ENCTYPES,
+
+    /* sequenceCheck() results other than GSS_S_COMPLETE */
+    GSSEAP_METRIC_SEQ_DUPLICATE = GSSEAP_METRIC_UNWRAP_BYTES + GSSEAP_METRICS_ENCTYPES,
+    GSSEAP_METRIC_SEQ_OLD,
+    GSSEAP_METRIC_SEQ_UNSEQ,
+    GSSEAP_METRIC_SEQ_GAP,
+
+    /* IdP responses, indexed by HTTP status / 100 */
+    GSSEAP_METRIC_IDP_HTTP,
+
+    /* Shibboleth SP attribute resolution */
+    GSSEAP_METRIC_SP_RESOLVE = GSSEAP_METRIC_IDP_HTTP + GSSEAP_METRICS_HTTP_CLASSES,
+    GSSEAP_METRIC_SP_RESOLVE_MICROS,
+
+    /* Caches */
+    GSSEAP_METRIC_POOL_HIT,
+    GSSEAP_METRIC_POOL_MISS,
+    GSSEAP_METRIC_INTERN_HIT,
+    GSSEAP_METRIC_INTERN_MISS,
+    GSSEAP_METRIC_LOCALNAME_HIT,
+    GSSEAP_METRIC_LOCALNAME_MISS,
+    GSSEAP_METRIC_CONFIG_HIT,
+    GSSEAP_METRIC_CONFIG_MISS,
+
+    GSSEAP_METRIC_MAX
+};
+
+/* Slot states */
+#define GSSEAP_METRICS_SLOT_FREE        0   /* counts kept, no writer */
+#define GSSEAP_METRICS_SLOT_OWNED       1   /* written by one thread */
+#define GSSEAP_METRICS_SLOT_SHARED      2   /* written atomically by many */
+
+/* Each slot fills whole 64 byte cache lines */
+#define GSSEAP_METRICS_SLOT_COUNTERS    \
+    ((((GSSEAP_METRIC_MAX + 1) + 7) & ~7) - 1)
+
+struct gss_eap_metrics_slot {
+    uint32_t state;
+    uint32_t reserved;
+    uint64_t counters[GSSEAP_METRICS_SLOT_COUNTERS];
+};
+
+/*
+ * The segment. A counter's value is the sum of that counter over all
+ * slots; threads keep their slot's counts when they exit, and a slot
+ * is reused by a later thread.
+ */
+struct gss_eap_metrics_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t counterCount;          /* GSSEAP_METRIC_MAX */
+    uint32_t slotSize;
+    uint32_t minorBase;             /* ERROR_TABLE_BASE_eapg */
+    uint64_t pid;
+    unsigned char reserved[32];
+    struct gss_eap_metrics_slot slots[GSSEAP_METRICS_SLOTS];
+};
+
+void
+gssEapMetricAdd(enum gss_eap_metric metric, uint64_t count);
+
+#define gssEapMetricIncrement(metric)   gssEapMetricAdd((metric), 1)
+
+void
+gssEapMetricFailure(enum gss_eap_metric metric, uint32_t minor);
+
+void
+gssEapMetricBytes(enum gss_eap_metric metric, int32_t enctype, uint64_t count);
+
+void
+gssEapMetricsSnapshot(uint64_t counters[GSSEAP_METRIC_MAX]);
+
+void
+gssEapReleaseMetricsSlot(struct gss_eap_metrics_slot *slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_METRICS_H_ */
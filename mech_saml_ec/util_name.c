@@ -66,25 +66,31 @@ static gss_OID_desc gssEapNtEapName = {
 
 gss_OID GSS_EAP_NT_EAP_NAME = &gssEapNtEapName;
 
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+/* SAML2XML.cpp */
+struct gss_eap_saml_resolution *
+referenceSAMLResolution(struct gss_eap_saml_resolution *res);
+void releaseSAMLResolution(struct gss_eap_saml_resolution *res);
+int getResolvedSAMLAttribute(struct gss_eap_saml_resolution *res,
+                             const char *attrib, char **value);
+int exportResolvedSAMLAttributes(struct gss_eap_saml_resolution *res,
+                                 char **attrs, size_t *length);
+
+static struct gss_eap_saml_attrs *
+referenceSamlAttrs(struct gss_eap_saml_attrs *attrs);
+#endif
+
 OM_uint32
 gssEapAllocName(OM_uint32 *minor, gss_name_t *pName)
 {
-    OM_uint32 tmpMinor;
+    OM_uint32 major;
     gss_name_t name;
 
     *pName = GSS_C_NO_NAME;
 
-    name = (gss_name_t)GSSEAP_CALLOC(1, sizeof(*name));
-    if (name == NULL) {
-        *minor = ENOMEM;
-        return GSS_S_FAILURE;
-    }
-
-    if (GSSEAP_MUTEX_INIT(&name->mutex) != 0) {
-        *minor = GSSEAP_GET_LAST_ERROR();
-        gssEapReleaseName(&tmpMinor, &name);
-        return GSS_S_FAILURE;
-    }
+    major = gssEapPoolAlloc(minor, GSSEAP_POOL_NAME, (void **)&name);
+    if (GSS_ERROR(major))
+        return major;
 
     *pName = name;
 
@@ -109,13 +115,17 @@ gssEapReleaseName(OM_uint32 *minor, gss_name_t *pName)
     }
 
     gss_release_buffer(&tmpMinor, &name->username);
+    gssEapReleaseInternedName(&name->interned);
     gssEapReleaseOid(&tmpMinor, &name->mechanismUsed);
 #ifdef GSSEAP_ENABLE_ACCEPTOR
     gssEapReleaseAttrContext(&tmpMinor, name);
+#ifndef MECH_EAP
+    gssEapReleaseSamlAttributes(name);
+    gss_release_buffer(&tmpMinor, &name->localLogin);
+#endif
 #endif
 
-    GSSEAP_MUTEX_DESTROY(&name->mutex);
-    GSSEAP_FREE(name);
+    gssEapPoolRelease(GSSEAP_POOL_NAME, name);
     *pName = NULL;
 
     return GSS_S_COMPLETE;
@@ -126,16 +136,20 @@ importServiceName(OM_uint32 *minor,
                   const gss_buffer_t nameBuffer,
                   gss_name_t *pName)
 {
-    OM_uint32 major;
+    OM_uint32 major, tmpMinor;
     gss_name_t name;
 
     major = gssEapAllocName(minor, &name);
     if (GSS_ERROR(major))
         return major;
 
-    duplicateBuffer(minor, nameBuffer, &name->username);
-    if (GSS_ERROR(major))
+    major = duplicateBuffer(minor, nameBuffer, &name->username);
+    if (GSS_ERROR(major)) {
+        gssEapReleaseName(&tmpMinor, &name);
         return major;
+    }
+
+    gssEapInternName(&name->username, &name->interned);
 
     *pName = name;
     *minor = 0;
@@ -153,16 +167,20 @@ importEapNameFlags(OM_uint32 *minor,
                    OM_uint32 importFlags,
                    gss_name_t *pName)
 {
-    OM_uint32 major;
+    OM_uint32 major, tmpMinor;
     gss_name_t name;
 
     major = gssEapAllocName(minor, &name);
     if (GSS_ERROR(major))
         return major;
 
-    duplicateBuffer(minor, nameBuffer, &name->username);
-    if (GSS_ERROR(major))
+    major = duplicateBuffer(minor, nameBuffer, &name->username);
+    if (GSS_ERROR(major)) {
+        gssEapReleaseName(&tmpMinor, &name);
         return major;
+    }
+
+    gssEapInternName(&name->username, &name->interned);
 
     *pName = name;
     *minor = 0;
@@ -308,7 +326,12 @@ gssEapImportNameInternal(OM_uint32 *minor,
         buf.length = remain;
         buf.value = p;
 
-        major = gssEapImportAttrContext(minor, &buf, name);
+#ifndef MECH_EAP
+        if (gssEapIsEncodedSamlAttributes(&buf))
+            major = gssEapDecodeSamlAttributes(minor, &buf, name);
+        else
+#endif
+            major = gssEapImportAttrContext(minor, &buf, name);
         if (GSS_ERROR(major))
             goto cleanup;
     }
@@ -447,10 +470,17 @@ gssEapExportNameInternal(OM_uint32 *minor,
     exportedNameLen += 4 + nameBuf.length;
 #ifdef GSSEAP_ENABLE_ACCEPTOR
     if (flags & EXPORT_NAME_FLAG_COMPOSITE) {
+#ifdef MECH_EAP
         major = gssEapExportAttrContext(minor, name, &attrs);
         if (GSS_ERROR(major))
             goto cleanup;
         exportedNameLen += attrs.length;
+#else
+        major = gssEapMaterializeSamlAttributes(minor, name);
+        if (GSS_ERROR(major))
+            goto cleanup;
+        exportedNameLen += gssEapSamlAttributesEncodedLength(name);
+#endif
     }
 #endif
 
@@ -490,8 +520,12 @@ gssEapExportNameInternal(OM_uint32 *minor,
     p += nameBuf.length;
 
     if (flags & EXPORT_NAME_FLAG_COMPOSITE) {
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+        p = gssEapEncodeSamlAttributes(name, p);
+#else
         memcpy(p, attrs.value, attrs.length);
         p += attrs.length;
+#endif
     }
 
     GSSEAP_ASSERT(p == (unsigned char *)exportedName->value + exportedNameLen);
@@ -542,12 +576,11 @@ gssEapCanonicalizeName(OM_uint32 *minor,
 
     name->flags = input_name->flags;
 
-    duplicateBuffer(minor, &input_name->username, &name->username);
-
-    if (*minor != 0) {
-        major = GSS_S_FAILURE;
+    major = duplicateBuffer(minor, &input_name->username, &name->username);
+    if (GSS_ERROR(major))
         goto cleanup;
-    }
+
+    name->interned = gssEapReferenceInternedName(input_name->interned);
 
 #ifdef GSSEAP_ENABLE_ACCEPTOR
     if (input_name->attrCtx != NULL) {
@@ -555,6 +588,12 @@ gssEapCanonicalizeName(OM_uint32 *minor,
         if (GSS_ERROR(major))
             goto cleanup;
     }
+#ifndef MECH_EAP
+    /* Both are immutable, so the copy can share them */
+    name->samlAttrs = referenceSamlAttrs(input_name->samlAttrs);
+    name->samlResolution =
+        referenceSAMLResolution(input_name->samlResolution);
+#endif
 #endif
 
     *dest_name = name;
@@ -622,10 +661,396 @@ gssEapCompareName(OM_uint32 *minor,
     if (name1 == GSS_C_NO_NAME && name2 == GSS_C_NO_NAME) {
         *name_equal = 1;
     } else if (name1 != GSS_C_NO_NAME && name2 != GSS_C_NO_NAME) {
-        *name_equal = (name1->username.length == name2->username.length &&
-                      strncmp(name1->username.value, name2->username.value,
-                              name1->username.length) == 0 ) ? 1 : 0;
+        if (name1->interned != NULL && name2->interned != NULL) {
+            /* Equal strings are interned once */
+            *name_equal = (name1->interned == name2->interned);
+        } else {
+            *name_equal = (name1->username.length == name2->username.length &&
+                          memcmp(name1->username.value, name2->username.value,
+                                 name1->username.length) == 0) ? 1 : 0;
+        }
+    } else {
+        *name_equal = 0;
+    }
+
+    return GSS_S_COMPLETE;
+}
+
+#if defined(GSSEAP_ENABLE_ACCEPTOR) && !defined(MECH_EAP)
+/*
+ * The attributes carried by a name are a list of (name, value) pairs,
+ * each prefixed by a 4-octet big-endian length. Return the pair at *pp
+ * and advance past it, or 0 at the end of the list.
+ */
+static int
+nextSamlAttribute(unsigned char **pp,
+                  size_t *pRemain,
+                  gss_buffer_t attr,
+                  gss_buffer_t value)
+{
+    unsigned char *p = *pp;
+    size_t remain = *pRemain;
+
+    if (remain < 4)
+        return 0;
+    attr->length = load_uint32_be(p);
+    if (remain - 4 < attr->length + 4)
+        return 0;
+    attr->value = p + 4;
+
+    p      += 4 + attr->length;
+    remain -= 4 + attr->length;
+
+    value->length = load_uint32_be(p);
+    if (remain - 4 < value->length)
+        return 0;
+    value->value = p + 4;
+
+    *pp      = p + 4 + value->length;
+    *pRemain = remain - 4 - value->length;
+
+    return 1;
+}
+
+/*
+ * Index the attributes by name. If memory runs out the index is left
+ * empty, and lookups scan the list instead.
+ */
+static void
+indexSamlAttrs(struct gss_eap_saml_attrs *attrs)
+{
+    unsigned char *p;
+    size_t remain, count = 0;
+    gss_buffer_desc attr, value;
+
+    p = (unsigned char *)attrs->list.value;
+    remain = attrs->list.length;
+
+    while (nextSamlAttribute(&p, &remain, &attr, &value))
+        count++;
+
+    if (!gssEapAttrIndexInit(&attrs->index, count))
+        return;
+
+    p = (unsigned char *)attrs->list.value;
+    remain = attrs->list.length;
+
+    while (nextSamlAttribute(&p, &remain, &attr, &value)) {
+        size_t offset = (unsigned char *)attr.value - 4 -
+                        (unsigned char *)attrs->list.value;
+
+        if (!gssEapAttrIndexAdd(&attrs->index, attr.value,
+                                attr.length, offset)) {
+            gssEapAttrIndexRelease(&attrs->index);
+            break;
+        }
     }
+}
+
+/*
+ * Wrap a list of attributes, whose storage is adopted, for sharing.
+ */
+static OM_uint32
+allocSamlAttrs(OM_uint32 *minor,
+               gss_buffer_t list,
+               struct gss_eap_saml_attrs **pAttrs)
+{
+    struct gss_eap_saml_attrs *attrs;
+
+    attrs = GSSEAP_CALLOC(1, sizeof(*attrs));
+    if (attrs == NULL) {
+        *minor = ENOMEM;
+        return GSS_S_FAILURE;
+    }
+
+    attrs->refs = 1;
+    attrs->list = *list;
+    list->length = 0;
+    list->value = NULL;
+
+    indexSamlAttrs(attrs);
+
+    *pAttrs = attrs;
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static struct gss_eap_saml_attrs *
+referenceSamlAttrs(struct gss_eap_saml_attrs *attrs)
+{
+    if (attrs != NULL)
+        GSSEAP_REFCOUNT_INCREMENT(&attrs->refs);
+
+    return attrs;
+}
+
+static void
+releaseSamlAttrs(struct gss_eap_saml_attrs *attrs)
+{
+    OM_uint32 tmpMinor;
 
+    if (attrs == NULL || GSSEAP_REFCOUNT_DECREMENT(&attrs->refs) != 0)
+        return;
+
+    gss_release_buffer(&tmpMinor, &attrs->list);
+    gssEapAttrIndexRelease(&attrs->index);
+    GSSEAP_FREE(attrs);
+}
+
+void
+gssEapReleaseSamlAttributes(gss_name_t name)
+{
+    releaseSamlAttrs(name->samlAttrs);
+    name->samlAttrs = NULL;
+    releaseSAMLResolution(name->samlResolution);
+    name->samlResolution = NULL;
+}
+
+/*
+ * Give the name a reference to the attributes resolved from the
+ * assertion its context was established with. They are not serialised
+ * until they are looked up or exported, which most acceptors never do.
+ */
+OM_uint32
+gssEapImportSamlAttributes(OM_uint32 *minor,
+                           gss_name_t name,
+                           struct gss_eap_saml_resolution *resolution)
+{
+    gssEapReleaseSamlAttributes(name);
+
+    name->samlResolution = referenceSAMLResolution(resolution);
+
+    *minor = 0;
     return GSS_S_COMPLETE;
 }
+
+/*
+ * Serialise the attributes referenced by the name into samlAttrs,
+ * before they are exported. Call with the name's mutex held, unless the
+ * name belongs to a context.
+ */
+OM_uint32
+gssEapMaterializeSamlAttributes(OM_uint32 *minor, gss_name_t name)
+{
+    OM_uint32 major = GSS_S_COMPLETE, tmpMinor;
+    gss_buffer_desc list = GSS_C_EMPTY_BUFFER;
+    char *attrs = NULL;
+
+    *minor = 0;
+
+    if (name->samlResolution == NULL)
+        return GSS_S_COMPLETE;
+
+    if (exportResolvedSAMLAttributes(name->samlResolution,
+                                     &attrs, &list.length) == 1) {
+        list.value = attrs;
+        major = allocSamlAttrs(minor, &list, &name->samlAttrs);
+        if (GSS_ERROR(major)) {
+            gss_release_buffer(&tmpMinor, &list);
+            return major;
+        }
+    }
+
+    releaseSAMLResolution(name->samlResolution);
+    name->samlResolution = NULL;
+
+    return major;
+}
+
+/*
+ * Give the name a copy of a list of attributes in the above format.
+ */
+OM_uint32
+gssEapSetSamlAttributes(OM_uint32 *minor,
+                        gss_name_t name,
+                        const gss_buffer_t attributes)
+{
+    OM_uint32 major, tmpMinor;
+    gss_buffer_desc list = GSS_C_EMPTY_BUFFER;
+
+    gssEapReleaseSamlAttributes(name);
+
+    major = duplicateBuffer(minor, attributes, &list);
+    if (GSS_ERROR(major))
+        return major;
+
+    major = allocSamlAttrs(minor, &list, &name->samlAttrs);
+    if (GSS_ERROR(major))
+        gss_release_buffer(&tmpMinor, &list);
+
+    return major;
+}
+
+/*
+ * Return the list of attributes carried by the name, or an empty buffer.
+ * The list is shared, so it must not be modified.
+ */
+void
+gssEapGetSamlAttributesList(gss_name_t name, gss_buffer_t list)
+{
+    if (name != GSS_C_NO_NAME && name->samlAttrs != NULL) {
+        *list = name->samlAttrs->list;
+    } else {
+        list->length = 0;
+        list->value = NULL;
+    }
+}
+
+/*
+ * Look up an attribute in the (name, value) list carried by the name,
+ * or in the attributes it references if they have not been serialised.
+ * Returns 1 and a string to be freed by the caller if the attribute is
+ * found.
+ */
+int
+gssEapGetSamlAttribute(gss_name_t name, const char *attr, char **value)
+{
+    unsigned char *p;
+    size_t remain, offset, attrLength = strlen(attr);
+    gss_buffer_desc attrBuf, valueBuf;
+    int found = 0;
+
+    *value = NULL;
+
+    if (name != GSS_C_NO_NAME && name->samlResolution != NULL)
+        return getResolvedSAMLAttribute(name->samlResolution, attr, value);
+    if (name == GSS_C_NO_NAME || name->samlAttrs == NULL)
+        return 0;
+
+    p = (unsigned char *)name->samlAttrs->list.value;
+    remain = name->samlAttrs->list.length;
+
+    if (name->samlAttrs->index.size != 0) {
+        if (gssEapAttrIndexFind(&name->samlAttrs->index, attr, attrLength,
+                                &offset)) {
+            p      += offset;
+            remain -= offset;
+            found = nextSamlAttribute(&p, &remain, &attrBuf, &valueBuf);
+        }
+    } else {
+        while (nextSamlAttribute(&p, &remain, &attrBuf, &valueBuf)) {
+            if (attrBuf.length == attrLength &&
+                memcmp(attrBuf.value, attr, attrLength) == 0) {
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    *value = GSSEAP_MALLOC(valueBuf.length + 1);
+    if (*value == NULL)
+        return 0;
+    memcpy(*value, valueBuf.value, valueBuf.length);
+    (*value)[valueBuf.length] = '\0';
+
+    return 1;
+}
+
+/*
+ * Composite exported names carry the attributes in a binary encoding,
+ * rather than as the JSON attribute context of mech_eap, whose text
+ * always begins with "{":
+ *
+ *      version         EAP_EXPORT_ATTRS_V2, 4 octets
+ *      records         tag and length, 4 octets each, and value
+ *
+ * An EAP_EXPORT_ATTRS_TAG_SAML record holds the (name, value) list
+ * described above. Records with other tags are skipped, so that later
+ * versions can add them. The encoder writes straight into the exported
+ * name, and the decoder validates the token in place, so neither
+ * builds an intermediate representation.
+ */
+size_t
+gssEapSamlAttributesEncodedLength(gss_name_t name)
+{
+    if (name->samlAttrs == NULL)
+        return 0;
+
+    return 4 + 8 + name->samlAttrs->list.length;
+}
+
+unsigned char *
+gssEapEncodeSamlAttributes(gss_name_t name, unsigned char *p)
+{
+    gss_buffer_t list;
+
+    if (name->samlAttrs == NULL)
+        return p;
+
+    list = &name->samlAttrs->list;
+
+    store_uint32_be(EAP_EXPORT_ATTRS_V2, p);
+    store_uint32_be(EAP_EXPORT_ATTRS_TAG_SAML, p + 4);
+    store_uint32_be(list->length, p + 8);
+    memcpy(p + 12, list->value, list->length);
+
+    return p + 12 + list->length;
+}
+
+int
+gssEapIsEncodedSamlAttributes(const gss_buffer_t buffer)
+{
+    return buffer->length >= 4 &&
+           load_uint32_be(buffer->value) == EAP_EXPORT_ATTRS_V2;
+}
+
+OM_uint32
+gssEapDecodeSamlAttributes(OM_uint32 *minor,
+                           const gss_buffer_t buffer,
+                           gss_name_t name)
+{
+    unsigned char *p = (unsigned char *)buffer->value + 4;
+    size_t remain = buffer->length - 4;
+    gss_buffer_desc saml = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc attr, value;
+    int found = 0;
+
+    GSSEAP_ASSERT(gssEapIsEncodedSamlAttributes(buffer));
+
+    while (remain != 0) {
+        uint32_t tag, length;
+
+        if (remain < 8)
+            goto defective;
+
+        tag = load_uint32_be(p);
+        length = load_uint32_be(p + 4);
+        if (remain - 8 < length)
+            goto defective;
+
+        if (tag == EAP_EXPORT_ATTRS_TAG_SAML) {
+            if (found)
+                goto defective;
+            saml.length = length;
+            saml.value = p + 8;
+            found = 1;
+        }
+
+        p      += 8 + length;
+        remain -= 8 + length;
+    }
+
+    if (!found || saml.length == 0) {
+        *minor = 0;
+        return GSS_S_COMPLETE;
+    }
+
+    /* The list must consist of whole (name, value) pairs */
+    p = (unsigned char *)saml.value;
+    remain = saml.length;
+    while (nextSamlAttribute(&p, &remain, &attr, &value))
+        ;
+    if (remain != 0)
+        goto defective;
+
+    return gssEapSetSamlAttributes(minor, name, &saml);
+
+defective:
+    *minor = GSSEAP_BAD_NAME_TOKEN;
+    return GSS_S_BAD_NAME;
+}
+#endif
@@ -143,17 +143,13 @@ sequenceInit(OM_uint32 *minor,
     return GSS_S_COMPLETE;
 }
 
-OM_uint32
-sequenceCheck(OM_uint32 *minor,
-              void **vqueue,
-              uint64_t seqnum)
+static OM_uint32
+checkSequence(void **vqueue, uint64_t seqnum)
 {
     queue *q;
     int i;
     uint64_t expected;
 
-    *minor = 0;
-
     q = (queue *) (*vqueue);
 
     if (!q->do_replay && !q->do_sequence)
@@ -232,6 +228,36 @@ sequenceCheck(OM_uint32 *minor,
     return GSS_S_FAILURE;
 }
 
+OM_uint32
+sequenceCheck(OM_uint32 *minor,
+              void **vqueue,
+              uint64_t seqnum)
+{
+    OM_uint32 major;
+
+    *minor = 0;
+
+    major = checkSequence(vqueue, seqnum);
+    switch (major) {
+    case GSS_S_DUPLICATE_TOKEN:
+        gssEapMetricIncrement(GSSEAP_METRIC_SEQ_DUPLICATE);
+        break;
+    case GSS_S_OLD_TOKEN:
+        gssEapMetricIncrement(GSSEAP_METRIC_SEQ_OLD);
+        break;
+    case GSS_S_UNSEQ_TOKEN:
+        gssEapMetricIncrement(GSSEAP_METRIC_SEQ_UNSEQ);
+        break;
+    case GSS_S_GAP_TOKEN:
+        gssEapMetricIncrement(GSSEAP_METRIC_SEQ_GAP);
+        break;
+    default:
+        break;
+    }
+
+    return major;
+}
+
 OM_uint32
 sequenceFree(OM_uint32 *minor, void **vqueue)
 {
@@ -293,6 +319,15 @@ sequenceInternalize(OM_uint32 *minor,
     }
 
     memcpy(q, *buf, sizeof(queue));
+
+    /* Reject a queue that would index outside elem[] */
+    if (((queue *)q)->start < 0 || ((queue *)q)->start >= QUEUE_LENGTH ||
+        ((queue *)q)->length < 1 || ((queue *)q)->length > QUEUE_LENGTH) {
+        GSSEAP_FREE(q);
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
     *buf += sizeof(queue);
     *lenremain -= sizeof(queue);
     *vqueue = q;
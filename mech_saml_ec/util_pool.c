@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-thread caches of context, name and credentials handles.
+ *
+ * Servers that establish many short-lived contexts allocate and free
+ * a handle, and initialise and destroy its mutex, for each context and
+ * for most name operations. Instead, a released handle is zeroed and
+ * kept on the releasing thread's list, with its mutex still
+ * initialised, until a handle of the same type is next allocated on
+ * that thread. At most GSSEAP_POOL_MAX_CACHED handles of each type are
+ * kept per thread; the rest, and those left when the thread exits, are
+ * freed.
+ *
+ * Configure with --disable-pool to allocate and free each handle, for
+ * example when running under AddressSanitizer or valgrind.
+ */
+
+#include "gssapiP_eap.h"
+
+#define GSSEAP_POOL_MAX_CACHED      32
+
+/* Every handle begins with its mutex; cached handles are linked after it */
+struct gss_eap_pool_object {
+    GSSEAP_MUTEX mutex;
+    struct gss_eap_pool_object *next;
+};
+
+struct gss_eap_object_pool {
+    struct gss_eap_pool_object *free[GSSEAP_POOL_MAX];
+    unsigned int count[GSSEAP_POOL_MAX];
+};
+
+static const size_t poolObjectSize[GSSEAP_POOL_MAX] = {
+    sizeof(*((gss_ctx_id_t)NULL)),
+    sizeof(*((gss_name_t)NULL)),
+    sizeof(*((gss_cred_id_t)NULL)),
+};
+
+static void
+zeroObject(struct gss_eap_pool_object *obj, enum gss_eap_pool_type type)
+{
+    gssEapSecureZero((unsigned char *)obj + sizeof(obj->mutex),
+                     poolObjectSize[type] - sizeof(obj->mutex));
+}
+
+#ifdef GSSEAP_ENABLE_POOL
+static struct gss_eap_object_pool *
+getObjectPool(void)
+{
+    struct gss_eap_thread_local_data *tld;
+
+    tld = gssEapGetThreadLocalData();
+    if (tld == NULL)
+        return NULL;
+
+    if (tld->objectPool == NULL)
+        tld->objectPool = GSSEAP_CALLOC(1, sizeof(*tld->objectPool));
+
+    return tld->objectPool;
+}
+#endif /* GSSEAP_ENABLE_POOL */
+
+/*
+ * Return a zeroed handle of the given type with an initialised mutex.
+ */
+OM_uint32
+gssEapPoolAlloc(OM_uint32 *minor,
+                enum gss_eap_pool_type type,
+                void **pObject)
+{
+    struct gss_eap_pool_object *obj;
+#ifdef GSSEAP_ENABLE_POOL
+    struct gss_eap_object_pool *pool = getObjectPool();
+
+    if (pool != NULL && pool->free[type] != NULL) {
+        obj = pool->free[type];
+        pool->free[type] = obj->next;
+        pool->count[type]--;
+        obj->next = NULL;
+
+        gssEapMetricIncrement(GSSEAP_METRIC_POOL_HIT);
+        *pObject = obj;
+        *minor = 0;
+        return GSS_S_COMPLETE;
+    }
+    gssEapMetricIncrement(GSSEAP_METRIC_POOL_MISS);
+#endif
+
+    obj = GSSEAP_CALLOC(1, poolObjectSize[type]);
+    if (obj == NULL) {
+        *minor = ENOMEM;
+        return GSS_S_FAILURE;
+    }
+
+    if (GSSEAP_MUTEX_INIT(&obj->mutex) != 0) {
+        *minor = GSSEAP_GET_LAST_ERROR();
+        GSSEAP_FREE(obj);
+        return GSS_S_FAILURE;
+    }
+
+    *pObject = obj;
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+/*
+ * Release a handle whose contents have been released. The mutex must
+ * not be held.
+ */
+void
+gssEapPoolRelease(enum gss_eap_pool_type type, void *object)
+{
+    struct gss_eap_pool_object *obj = object;
+#ifdef GSSEAP_ENABLE_POOL
+    struct gss_eap_object_pool *pool;
+#endif
+
+    if (obj == NULL)
+        return;
+
+    zeroObject(obj, type);
+
+#ifdef GSSEAP_ENABLE_POOL
+    pool = getObjectPool();
+    if (pool != NULL && pool->count[type] < GSSEAP_POOL_MAX_CACHED) {
+        obj->next = pool->free[type];
+        pool->free[type] = obj;
+        pool->count[type]++;
+        return;
+    }
+#endif
+
+    GSSEAP_MUTEX_DESTROY(&obj->mutex);
+    GSSEAP_FREE(obj);
+}
+
+/* Free a thread's cached handles; called on thread exit */
+void
+gssEapDestroyObjectPool(struct gss_eap_object_pool *pool)
+{
+    struct gss_eap_pool_object *obj;
+    int type;
+
+    for (type = 0; type < GSSEAP_POOL_MAX; type++) {
+        while ((obj = pool->free[type]) != NULL) {
+            pool->free[type] = obj->next;
+            GSSEAP_MUTEX_DESTROY(&obj->mutex);
+            GSSEAP_FREE(obj);
+        }
+    }
+
+    GSSEAP_FREE(pool);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-thread buffered random bytes.
+ *
+ * krb5_c_random_make_octets() serialises its callers on the PRNG's lock,
+ * and rand() and random() on the C library's. Each thread instead draws
+ * from its own GSSEAP_RANDOM_POOL_SIZE bytes of PRNG output, refilled
+ * when used up; bytes are wiped from the buffer as they are handed out.
+ * A forked child refills before its first use, so that it does not hand
+ * out the bytes its parent will.
+ */
+
+#include "gssapiP_eap.h"
+
+#define GSSEAP_RANDOM_POOL_SIZE     512
+
+struct gss_eap_random_pool {
+#ifndef WIN32
+    pid_t pid;
+#endif
+    size_t offset;              /* bytes before this have been used */
+    unsigned char bytes[GSSEAP_RANDOM_POOL_SIZE];
+};
+
+static int
+refillPool(struct gss_eap_random_pool *pool)
+{
+    krb5_context krbContext;
+    krb5_data data;
+    OM_uint32 major, minor;
+
+    major = gssEapKerberosInit(&minor, &krbContext);
+    if (GSS_ERROR(major))
+        return minor;
+
+    data.data = (char *)pool->bytes;
+    data.length = sizeof(pool->bytes);
+
+    minor = krb5_c_random_make_octets(krbContext, &data);
+    if (minor != 0)
+        return minor;
+
+    pool->offset = 0;
+#ifndef WIN32
+    pool->pid = getpid();
+#endif
+
+    return 0;
+}
+
+int
+gssEapRandomBytes(void *buf, size_t length)
+{
+    struct gss_eap_thread_local_data *tld;
+    struct gss_eap_random_pool *pool;
+    unsigned char *p = buf;
+    size_t n;
+    int code;
+
+    tld = gssEapGetThreadLocalData();
+    if (tld == NULL)
+        return ENOMEM;
+
+    pool = tld->randomPool;
+    if (pool == NULL) {
+        pool = GSSEAP_CALLOC(1, sizeof(*pool));
+        if (pool == NULL)
+            return ENOMEM;
+        pool->offset = sizeof(pool->bytes);
+        tld->randomPool = pool;
+    }
+
+#ifndef WIN32
+    if (pool->pid != getpid())
+        pool->offset = sizeof(pool->bytes);
+#endif
+
+    while (length > 0) {
+        if (pool->offset == sizeof(pool->bytes)) {
+            code = refillPool(pool);
+            if (code != 0)
+                return code;
+        }
+
+        n = sizeof(pool->bytes) - pool->offset;
+        if (n > length)
+            n = length;
+
+        memcpy(p, &pool->bytes[pool->offset], n);
+        memset(&pool->bytes[pool->offset], 0, n);
+
+        pool->offset += n;
+        p += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+int
+gssEapRandomHex(char *buf, size_t length)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    unsigned char bytes[64];
+    size_t i, n;
+    int code = 0;
+
+    while (length > 0) {
+        n = (length + 1) / 2;
+        if (n > sizeof(bytes))
+            n = sizeof(bytes);
+
+        code = gssEapRandomBytes(bytes, n);
+        if (code != 0)
+            break;
+
+        for (i = 0; i < 2 * n && length > 0; i++, length--)
+            *buf++ = hexDigits[(bytes[i / 2] >> ((i & 1) ? 0 : 4)) & 0x0F];
+    }
+    *buf = '\0';
+
+    gssEapSecureZero(bytes, sizeof(bytes));
+
+    return code;
+}
+
+void
+gssEapDestroyRandomPool(struct gss_eap_random_pool *pool)
+{
+    gssEapSecureZero(pool, sizeof(*pool));
+    GSSEAP_FREE(pool);
+}
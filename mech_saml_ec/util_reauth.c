@@ -0,0 +1,1452 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Fast reauthentication support.
+ *
+ * After a full SAML EC login in which the initiator asked for one, the
+ * acceptor issues a ticket sealed in a key only acceptors know. The
+ * ticket carries the initiator name and attributes, an expiry no later
+ * than the SessionNotOnOrAfter of the assertion, and a fresh session
+ * key. The ticket and session key are returned to the initiator in the
+ * context key, and cached in its credentials handle.
+ *
+ * The next context with the same acceptor sends the ticket together
+ * with an authenticator in the session key. The acceptor answers with
+ * its own nonce and both sides derive the context key from the session
+ * key and the nonces of each side, so the exchange completes in a
+ * single round trip without the IdP or Shibboleth. If the acceptor
+ * cannot use the ticket it starts a full login instead, and the
+ * initiator forgets the ticket and carries on.
+ *
+ * Tickets are sealed in a key derived from the 32 byte secret in the
+ * file named by MECH_SAML_EC_REAUTH_KEY_FILE, which acceptors sharing
+ * tickets must share, or else in a random key private to the process.
+ * MECH_SAML_EC_REAUTH_LIFETIME bounds ticket lifetime, in seconds.
+ *
+ * Integers are big-endian and variable length fields are preceded by
+ * a four octet length:
+ *
+ *  ticket   = E(ticket key, KEY_USAGE_REAUTH_TICKET,
+ *               version | issued | expires | enctype | key |
+ *               acceptor name | initiator name | attributes)
+ *  creds    = E(context key, KEY_USAGE_REAUTH_CREDS,
+ *               expires | enctype | key | ticket)
+ *  request  = ticket | E(session key, KEY_USAGE_REAUTH_REQ,
+ *               time | flags | initiator nonce | channel bindings)
+ *  response = E(session key, KEY_USAGE_REAUTH_RESP,
+ *               time | flags | acceptor nonce)
+ *
+ * These are sent as the ITOK_TYPE_REAUTH_CREDS, _REQ and _RESP inner
+ * tokens. The request is preceded by ITOK_TYPE_GSS_FLAGS, in the clear
+ * so that the acceptor can fall back to a full login. The acceptor
+ * remembers each initiator nonce until the request has aged out of the
+ * clock skew window, and rejects repeats.
+ */
+
+#include "gssapiP_eap.h"
+
+#ifndef MECH_EAP
+
+#ifdef GSSEAP_ENABLE_ACCEPTOR
+#include "util_replay.h"
+
+/* SAML2XML.cpp */
+struct gss_eap_replay_store *reauthReplayStore(void);
+#endif
+
+#define REAUTH_TICKET_VERSION               1
+
+#define REAUTH_CONTEXT_FLAGS                (GSS_C_MUTUAL_FLAG | \
+                                             GSS_C_DELEG_FLAG)
+
+struct gss_eap_reauth_creds {
+    struct gss_eap_reauth_creds *next;
+    gss_buffer_desc acceptorName;
+    gss_buffer_desc ticket;
+    krb5_keyblock key;
+    time_t expiryTime;
+};
+
+/*
+ * Encoding helpers
+ */
+
+static void
+releaseSecretBuffer(gss_buffer_t buffer)
+{
+    OM_uint32 tmpMinor;
+
+    if (buffer->value != NULL)
+        memset(buffer->value, 0, buffer->length);
+    gss_release_buffer(&tmpMinor, buffer);
+}
+
+static int
+getUint32(unsigned char **pp, size_t *remain, OM_uint32 *value)
+{
+    if (*remain < 4)
+        return 0;
+
+    *value = load_uint32_be(*pp);
+    *pp += 4;
+    *remain -= 4;
+
+    return 1;
+}
+
+static int
+getTime(unsigned char **pp, size_t *remain, time_t *value)
+{
+    if (*remain < 8)
+        return 0;
+
+    *value = (time_t)load_uint64_be(*pp);
+    *pp += 8;
+    *remain -= 8;
+
+    return 1;
+}
+
+/* The buffer returned points into the input */
+static int
+getBuffer(unsigned char **pp, size_t *remain, gss_buffer_t buffer)
+{
+    size_t length;
+
+    if (*remain < 4)
+        return 0;
+
+    length = load_uint32_be(*pp);
+    if (*remain - 4 < length)
+        return 0;
+
+    buffer->length = length;
+    buffer->value = *pp + 4;
+    *pp += 4 + length;
+    *remain -= 4 + length;
+
+    return 1;
+}
+
+static unsigned char *
+storeKey(krb5_keyblock *key, unsigned char *p)
+{
+    gss_buffer_desc keyBuf;
+
+    keyBuf.length = KRB_KEY_LENGTH(key);
+    keyBuf.value = KRB_KEY_DATA(key);
+
+    store_uint32_be(KRB_KEY_TYPE(key), p);
+
+    return store_buffer(&keyBuf, p + 4, FALSE);
+}
+
+static int
+getKey(unsigned char **pp, size_t *remain, krb5_keyblock *key)
+{
+    OM_uint32 enctype;
+    gss_buffer_desc keyBuf;
+
+    KRB_KEY_INIT(key);
+
+    if (!getUint32(pp, remain, &enctype) ||
+        !getBuffer(pp, remain, &keyBuf) ||
+        keyBuf.length == 0)
+        return 0;
+
+    KRB_KEY_DATA(key) = KRB_MALLOC(keyBuf.length);
+    if (KRB_KEY_DATA(key) == NULL)
+        return 0;
+
+    memcpy(KRB_KEY_DATA(key), keyBuf.value, keyBuf.length);
+    KRB_KEY_LENGTH(key) = keyBuf.length;
+    KRB_KEY_TYPE(key) = enctype;
+
+    return 1;
+}
+
+static OM_uint32
+reauthEncrypt(OM_uint32 *minor,
+              krb5_keyblock *key,
+              krb5_keyusage usage,
+              const gss_buffer_t plaintext,
+              gss_buffer_t ciphertext)
+{
+    krb5_context krbContext;
+    krb5_error_code code;
+    krb5_data data;
+    krb5_enc_data encData;
+    size_t length;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    ciphertext->length = 0;
+    ciphertext->value = NULL;
+
+    code = krb5_c_encrypt_length(krbContext, KRB_KEY_TYPE(key),
+                                 plaintext->length, &length);
+    if (code != 0)
+        goto cleanup;
+
+    ciphertext->value = GSSEAP_MALLOC(length);
+    if (ciphertext->value == NULL) {
+        code = ENOMEM;
+        goto cleanup;
+    }
+
+    gssBufferToKrbData(plaintext, &data);
+
+    memset(&encData, 0, sizeof(encData));
+    encData.ciphertext.data = ciphertext->value;
+    encData.ciphertext.length = length;
+
+    code = krb5_c_encrypt(krbContext, key, usage, NULL, &data, &encData);
+    if (code != 0)
+        goto cleanup;
+
+    ciphertext->length = encData.ciphertext.length;
+
+cleanup:
+    if (code != 0 && ciphertext->value != NULL) {
+        GSSEAP_FREE(ciphertext->value);
+        ciphertext->value = NULL;
+    }
+
+    *minor = code;
+
+    return (code == 0) ? GSS_S_COMPLETE : GSS_S_FAILURE;
+}
+
+/* The plaintext must be released with releaseSecretBuffer() */
+static OM_uint32
+reauthDecrypt(OM_uint32 *minor,
+              krb5_keyblock *key,
+              krb5_keyusage usage,
+              const gss_buffer_t ciphertext,
+              gss_buffer_t plaintext)
+{
+    krb5_context krbContext;
+    krb5_error_code code;
+    krb5_data data;
+    krb5_enc_data encData;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    plaintext->length = 0;
+    plaintext->value = GSSEAP_MALLOC(ciphertext->length ? ciphertext->length : 1);
+    if (plaintext->value == NULL) {
+        *minor = ENOMEM;
+        return GSS_S_FAILURE;
+    }
+
+    memset(&encData, 0, sizeof(encData));
+    encData.enctype = KRB_KEY_TYPE(key);
+    gssBufferToKrbData(ciphertext, &encData.ciphertext);
+
+    data.data = plaintext->value;
+    data.length = ciphertext->length;
+
+    code = krb5_c_decrypt(krbContext, key, usage, NULL, &encData, &data);
+    if (code != 0) {
+        GSSEAP_FREE(plaintext->value);
+        plaintext->value = NULL;
+        *minor = code;
+        return GSS_S_BAD_SIG;
+    }
+
+    plaintext->length = data.length;
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+makeReauthToken(OM_uint32 *minor,
+                gss_ctx_id_t ctx,
+                struct gss_eap_token_buffer_set *tokens,
+                gss_buffer_t outputToken)
+{
+    OM_uint32 major, tmpMinor;
+    gss_buffer_desc innerToken = GSS_C_EMPTY_BUFFER;
+
+    major = gssEapEncodeInnerTokens(minor, tokens, &innerToken);
+    if (GSS_ERROR(major))
+        return major;
+
+    major = gssEapMakeToken(minor, ctx, &innerToken, -1, outputToken);
+
+    gss_release_buffer(&tmpMinor, &innerToken);
+
+    return major;
+}
+
+/*
+ * Find the inner token of the given type, failing if any other critical
+ * inner token is present.
+ */
+static OM_uint32
+findReauthToken(OM_uint32 *minor,
+                struct gss_eap_token_buffer_set *tokens,
+                OM_uint32 type,
+                gss_buffer_t *pBuffer)
+{
+    size_t i;
+
+    *pBuffer = GSS_C_NO_BUFFER;
+
+    for (i = 0; i < tokens->buffers.count; i++) {
+        OM_uint32 itokType = tokens->types[i] & ITOK_TYPE_MASK;
+
+        if (itokType == type) {
+            if (*pBuffer != GSS_C_NO_BUFFER) {
+                *minor = GSSEAP_DUPLICATE_ITOK;
+                return GSS_S_DEFECTIVE_TOKEN;
+            }
+            *pBuffer = &tokens->buffers.elements[i];
+        } else if (itokType != ITOK_TYPE_GSS_FLAGS &&
+                   (tokens->types[i] & ITOK_FLAG_CRITICAL)) {
+            *minor = GSSEAP_CRIT_ITOK_UNAVAILABLE;
+            return GSS_S_UNAVAILABLE;
+        }
+    }
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+decodeReauthToken(OM_uint32 *minor,
+                  gss_ctx_id_t ctx,
+                  gss_buffer_t inputToken,
+                  struct gss_eap_token_buffer_set *tokens)
+{
+    OM_uint32 major;
+    gss_buffer_desc innerToken;
+
+    tokens->buffers.count = 0;
+    tokens->buffers.elements = NULL;
+    tokens->types = NULL;
+
+    if (inputToken == GSS_C_NO_BUFFER || inputToken->length == 0) {
+        *minor = GSSEAP_TOK_TRUNC;
+        return GSS_S_DEFECTIVE_TOKEN;
+    }
+
+    major = gssEapVerifyToken(minor, ctx, inputToken, NULL, &innerToken);
+    if (GSS_ERROR(major))
+        return major;
+
+    return gssEapDecodeInnerTokens(minor, &innerToken, tokens);
+}
+
+/*
+ * Derive the context key from the session key and both nonces:
+ *
+ *  Tn = pseudo-random(session key, n || "saml-ec-reauth" || Ni || Na)
+ *  K  = gssEapDeriveRfc3961Key(T1 || T2 || ..)
+ */
+static OM_uint32
+reauthDeriveKey(OM_uint32 *minor,
+                krb5_keyblock *sessionKey,
+                const unsigned char *initiatorNonce,
+                const unsigned char *acceptorNonce,
+                krb5_keyblock *pKey)
+{
+    OM_uint32 major;
+    krb5_context krbContext;
+    krb5_error_code code;
+    krb5_data ns, t;
+    unsigned char constant[4 + sizeof("saml-ec-reauth") - 1 +
+                           2 * GSSEAP_REAUTH_NONCE_LENGTH];
+    unsigned char derived[64];
+    size_t randomLength, keyLength, prfLength, offset;
+    uint32_t i;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    KRB_DATA_INIT(&t);
+
+    code = krb5_c_keylengths(krbContext, KRB_KEY_TYPE(sessionKey),
+                             &randomLength, &keyLength);
+    if (code != 0)
+        goto cleanup;
+
+    code = krb5_c_prf_length(krbContext, KRB_KEY_TYPE(sessionKey),
+                             &prfLength);
+    if (code != 0)
+        goto cleanup;
+
+    if (randomLength > sizeof(derived) || prfLength == 0) {
+        code = KRB5_BAD_ENCTYPE;
+        goto cleanup;
+    }
+
+    offset = 4;
+    memcpy(&constant[offset], "saml-ec-reauth", sizeof("saml-ec-reauth") - 1);
+    offset += sizeof("saml-ec-reauth") - 1;
+    memcpy(&constant[offset], initiatorNonce, GSSEAP_REAUTH_NONCE_LENGTH);
+    offset += GSSEAP_REAUTH_NONCE_LENGTH;
+    memcpy(&constant[offset], acceptorNonce, GSSEAP_REAUTH_NONCE_LENGTH);
+
+    ns.length = sizeof(constant);
+    ns.data = (char *)constant;
+
+#ifndef HAVE_HEIMDAL_VERSION
+    t.length = prfLength;
+    t.data = GSSEAP_MALLOC(t.length);
+    if (t.data == NULL) {
+        code = ENOMEM;
+        goto cleanup;
+    }
+#endif
+
+    for (i = 0, offset = 0; offset < randomLength; i++) {
+        store_uint32_be(i, constant);
+
+        code = krb5_c_prf(krbContext, sessionKey, &ns, &t);
+        if (code != 0)
+            goto cleanup;
+
+        memcpy(&derived[offset], t.data, MIN(t.length, randomLength - offset));
+        offset += MIN(t.length, randomLength - offset);
+#ifdef HAVE_HEIMDAL_VERSION
+        krb5_free_data_contents(krbContext, &t);
+#endif
+    }
+
+    major = gssEapDeriveRfc3961Key(minor, derived, randomLength,
+                                   KRB_KEY_TYPE(sessionKey), pKey);
+    memset(derived, 0, sizeof(derived));
+
+    return major;
+
+cleanup:
+#ifndef HAVE_HEIMDAL_VERSION
+    if (t.data != NULL) {
+        memset(t.data, 0, t.length);
+        GSSEAP_FREE(t.data);
+    }
+#endif
+    memset(derived, 0, sizeof(derived));
+
+    *minor = code;
+
+    return GSS_S_FAILURE;
+}
+
+/*
+ * Mark a reauthenticated context as established, with a key derived
+ * from the ticket session key and the nonces of each side.
+ */
+static OM_uint32
+reauthReady(OM_uint32 *minor,
+            gss_ctx_id_t ctx,
+            krb5_keyblock *sessionKey,
+            const unsigned char *initiatorNonce,
+            const unsigned char *acceptorNonce)
+{
+    OM_uint32 major;
+    krb5_context krbContext;
+    krb5_keyblock key;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    major = reauthDeriveKey(minor, sessionKey, initiatorNonce,
+                            acceptorNonce, &key);
+    if (GSS_ERROR(major))
+        return major;
+
+    /* On the initiator the session key may be the current context key */
+    krb5_free_keyblock_contents(krbContext, &ctx->rfc3961Key);
+    ctx->rfc3961Key = key;
+    ctx->encryptionType = KRB_KEY_TYPE(&key);
+#ifdef GSSEAP_HAVE_AESNI
+    gssEapAesNiReleaseKey(&ctx->aesNiKey);
+#endif
+
+    major = rfc3961ChecksumTypeForKey(minor, &ctx->rfc3961Key,
+                                      &ctx->checksumType);
+    if (GSS_ERROR(major))
+        return major;
+
+    major = sequenceInit(minor,
+                         &ctx->seqState,
+                         ctx->recvSeq,
+                         ((ctx->gssFlags & GSS_C_REPLAY_FLAG) != 0),
+                         ((ctx->gssFlags & GSS_C_SEQUENCE_FLAG) != 0),
+                         TRUE);
+    if (GSS_ERROR(major))
+        return major;
+
+    ctx->flags |= CTX_FLAG_KRB_REAUTH;
+    ctx->gssFlags |= GSS_C_PROT_READY_FLAG;
+    ctx->state = GSSEAP_STATE_ESTABLISHED;
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+makeNonce(OM_uint32 *minor, unsigned char *nonce)
+{
+    krb5_context krbContext;
+    krb5_data data;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    data.data = (char *)nonce;
+    data.length = GSSEAP_REAUTH_NONCE_LENGTH;
+
+    *minor = krb5_c_random_make_octets(krbContext, &data);
+
+    return (*minor == 0) ? GSS_S_COMPLETE : GSS_S_FAILURE;
+}
+
+/*
+ * Initiator
+ */
+
+static void
+freeReauthCreds(struct gss_eap_reauth_creds *rc)
+{
+    krb5_context krbContext;
+    OM_uint32 tmpMinor;
+
+    gss_release_buffer(&tmpMinor, &rc->acceptorName);
+    gss_release_buffer(&tmpMinor, &rc->ticket);
+
+    if (KRB_KEY_DATA(&rc->key) != NULL &&
+        gssEapKerberosInit(&tmpMinor, &krbContext) == GSS_S_COMPLETE)
+        krb5_free_keyblock_contents(krbContext, &rc->key);
+
+    GSSEAP_FREE(rc);
+}
+
+/*
+ * Remove cached tickets for the target (or, with GSS_C_NO_NAME, those
+ * that have expired) from the credential.
+ */
+static void
+pruneReauthCreds(gss_cred_id_t cred, gss_name_t target)
+{
+    struct gss_eap_reauth_creds **prc, *rc;
+    time_t now = time(NULL);
+
+    for (prc = &cred->reauthCreds; (rc = *prc) != NULL; ) {
+        if ((target != GSS_C_NO_NAME &&
+             bufferEqual(&rc->acceptorName, &target->username)) ||
+            rc->expiryTime <= now) {
+            *prc = rc->next;
+            freeReauthCreds(rc);
+        } else {
+            prc = &rc->next;
+        }
+    }
+}
+
+static struct gss_eap_reauth_creds *
+findReauthCreds(gss_cred_id_t cred, gss_name_t target)
+{
+    struct gss_eap_reauth_creds *rc;
+
+    if (target == GSS_C_NO_NAME)
+        return NULL;
+
+    for (rc = cred->reauthCreds; rc != NULL; rc = rc->next) {
+        if (bufferEqual(&rc->acceptorName, &target->username))
+            return rc;
+    }
+
+    return NULL;
+}
+
+void
+gssEapReleaseReauthCreds(struct gss_eap_reauth_creds **pCreds)
+{
+    struct gss_eap_reauth_creds *rc, *next;
+
+    for (rc = *pCreds; rc != NULL; rc = next) {
+        next = rc->next;
+        freeReauthCreds(rc);
+    }
+
+    *pCreds = NULL;
+}
+
+/*
+ * Returns TRUE if the credential holds a ticket for the target that
+ * outlasts the requested context lifetime. The caller must hold the
+ * credential mutex.
+ */
+int
+gssEapCanReauthP(gss_cred_id_t cred,
+                 gss_name_t target,
+                 OM_uint32 timeReq)
+{
+    struct gss_eap_reauth_creds *rc;
+    time_t expiryReq = time(NULL);
+
+    if (cred == GSS_C_NO_CREDENTIAL ||
+        (cred->flags & GSS_EAP_ENABLE_REAUTH_FLAG) == 0)
+        return FALSE;
+
+    rc = findReauthCreds(cred, target);
+    if (rc == NULL)
+        return FALSE;
+
+    if (timeReq != GSS_C_INDEFINITE)
+        expiryReq += timeReq;
+
+    return (rc->expiryTime > expiryReq);
+}
+
+/*
+ * Make the initiator's reauthentication request. Until the response
+ * arrives the context key is the ticket session key.
+ */
+OM_uint32
+gssEapReauthInitiatorRequest(OM_uint32 *minor,
+                             gss_ctx_id_t ctx,
+                             gss_cred_id_t cred,
+                             gss_name_t target,
+                             OM_uint32 reqFlags,
+                             gss_channel_bindings_t chanBindings,
+                             gss_buffer_t outputToken)
+{
+    OM_uint32 major, tmpMinor;
+    krb5_context krbContext;
+    krb5_error_code code;
+    struct gss_eap_reauth_creds *rc;
+    struct gss_eap_token_buffer_set tokens = { { 0, NULL }, NULL };
+    gss_buffer_desc authenticator = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc sealedAuthenticator = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc request = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc cb = GSS_C_EMPTY_BUFFER;
+    unsigned char wireFlags[4], *p;
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    rc = findReauthCreds(cred, target);
+    if (rc == NULL) {
+        major = GSS_S_NO_CRED;
+        *minor = GSSEAP_NO_DEFAULT_CRED;
+        goto cleanup;
+    }
+
+    if (cred->name != GSS_C_NO_NAME) {
+        major = gssEapDuplicateName(minor, cred->name, &ctx->initiatorName);
+        if (GSS_ERROR(major))
+            goto cleanup;
+    }
+
+    krb5_free_keyblock_contents(krbContext, &ctx->rfc3961Key);
+    code = krb5_copy_keyblock_contents(krbContext, &rc->key,
+                                       &ctx->rfc3961Key);
+    if (code != 0) {
+        major = GSS_S_FAILURE;
+        *minor = code;
+        goto cleanup;
+    }
+    ctx->encryptionType = KRB_KEY_TYPE(&ctx->rfc3961Key);
+    ctx->expiryTime = rc->expiryTime;
+
+    major = makeNonce(minor, ctx->initiatorCtx.reauthNonce);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    ctx->initiatorCtx.reauthTime = time(NULL);
+    reqFlags &= GSSEAP_WIRE_FLAGS_MASK | REAUTH_CONTEXT_FLAGS;
+
+    if (chanBindings != GSS_C_NO_CHANNEL_BINDINGS)
+        cb = chanBindings->application_data;
+
+    /* Authenticator */
+    authenticator.length = 8 + 4 + GSSEAP_REAUTH_NONCE_LENGTH + 4 + cb.length;
+    authenticator.value = GSSEAP_MALLOC(authenticator.length);
+    if (authenticator.value == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)authenticator.value;
+    store_uint64_be(ctx->initiatorCtx.reauthTime, p);
+    store_uint32_be(reqFlags, p + 8);
+    memcpy(p + 12, ctx->initiatorCtx.reauthNonce, GSSEAP_REAUTH_NONCE_LENGTH);
+    store_buffer(&cb, p + 12 + GSSEAP_REAUTH_NONCE_LENGTH, FALSE);
+
+    major = reauthEncrypt(minor, &ctx->rfc3961Key, KEY_USAGE_REAUTH_REQ,
+                          &authenticator, &sealedAuthenticator);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* Ticket and authenticator */
+    request.length = 4 + rc->ticket.length + 4 + sealedAuthenticator.length;
+    request.value = GSSEAP_MALLOC(request.length);
+    if (request.value == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
+    p = store_buffer(&rc->ticket, request.value, FALSE);
+    store_buffer(&sealedAuthenticator, p, FALSE);
+
+    store_uint32_be(reqFlags, wireFlags);
+
+    major = gssEapAllocInnerTokens(minor, 2, &tokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    tokens.types[0] = ITOK_TYPE_GSS_FLAGS;
+    tokens.buffers.elements[0].length = sizeof(wireFlags);
+    tokens.buffers.elements[0].value = wireFlags;
+    tokens.types[1] = ITOK_TYPE_REAUTH_REQ | ITOK_FLAG_CRITICAL;
+    tokens.buffers.elements[1] = request;
+    tokens.buffers.count = 2;
+
+    major = makeReauthToken(minor, ctx, &tokens, outputToken);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    ctx->gssFlags |= reqFlags & GSS_C_MUTUAL_FLAG;
+    ctx->flags |= CTX_FLAG_KRB_REAUTH;
+
+cleanup:
+    gssEapReleaseInnerTokens(&tmpMinor, &tokens, 0);
+    releaseSecretBuffer(&authenticator);
+    gss_release_buffer(&tmpMinor, &sealedAuthenticator);
+    gss_release_buffer(&tmpMinor, &request);
+
+    return major;
+}
+
+/*
+ * Process the acceptor's reauthentication response.
+ */
+OM_uint32
+gssEapReauthInitiatorComplete(OM_uint32 *minor,
+                              gss_ctx_id_t ctx,
+                              gss_buffer_t inputToken)
+{
+    OM_uint32 major, tmpMinor;
+    struct gss_eap_token_buffer_set tokens = { { 0, NULL }, NULL };
+    gss_buffer_t response;
+    gss_buffer_desc plaintext = GSS_C_EMPTY_BUFFER;
+    unsigned char *p;
+    size_t remain;
+    time_t echoedTime;
+    OM_uint32 flags;
+
+    GSSEAP_ASSERT(ctx->flags & CTX_FLAG_KRB_REAUTH);
+
+    major = decodeReauthToken(minor, ctx, inputToken, &tokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    major = findReauthToken(minor, &tokens, ITOK_TYPE_REAUTH_RESP, &response);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    if (response == GSS_C_NO_BUFFER) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_MISSING_REQUIRED_ITOK;
+        goto cleanup;
+    }
+
+    major = reauthDecrypt(minor, &ctx->rfc3961Key, KEY_USAGE_REAUTH_RESP,
+                          response, &plaintext);
+    if (GSS_ERROR(major)) {
+        *minor = GSSEAP_BAD_REAUTH_RESPONSE;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)plaintext.value;
+    remain = plaintext.length;
+
+    if (!getTime(&p, &remain, &echoedTime) ||
+        !getUint32(&p, &remain, &flags) ||
+        remain != GSSEAP_REAUTH_NONCE_LENGTH ||
+        echoedTime != ctx->initiatorCtx.reauthTime) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_BAD_REAUTH_RESPONSE;
+        goto cleanup;
+    }
+
+    if ((ctx->gssFlags & GSS_C_MUTUAL_FLAG) &&
+        (flags & GSS_C_MUTUAL_FLAG) == 0) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_BAD_REAUTH_RESPONSE;
+        goto cleanup;
+    }
+
+    major = reauthReady(minor, ctx, &ctx->rfc3961Key,
+                        ctx->initiatorCtx.reauthNonce, p);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+cleanup:
+    gssEapReleaseInnerTokens(&tmpMinor, &tokens, 0);
+    releaseSecretBuffer(&plaintext);
+    memset(ctx->initiatorCtx.reauthNonce, 0, GSSEAP_REAUTH_NONCE_LENGTH);
+
+    return major;
+}
+
+/*
+ * The acceptor would not accept the ticket: forget it, and drop the
+ * ticket session key from the context before the full login.
+ */
+void
+gssEapReauthInitiatorAbandon(gss_ctx_id_t ctx, gss_cred_id_t cred)
+{
+    krb5_context krbContext;
+    OM_uint32 tmpMinor;
+
+    if (cred != GSS_C_NO_CREDENTIAL)
+        pruneReauthCreds(cred, ctx->acceptorName);
+
+    if (gssEapKerberosInit(&tmpMinor, &krbContext) == GSS_S_COMPLETE)
+        krb5_free_keyblock_contents(krbContext, &ctx->rfc3961Key);
+    KRB_KEY_INIT(&ctx->rfc3961Key);
+
+    ctx->encryptionType = ENCTYPE_NULL;
+    ctx->expiryTime = 0;
+    ctx->flags &= ~(CTX_FLAG_KRB_REAUTH);
+    gssEapReleaseName(&tmpMinor, &ctx->initiatorName);
+    memset(ctx->initiatorCtx.reauthNonce, 0, GSSEAP_REAUTH_NONCE_LENGTH);
+}
+
+/*
+ * Cache the ticket sent by the acceptor at the end of a full login in
+ * the credential. The caller must hold the credential mutex.
+ */
+OM_uint32
+gssEapStoreReauthCreds(OM_uint32 *minor,
+                       gss_ctx_id_t ctx,
+                       gss_cred_id_t cred,
+                       gss_buffer_t inputToken)
+{
+    OM_uint32 major, tmpMinor;
+    struct gss_eap_token_buffer_set tokens = { { 0, NULL }, NULL };
+    struct gss_eap_reauth_creds *rc = NULL;
+    gss_buffer_t creds;
+    gss_buffer_desc plaintext = GSS_C_EMPTY_BUFFER, ticket;
+    unsigned char *p;
+    size_t remain;
+
+    major = decodeReauthToken(minor, ctx, inputToken, &tokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    major = findReauthToken(minor, &tokens, ITOK_TYPE_REAUTH_CREDS, &creds);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* The acceptor declined to issue a ticket */
+    if (creds == GSS_C_NO_BUFFER || ctx->acceptorName == GSS_C_NO_NAME)
+        goto cleanup;
+
+    major = reauthDecrypt(minor, &ctx->rfc3961Key, KEY_USAGE_REAUTH_CREDS,
+                          creds, &plaintext);
+    if (GSS_ERROR(major)) {
+        *minor = GSSEAP_BAD_REAUTH_TICKET;
+        goto cleanup;
+    }
+
+    rc = GSSEAP_CALLOC(1, sizeof(*rc));
+    if (rc == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)plaintext.value;
+    remain = plaintext.length;
+
+    if (!getTime(&p, &remain, &rc->expiryTime) ||
+        !getKey(&p, &remain, &rc->key) ||
+        !getBuffer(&p, &remain, &ticket) ||
+        remain != 0) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_BAD_REAUTH_TICKET;
+        goto cleanup;
+    }
+
+    major = duplicateBuffer(minor, &ticket, &rc->ticket);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    major = duplicateBuffer(minor, &ctx->acceptorName->username,
+                            &rc->acceptorName);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* Replace any earlier ticket for this acceptor */
+    pruneReauthCreds(cred, ctx->acceptorName);
+
+    rc->next = cred->reauthCreds;
+    cred->reauthCreds = rc;
+    rc = NULL;
+
+cleanup:
+    if (rc != NULL)
+        freeReauthCreds(rc);
+    gssEapReleaseInnerTokens(&tmpMinor, &tokens, 0);
+    releaseSecretBuffer(&plaintext);
+
+    return major;
+}
+
+/*
+ * Acceptor
+ */
+
+#ifdef GSSEAP_ENABLE_ACCEPTOR
+
+static GSSEAP_THREAD_ONCE reauthKeyOnce = GSSEAP_ONCE_INITIALIZER;
+static krb5_keyblock reauthTicketKey;
+static OM_uint32 reauthTicketKeyStatus;
+static time_t reauthLifetime = GSSEAP_REAUTH_DEFAULT_LIFETIME;
+
+static GSSEAP_ONCE_CALLBACK(reauthTicketKeyInit)
+{
+    krb5_context krbContext;
+    OM_uint32 major, minor;
+    const char *keyFile, *lifetime;
+    unsigned char secret[32];
+    size_t length = 0;
+    FILE *fp;
+
+    lifetime = getenv("MECH_SAML_EC_REAUTH_LIFETIME");
+    if (lifetime != NULL && atol(lifetime) > 0)
+        reauthLifetime = atol(lifetime);
+
+    major = gssEapKerberosInit(&minor, &krbContext);
+    if (GSS_ERROR(major)) {
+        reauthTicketKeyStatus = minor;
+        GSSEAP_ONCE_LEAVE;
+    }
+
+    keyFile = getenv("MECH_SAML_EC_REAUTH_KEY_FILE");
+    if (keyFile != NULL) {
+        fp = fopen(keyFile, "rb");
+        if (fp != NULL) {
+            length = fread(secret, 1, sizeof(secret), fp);
+            fclose(fp);
+        }
+        if (length != sizeof(secret)) {
+            GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                         "ERROR: could not read %lu byte reauthentication "
+                         "key from %s\n", (unsigned long)sizeof(secret), keyFile);
+            reauthTicketKeyStatus = GSSEAP_KEY_TOO_SHORT;
+        } else {
+            major = gssEapDeriveRfc3961Key(&minor, secret, length,
+                                           ENCTYPE_AES256_CTS_HMAC_SHA1_96,
+                                           &reauthTicketKey);
+            reauthTicketKeyStatus = GSS_ERROR(major) ? minor : 0;
+        }
+        memset(secret, 0, sizeof(secret));
+    } else {
+        reauthTicketKeyStatus =
+            krb5_c_make_random_key(krbContext,
+                                   ENCTYPE_AES256_CTS_HMAC_SHA1_96,
+                                   &reauthTicketKey);
+    }
+
+    GSSEAP_ONCE_LEAVE;
+}
+
+static OM_uint32
+getTicketKey(OM_uint32 *minor, krb5_keyblock **pKey)
+{
+    GSSEAP_ONCE(&reauthKeyOnce, reauthTicketKeyInit);
+
+    if (reauthTicketKeyStatus != 0) {
+        *pKey = NULL;
+        *minor = reauthTicketKeyStatus;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    *pKey = &reauthTicketKey;
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+static OM_uint32
+makeTicket(OM_uint32 *minor,
+           gss_ctx_id_t ctx,
+           krb5_keyblock *sessionKey,
+           time_t expiryTime,
+           gss_buffer_t ticket)
+{
+    OM_uint32 major;
+    krb5_keyblock *ticketKey;
+    gss_buffer_desc plaintext = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc acceptorName = GSS_C_EMPTY_BUFFER;
+    gss_buffer_t initiatorName = &ctx->initiatorName->username;
+    gss_buffer_desc attributes;
+    unsigned char *p;
+
+    major = getTicketKey(minor, &ticketKey);
+    if (GSS_ERROR(major))
+        return major;
+
+    /* The ticket carries the attributes, so serialise them now */
+    major = gssEapMaterializeSamlAttributes(minor, ctx->initiatorName);
+    if (GSS_ERROR(major))
+        return major;
+
+    gssEapGetSamlAttributesList(ctx->initiatorName, &attributes);
+
+    if (ctx->acceptorName != GSS_C_NO_NAME)
+        acceptorName = ctx->acceptorName->username;
+
+    plaintext.length = 4 + 8 + 8 + 4 + 4 + KRB_KEY_LENGTH(sessionKey) +
+                       4 + acceptorName.length +
+                       4 + initiatorName->length +
+                       4 + attributes.length;
+    plaintext.value = GSSEAP_MALLOC(plaintext.length);
+    if (plaintext.value == NULL) {
+        *minor = ENOMEM;
+        return GSS_S_FAILURE;
+    }
+
+    p = (unsigned char *)plaintext.value;
+    store_uint32_be(REAUTH_TICKET_VERSION, p);
+    store_uint64_be(time(NULL), p + 4);
+    store_uint64_be(expiryTime, p + 12);
+    p = storeKey(sessionKey, p + 20);
+    p = store_buffer(&acceptorName, p, FALSE);
+    p = store_buffer(initiatorName, p, FALSE);
+    p = store_buffer(&attributes, p, FALSE);
+
+    GSSEAP_ASSERT(p == (unsigned char *)plaintext.value + plaintext.length);
+
+    major = reauthEncrypt(minor, ticketKey, KEY_USAGE_REAUTH_TICKET,
+                          &plaintext, ticket);
+
+    releaseSecretBuffer(&plaintext);
+
+    return major;
+}
+
+/*
+ * Issue a reauthentication ticket to the initiator after a full login.
+ * The token carries no ticket if none can be issued, so that the
+ * initiator, which waits for this token, still completes.
+ */
+OM_uint32
+gssEapMakeReauthCreds(OM_uint32 *minor,
+                      gss_ctx_id_t ctx,
+                      time_t sessionExpiryTime,
+                      gss_buffer_t outputToken)
+{
+    OM_uint32 major, tmpMinor;
+    krb5_context krbContext;
+    krb5_keyblock sessionKey;
+    struct gss_eap_token_buffer_set tokens = { { 0, NULL }, NULL };
+    gss_buffer_desc ticket = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc plaintext = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc creds = GSS_C_EMPTY_BUFFER;
+    time_t now, expiryTime;
+    unsigned char *p;
+
+    GSSEAP_KRB_INIT(&krbContext);
+    GSSEAP_ASSERT(CTX_IS_ESTABLISHED(ctx));
+
+    KRB_KEY_INIT(&sessionKey);
+
+    major = gssEapAllocInnerTokens(minor, 1, &tokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    GSSEAP_ONCE(&reauthKeyOnce, reauthTicketKeyInit);
+
+    now = time(NULL);
+    expiryTime = now + reauthLifetime;
+    if (sessionExpiryTime != 0 && sessionExpiryTime < expiryTime)
+        expiryTime = sessionExpiryTime;
+
+    if (expiryTime <= now || ctx->initiatorName == GSS_C_NO_NAME)
+        goto send;
+
+    *minor = krb5_c_make_random_key(krbContext, ctx->encryptionType,
+                                    &sessionKey);
+    if (*minor != 0)
+        goto send;
+
+    major = makeTicket(minor, ctx, &sessionKey, expiryTime, &ticket);
+    if (GSS_ERROR(major))
+        goto send;
+
+    plaintext.length = 8 + 4 + 4 + KRB_KEY_LENGTH(&sessionKey) +
+                       4 + ticket.length;
+    plaintext.value = GSSEAP_MALLOC(plaintext.length);
+    if (plaintext.value == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)plaintext.value;
+    store_uint64_be(expiryTime, p);
+    p = storeKey(&sessionKey, p + 8);
+    store_buffer(&ticket, p, FALSE);
+
+    major = reauthEncrypt(minor, &ctx->rfc3961Key, KEY_USAGE_REAUTH_CREDS,
+                          &plaintext, &creds);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    tokens.types[0] = ITOK_TYPE_REAUTH_CREDS;
+    tokens.buffers.elements[0] = creds;
+    tokens.buffers.count = 1;
+
+send:
+    if (tokens.buffers.count == 0)
+        GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                     "NOTE: not issuing reauthentication ticket\n");
+
+    major = makeReauthToken(minor, ctx, &tokens, outputToken);
+
+cleanup:
+    gssEapReleaseInnerTokens(&tmpMinor, &tokens, 0);
+    krb5_free_keyblock_contents(krbContext, &sessionKey);
+    gss_release_buffer(&tmpMinor, &ticket);
+    releaseSecretBuffer(&plaintext);
+    gss_release_buffer(&tmpMinor, &creds);
+
+    return major;
+}
+
+/*
+ * Returns TRUE if the body of an initial context token is a
+ * reauthentication request rather than a SAML EC one, which
+ * always starts with a comma.
+ */
+int
+gssEapIsReauthToken(const gss_buffer_t innerToken)
+{
+    OM_uint32 type;
+
+    if (innerToken->length < 8)
+        return FALSE;
+
+    type = load_uint32_be(innerToken->value) & ITOK_TYPE_MASK;
+
+    return (type == ITOK_TYPE_GSS_FLAGS || type == ITOK_TYPE_REAUTH_REQ);
+}
+
+/*
+ * An authenticator is good for GSSEAP_REAUTH_MAX_SKEW either side of its
+ * time, so each is remembered, by its nonce, until it could no longer be
+ * accepted anyway. Without a replay store the initiator is sent to the
+ * IdP instead.
+ */
+static OM_uint32
+checkReauthReplay(OM_uint32 *minor,
+                  const unsigned char *initiatorNonce,
+                  time_t authTime)
+{
+    struct gss_eap_replay_store *replay = reauthReplayStore();
+    unsigned char key[GSSEAP_REAUTH_NONCE_LENGTH + 8];
+
+    if (replay == NULL) {
+        *minor = GSSEAP_REAUTH_NO_REPLAY_CACHE;
+        return GSS_S_DEFECTIVE_CREDENTIAL;
+    }
+
+    memcpy(key, initiatorNonce, GSSEAP_REAUTH_NONCE_LENGTH);
+    store_uint64_be(authTime, &key[GSSEAP_REAUTH_NONCE_LENGTH]);
+
+    if (gssEapReplayCheck(replay, GSSEAP_REPLAY_REAUTH, key, sizeof(key),
+                          authTime + GSSEAP_REAUTH_MAX_SKEW + 1,
+                          time(NULL)) != GSSEAP_REPLAY_FRESH) {
+        GSSEAP_TRACE(GSSEAP_TRACE_ERROR,
+                     "ERROR: reauthentication request was replayed\n");
+        *minor = GSSEAP_REAUTH_REPLAYED;
+        return GSS_S_FAILURE;
+    }
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
+/*
+ * Validate a ticket and its authenticator. Errors from which a full
+ * login may recover, such as an expired ticket or one sealed in some
+ * other key, return GSS_S_DEFECTIVE_CREDENTIAL or
+ * GSS_S_CREDENTIALS_EXPIRED; all others are fatal.
+ */
+OM_uint32
+gssEapReauthAccept(OM_uint32 *minor,
+                   gss_ctx_id_t ctx,
+                   gss_buffer_t innerToken,
+                   gss_channel_bindings_t chanBindings,
+                   gss_buffer_t outputToken)
+{
+    OM_uint32 major, tmpMinor;
+    krb5_context krbContext;
+    krb5_keyblock *ticketKey;
+    krb5_keyblock sessionKey;
+    struct gss_eap_token_buffer_set tokens = { { 0, NULL }, NULL };
+    struct gss_eap_token_buffer_set respTokens = { { 0, NULL }, NULL };
+    gss_buffer_t request = GSS_C_NO_BUFFER;
+    gss_buffer_desc ticket, sealedAuthenticator;
+    gss_buffer_desc ticketData = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc authenticator = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc response = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc sealedResponse = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc acceptorName, initiatorName, attributes, cb;
+    unsigned char acceptorNonce[GSSEAP_REAUTH_NONCE_LENGTH];
+    unsigned char *p, *initiatorNonce;
+    size_t remain, i;
+    OM_uint32 version, flags = 0, authFlags;
+    time_t issued, expiryTime, authTime, now = time(NULL);
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+    KRB_KEY_INIT(&sessionKey);
+
+    major = gssEapDecodeInnerTokens(minor, innerToken, &tokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* The flags are needed even if the ticket is not accepted */
+    for (i = 0; i < tokens.buffers.count; i++) {
+        if ((tokens.types[i] & ITOK_TYPE_MASK) == ITOK_TYPE_GSS_FLAGS &&
+            tokens.buffers.elements[i].length >= 4) {
+            flags = load_uint32_be(tokens.buffers.elements[i].value);
+            ctx->gssFlags |= flags & REAUTH_CONTEXT_FLAGS;
+        }
+    }
+
+    major = findReauthToken(minor, &tokens, ITOK_TYPE_REAUTH_REQ, &request);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    if (request == GSS_C_NO_BUFFER) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_MISSING_REQUIRED_ITOK;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)request->value;
+    remain = request->length;
+
+    if (!getBuffer(&p, &remain, &ticket) ||
+        !getBuffer(&p, &remain, &sealedAuthenticator) ||
+        remain != 0) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_TOK_TRUNC;
+        goto cleanup;
+    }
+
+    /* Ticket */
+    major = getTicketKey(minor, &ticketKey);
+    if (GSS_ERROR(major)) {
+        major = GSS_S_DEFECTIVE_CREDENTIAL;
+        goto cleanup;
+    }
+
+    major = reauthDecrypt(minor, ticketKey, KEY_USAGE_REAUTH_TICKET,
+                          &ticket, &ticketData);
+    if (GSS_ERROR(major)) {
+        major = GSS_S_DEFECTIVE_CREDENTIAL;
+        *minor = GSSEAP_BAD_REAUTH_TICKET;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)ticketData.value;
+    remain = ticketData.length;
+
+    if (!getUint32(&p, &remain, &version) ||
+        version != REAUTH_TICKET_VERSION ||
+        !getTime(&p, &remain, &issued) ||
+        !getTime(&p, &remain, &expiryTime) ||
+        !getKey(&p, &remain, &sessionKey) ||
+        !getBuffer(&p, &remain, &acceptorName) ||
+        !getBuffer(&p, &remain, &initiatorName) ||
+        !getBuffer(&p, &remain, &attributes) ||
+        remain != 0) {
+        major = GSS_S_DEFECTIVE_CREDENTIAL;
+        *minor = GSSEAP_BAD_REAUTH_TICKET;
+        goto cleanup;
+    }
+
+    if (expiryTime <= now) {
+        major = GSS_S_CREDENTIALS_EXPIRED;
+        *minor = GSSEAP_REAUTH_TICKET_EXPIRED;
+        goto cleanup;
+    }
+
+    /* Tickets are only good for the acceptor that issued them */
+    if (ctx->acceptorName != GSS_C_NO_NAME &&
+        !bufferEqual(&acceptorName, &ctx->acceptorName->username)) {
+        major = GSS_S_DEFECTIVE_CREDENTIAL;
+        *minor = GSSEAP_BAD_REAUTH_TICKET;
+        goto cleanup;
+    }
+
+    /* Authenticator */
+    major = reauthDecrypt(minor, &sessionKey, KEY_USAGE_REAUTH_REQ,
+                          &sealedAuthenticator, &authenticator);
+    if (GSS_ERROR(major)) {
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)authenticator.value;
+    remain = authenticator.length;
+
+    if (!getTime(&p, &remain, &authTime) ||
+        !getUint32(&p, &remain, &authFlags) ||
+        remain < GSSEAP_REAUTH_NONCE_LENGTH) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        goto cleanup;
+    }
+
+    initiatorNonce = p;
+    p += GSSEAP_REAUTH_NONCE_LENGTH;
+    remain -= GSSEAP_REAUTH_NONCE_LENGTH;
+
+    if (!getBuffer(&p, &remain, &cb) || remain != 0 || authFlags != flags) {
+        major = GSS_S_DEFECTIVE_TOKEN;
+        *minor = GSSEAP_BAD_CONTEXT_TOKEN;
+        goto cleanup;
+    }
+
+    if (authTime < now - GSSEAP_REAUTH_MAX_SKEW ||
+        authTime > now + GSSEAP_REAUTH_MAX_SKEW) {
+        major = GSS_S_CREDENTIALS_EXPIRED;
+        *minor = GSSEAP_REAUTH_CLOCK_SKEW;
+        goto cleanup;
+    }
+
+    if (chanBindings != GSS_C_NO_CHANNEL_BINDINGS &&
+        chanBindings->application_data.length != 0 &&
+        !bufferEqual(&cb, &chanBindings->application_data)) {
+        major = GSS_S_BAD_BINDINGS;
+        *minor = GSSEAP_BINDINGS_MISMATCH;
+        goto cleanup;
+    }
+
+    major = checkReauthReplay(minor, initiatorNonce, authTime);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* Restore the initiator identity from the ticket */
+    gssEapReleaseName(&tmpMinor, &ctx->initiatorName);
+
+    major = gssEapImportName(minor, &initiatorName, GSS_C_NT_USER_NAME,
+                             GSS_C_NO_OID, &ctx->initiatorName);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    if (attributes.length != 0) {
+        major = gssEapSetSamlAttributes(minor, ctx->initiatorName,
+                                        &attributes);
+        if (GSS_ERROR(major))
+            goto cleanup;
+    }
+
+    /* Delegation needs a fresh assertion from the IdP */
+    ctx->gssFlags &= ~(GSS_C_DELEG_FLAG);
+    ctx->encryptionType = KRB_KEY_TYPE(&sessionKey);
+    ctx->expiryTime = expiryTime;
+
+    major = makeNonce(minor, acceptorNonce);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* Response */
+    response.length = 8 + 4 + GSSEAP_REAUTH_NONCE_LENGTH;
+    response.value = GSSEAP_MALLOC(response.length);
+    if (response.value == NULL) {
+        major = GSS_S_FAILURE;
+        *minor = ENOMEM;
+        goto cleanup;
+    }
+
+    p = (unsigned char *)response.value;
+    store_uint64_be(authTime, p);
+    store_uint32_be(ctx->gssFlags & GSSEAP_WIRE_FLAGS_MASK, p + 8);
+    memcpy(p + 12, acceptorNonce, GSSEAP_REAUTH_NONCE_LENGTH);
+
+    major = reauthEncrypt(minor, &sessionKey, KEY_USAGE_REAUTH_RESP,
+                          &response, &sealedResponse);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    major = gssEapAllocInnerTokens(minor, 1, &respTokens);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    respTokens.types[0] = ITOK_TYPE_REAUTH_RESP | ITOK_FLAG_CRITICAL;
+    respTokens.buffers.elements[0] = sealedResponse;
+    respTokens.buffers.count = 1;
+
+    major = makeReauthToken(minor, ctx, &respTokens, outputToken);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    major = reauthReady(minor, ctx, &sessionKey, initiatorNonce,
+                        acceptorNonce);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    GSSEAP_TRACE(GSSEAP_TRACE_NOTE,
+                 "NOTE: reauthenticated %.*s with ticket issued "
+                 "%ld seconds ago\n", (int)initiatorName.length,
+                 (char *)initiatorName.value, (long)(now - issued));
+
+cleanup:
+    if (GSS_ERROR(major))
+        gss_release_buffer(&tmpMinor, outputToken);
+    gssEapReleaseInnerTokens(&tmpMinor, &tokens, 0);
+    gssEapReleaseInnerTokens(&tmpMinor, &respTokens, 0);
+    krb5_free_keyblock_contents(krbContext, &sessionKey);
+    releaseSecretBuffer(&ticketData);
+    releaseSecretBuffer(&authenticator);
+    releaseSecretBuffer(&response);
+    gss_release_buffer(&tmpMinor, &sealedResponse);
+    memset(acceptorNonce, 0, sizeof(acceptorNonce));
+
+    return major;
+}
+
+#endif /* GSSEAP_ENABLE_ACCEPTOR */
+
+#endif /* !MECH_EAP */
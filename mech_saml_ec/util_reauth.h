@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Fast reauthentication support.
+ */
+
+#ifndef _UTIL_REAUTH_H_
+#define _UTIL_REAUTH_H_ 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MECH_EAP
+
+/* Initiator's request for a ticket, as the fourth field of the first token */
+#define MECH_SAML_EC_REAUTH_REQ             "reauth"
+
+#define GSSEAP_REAUTH_NONCE_LENGTH          32
+
+/* Default ticket lifetime when the IdP gives no SessionNotOnOrAfter */
+#define GSSEAP_REAUTH_DEFAULT_LIFETIME      (8 * 60 * 60)
+
+/* Maximum clock skew between initiator and acceptor */
+#define GSSEAP_REAUTH_MAX_SKEW              (5 * 60)
+
+struct gss_eap_reauth_creds;
+
+/* Initiator */
+int
+gssEapCanReauthP(gss_cred_id_t cred,
+                 gss_name_t target,
+                 OM_uint32 timeReq);
+
+OM_uint32
+gssEapReauthInitiatorRequest(OM_uint32 *minor,
+                             gss_ctx_id_t ctx,
+                             gss_cred_id_t cred,
+                             gss_name_t target,
+                             OM_uint32 reqFlags,
+                             gss_channel_bindings_t chanBindings,
+                             gss_buffer_t outputToken);
+
+OM_uint32
+gssEapReauthInitiatorComplete(OM_uint32 *minor,
+                              gss_ctx_id_t ctx,
+                              gss_buffer_t inputToken);
+
+OM_uint32
+gssEapStoreReauthCreds(OM_uint32 *minor,
+                       gss_ctx_id_t ctx,
+                       gss_cred_id_t cred,
+                       gss_buffer_t inputToken);
+
+void
+gssEapReauthInitiatorAbandon(gss_ctx_id_t ctx, gss_cred_id_t cred);
+
+void
+gssEapReleaseReauthCreds(struct gss_eap_reauth_creds **pCreds);
+
+/* Acceptor */
+int
+gssEapIsReauthToken(const gss_buffer_t innerToken);
+
+OM_uint32
+gssEapReauthAccept(OM_uint32 *minor,
+                   gss_ctx_id_t ctx,
+                   gss_buffer_t innerToken,
+                   gss_channel_bindings_t chanBindings,
+                   gss_buffer_t outputToken);
+
+OM_uint32
+gssEapMakeReauthCreds(OM_uint32 *minor,
+                      gss_ctx_id_t ctx,
+                      time_t sessionExpiryTime,
+                      gss_buffer_t outputToken);
+
+#endif /* !MECH_EAP */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_REAUTH_H_ */
@@ -0,0 +1,771 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Replay store.
+ *
+ * Keys are spread over REPLAY_SHARDS shards by hash, each with its own
+ * lock, so that accepts on different threads rarely wait for each
+ * other. A shard is a fixed-size hash table chained through an array
+ * of entries, and a timing wheel whose slots list the entries expiring
+ * in each REPLAY_WHEEL_TICK seconds; every call first frees the entries
+ * in the slots that time has passed. An entry expiring beyond one turn
+ * of the wheel is moved on when its slot comes round. A full shard makes
+ * room by freeing the entry that expires soonest.
+ *
+ * Entries link to each other by index rather than by pointer, and an
+ * all-zero shard is empty, so the store can be a file mapped into
+ * memory and survive a restart. Processes mapping the same file share
+ * it: the shard locks are process-shared robust mutexes kept in the
+ * file, and a shard whose lock was held by a process that died is
+ * emptied, as is one found half-changed by the first process to open
+ * the file after a crash.
+ *
+ * Opening processes hold a read lock on the byte at REPLAY_USERS_LOCK
+ * for as long as they use the file. One that finds no other user sets
+ * the file up, serialised against other openers by a write lock on the
+ * byte at REPLAY_SETUP_LOCK.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "util_replay.h"
+
+#ifdef WIN32
+#define REPLAY_MUTEX                    CRITICAL_SECTION
+#define REPLAY_MUTEX_INIT(m)            (InitializeCriticalSection(m), 0)
+#define REPLAY_MUTEX_DESTROY(m)         DeleteCriticalSection(m)
+#define REPLAY_MUTEX_LOCK(m)            EnterCriticalSection(m)
+#define REPLAY_MUTEX_UNLOCK(m)          LeaveCriticalSection(m)
+#else
+#define REPLAY_MUTEX                    pthread_mutex_t
+#define REPLAY_MUTEX_INIT(m)            pthread_mutex_init((m), NULL)
+#define REPLAY_MUTEX_DESTROY(m)         pthread_mutex_destroy(m)
+#define REPLAY_MUTEX_LOCK(m)            pthread_mutex_lock(m)
+#define REPLAY_MUTEX_UNLOCK(m)          pthread_mutex_unlock(m)
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+#define REPLAY_SHARED_FILE      1
+#endif
+#endif
+
+#define REPLAY_MAGIC            0x4D535250  /* "MSRP" */
+#define REPLAY_VERSION          2
+
+#define REPLAY_SETUP_LOCK       0
+#define REPLAY_USERS_LOCK       1
+
+/*
+ * Where available, locks that belong to the open file rather than to
+ * the process, so that they also hold between stores in one process.
+ */
+#ifdef F_OFD_SETLK
+#define REPLAY_SETLK            F_OFD_SETLK
+#define REPLAY_SETLKW           F_OFD_SETLKW
+#else
+#define REPLAY_SETLK            F_SETLK
+#define REPLAY_SETLKW           F_SETLKW
+#endif
+
+#define REPLAY_SHARDS           64          /* power of two */
+#define REPLAY_MIN_ENTRIES      64          /* per shard */
+#define REPLAY_MAX_ENTRIES      (1 << 24)   /* per shard */
+#define REPLAY_WHEEL_SLOTS      256
+#define REPLAY_WHEEL_TICK       4           /* seconds */
+
+/* Longer keys are kept as a 128-bit digest */
+#define REPLAY_KEY_MAX          102
+#define REPLAY_KEY_HASHED       0xFF
+
+/* Index zero ends a list; entries are numbered from one */
+#define REPLAY_NIL              0
+
+struct replay_entry {
+    uint64_t hash;
+    int64_t expiry;
+    uint32_t next;              /* in its bucket */
+    uint32_t wheelNext;         /* in its wheel slot, or the free list */
+    uint8_t kind;
+    uint8_t length;
+    unsigned char key[REPLAY_KEY_MAX];
+};
+
+/*
+ * Followed by the shard's buckets, then its entries. All the counts are
+ * of entries, and entries up to used have been handed out at least once.
+ */
+struct replay_shard {
+    uint32_t dirty;             /* set while the shard is being changed */
+    uint32_t freeList;
+    uint32_t used;
+    uint32_t count;
+    int64_t sweptTick;
+    uint32_t wheel[REPLAY_WHEEL_SLOTS];
+};
+
+struct replay_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t shardCount;
+    uint32_t shardEntries;
+    uint64_t shardSize;
+    uint64_t reserved[5];
+};
+
+/* One lock per cache line, following the header */
+union replay_lock {
+    REPLAY_MUTEX mutex;
+    unsigned char pad[64];
+};
+
+struct gss_eap_replay_store {
+    unsigned char *base;        /* header, then locks, then shards */
+    size_t size;
+    size_t shardSize;
+    uint32_t shardEntries;      /* power of two */
+    int fd;                     /* -1 unless kept in a file */
+    union replay_lock *locks;
+};
+
+static struct replay_shard *
+shardAt(struct gss_eap_replay_store *store, unsigned int i)
+{
+    return (struct replay_shard *)(store->base + sizeof(struct replay_header) +
+                                   REPLAY_SHARDS * sizeof(union replay_lock) +
+                                   i * store->shardSize);
+}
+
+static uint32_t *
+shardBuckets(struct replay_shard *shard)
+{
+    return (uint32_t *)(shard + 1);
+}
+
+static struct replay_entry *
+shardEntries(struct gss_eap_replay_store *store, struct replay_shard *shard)
+{
+    return (struct replay_entry *)(shardBuckets(shard) + store->shardEntries);
+}
+
+static void
+shardReset(struct gss_eap_replay_store *store, struct replay_shard *shard)
+{
+    memset(shard, 0, store->shardSize);
+}
+
+/*
+ * FNV-1a, with the kind first so that kinds hash apart, and finished
+ * with a mix so that the high bits, which choose the shard, depend on
+ * the whole key.
+ */
+static uint64_t
+replayHash(enum gss_eap_replay_kind kind, const unsigned char *key,
+           size_t length, uint64_t basis)
+{
+    uint64_t hash = basis;
+    size_t i;
+
+    hash ^= (unsigned char)kind;
+    hash *= 1099511628211ULL;
+    for (i = 0; i < length; i++) {
+        hash ^= key[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static int64_t
+expiryTick(int64_t expiry)
+{
+    return (expiry + REPLAY_WHEEL_TICK - 1) / REPLAY_WHEEL_TICK;
+}
+
+static void
+wheelInsert(struct replay_shard *shard, struct replay_entry *entries,
+            uint32_t i)
+{
+    unsigned int slot = expiryTick(entries[i].expiry) % REPLAY_WHEEL_SLOTS;
+
+    entries[i].wheelNext = shard->wheel[slot];
+    shard->wheel[slot] = i;
+}
+
+/* Unlink entry i from its bucket and free it */
+static int
+entryFree(struct gss_eap_replay_store *store, struct replay_shard *shard,
+          struct replay_entry *entries, uint32_t i)
+{
+    uint32_t *link = &shardBuckets(shard)[entries[i].hash &
+                                          (store->shardEntries - 1)];
+    uint32_t steps = 0;
+
+    while (*link != i) {
+        if (*link == REPLAY_NIL || *link > shard->used ||
+            ++steps > shard->used)
+            return -1;
+        link = &entries[*link].next;
+    }
+    *link = entries[i].next;
+
+    entries[i].wheelNext = shard->freeList;
+    shard->freeList = i;
+    shard->count--;
+
+    return 0;
+}
+
+/*
+ * Free the entries in the wheel slots between the last sweep and now,
+ * moving on any that expire in a later turn of the wheel.
+ */
+static int
+shardSweep(struct gss_eap_replay_store *store, struct replay_shard *shard,
+           time_t now)
+{
+    struct replay_entry *entries = shardEntries(store, shard);
+    int64_t nowTick = (int64_t)now / REPLAY_WHEEL_TICK;
+    int64_t tick = shard->sweptTick;
+
+    if (nowTick <= tick)
+        return 0;
+    if (nowTick - tick > REPLAY_WHEEL_SLOTS)
+        tick = nowTick - REPLAY_WHEEL_SLOTS;
+
+    for (tick++; tick <= nowTick; tick++) {
+        unsigned int slot = tick % REPLAY_WHEEL_SLOTS;
+        uint32_t i = shard->wheel[slot], next, steps = 0;
+
+        shard->wheel[slot] = REPLAY_NIL;
+        for (; i != REPLAY_NIL; i = next) {
+            if (i > shard->used || ++steps > shard->used)
+                return -1;
+            next = entries[i].wheelNext;
+            if (expiryTick(entries[i].expiry) <= nowTick) {
+                if (entryFree(store, shard, entries, i) != 0)
+                    return -1;
+            } else {
+                wheelInsert(shard, entries, i);
+            }
+        }
+    }
+
+    shard->sweptTick = nowTick;
+
+    return 0;
+}
+
+/*
+ * Free the entry that expires soonest, to make room in a full shard.
+ * Slots are visited in the order they come round, so once the soonest
+ * entry seen is due by the slot just visited, no later slot holds a
+ * sooner one.
+ */
+static int
+shardEvict(struct gss_eap_replay_store *store, struct replay_shard *shard)
+{
+    struct replay_entry *entries = shardEntries(store, shard);
+    uint32_t best = REPLAY_NIL, *link;
+    unsigned int n, slot, bestSlot = 0;
+    uint32_t i, steps;
+
+    for (n = 1; n <= REPLAY_WHEEL_SLOTS; n++) {
+        slot = (shard->sweptTick + n) % REPLAY_WHEEL_SLOTS;
+        steps = 0;
+        for (i = shard->wheel[slot]; i != REPLAY_NIL; i = entries[i].wheelNext) {
+            if (i > shard->used || ++steps > shard->used)
+                return -1;
+            if (best == REPLAY_NIL || entries[i].expiry < entries[best].expiry) {
+                best = i;
+                bestSlot = slot;
+            }
+        }
+        if (best != REPLAY_NIL &&
+            expiryTick(entries[best].expiry) <= shard->sweptTick + n)
+            break;
+    }
+
+    if (best == REPLAY_NIL)
+        return -1;
+
+    for (link = &shard->wheel[bestSlot]; *link != best;
+         link = &entries[*link].wheelNext)
+        ;
+    *link = entries[best].wheelNext;
+
+    return entryFree(store, shard, entries, best);
+}
+
+/*
+ * The stored form of a key: the key itself if it fits in an entry,
+ * otherwise a digest of it.
+ */
+struct replay_key {
+    uint64_t hash;
+    uint8_t kind;
+    uint8_t length;
+    const unsigned char *bytes;
+    unsigned char digest[16];
+};
+
+static void
+replayKey(struct replay_key *k, enum gss_eap_replay_kind kind,
+          const void *key, size_t length)
+{
+    k->kind = (uint8_t)kind;
+    k->hash = replayHash(kind, key, length, 14695981039346656037ULL);
+
+    if (length <= REPLAY_KEY_MAX) {
+        k->length = (uint8_t)length;
+        k->bytes = key;
+    } else {
+        uint64_t second = replayHash(kind, key, length, 0x6d65636873616d6cULL);
+
+        memcpy(k->digest, &k->hash, 8);
+        memcpy(k->digest + 8, &second, 8);
+        k->length = REPLAY_KEY_HASHED;
+        k->bytes = k->digest;
+    }
+}
+
+static size_t
+keyBytes(uint8_t length)
+{
+    return (length == REPLAY_KEY_HASHED) ? 16 : length;
+}
+
+/* Returns the entry holding k, REPLAY_NIL if none, or -1 if corrupt */
+static int64_t
+shardFind(struct gss_eap_replay_store *store, struct replay_shard *shard,
+          const struct replay_key *k)
+{
+    struct replay_entry *entries = shardEntries(store, shard);
+    uint32_t i = shardBuckets(shard)[k->hash & (store->shardEntries - 1)];
+    uint32_t steps = 0;
+
+    for (; i != REPLAY_NIL; i = entries[i].next) {
+        if (i > shard->used || ++steps > shard->used)
+            return -1;
+        if (entries[i].hash == k->hash &&
+            entries[i].kind == k->kind &&
+            entries[i].length == k->length &&
+            memcmp(entries[i].key, k->bytes, keyBytes(k->length)) == 0)
+            return i;
+    }
+
+    return REPLAY_NIL;
+}
+
+static void
+lockShard(struct gss_eap_replay_store *store, unsigned int index)
+{
+#ifdef REPLAY_SHARED_FILE
+    if (pthread_mutex_lock(&store->locks[index].mutex) == EOWNERDEAD) {
+        /* Another process died holding it, perhaps mid-change */
+        shardReset(store, shardAt(store, index));
+        pthread_mutex_consistent(&store->locks[index].mutex);
+    }
+#else
+    REPLAY_MUTEX_LOCK(&store->locks[index].mutex);
+#endif
+}
+
+static struct replay_shard *
+shardLock(struct gss_eap_replay_store *store, const struct replay_key *k,
+          unsigned int *index)
+{
+    struct replay_shard *shard;
+
+    *index = (k->hash >> 32) & (REPLAY_SHARDS - 1);
+    lockShard(store, *index);
+
+    shard = shardAt(store, *index);
+    shard->dirty = 1;
+
+    return shard;
+}
+
+static void
+shardUnlock(struct gss_eap_replay_store *store, struct replay_shard *shard,
+            unsigned int index)
+{
+    shard->dirty = 0;
+    REPLAY_MUTEX_UNLOCK(&store->locks[index].mutex);
+}
+
+int
+gssEapReplayCheck(struct gss_eap_replay_store *store,
+                  enum gss_eap_replay_kind kind,
+                  const void *key,
+                  size_t length,
+                  time_t expiry,
+                  time_t now)
+{
+    struct replay_shard *shard;
+    struct replay_entry *entries;
+    struct replay_key k;
+    unsigned int index;
+    int64_t found;
+    uint32_t i;
+    int result = GSSEAP_REPLAY_FRESH;
+
+    replayKey(&k, kind, key, length);
+    shard = shardLock(store, &k, &index);
+    entries = shardEntries(store, shard);
+
+    if (shardSweep(store, shard, now) != 0 ||
+        (found = shardFind(store, shard, &k)) < 0) {
+        shardReset(store, shard);
+        found = REPLAY_NIL;
+    }
+
+    if (found != REPLAY_NIL) {
+        /*
+         * An expired entry not yet swept is renewed in place; its wheel
+         * slot is still to come, and will move it on.
+         */
+        if (entries[found].expiry > now)
+            result = GSSEAP_REPLAY_SEEN;
+        else
+            entries[found].expiry = expiry;
+    } else if (expiry > now) {
+        uint32_t *bucket = &shardBuckets(shard)[k.hash &
+                                                (store->shardEntries - 1)];
+
+        if (shard->freeList == REPLAY_NIL &&
+            shard->used == store->shardEntries &&
+            shardEvict(store, shard) != 0)
+            shardReset(store, shard);
+
+        if (shard->freeList != REPLAY_NIL) {
+            i = shard->freeList;
+            shard->freeList = entries[i].wheelNext;
+        } else {
+            i = ++shard->used;
+        }
+
+        entries[i].hash = k.hash;
+        entries[i].expiry = expiry;
+        entries[i].kind = k.kind;
+        entries[i].length = k.length;
+        memcpy(entries[i].key, k.bytes, keyBytes(k.length));
+        entries[i].next = *bucket;
+        *bucket = i;
+        wheelInsert(shard, entries, i);
+        shard->count++;
+    }
+
+    shardUnlock(store, shard, index);
+
+    return result;
+}
+
+size_t
+gssEapReplayCount(struct gss_eap_replay_store *store, time_t now)
+{
+    size_t count = 0;
+    unsigned int s;
+    uint32_t b, i;
+
+    for (s = 0; s < REPLAY_SHARDS; s++) {
+        struct replay_shard *shard = shardAt(store, s);
+        struct replay_entry *entries = shardEntries(store, shard);
+
+        lockShard(store, s);
+        for (b = 0; b < store->shardEntries; b++) {
+            for (i = shardBuckets(shard)[b]; i != REPLAY_NIL;
+                 i = entries[i].next) {
+                if (entries[i].expiry > now)
+                    count++;
+            }
+        }
+        REPLAY_MUTEX_UNLOCK(&store->locks[s].mutex);
+    }
+
+    return count;
+}
+
+/* Empty any shard left half-changed, or otherwise inconsistent */
+static void
+checkShards(struct gss_eap_replay_store *store)
+{
+    unsigned int s;
+
+    for (s = 0; s < REPLAY_SHARDS; s++) {
+        struct replay_shard *shard = shardAt(store, s);
+
+        if (shard->dirty ||
+            shard->used > store->shardEntries ||
+            shard->freeList > shard->used ||
+            shard->count > shard->used)
+            shardReset(store, shard);
+    }
+}
+
+static int
+initLocks(struct gss_eap_replay_store *store, int shared)
+{
+    unsigned int s;
+#ifdef REPLAY_SHARED_FILE
+    pthread_mutexattr_t attr;
+
+    if (shared) {
+        if (pthread_mutexattr_init(&attr) != 0)
+            return -1;
+        if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) {
+            pthread_mutexattr_destroy(&attr);
+            return -1;
+        }
+        for (s = 0; s < REPLAY_SHARDS; s++)
+            pthread_mutex_init(&store->locks[s].mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        return 0;
+    }
+#else
+    (void)shared;
+#endif
+
+    for (s = 0; s < REPLAY_SHARDS; s++)
+        REPLAY_MUTEX_INIT(&store->locks[s].mutex);
+
+    return 0;
+}
+
+static int
+layoutMatches(struct gss_eap_replay_store *store)
+{
+    struct replay_header *header = (struct replay_header *)store->base;
+
+    return header->magic == REPLAY_MAGIC &&
+           header->version == REPLAY_VERSION &&
+           header->shardCount == REPLAY_SHARDS &&
+           header->shardEntries == store->shardEntries &&
+           header->shardSize == store->shardSize;
+}
+
+static void
+writeHeader(struct gss_eap_replay_store *store)
+{
+    struct replay_header *header = (struct replay_header *)store->base;
+
+    header->shardCount = REPLAY_SHARDS;
+    header->shardEntries = store->shardEntries;
+    header->shardSize = store->shardSize;
+    header->version = REPLAY_VERSION;
+    header->magic = REPLAY_MAGIC;
+}
+
+#ifndef WIN32
+static int
+lockByte(int fd, int cmd, short type, off_t offset)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = offset;
+    fl.l_len = 1;
+
+    return fcntl(fd, cmd, &fl);
+}
+
+static int
+mapFile(struct gss_eap_replay_store *store, const char *path)
+{
+    struct stat st;
+    void *base;
+    int alone;
+
+    store->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (store->fd < 0)
+        return -1;
+
+    if (lockByte(store->fd, REPLAY_SETLKW, F_WRLCK, REPLAY_SETUP_LOCK) != 0)
+        goto fail;
+
+    alone = (lockByte(store->fd, REPLAY_SETLK, F_WRLCK, REPLAY_USERS_LOCK) == 0);
+#ifdef REPLAY_SHARED_FILE
+    if (!alone &&
+        lockByte(store->fd, REPLAY_SETLK, F_RDLCK, REPLAY_USERS_LOCK) != 0)
+        goto fail;
+#else
+    /* Without robust mutexes a process may not share the file */
+    if (!alone)
+        goto fail;
+#endif
+
+    if (fstat(store->fd, &st) != 0)
+        goto fail;
+
+    if ((size_t)st.st_size != store->size) {
+        if (!alone ||
+            ftruncate(store->fd, 0) != 0 ||
+            ftruncate(store->fd, store->size) != 0)
+            goto fail;
+    }
+
+    base = mmap(NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                store->fd, 0);
+    if (base == MAP_FAILED)
+        goto fail;
+    store->base = base;
+    store->locks = (union replay_lock *)(store->base +
+                                         sizeof(struct replay_header));
+
+    if (alone) {
+        /* Start afresh from a file of another layout */
+        if (!layoutMatches(store))
+            memset(store->base, 0, store->size);
+        checkShards(store);
+        if (initLocks(store, 1) != 0)
+            goto fail;
+        writeHeader(store);
+#ifdef REPLAY_SHARED_FILE
+        /* Atomically, so that no other opener can find itself alone */
+        if (lockByte(store->fd, REPLAY_SETLK, F_RDLCK, REPLAY_USERS_LOCK) != 0)
+            goto fail;
+#endif
+    } else if (!layoutMatches(store)) {
+        /* In use with another size */
+        goto fail;
+    }
+
+    lockByte(store->fd, REPLAY_SETLK, F_UNLCK, REPLAY_SETUP_LOCK);
+
+    return 0;
+
+fail:
+    if (store->base != NULL) {
+        munmap(store->base, store->size);
+        store->base = NULL;
+    }
+    close(store->fd);
+    store->fd = -1;
+    return -1;
+}
+#endif /* !WIN32 */
+
+struct gss_eap_replay_store *
+gssEapReplayOpen(const char *path, size_t entries)
+{
+    struct gss_eap_replay_store *store;
+    size_t perShard = REPLAY_MIN_ENTRIES;
+
+    while (perShard * REPLAY_SHARDS < entries && perShard < REPLAY_MAX_ENTRIES)
+        perShard *= 2;
+
+    store = calloc(1, sizeof(*store));
+    if (store == NULL)
+        return NULL;
+
+    store->fd = -1;
+    store->shardEntries = (uint32_t)perShard;
+    store->shardSize = sizeof(struct replay_shard) +
+                       perShard * sizeof(uint32_t) +
+                       (perShard + 1) * sizeof(struct replay_entry);
+    store->shardSize = (store->shardSize + 63) & ~(size_t)63;
+    store->size = sizeof(struct replay_header) +
+                  REPLAY_SHARDS * sizeof(union replay_lock) +
+                  REPLAY_SHARDS * store->shardSize;
+
+    if (path != NULL) {
+#ifdef WIN32
+        errno = ENOTSUP;
+        free(store);
+        return NULL;
+#else
+        if (mapFile(store, path) != 0) {
+            free(store);
+            return NULL;
+        }
+#endif
+    } else {
+        store->base = calloc(1, store->size);
+        if (store->base == NULL) {
+            free(store);
+            return NULL;
+        }
+        store->locks = (union replay_lock *)(store->base +
+                                             sizeof(struct replay_header));
+        initLocks(store, 0);
+        writeHeader(store);
+    }
+
+    return store;
+}
+
+void
+gssEapReplayClose(struct gss_eap_replay_store *store)
+{
+    unsigned int s;
+
+    if (store == NULL)
+        return;
+
+#ifndef WIN32
+    /* The locks in a file belong to every process using it */
+    if (store->fd >= 0) {
+        munmap(store->base, store->size);
+        close(store->fd);
+    } else
+#endif
+    {
+        for (s = 0; s < REPLAY_SHARDS; s++)
+            REPLAY_MUTEX_DESTROY(&store->locks[s].mutex);
+        free(store->base);
+    }
+
+    free(store);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Replay store for the acceptor. Like util_metrics.h,
+ * this depends only on the C library, and util_replay.c only on threads,
+ * so that gss-bench can build the store in to time it.
+ */
+
+#ifndef _UTIL_REPLAY_H_
+#define _UTIL_REPLAY_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Keys of different kinds never match each other */
+enum gss_eap_replay_kind {
+    GSSEAP_REPLAY_ASSERTION = 1,    /* IDs of bearer assertions */
+    GSSEAP_REPLAY_MESSAGE,          /* IDs of samlp:Response messages */
+    GSSEAP_REPLAY_REAUTH            /* reauthentication authenticators */
+};
+
+/* Results */
+#define GSSEAP_REPLAY_FRESH             0   /* not seen; now recorded */
+#define GSSEAP_REPLAY_SEEN              1   /* recorded and not expired */
+
+/* How long after its IssueInstant a Response is accepted, less skew */
+#define GSSEAP_REPLAY_MESSAGE_WINDOW    60
+
+#define GSSEAP_REPLAY_DEFAULT_ENTRIES   65536
+
+struct gss_eap_replay_store;
+
+/*
+ * Open a store with room for about entries keys. With a path, the store is
+ * kept in that file, which is created if need be, so that it survives a
+ * restart, and is shared with every other store open on the file. NULL is
+ * returned if the file is in use with another number of entries, or, on
+ * systems without robust mutexes, at all. Without a path the store is in
+ * memory.
+ */
+struct gss_eap_replay_store *
+gssEapReplayOpen(const char *path, size_t entries);
+
+void
+gssEapReplayClose(struct gss_eap_replay_store *store);
+
+/*
+ * Record a key until expiry, returning GSSEAP_REPLAY_FRESH, or
+ * GSSEAP_REPLAY_SEEN if it was already recorded and had not expired.
+ * If the key's shard is full of unexpired keys, the one that expires
+ * soonest is forgotten to make room.
+ */
+int
+gssEapReplayCheck(struct gss_eap_replay_store *store,
+                  enum gss_eap_replay_kind kind,
+                  const void *key,
+                  size_t length,
+                  time_t expiry,
+                  time_t now);
+
+/* Number of unexpired keys, for tests and benchmarks */
+size_t
+gssEapReplayCount(struct gss_eap_replay_store *store, time_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_REPLAY_H_ */
@@ -84,10 +84,12 @@ gss_eap_shib_attr_provider::gss_eap_shib_attr_provider(void)
 {
     m_initialized = false;
     m_authenticated = false;
+    memset(&m_index, 0, sizeof(m_index));
 }
 
 gss_eap_shib_attr_provider::~gss_eap_shib_attr_provider(void)
 {
+    gssEapAttrIndexRelease(&m_index);
     for_each(m_attributes.begin(),
              m_attributes.end(),
              xmltooling::cleanup<Attribute>())
@@ -112,6 +114,8 @@ gss_eap_shib_attr_provider::initWithExistingContext(const gss_eap_attr_ctx *mana
         m_authenticated = shib->authenticated();
     }
 
+    buildIndex();
+
     m_initialized = true;
 
     return true;
@@ -183,6 +187,8 @@ gss_eap_shib_attr_provider::initWithGssContext(const gss_eap_attr_ctx *manager,
     }
 #endif /* HAVE_OPENSAML */
 
+    uint64_t start = gssEapMonotonicMicros();
+
     try {
         resolver->resolve();
         m_attributes = resolver->getResolvedAttributes();
@@ -191,34 +197,59 @@ gss_eap_shib_attr_provider::initWithGssContext(const gss_eap_attr_ctx *manager,
         return false;
     }
 
+    gssEapMetricIncrement(GSSEAP_METRIC_SP_RESOLVE);
+    gssEapMetricAdd(GSSEAP_METRIC_SP_RESOLVE_MICROS,
+                    gssEapMonotonicMicros() - start);
+
+    buildIndex();
+
     m_authenticated = true;
     m_initialized = true;
 
     return true;
 }
 
-ssize_t
-gss_eap_shib_attr_provider::getAttributeIndex(const gss_buffer_t attr) const
+/*
+ * Index every alias of every attribute, so that lookups by name do not
+ * have to walk the aliases of all attributes in turn. Must be called
+ * whenever m_attributes changes, as positions and alias storage move.
+ */
+void
+gss_eap_shib_attr_provider::buildIndex(void)
 {
-    int i = 0;
-
-    GSSEAP_ASSERT(m_initialized);
+    size_t count = 0;
 
     for (vector<Attribute *>::const_iterator a = m_attributes.begin();
          a != m_attributes.end();
          ++a)
-    {
-        for (vector<string>::const_iterator s = (*a)->getAliases().begin();
-             s != (*a)->getAliases().end();
+        count += (*a)->getAliases().size();
+
+    if (!gssEapAttrIndexInit(&m_index, count))
+        throw std::bad_alloc();
+
+    for (size_t i = 0; i < m_attributes.size(); i++) {
+        const vector<string> &aliases = m_attributes[i]->getAliases();
+
+        for (vector<string>::const_iterator s = aliases.begin();
+             s != aliases.end();
              ++s) {
-            if (attr->length == (*s).length() &&
-                memcmp((*s).c_str(), attr->value, attr->length) == 0) {
-                return i;
-            }
+            if (!gssEapAttrIndexAdd(&m_index, (*s).data(), (*s).length(), i))
+                throw std::bad_alloc();
         }
     }
+}
+
+ssize_t
+gss_eap_shib_attr_provider::getAttributeIndex(const gss_buffer_t attr) const
+{
+    size_t i;
+
+    GSSEAP_ASSERT(m_initialized);
+
+    if (!gssEapAttrIndexFind(&m_index, attr->value, attr->length, &i))
+        return -1;
 
-    return -1;
+    return i;
 }
 
 bool
@@ -244,6 +275,7 @@ gss_eap_shib_attr_provider::setAttribute(int complete GSSEAP_UNUSED,
 
 #ifdef MECH_EAP
     m_attributes.push_back(a);
+    buildIndex();
 #endif
     m_authenticated = false;
 
@@ -258,8 +290,11 @@ gss_eap_shib_attr_provider::deleteAttribute(const gss_buffer_t attr)
     GSSEAP_ASSERT(m_initialized);
 
     i = getAttributeIndex(attr);
-    if (i >= 0)
+    if (i >= 0) {
+        delete m_attributes[i];
         m_attributes.erase(m_attributes.begin() + i);
+        buildIndex();
+    }
 
     m_authenticated = false;
 
@@ -291,28 +326,13 @@ gss_eap_shib_attr_provider::getAttributeTypes(gss_eap_attr_enumeration_cb addAtt
 const Attribute *
 gss_eap_shib_attr_provider::getAttribute(const gss_buffer_t attr) const
 {
-    const Attribute *ret = NULL;
-
-    GSSEAP_ASSERT(m_initialized);
+    ssize_t i;
 
-    for (vector<Attribute *>::const_iterator a = m_attributes.begin();
-         a != m_attributes.end();
-         ++a)
-    {
-        for (vector<string>::const_iterator s = (*a)->getAliases().begin();
-             s != (*a)->getAliases().end();
-             ++s) {
-            if (attr->length == (*s).length() &&
-                memcmp((*s).c_str(), attr->value, attr->length) == 0) {
-                ret = *a;
-                break;
-            }
-        }
-        if (ret != NULL)
-            break;
-    }
+    i = getAttributeIndex(attr);
+    if (i < 0)
+        return NULL;
 
-    return ret;
+    return m_attributes[i];
 }
 
 bool
@@ -349,13 +369,13 @@ gss_eap_shib_attr_provider::getAttribute(const gss_buffer_t attr,
 #ifdef MECH_EAP
     binaryAttr = dynamic_cast<const BinaryAttribute *>(shibAttr);
     if (binaryAttr != NULL) {
-        std::string str = binaryAttr->getValues()[*more];
+        const std::string &str = binaryAttr->getValues()[i];
 
         valueBuf.value = (void *)str.data();
         valueBuf.length = str.size();
     } else {
 #endif
-        std::string str = shibAttr->getSerializedValues()[*more];
+        const std::string &str = shibAttr->getSerializedValues()[i];
 
         valueBuf.value = (void *)str.c_str();
         valueBuf.length = str.length();
@@ -470,6 +490,8 @@ gss_eap_shib_attr_provider::initWithJsonObject(const gss_eap_attr_ctx *ctx,
         m_attributes.push_back(attribute);
     }
 
+    buildIndex();
+
     m_authenticated = obj["authenticated"].integer();
     m_initialized = true;
 
@@ -41,6 +41,8 @@
 
 #include <vector>
 
+#include "util_attr_index.h"
+
 namespace shibsp {
     class Attribute;
 };
@@ -103,12 +105,15 @@ private:
 
     ssize_t getAttributeIndex(const gss_buffer_t attr) const;
     const shibsp::Attribute *getAttribute(const gss_buffer_t attr) const;
+    void buildIndex(void);
 
     bool authenticated(void) const { return m_authenticated; }
 
     bool m_initialized;
     bool m_authenticated;
     std::vector<shibsp::Attribute *> m_attributes;
+    /* maps each alias to its position in m_attributes */
+    struct gss_eap_attr_index m_index;
 };
 
 extern "C" {
@@ -81,9 +81,9 @@ gssEapSmTransition(gss_ctx_id_t ctx, enum gss_eap_state state)
     GSSEAP_ASSERT(state >= GSSEAP_STATE_INITIAL);
     GSSEAP_ASSERT(state <= GSSEAP_STATE_ESTABLISHED);
 
-    fprintf(stderr, "GSS-EAP: state transition %s->%s\n",
-            gssEapStateToString(GSSEAP_SM_STATE(ctx)),
-            gssEapStateToString(state));
+    GSSEAP_TRACE(GSSEAP_TRACE_DEBUG, "GSS-EAP: state transition %s->%s\n",
+                 gssEapStateToString(GSSEAP_SM_STATE(ctx)),
+                 gssEapStateToString(state));
 
     ctx->state = state;
 }
@@ -43,6 +43,12 @@ destroyThreadLocalData(struct gss_eap_thread_local_data *tld)
 {
     if (tld->statusInfo != NULL)
         gssEapDestroyStatusInfo(tld->statusInfo);
+    if (tld->objectPool != NULL)
+        gssEapDestroyObjectPool(tld->objectPool);
+    if (tld->metricsSlot != NULL)
+        gssEapReleaseMetricsSlot(tld->metricsSlot);
+    if (tld->randomPool != NULL)
+        gssEapDestroyRandomPool(tld->randomPool);
     GSSEAP_FREE(tld);
 }
 
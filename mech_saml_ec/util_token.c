@@ -522,4 +522,23 @@ getXmlElement(xmlNode *a_node, char *name, char *ns)
     }
     return NULL;
 }
+
+/* Trace a document, as one message */
+void
+traceXmlDoc(int level, const char *label, xmlDocPtr doc)
+{
+    xmlChar *text = NULL;
+    int length = 0;
+
+    if (doc == NULL || !GSSEAP_TRACING(level))
+        return;
+
+    xmlDocDumpMemory(doc, &text, &length);
+    if (text == NULL)
+        return;
+
+    gssEapTrace(level, "%s%.*s", label, length, (char *)text);
+
+    xmlFree(text);
+}
 #endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Leveled tracing.
+ *
+ * The level is read from the environment once, when the library is
+ * loaded, and each trace point costs one comparison against it when it
+ * is off. MECH_SAML_EC_DEBUG turns on all levels, as before;
+ * MECH_SAML_EC_TRACE_LEVEL may instead name one of none, error,
+ * warning, note or debug. Errors and warnings are traced by default.
+ *
+ * Messages are written to stderr with a single write each. If
+ * MECH_SAML_EC_TRACE_RING gives a number of entries, messages are
+ * instead copied into a ring of that many entries, without locking,
+ * and a background thread writes them out, so that tracing threads do
+ * not wait on stderr. Messages are cut to GSSEAP_TRACE_RING_MESSAGE
+ * bytes in the ring, and are dropped if the writer falls a whole ring
+ * behind.
+ */
+
+#include "gssapiP_eap.h"
+
+#include <strings.h>
+
+#define GSSEAP_TRACE_MESSAGE            1024
+#define GSSEAP_TRACE_RING_MESSAGE       512
+#define GSSEAP_TRACE_RING_MAX           65536
+#define GSSEAP_TRACE_RING_INTERVAL      10      /* milliseconds */
+
+int gssEapTraceLevel = GSSEAP_TRACE_WARNING;
+int gssEapTracePhases = 0;
+
+static const char *traceLevelNames[] = {
+    "none", "error", "warning", "note", "debug",
+};
+
+#ifndef WIN32
+struct gss_eap_trace_entry {
+    volatile uint64_t seq;              /* index + 1, or 0 while written */
+    size_t length;
+    char text[GSSEAP_TRACE_RING_MESSAGE];
+};
+
+static struct gss_eap_trace_entry *traceRing;
+static uint64_t traceRingMask;
+static volatile uint64_t traceHead;     /* next index to write */
+static uint64_t traceTail;              /* next index to drain */
+static uint64_t traceDropped;
+static GSSEAP_MUTEX traceDrainMutex;
+
+static void
+ringPut(const char *text, size_t length)
+{
+    struct gss_eap_trace_entry *entry;
+    uint64_t index;
+
+    index = __sync_fetch_and_add(&traceHead, 1);
+    entry = &traceRing[index & traceRingMask];
+
+    entry->seq = 0;
+    __sync_synchronize();
+    if (length > sizeof(entry->text)) {
+        length = sizeof(entry->text);
+        memcpy(entry->text, text, length - 1);
+        entry->text[length - 1] = '\n';
+    } else
+        memcpy(entry->text, text, length);
+    entry->length = length;
+    __sync_synchronize();
+    entry->seq = index + 1;
+}
+
+/* Write out whatever is in the ring; called with traceDrainMutex held */
+static void
+ringDrain(void)
+{
+    struct gss_eap_trace_entry *entry;
+    char text[GSSEAP_TRACE_RING_MESSAGE];
+    size_t length;
+    uint64_t seq, head = traceHead;
+
+    if (head - traceTail > traceRingMask + 1) {
+        traceDropped += head - traceTail - (traceRingMask + 1);
+        traceTail = head - (traceRingMask + 1);
+    }
+
+    while (traceTail < head) {
+        entry = &traceRing[traceTail & traceRingMask];
+        seq = entry->seq;
+        if (seq == 0 || seq < traceTail + 1)
+            break;                      /* not yet written */
+        if (seq == traceTail + 1) {
+            length = entry->length;
+            memcpy(text, entry->text, length);
+            __sync_synchronize();
+            if (entry->seq == seq)
+                fwrite(text, 1, length, stderr);
+            else
+                traceDropped++;
+        } else
+            traceDropped++;             /* overwritten by a later message */
+        traceTail++;
+    }
+
+    if (traceDropped != 0) {
+        fprintf(stderr, "mech_saml_ec: %llu trace messages dropped\n",
+                (unsigned long long)traceDropped);
+        traceDropped = 0;
+    }
+    fflush(stderr);
+}
+
+static void *
+ringWriter(void *arg GSSEAP_UNUSED)
+{
+    struct timespec interval;
+
+    interval.tv_sec = 0;
+    interval.tv_nsec = GSSEAP_TRACE_RING_INTERVAL * 1000000L;
+
+    for (;;) {
+        GSSEAP_MUTEX_LOCK(&traceDrainMutex);
+        ringDrain();
+        GSSEAP_MUTEX_UNLOCK(&traceDrainMutex);
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+static void
+ringInit(const char *value)
+{
+    unsigned long entries = strtoul(value, NULL, 10);
+    uint64_t size = 1;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (entries == 0)
+        return;
+    if (entries > GSSEAP_TRACE_RING_MAX)
+        entries = GSSEAP_TRACE_RING_MAX;
+    while (size < entries)
+        size <<= 1;
+
+    if (GSSEAP_MUTEX_INIT(&traceDrainMutex) != 0)
+        return;
+
+    traceRing = GSSEAP_CALLOC(size, sizeof(*traceRing));
+    if (traceRing == NULL)
+        return;
+    traceRingMask = size - 1;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, ringWriter, NULL) != 0) {
+        GSSEAP_FREE(traceRing);
+        traceRing = NULL;
+    }
+    pthread_attr_destroy(&attr);
+}
+#endif /* !WIN32 */
+
+void
+gssEapTraceInit(void)
+{
+    const char *value;
+    int level;
+
+    if (getenv("MECH_SAML_EC_DEBUG") != NULL)
+        gssEapTraceLevel = GSSEAP_TRACE_DEBUG;
+
+    value = getenv("MECH_SAML_EC_TRACE_LEVEL");
+    if (value != NULL) {
+        for (level = GSSEAP_TRACE_NONE; level <= GSSEAP_TRACE_DEBUG; level++) {
+            if (strcasecmp(value, traceLevelNames[level]) == 0) {
+                gssEapTraceLevel = level;
+                break;
+            }
+        }
+    }
+
+    gssEapTracePhases = (getenv("MECH_SAML_EC_PHASE_TRACE") != NULL);
+
+#ifndef WIN32
+    value = getenv("MECH_SAML_EC_TRACE_RING");
+    if (value != NULL && traceRing == NULL)
+        ringInit(value);
+#endif
+}
+
+/* Write out anything left in the ring; called when the library unloads */
+void
+gssEapTraceFlush(void)
+{
+#ifndef WIN32
+    if (traceRing != NULL) {
+        GSSEAP_MUTEX_LOCK(&traceDrainMutex);
+        ringDrain();
+        GSSEAP_MUTEX_UNLOCK(&traceDrainMutex);
+    }
+#endif
+}
+
+/*
+ * Write a message, adding a newline if it has none. Callers check the
+ * level with GSSEAP_TRACE() or GSSEAP_TRACING() first.
+ */
+void
+gssEapTrace(int level, const char *format, ...)
+{
+    char buffer[GSSEAP_TRACE_MESSAGE];
+    char *text = buffer;
+    va_list ap;
+    int length;
+
+    va_start(ap, format);
+    length = vsnprintf(buffer, sizeof(buffer) - 1, format, ap);
+    va_end(ap);
+
+    if (length < 0)
+        return;
+
+    /* Long messages, such as XML documents, are written whole */
+    if ((size_t)length >= sizeof(buffer) - 1) {
+        va_start(ap, format);
+        length = vasprintf(&text, format, ap);
+        va_end(ap);
+        if (length < 0)
+            return;
+    }
+
+    /* Keep the text terminated for the trace probe's consumers */
+    if (length == 0 || text[length - 1] != '\n') {
+        if (text != buffer) {
+            char *longText = realloc(text, length + 2);
+
+            if (longText == NULL) {
+                free(text);
+                return;
+            }
+            text = longText;
+        }
+        text[length++] = '\n';
+        text[length] = '\0';
+    }
+
+    GSSEAP_PROBE2(trace, level, text);
+
+#ifndef WIN32
+    if (traceRing != NULL)
+        ringPut(text, length);
+    else
+#endif
+        fwrite(text, 1, length, stderr);
+
+    if (text != buffer)
+        free(text);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2011, JANET(UK)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of JANET(UK) nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Leveled tracing and static probes. This header depends only on the C
+ * library so that the C++ SAML code can include it on its own.
+ */
+
+#ifndef _UTIL_TRACE_H_
+#define _UTIL_TRACE_H_ 1
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GSSEAP_TRACE_NONE               0
+#define GSSEAP_TRACE_ERROR              1
+#define GSSEAP_TRACE_WARNING            2
+#define GSSEAP_TRACE_NOTE               3
+#define GSSEAP_TRACE_DEBUG              4
+
+/* Levels above this are compiled out; see configure --disable-trace */
+#ifndef GSSEAP_TRACE_MAX_LEVEL
+#define GSSEAP_TRACE_MAX_LEVEL          GSSEAP_TRACE_DEBUG
+#endif
+
+/* Set once, when the library is loaded */
+extern int gssEapTraceLevel;
+extern int gssEapTracePhases;
+
+#define GSSEAP_TRACING(level)                                   \
+    ((level) <= GSSEAP_TRACE_MAX_LEVEL && (level) <= gssEapTraceLevel)
+
+#define GSSEAP_TRACE(level, ...)                                \
+    do {                                                        \
+        if (GSSEAP_TRACING(level))                              \
+            gssEapTrace((level), __VA_ARGS__);                  \
+    } while (0)
+
+#ifdef __GNUC__
+#define GSSEAP_TRACE_FORMAT __attribute__((__format__(__printf__, 2, 3)))
+#else
+#define GSSEAP_TRACE_FORMAT
+#endif
+
+void
+gssEapTrace(int level, const char *format, ...) GSSEAP_TRACE_FORMAT;
+
+void
+gssEapTraceInit(void);
+
+void
+gssEapTraceFlush(void);
+
+/*
+ * USDT probes, for example
+ *
+ *      bpftrace -e 'usdt:libmech_saml_ec.so:mech_saml_ec:phase__end
+ *                   { @[arg1] = hist(arg2); }'
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define GSSEAP_PROBE1(name, a)          DTRACE_PROBE1(mech_saml_ec, name, a)
+#define GSSEAP_PROBE2(name, a, b)       DTRACE_PROBE2(mech_saml_ec, name, a, b)
+#define GSSEAP_PROBE3(name, a, b, c)    DTRACE_PROBE3(mech_saml_ec, name, a, b, c)
+#else
+#define GSSEAP_PROBE1(name, a)          do { } while (0)
+#define GSSEAP_PROBE2(name, a, b)       do { } while (0)
+#define GSSEAP_PROBE3(name, a, b, c)    do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UTIL_TRACE_H_ */
@@ -52,10 +52,7 @@ gss_verify_mic(OM_uint32 *minor,
         return GSS_S_BAD_SIG;
     }
 
-    if (MECH_SAML_EC_DEBUG) {
-        fprintf(stdout, "MIC TOKEN TO VERIFY IS: \n");
-        printBuffer(stdout, message_token);
-    }
+    traceBuffer(GSSEAP_TRACE_DEBUG, "MIC TOKEN TO VERIFY IS: ", message_token);
 
     *minor = 0;
 
@@ -135,3 +135,121 @@ gssEapWrap(OM_uint32 *minor,
 
     return major;
 }
+
+/*
+ * Wrap data_length bytes at data_offset in buffer without copying. The
+ * caller must have reserved at least the header and trailer lengths
+ * returned by gssEapWrapTokenLength() either side of the data; the
+ * resulting token is returned in output_message_buffer, which points
+ * into the caller's buffer and must not be released.
+ */
+OM_uint32
+gssEapWrapInPlace(OM_uint32 *minor,
+                  gss_ctx_id_t ctx,
+                  int conf_req_flag,
+                  gss_buffer_t buffer,
+                  size_t data_offset,
+                  size_t data_length,
+                  int *conf_state,
+                  gss_buffer_t output_message_buffer)
+{
+    OM_uint32 major;
+    gss_iov_buffer_desc iov[3];
+    size_t headerLen, trailerLen;
+    unsigned char *p;
+
+    output_message_buffer->length = 0;
+    output_message_buffer->value = NULL;
+
+    major = gssEapWrapTokenLength(minor, ctx, conf_req_flag, data_length,
+                                  &headerLen, &trailerLen);
+    if (GSS_ERROR(major))
+        return major;
+
+    if (data_offset < headerLen ||
+        data_offset > buffer->length ||
+        buffer->length - data_offset < data_length ||
+        buffer->length - data_offset - data_length < trailerLen) {
+        *minor = GSSEAP_WRONG_SIZE;
+        return GSS_S_FAILURE;
+    }
+
+    p = (unsigned char *)buffer->value + data_offset;
+
+    iov[0].type = GSS_IOV_BUFFER_TYPE_HEADER;
+    iov[0].buffer.value = p - headerLen;
+    iov[0].buffer.length = headerLen;
+
+    iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+    iov[1].buffer.value = p;
+    iov[1].buffer.length = data_length;
+
+    iov[2].type = GSS_IOV_BUFFER_TYPE_TRAILER;
+    iov[2].buffer.value = p + data_length;
+    iov[2].buffer.length = trailerLen;
+
+    major = gssEapWrapOrGetMIC(minor, ctx, conf_req_flag, conf_state,
+                               iov, 3, TOK_TYPE_WRAP);
+    if (GSS_ERROR(major))
+        return major;
+
+    output_message_buffer->value = iov[0].buffer.value;
+    output_message_buffer->length = headerLen + data_length + trailerLen;
+
+    return major;
+}
+
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_in_place(OM_uint32 *minor,
+                  gss_ctx_id_t ctx,
+                  int conf_req_flag,
+                  gss_qop_t qop_req,
+                  gss_buffer_t buffer,
+                  size_t data_offset,
+                  size_t data_length,
+                  int *conf_state,
+                  gss_buffer_t output_message_buffer)
+{
+    OM_uint32 major;
+
+    if (ctx == GSS_C_NO_CONTEXT) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    }
+
+    if (buffer == GSS_C_NO_BUFFER || buffer->value == NULL) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ;
+    }
+
+    if (output_message_buffer == GSS_C_NO_BUFFER) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_WRITE;
+    }
+
+    if (qop_req != GSS_C_QOP_DEFAULT) {
+        *minor = GSSEAP_UNKNOWN_QOP;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    *minor = 0;
+
+    GSSEAP_MUTEX_LOCK(&ctx->mutex);
+
+    if (!CTX_IS_ESTABLISHED(ctx)) {
+        major = GSS_S_NO_CONTEXT;
+        *minor = GSSEAP_CONTEXT_INCOMPLETE;
+        goto cleanup;
+    }
+
+    major = gssEapWrapInPlace(minor, ctx, conf_req_flag, buffer,
+                              data_offset, data_length,
+                              conf_state, output_message_buffer);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+cleanup:
+    GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
+
+    return major;
+}
@@ -80,14 +80,19 @@ rfc4121Flags(gss_ctx_id_t ctx, int receiving)
     return flags;
 }
 
-OM_uint32
-gssEapWrapOrGetMIC(OM_uint32 *minor,
-                   gss_ctx_id_t ctx,
-                   int conf_req_flag,
-                   int *conf_state,
-                   gss_iov_buffer_desc *iov,
-                   int iov_count,
-                   enum gss_eap_token_type toktype)
+static OM_uint32
+wrapToken(OM_uint32 *minor,
+          gss_ctx_id_t ctx,
+#ifdef HAVE_HEIMDAL_VERSION
+          krb5_crypto krbCrypto,
+#else
+          krb5_keyblock *unused GSSEAP_UNUSED,
+#endif
+          int conf_req_flag,
+          int *conf_state,
+          gss_iov_buffer_desc *iov,
+          int iov_count,
+          enum gss_eap_token_type toktype)
 {
     krb5_error_code code = 0;
     gss_iov_buffer_t header;
@@ -102,14 +107,9 @@ gssEapWrapOrGetMIC(OM_uint32 *minor,
     size_t dataLen, assocDataLen;
     krb5_context krbContext;
 #ifdef HAVE_HEIMDAL_VERSION
-    krb5_crypto krbCrypto = NULL;
+    int freeCrypto = (krbCrypto == NULL);
 #endif
 
-    if (ctx->encryptionType == ENCTYPE_NULL) {
-        *minor = GSSEAP_KEY_UNAVAILABLE;
-        return GSS_S_UNAVAILABLE;
-    }
-
     GSSEAP_KRB_INIT(&krbContext);
 
     flags = rfc4121Flags(ctx, FALSE);
@@ -139,9 +139,12 @@ gssEapWrapOrGetMIC(OM_uint32 *minor,
     trailer = gssEapLocateIov(iov, iov_count, GSS_IOV_BUFFER_TYPE_TRAILER);
 
 #ifdef HAVE_HEIMDAL_VERSION
-    code = krb5_crypto_init(krbContext, &ctx->rfc3961Key, ETYPE_NULL, &krbCrypto);
-    if (code != 0)
-        goto cleanup;
+    if (krbCrypto == NULL) {
+        code = krb5_crypto_init(krbContext, &ctx->rfc3961Key,
+                                ETYPE_NULL, &krbCrypto);
+        if (code != 0)
+            goto cleanup;
+    }
 #endif
 
     if (toktype == TOK_TYPE_WRAP && conf_req_flag) {
@@ -230,7 +233,8 @@ gssEapWrapOrGetMIC(OM_uint32 *minor,
         code = gssEapEncrypt(krbContext,
                              ((ctx->gssFlags & GSS_C_DCE_STYLE) != 0),
                              ec, rrc, KRB_CRYPTO_CONTEXT(ctx),
-                             keyUsage, iov, iov_count);
+                             gssEapAesNiContextKey(ctx), keyUsage,
+                             iov, iov_count);
         if (code != 0)
             goto cleanup;
 
@@ -296,7 +300,8 @@ gssEapWrapOrGetMIC(OM_uint32 *minor,
         store_uint64_be(ctx->sendSeq, outbuf + 8);
 
         code = gssEapSign(krbContext, ctx->checksumType, rrc,
-                          KRB_CRYPTO_CONTEXT(ctx), keyUsage,
+                          KRB_CRYPTO_CONTEXT(ctx),
+                          gssEapAesNiContextKey(ctx), keyUsage,
                           iov, iov_count);
         if (code != 0)
             goto cleanup;
@@ -327,7 +332,7 @@ cleanup:
     if (code != 0)
         gssEapReleaseIov(iov, iov_count);
 #ifdef HAVE_HEIMDAL_VERSION
-    if (krbCrypto != NULL)
+    if (freeCrypto && krbCrypto != NULL)
         krb5_crypto_destroy(krbContext, krbCrypto);
 #endif
 
@@ -336,6 +341,51 @@ cleanup:
     return (code == 0) ? GSS_S_COMPLETE : GSS_S_FAILURE;
 }
 
+/* Count a message that was wrapped, or a MIC that was made */
+static void
+countToken(gss_ctx_id_t ctx,
+           gss_iov_buffer_desc *iov,
+           int iov_count,
+           enum gss_eap_token_type toktype)
+{
+    size_t dataLength, assocDataLength;
+
+    if (toktype == TOK_TYPE_WRAP) {
+        gssEapIovMessageLength(iov, iov_count,
+                               &dataLength, &assocDataLength);
+        gssEapMetricIncrement(GSSEAP_METRIC_WRAP);
+        gssEapMetricBytes(GSSEAP_METRIC_WRAP_BYTES, ctx->encryptionType,
+                          dataLength - assocDataLength);
+    } else if (toktype == TOK_TYPE_MIC)
+        gssEapMetricIncrement(GSSEAP_METRIC_GET_MIC);
+}
+
+OM_uint32
+gssEapWrapOrGetMIC(OM_uint32 *minor,
+                   gss_ctx_id_t ctx,
+                   int conf_req_flag,
+                   int *conf_state,
+                   gss_iov_buffer_desc *iov,
+                   int iov_count,
+                   enum gss_eap_token_type toktype)
+{
+    OM_uint32 major;
+
+    if (ctx->encryptionType == ENCTYPE_NULL) {
+        *minor = GSSEAP_KEY_UNAVAILABLE;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    major = wrapToken(minor, ctx,
+                      NULL, /* krbCrypto */
+                      conf_req_flag, conf_state,
+                      iov, iov_count, toktype);
+    if (major == GSS_S_COMPLETE)
+        countToken(ctx, iov, iov_count, toktype);
+
+    return major;
+}
+
 OM_uint32 GSSAPI_CALLCONV
 gss_wrap_iov(OM_uint32 *minor,
              gss_ctx_id_t ctx,
@@ -377,3 +427,100 @@ cleanup:
 
     return major;
 }
+
+/*
+ * Wrap a batch of messages under a single acquisition of the context
+ * lock and, on Heimdal, a single crypto context. Messages are wrapped
+ * in array order, so they are assigned consecutive sequence numbers.
+ * The status of each message is returned in its batch element; the
+ * return value is that of the first message that failed.
+ */
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_iov_batch(OM_uint32 *minor,
+                   gss_ctx_id_t ctx,
+                   int conf_req_flag,
+                   gss_qop_t qop_req,
+                   gss_iov_batch_desc *batch,
+                   int batch_count)
+{
+    OM_uint32 major = GSS_S_COMPLETE;
+    int i;
+#ifdef HAVE_HEIMDAL_VERSION
+    krb5_context krbContext;
+    krb5_crypto krbCrypto = NULL;
+    krb5_error_code code;
+#endif
+
+    if (ctx == GSS_C_NO_CONTEXT) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    }
+
+    if (batch == NULL && batch_count != 0) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ;
+    }
+
+    if (qop_req != GSS_C_QOP_DEFAULT) {
+        *minor = GSSEAP_UNKNOWN_QOP;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    *minor = 0;
+
+    GSSEAP_MUTEX_LOCK(&ctx->mutex);
+
+    if (!CTX_IS_ESTABLISHED(ctx)) {
+        major = GSS_S_NO_CONTEXT;
+        *minor = GSSEAP_CONTEXT_INCOMPLETE;
+        goto cleanup;
+    }
+
+    if (ctx->encryptionType == ENCTYPE_NULL) {
+        major = GSS_S_UNAVAILABLE;
+        *minor = GSSEAP_KEY_UNAVAILABLE;
+        goto cleanup;
+    }
+
+#ifdef HAVE_HEIMDAL_VERSION
+    major = gssEapKerberosInit(minor, &krbContext);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    code = krb5_crypto_init(krbContext, &ctx->rfc3961Key,
+                            ETYPE_NULL, &krbCrypto);
+    if (code != 0) {
+        major = GSS_S_FAILURE;
+        *minor = code;
+        goto cleanup;
+    }
+#endif
+
+    for (i = 0; i < batch_count; i++) {
+        gss_iov_batch_t msg = &batch[i];
+
+        msg->conf_state = 0;
+        msg->qop_state = GSS_C_QOP_DEFAULT;
+
+        msg->major_status = wrapToken(&msg->minor_status, ctx,
+                                      KRB_CRYPTO_CONTEXT(ctx),
+                                      conf_req_flag, &msg->conf_state,
+                                      msg->iov, msg->iov_count,
+                                      TOK_TYPE_WRAP);
+        if (msg->major_status == GSS_S_COMPLETE)
+            countToken(ctx, msg->iov, msg->iov_count, TOK_TYPE_WRAP);
+        if (GSS_ERROR(msg->major_status) && !GSS_ERROR(major)) {
+            major = msg->major_status;
+            *minor = msg->minor_status;
+        }
+    }
+
+cleanup:
+#ifdef HAVE_HEIMDAL_VERSION
+    if (krbCrypto != NULL)
+        krb5_crypto_destroy(krbContext, krbCrypto);
+#endif
+    GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
+
+    return major;
+}
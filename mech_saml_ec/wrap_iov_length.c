@@ -63,6 +63,120 @@
         (_iov)->buffer.length = 0; }                                    \
     while (0)
 
+static OM_uint32
+gssEapCacheWrapLengths(OM_uint32 *minor, gss_ctx_id_t ctx)
+{
+    struct gss_eap_wrap_lengths *lengths = &ctx->wrapLengths;
+    krb5_error_code code;
+    krb5_context krbContext;
+#ifdef HAVE_HEIMDAL_VERSION
+    krb5_crypto krbCrypto = NULL;
+#endif
+
+    if (lengths->enctype == ctx->encryptionType) {
+        *minor = 0;
+        return GSS_S_COMPLETE;
+    }
+
+    GSSEAP_KRB_INIT(&krbContext);
+
+#ifdef HAVE_HEIMDAL_VERSION
+    code = krb5_crypto_init(krbContext, &ctx->rfc3961Key, ETYPE_NULL, &krbCrypto);
+    if (code != 0)
+        goto cleanup;
+#endif
+
+    code = krbCryptoLength(krbContext, KRB_CRYPTO_CONTEXT(ctx),
+                           KRB5_CRYPTO_TYPE_HEADER, &lengths->krbHeaderLen);
+    if (code != 0)
+        goto cleanup;
+
+    code = krbCryptoLength(krbContext, KRB_CRYPTO_CONTEXT(ctx),
+                           KRB5_CRYPTO_TYPE_TRAILER, &lengths->krbTrailerLen);
+    if (code != 0)
+        goto cleanup;
+
+    code = krbCryptoLength(krbContext, KRB_CRYPTO_CONTEXT(ctx),
+                           KRB5_CRYPTO_TYPE_PADDING, &lengths->krbPaddingLen);
+    if (code != 0)
+        goto cleanup;
+
+    code = krbCryptoLength(krbContext, KRB_CRYPTO_CONTEXT(ctx),
+                           KRB5_CRYPTO_TYPE_CHECKSUM, &lengths->krbChecksumLen);
+    if (code != 0)
+        goto cleanup;
+
+    code = krbBlockSize(krbContext, KRB_CRYPTO_CONTEXT(ctx),
+                        &lengths->krbBlockSize);
+    if (code != 0)
+        goto cleanup;
+
+    lengths->enctype = ctx->encryptionType;
+
+cleanup:
+#ifdef HAVE_HEIMDAL_VERSION
+    if (krbCrypto != NULL)
+        krb5_crypto_destroy(krbContext, krbCrypto);
+#endif
+
+    *minor = code;
+
+    return (code == 0) ? GSS_S_COMPLETE : GSS_S_FAILURE;
+}
+
+/*
+ * Return the RFC 4121 header and trailer lengths of a non-rotated wrap
+ * token protecting dataLength bytes of confidential data. The header
+ * length does not include the trailer.
+ */
+OM_uint32
+gssEapWrapTokenLength(OM_uint32 *minor,
+                      gss_ctx_id_t ctx,
+                      int conf_req_flag,
+                      size_t dataLength,
+                      size_t *headerLength,
+                      size_t *trailerLength)
+{
+    OM_uint32 major;
+    struct gss_eap_wrap_lengths *lengths = &ctx->wrapLengths;
+    size_t krbPadLen = 0, ec;
+
+    if (ctx->encryptionType == ENCTYPE_NULL) {
+        *minor = GSSEAP_KEY_UNAVAILABLE;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    major = gssEapCacheWrapLengths(minor, ctx);
+    if (GSS_ERROR(major))
+        return major;
+
+    if (conf_req_flag) {
+        /* same as krbPaddingLength(), without calling into the library */
+        if (lengths->krbPaddingLen != 0) {
+            size_t rem = (lengths->krbHeaderLen + dataLength +
+                          16 /* E(Header) */) % lengths->krbPaddingLen;
+
+            if (rem != 0)
+                krbPadLen = lengths->krbPaddingLen - rem;
+        }
+
+        if (krbPadLen == 0 && (ctx->gssFlags & GSS_C_DCE_STYLE)) {
+            /* Windows rejects AEAD tokens with non-zero EC */
+            ec = lengths->krbBlockSize;
+        } else
+            ec = krbPadLen;
+
+        *headerLength = 16 /* Header */ + lengths->krbHeaderLen;
+        *trailerLength = ec + 16 /* E(Header) */ + lengths->krbTrailerLen;
+    } else {
+        *headerLength = 16 /* Header */;
+        *trailerLength = lengths->krbChecksumLen;
+    }
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
+}
+
 OM_uint32
 gssEapWrapIovLength(OM_uint32 *minor,
                     gss_ctx_id_t ctx,
@@ -72,8 +186,57 @@ gssEapWrapIovLength(OM_uint32 *minor,
                     gss_iov_buffer_desc *iov,
                     int iov_count)
 {
-    *minor = GSSEAP_KEY_UNAVAILABLE;
-    return GSS_S_UNAVAILABLE;
+    OM_uint32 major;
+    gss_iov_buffer_t header, trailer, padding;
+    size_t dataLength, assocDataLength;
+    size_t gssHeaderLen, gssTrailerLen;
+
+    if (qop_req != GSS_C_QOP_DEFAULT) {
+        *minor = GSSEAP_UNKNOWN_QOP;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    header = gssEapLocateIov(iov, iov_count, GSS_IOV_BUFFER_TYPE_HEADER);
+    if (header == NULL) {
+        *minor = GSSEAP_MISSING_IOV;
+        return GSS_S_FAILURE;
+    }
+    INIT_IOV_DATA(header);
+
+    trailer = gssEapLocateIov(iov, iov_count, GSS_IOV_BUFFER_TYPE_TRAILER);
+    if (trailer != NULL) {
+        INIT_IOV_DATA(trailer);
+    }
+
+    /* For CFX, EC is used instead of padding, and is placed in header or trailer */
+    padding = gssEapLocateIov(iov, iov_count, GSS_IOV_BUFFER_TYPE_PADDING);
+    if (padding != NULL) {
+        INIT_IOV_DATA(padding);
+    }
+
+    gssEapIovMessageLength(iov, iov_count, &dataLength, &assocDataLength);
+
+    if (conf_req_flag && gssEapIsIntegrityOnly(iov, iov_count))
+        conf_req_flag = FALSE;
+
+    major = gssEapWrapTokenLength(minor, ctx, conf_req_flag,
+                                  dataLength - assocDataLength,
+                                  &gssHeaderLen, &gssTrailerLen);
+    if (GSS_ERROR(major))
+        return major;
+
+    if (trailer == NULL)
+        gssHeaderLen += gssTrailerLen;
+    else
+        trailer->buffer.length = gssTrailerLen;
+
+    header->buffer.length = gssHeaderLen;
+
+    if (conf_state != NULL)
+        *conf_state = conf_req_flag;
+
+    *minor = 0;
+    return GSS_S_COMPLETE;
 }
 
 OM_uint32 GSSAPI_CALLCONV
@@ -112,3 +275,50 @@ cleanup:
 
     return major;
 }
+
+OM_uint32 GSSAPI_CALLCONV
+gss_wrap_in_place_length(OM_uint32 *minor,
+                         gss_ctx_id_t ctx,
+                         int conf_req_flag,
+                         gss_qop_t qop_req,
+                         size_t data_length,
+                         size_t *header_length,
+                         size_t *trailer_length)
+{
+    OM_uint32 major;
+
+    if (ctx == GSS_C_NO_CONTEXT) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    }
+
+    if (header_length == NULL || trailer_length == NULL) {
+        *minor = EINVAL;
+        return GSS_S_CALL_INACCESSIBLE_WRITE;
+    }
+
+    if (qop_req != GSS_C_QOP_DEFAULT) {
+        *minor = GSSEAP_UNKNOWN_QOP;
+        return GSS_S_UNAVAILABLE;
+    }
+
+    *minor = 0;
+
+    GSSEAP_MUTEX_LOCK(&ctx->mutex);
+
+    if (!CTX_IS_ESTABLISHED(ctx)) {
+        major = GSS_S_NO_CONTEXT;
+        *minor = GSSEAP_CONTEXT_INCOMPLETE;
+        goto cleanup;
+    }
+
+    major = gssEapWrapTokenLength(minor, ctx, conf_req_flag, data_length,
+                                  header_length, trailer_length);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+cleanup:
+    GSSEAP_MUTEX_UNLOCK(&ctx->mutex);
+
+    return major;
+}
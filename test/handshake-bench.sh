@@ -0,0 +1,190 @@
+#!/bin/bash
+
+# End-to-end handshake benchmark that needs no network or real IdP:
+# gss-client in load mode establishes contexts with gss-server, and the
+# initiator's ECP requests go to mock-idp on localhost. Prints contexts
+# per second and, from MECH_SAML_EC_PHASE_TRACE, the latency of each
+# phase on both sides.
+#
+# With -check n it instead establishes n contexts, each exchanging
+# wrapped messages and MICs, and fails unless every context succeeds
+# and each got its own key from the IdP. Contexts run concurrently on
+# both sides, so a key kept anywhere but in its own context shows up as
+# a message that the peer cannot unwrap or verify.
+#
+# Run it as "make handshake-bench" or "make handshake-check" from the
+# top of the build tree, or directly with top_builddir set. Needs an
+# installed Shibboleth SP for its security-policy.xml and protocols.xml,
+# and a GSS-API library that honours GSS_MECH_CONFIG.
+#
+#   handshake-bench.sh [-concurrency n] [-duration secs] [-threads n]
+#                      [-check n] [-encrypt] [-keep]
+
+srcdir=${srcdir:-`dirname "$0"`}
+top_builddir=${top_builddir:-.}
+fixtures=`cd "$srcdir" && pwd`
+
+concurrency=4
+duration=10
+threads=4
+check=
+encrypt=
+keep=
+idp_port=${IDP_PORT:-18443}
+port=${GSS_PORT:-13490}
+user=benchuser
+pass=benchpass
+service="host@localhost"
+
+while [ $# -gt 0 ] ; do
+    case "$1" in
+    -concurrency) concurrency=$2; shift ;;
+    -duration) duration=$2; shift ;;
+    -threads) threads=$2; shift ;;
+    -check) check=$2; shift ;;
+    -encrypt) encrypt=-encrypt ;;
+    -keep) keep=1 ;;
+    *) echo "Usage: $0 [-concurrency n] [-duration secs] [-threads n] [-check n] [-encrypt] [-keep]" >&2
+       exit 1 ;;
+    esac
+    shift
+done
+
+mech_so="$top_builddir/mech_saml_ec/.libs/mech_saml_ec.so"
+client="$top_builddir/gss-sample/gss-client"
+server="$top_builddir/gss-sample/gss-server"
+idp="$top_builddir/gss-sample/mock-idp"
+
+for f in "$mech_so" "$client" "$server" "$idp" ; do
+    if [ ! -x "$f" ] && [ ! -f "$f" ] ; then
+        echo "$0: $f not built" >&2
+        exit 1
+    fi
+done
+mech_so=`cd \`dirname "$mech_so"\` && pwd`/mech_saml_ec.so
+
+work=`mktemp -d "${TMPDIR:-/tmp}/handshake-bench.XXXXXX"` || exit 1
+pids=
+
+cleanup() {
+    [ -n "$pids" ] && kill $pids 2>/dev/null
+    wait 2>/dev/null
+    if [ -n "$keep" ] ; then
+        echo "logs kept in $work"
+    else
+        rm -rf "$work"
+    fi
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Wait for a line in a log file, or for the process writing it to die
+wait_for() {
+    local i
+    for i in `seq 50` ; do
+        grep -q "$2" "$1" 2>/dev/null && return 0
+        kill -0 $3 2>/dev/null || break
+        sleep 0.1
+    done
+    echo "$0: $4 did not start; see $1:" >&2
+    cat "$1" >&2
+    return 1
+}
+
+# Fixtures, with this run's paths and ports
+cp -r "$fixtures/keys" "$fixtures/attribute-map.xml" \
+    "$fixtures/sp-metadata.xml" "$work/"
+for f in shibboleth2.xml idp-metadata.xml ; do
+    sed -e "s|@FIXTURES@|$work|g" -e "s|@PORT@|$idp_port|g" \
+        "$fixtures/$f.in" > "$work/$f"
+done
+echo "saml-ec 1.3.6.1.4.1.11591.4.6 $mech_so" > "$work/mech"
+
+export GSS_MECH_CONFIG="$work/mech"
+export MECH_SAML_EC_PHASE_TRACE=1
+export MECH_SAML_EC_TRACE_LEVEL=${MECH_SAML_EC_TRACE_LEVEL:-error}
+
+"$idp" -port $idp_port -user $user -pass $pass $encrypt ${check:+-v} \
+    -sp-metadata "$work/sp-metadata.xml" "$work/keys" \
+    > "$work/idp.log" 2>&1 &
+pids="$pids $!"
+wait_for "$work/idp.log" listening $! mock-idp || exit 1
+
+SHIBSP_CONFIG="$work/shibboleth2.xml" \
+    "$server" -port $port -threads $threads "$service" \
+    > "$work/server.log" 2> "$work/server.phases" &
+pids="$pids $!"
+server_pid=$!
+for i in `seq 50` ; do
+    (exec 3<>/dev/tcp/127.0.0.1/$port) 2>/dev/null && break
+    kill -0 $server_pid 2>/dev/null || break
+    sleep 0.1
+done
+if ! kill -0 $server_pid 2>/dev/null ; then
+    echo "$0: gss-server did not start:" >&2
+    cat "$work/server.log" "$work/server.phases" >&2
+    exit 1
+fi
+
+if [ -n "$check" ] ; then
+    load="-ccount $check -mcount 4"
+else
+    load="-duration $duration"
+fi
+
+SAML_EC_IDP="https://localhost:$idp_port/idp/profile/SAML2/SOAP/ECP" \
+SAML_EC_IDP_CA="$work/keys/idp-tls.crt" \
+    "$client" -port $port -user $user -pass $pass \
+    -mech "{ 1 3 6 1 4 1 11591 4 6 }" \
+    -concurrency $concurrency $load \
+    localhost "$service" testmessage \
+    > "$work/client.log" 2> "$work/client.phases"
+status=$?
+
+grep -v '^{' "$work/client.log"
+if [ $status -ne 0 ] ; then
+    echo "$0: gss-client failed:" >&2
+    grep -v '^{' "$work/client.phases" | tail -20 >&2
+fi
+
+if [ -n "$check" ] ; then
+    # mock-idp draws a fresh key for every response it answers
+    keys=`grep -c "^mock-idp: .*: 200$" "$work/idp.log"`
+    if [ $status -eq 0 ] && [ "$keys" -ne "$check" ] ; then
+        echo "$0: $check contexts but $keys keys from mock-idp" >&2
+        status=1
+    fi
+    [ $status -eq 0 ] &&
+        echo "$check concurrent contexts, each with its own key: ok"
+    exit $status
+fi
+
+# One row per phase: count, mean and percentiles in milliseconds
+echo
+printf "%-32s %8s %9s %9s %9s %9s %9s\n" \
+    phase count mean p50 p90 p99 max
+cat "$work/client.phases" "$work/server.phases" | grep '^{"initiator"' |
+awk '{
+    role = ($0 ~ /"initiator": true/) ? "initiator" : "acceptor";
+    line = $0;
+    while (match(line, /"[a-z_]+_us": [0-9]+/)) {
+        pair = substr(line, RSTART, RLENGTH);
+        line = substr(line, RSTART + RLENGTH);
+        split(pair, kv, /": /);
+        name = substr(kv[1], 2);
+        sub(/_us$/, "", name);
+        print role "." name, kv[2];
+    }
+}' | sort -k1,1 -k2,2n | awk '
+function report() {
+    if (n == 0)
+        return;
+    printf "%-32s %8d %9.3f %9.3f %9.3f %9.3f %9.3f\n", key, n,
+        sum / n / 1e3, v[int(n * 0.50)] / 1e3, v[int(n * 0.90)] / 1e3,
+        v[int(n * 0.99)] / 1e3, v[n - 1] / 1e3;
+}
+$1 != key { report(); key = $1; n = 0; sum = 0 }
+{ v[n++] = $2; sum += $2 }
+END { report() }'
+
+exit $status